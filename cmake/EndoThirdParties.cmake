@@ -97,6 +97,18 @@ endif()
 EndoThirdParties_Embed_boxed_cpp()
 set(THIRDPARTY_BUILDIN_boxed_cpp "embedded")
 
+# nanobench is a single header library, whose implementation is compiled into bench-endo itself.
+if(ENDO_BENCHMARKS)
+    find_path(NANOBENCH_INCLUDE_DIR nanobench.h
+        HINTS ${EndoThirdParties_SRCDIR}/nanobench-4.3.11/src/include
+        REQUIRED)
+    add_library(nanobench INTERFACE)
+    target_include_directories(nanobench INTERFACE ${NANOBENCH_INCLUDE_DIR})
+    set(THIRDPARTY_BUILTIN_nanobench "${NANOBENCH_INCLUDE_DIR}")
+else()
+    set(THIRDPARTY_BUILTIN_nanobench "disabled")
+endif()
+
 macro(EndoThirdPartiesSummary2)
     message(STATUS "==============================================================================")
     message(STATUS "    Endo Shell ThirdParties")
@@ -108,5 +120,6 @@ macro(EndoThirdPartiesSummary2)
     message(STATUS "unicode::core       ${THIRDPARTY_BUILTIN_unicode_core}")
     message(STATUS "yaml-cpp            ${THIRDPARTY_BUILTIN_yaml_cpp}")
     message(STATUS "boxed-cpp           ${THIRDPARTY_BUILDIN_boxed_cpp}")
+    message(STATUS "nanobench           ${THIRDPARTY_BUILTIN_nanobench}")
     message(STATUS "------------------------------------------------------------------------------")
 endmacro()
@@ -128,6 +128,16 @@ fetch_and_unpack_boxed()
         boxed_cpp
 }
 
+# Header only, thus never added as subdirectory (see cmake/EndoThirdParties.cmake).
+fetch_and_unpack_nanobench()
+{
+    fetch_and_unpack \
+        nanobench-4.3.11 \
+        nanobench-4.3.11.tar.gz \
+        https://github.com/martinus/nanobench/archive/refs/tags/v4.3.11.tar.gz \
+        nanobench
+}
+
 fetch_and_unpack_range()
 {
     fetch_and_unpack \
@@ -374,6 +384,7 @@ main()
     esac
 
     fetch_and_unpack_embeds
+    fetch_and_unpack_nanobench
 }
 
 main $*
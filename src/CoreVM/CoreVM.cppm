@@ -4,6 +4,7 @@ module;
 #include <fmt/format.h>
 
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -14,6 +15,8 @@ module;
 #include <optional>
 #include <regex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -46,6 +49,7 @@ class Value;
 class Constant;
 class BasicBlock;
 class IRHandler;
+class IRArgument;
 class IRProgram;
 class IRBuilder;
 class IRBuiltinHandler;
@@ -64,6 +68,7 @@ class StoreInstr;
 class LoadInstr;
 class CallInstr;
 class HandlerCallInstr;
+class InvokeInstr;
 class PhiNode;
 class CondBrInstr;
 class BrInstr;
@@ -71,6 +76,7 @@ class RetInstr;
 class MatchInstr;
 class RegExpGroupInstr;
 class CastInstr;
+class SConcatInstr;
 
 using Register = uint64_t; // vm
 using CoreNumber = int64_t;
@@ -127,6 +133,7 @@ class InstructionVisitor
     // calls
     virtual void visit(CallInstr& instr) = 0;
     virtual void visit(HandlerCallInstr& instr) = 0;
+    virtual void visit(InvokeInstr& instr) = 0;
 
     // terminator
     virtual void visit(CondBrInstr& instr) = 0;
@@ -171,6 +178,7 @@ class InstructionVisitor
     virtual void visit(SLenInstr& instr) = 0;
     virtual void visit(SIsEmptyInstr& instr) = 0;
     virtual void visit(SAddInstr& instr) = 0;
+    virtual void visit(SConcatInstr& instr) = 0;
     virtual void visit(SSubStrInstr& instr) = 0;
     virtual void visit(SCmpEQInstr& instr) = 0;
     virtual void visit(SCmpNEInstr& instr) = 0;
@@ -280,6 +288,15 @@ class Runner
         QuotaExceeded(): std::runtime_error { "CoreVM runtime quota exceeded." } {}
     };
 
+    class CallDepthExceeded: public std::runtime_error
+    {
+      public:
+        CallDepthExceeded(): std::runtime_error { "CoreVM maximum handler call depth exceeded." } {}
+    };
+
+    //! maximum number of nested INVOKEs, bounding (e.g. endless) recursion
+    static constexpr size_t MaxCallDepth = 1000;
+
     using Value = uint64_t;
     using Globals = std::vector<Value>;
 
@@ -375,6 +392,9 @@ class Runner
 
     CoreString* catString(const CoreString& a, const CoreString& b);
 
+    //! concatenates the topmost @p count strings on the stack, allocating the result just once.
+    CoreString* concatStrings(int count);
+
     const Stack& stack() const noexcept { return _stack; }
     Value stack(int si) const { return _stack[si]; }
 
@@ -420,6 +440,17 @@ class Runner
 
     Stack _stack; //!< runtime stack
 
+    //! caller state saved by INVOKE and restored by RET
+    struct Frame
+    {
+        const Handler* handler; //!< invoking handler
+        size_t returnAddress;   //!< program offset to continue at in @c handler
+        size_t base;            //!< stack base of @c handler
+    };
+
+    std::vector<Frame> _frames; //!< call stack of the currently invoked handlers
+    size_t _base = 0;           //!< stack index of the current handler's first stack slot
+
     Globals& _globals; //!< runtime global scope
 
     std::list<std::string> _stringGarbage;
@@ -475,13 +506,15 @@ class ConstantPool
   public:
     using Code = std::vector<Instruction>;
 
-    ConstantPool(const ConstantPool& v) = delete;
     ConstantPool& operator=(const ConstantPool& v) = delete;
 
     ConstantPool() = default;
     ConstantPool(ConstantPool&& from) noexcept = default;
     ConstantPool& operator=(ConstantPool&& v) noexcept = default;
 
+    // Returns a copy of this pool, e.g. to be extended without affecting the original until done.
+    [[nodiscard]] ConstantPool clone() const { return ConstantPool(*this); }
+
     // builder
     size_t makeInteger(CoreNumber value);
     size_t makeString(const std::string& value);
@@ -555,7 +588,22 @@ class ConstantPool
 
     void dump() const;
 
+    // Serializes this constant pool, including the code of all handlers, into a self contained
+    // binary image (see Program.cpp for its layout).
+    //
+    // @returns the image or std::nullopt if the pool contains constants that cannot be serialized,
+    //          i.e. IP addresses, CIDRs, regular expressions or match definitions.
+    [[nodiscard]] std::optional<std::string> serialize() const;
+
+    // Reconstructs a constant pool from an image as created by serialize().
+    //
+    // @returns the constant pool or std::nullopt if the image is truncated or malformed.
+    [[nodiscard]] static std::optional<ConstantPool> deserialize(std::string_view image);
+
   private:
+    // only copied explicitly, see clone()
+    ConstantPool(const ConstantPool& v) = default;
+
     // constant primitives
     std::vector<CoreNumber> _numbers;
     std::vector<std::string> _strings;
@@ -575,6 +623,13 @@ class ConstantPool
     std::vector<MatchDef> _matchDefs;
     std::vector<std::string> _nativeHandlerSignatures;
     std::vector<std::string> _nativeFunctionSignatures;
+
+    // lookup tables of the above, so that a long-living pool (e.g. of an interactive session)
+    // does not need to be scanned for every constant added
+    std::unordered_map<CoreNumber, size_t> _numberIndex;
+    std::unordered_map<std::string, size_t> _stringIndex;
+    std::unordered_map<std::string, size_t> _nativeHandlerIndex;
+    std::unordered_map<std::string, size_t> _nativeFunctionIndex;
 };
 
 class Program
@@ -603,11 +658,17 @@ class Program
 
     bool link(Runtime* runtime, diagnostics::Report* report);
 
+    /**
+     * Creates the handlers and matches that were added to the constant pool since
+     * this program was created or last updated.
+     *
+     * Use link() afterwards to resolve newly referenced native callbacks.
+     */
+    void update();
+
     void dump();
 
   private:
-    void setup();
-
     // builders
     using Code = ConstantPool::Code;
     Handler* createHandler(const std::string& name);
@@ -618,6 +679,7 @@ class Program
 
     // linked data
     Runtime* _runtime;
+    size_t _importedModules = 0;
     mutable std::vector<std::unique_ptr<Handler>> _handlers;
     std::vector<std::unique_ptr<Match>> _matches;
     std::vector<NativeCallback*> _nativeHandlers;
@@ -934,26 +996,82 @@ class PassManager
   public:
     using HandlerPass = std::function<bool(IRHandler* handler)>;
 
-    PassManager() = default;
+    /**
+     * Kinds of changes a pass may make to a handler, used to tell what passes
+     * have to be run again after one of them changed something.
+     */
+    enum Changes : unsigned
+    {
+        NoChanges = 0,
+        Instructions = 1 << 0, //!< instructions got added, removed, or their operands replaced
+        ControlFlow = 1 << 1,  //!< basic blocks or the edges between them got added or removed
+        AnyChanges = Instructions | ControlFlow,
+    };
+
+    /**
+     * Accumulated costs and effects of a single pass, as collected with timing enabled.
+     */
+    struct Statistics
+    {
+        size_t runs = 0;
+        size_t changes = 0;
+        std::chrono::nanoseconds time {};
+        int64_t instructionsRemoved = 0;
+        int64_t blocksRemoved = 0;
+    };
+
+    PassManager();
     ~PassManager() = default;
 
     /** registers given pass to the pass manager.
      *
      * @param name uniquely identifyable name of the handler pass
      * @param handler callback to invoke to handle the transformation pass
+     * @param modifies the kinds of changes the pass may make
+     * @param dependsOn the kinds of changes that may give the pass something (new) to do
      *
      * The handler must return @c true if it modified its input, @c false otherwise.
+     *
+     * A pass is only run again once another pass (or the pass itself) made changes
+     * it depends on.
      */
-    void registerPass(std::string name, HandlerPass handlerPass);
+    void registerPass(std::string name,
+                      HandlerPass handlerPass,
+                      unsigned modifies = AnyChanges,
+                      unsigned dependsOn = AnyChanges);
 
     /** runs passes on a complete program.
+     *
+     * Prints the collected statistics to stderr afterwards, if timing is enabled.
      */
     void run(IRProgram* program);
 
-    /** runs passes on given handler.
+    /** runs passes on given handler until none of them has anything left to change.
      */
     void run(IRHandler* handler);
 
+    /**
+     * Verifies the handler after each pass that changed it.
+     *
+     * Enabled by default unless built with @c NDEBUG.
+     */
+    void setVerify(bool enabled) noexcept { _verify = enabled; }
+
+    /**
+     * Collects per pass statistics, as reported by formatStatistics().
+     *
+     * Enabled by default if the environment variable @c COREVM_TIME_PASSES is set to @c 1.
+     */
+    void setTimePasses(bool enabled) noexcept { _timePasses = enabled; }
+
+    /** retrieves the statistics collected for the pass with given @p name so far, if any.
+     */
+    [[nodiscard]] const Statistics* statistics(std::string_view name) const;
+
+    /** formats the statistics of all passes into a table, one pass per line.
+     */
+    [[nodiscard]] std::string formatStatistics() const;
+
     template <typename... Args>
     void logDebug(fmt::format_string<Args...> msg, Args... args)
     {
@@ -963,7 +1081,20 @@ class PassManager
     void logDebug(const std::string& msg);
 
   private:
-    std::list<std::pair<std::string, HandlerPass>> _handlerPasses;
+    struct Pass
+    {
+        std::string name;
+        HandlerPass run;
+        unsigned modifies;
+        unsigned dependsOn;
+        Statistics statistics;
+    };
+
+    bool runPass(Pass& pass, IRHandler* handler);
+
+    std::vector<Pass> _passes;
+    bool _verify;
+    bool _timePasses;
 };
 
 /**
@@ -1085,7 +1216,7 @@ class ConstantValue: public Constant
   public:
     ConstantValue(T value, const std::string& name = ""): Constant(Ty, name), _value(std::move(value)) {}
 
-    [[nodiscard]] T get() const { return _value; }
+    [[nodiscard]] T const& get() const { return _value; }
 
     [[nodiscard]] std::string to_string() const override
     {
@@ -1326,6 +1457,25 @@ class HandlerCallInstr: public Instr
     void accept(InstructionVisitor& v) override;
 };
 
+/**
+ * Invokes a handler of the same program as function.
+ *
+ * The arguments are passed to the callee on the stack (see IRHandler::addArgument()),
+ * and the callee's return value is this instruction's result.
+ */
+class InvokeInstr: public Instr
+{
+  public:
+    InvokeInstr(const std::vector<Value*>& args, const std::string& name);
+    InvokeInstr(IRHandler* callee, const std::vector<Value*>& args, const std::string& name);
+
+    [[nodiscard]] IRHandler* callee() const;
+
+    [[nodiscard]] std::string to_string() const override;
+    [[nodiscard]] std::unique_ptr<Instr> clone() override;
+    void accept(InstructionVisitor& v) override;
+};
+
 class CastInstr: public Instr
 {
   public:
@@ -1338,6 +1488,26 @@ class CastInstr: public Instr
     void accept(InstructionVisitor& v) override;
 };
 
+/**
+ * Concatenates all of its string operands, in order, into a single string.
+ *
+ * Unlike a chain of SAddInstr, the result is allocated once, with each piece copied just once.
+ *
+ * @see transform::fuseStringConcatenations()
+ */
+class SConcatInstr: public Instr
+{
+  public:
+    SConcatInstr(const std::vector<Value*>& pieces, const std::string& name):
+        Instr(LiteralType::String, pieces, name)
+    {
+    }
+
+    [[nodiscard]] std::string to_string() const override;
+    [[nodiscard]] std::unique_ptr<Instr> clone() override;
+    void accept(InstructionVisitor& v) override;
+};
+
 template <const UnaryOperator Operator, const LiteralType ResultType>
 class UnaryInstr: public Instr
 {
@@ -1386,19 +1556,48 @@ class BinaryInstr: public Instr
 /**
  * Creates a PHI (phoney) instruction.
  *
- * Creates a synthetic instruction that purely informs the target register
- *allocator
- * to allocate the very same register for all given operands,
- * which is then used across all their basic blocks.
+ * Merges the values flowing into its basic block, selecting the one of the predecessor
+ * that control came from. Its operands are the incoming values, each paired with the
+ * predecessor it flows in from (which is not an operand, as that would make it a successor).
+ *
+ * PHI nodes are always placed at the beginning of their basic block. Incoming values of
+ * blocks that are no longer a predecessor are ignored.
+ *
+ * @see transform::promoteMemoryToRegisters()
  */
 class PhiNode: public Instr
 {
   public:
-    PhiNode(const std::vector<Value*>& ops, const std::string& name);
+    PhiNode(LiteralType ty, const std::string& name);
+
+    /**
+     * Sets the value flowing in from @p predecessor, replacing the one it had before.
+     */
+    void addIncoming(Value* value, BasicBlock* predecessor);
+
+    /**
+     * Removes the value flowing in from @p predecessor, if any.
+     */
+    void removeIncoming(BasicBlock* predecessor);
+
+    /**
+     * Makes the value flowing in from @p oldPredecessor flow in from @p newPredecessor instead.
+     */
+    void replaceIncomingBlock(BasicBlock* oldPredecessor, BasicBlock* newPredecessor);
+
+    /**
+     * Retrieves the value flowing in from @p predecessor, or @c nullptr if there is none.
+     */
+    [[nodiscard]] Value* incomingValue(const BasicBlock* predecessor) const;
+
+    [[nodiscard]] const std::vector<BasicBlock*>& incomingBlocks() const { return _incomingBlocks; }
 
     [[nodiscard]] std::string to_string() const override;
     [[nodiscard]] std::unique_ptr<Instr> clone() override;
     void accept(InstructionVisitor& v) override;
+
+  private:
+    std::vector<BasicBlock*> _incomingBlocks; // the predecessor of each operand
 };
 
 class TerminateInstr: public Instr
@@ -1523,6 +1722,7 @@ class IsSameInstruction: public InstructionVisitor
     // calls
     void visit(CallInstr& instr) override;
     void visit(HandlerCallInstr& instr) override;
+    void visit(InvokeInstr& instr) override;
 
     // terminator
     void visit(CondBrInstr& instr) override;
@@ -1567,6 +1767,7 @@ class IsSameInstruction: public InstructionVisitor
     void visit(SLenInstr& instr) override;
     void visit(SIsEmptyInstr& instr) override;
     void visit(SAddInstr& instr) override;
+    void visit(SConcatInstr& instr) override;
     void visit(SSubStrInstr& instr) override;
     void visit(SCmpEQInstr& instr) override;
     void visit(SCmpNEInstr& instr) override;
@@ -1585,6 +1786,24 @@ class IsSameInstruction: public InstructionVisitor
     void visit(PInCidrInstr& instr) override;
 };
 
+/**
+ * A parameter of a handler that is invoked as function.
+ *
+ * Its value is the respective argument, as passed on the stack by the invoking InvokeInstr.
+ */
+class IRArgument: public Value
+{
+  public:
+    IRArgument(LiteralType ty, const std::string& name, IRHandler* handler): Value(ty, name), _handler(handler)
+    {
+    }
+
+    [[nodiscard]] IRHandler* getHandler() const { return _handler; }
+
+  private:
+    IRHandler* _handler;
+};
+
 class IRHandler: public Constant
 {
   public:
@@ -1601,8 +1820,31 @@ class IRHandler: public Constant
 
     void dump();
 
+    /**
+     * Tests whether this handler has no code, e.g. because it merely declares a function
+     * that is defined by another program.
+     */
     [[nodiscard]] bool empty() const noexcept { return _blocks.empty(); }
 
+    /**
+     * Appends a parameter of given @p type, turning this handler into a function.
+     *
+     * @see InvokeInstr
+     */
+    IRArgument* addArgument(LiteralType type, const std::string& name);
+
+    [[nodiscard]] IRArgument* argument(size_t index) const { return _arguments[index].get(); }
+    [[nodiscard]] size_t argumentCount() const noexcept { return _arguments.size(); }
+    auto arguments() { return util::unbox(_arguments); }
+
+    /**
+     * Handlers with a return type are functions, returning their result to the invoking handler,
+     * whereas all others exit the program upon return.
+     */
+    [[nodiscard]] bool isFunction() const noexcept { return _returnType != LiteralType::Void; }
+    [[nodiscard]] LiteralType returnType() const noexcept { return _returnType; }
+    void setReturnType(LiteralType type) { _returnType = type; }
+
     auto basicBlocks() { return util::unbox(_blocks); }
 
     [[nodiscard]] BasicBlock* getEntryBlock() const { return _blocks.front().get(); }
@@ -1643,6 +1885,8 @@ class IRHandler: public Constant
   private:
     IRProgram* _program;
     std::list<std::unique_ptr<BasicBlock>> _blocks;
+    std::vector<std::unique_ptr<IRArgument>> _arguments;
+    LiteralType _returnType = LiteralType::Void;
 
     friend class IRBuilder;
 };
@@ -1672,7 +1916,8 @@ class IRProgram
 
     ConstantBoolean* getBoolean(bool literal) { return literal ? &_trueLiteral : &_falseLiteral; }
     ConstantInt* get(int64_t literal) { return get<ConstantInt>(_numbers, literal); }
-    ConstantString* get(const std::string& literal) { return get<ConstantString>(_strings, literal); }
+    // Interns @p literal, i.e. returns the one string constant of this program equal to it.
+    ConstantString* get(std::string_view literal);
     ConstantIP* get(const util::IPAddress& literal) { return get<ConstantIP>(_ipaddrs, literal); }
     ConstantCidr* get(const util::Cidr& literal) { return get<ConstantCidr>(_cidrs, literal); }
     ConstantRegExp* get(const util::RegExp& literal) { return get<ConstantRegExp>(_regexps, literal); }
@@ -1754,6 +1999,7 @@ class IRProgram
     std::vector<std::unique_ptr<ConstantArray>> _constantArrays;
     std::vector<std::unique_ptr<ConstantInt>> _numbers;
     std::vector<std::unique_ptr<ConstantString>> _strings;
+    std::unordered_map<std::string_view, ConstantString*> _stringIndex; // keys refer to the constants' values
     std::vector<std::unique_ptr<ConstantIP>> _ipaddrs;
     std::vector<std::unique_ptr<ConstantCidr>> _cidrs;
     std::vector<std::unique_ptr<ConstantRegExp>> _regexps;
@@ -1803,7 +2049,7 @@ class IRBuilder
     // literals
     ConstantBoolean* getBoolean(bool literal) { return _program->getBoolean(literal); }
     ConstantInt* get(int64_t literal) { return _program->get(literal); }
-    ConstantString* get(const std::string& literal) { return _program->get(literal); }
+    ConstantString* get(std::string_view literal) { return _program->get(literal); }
     ConstantIP* get(const util::IPAddress& literal) { return _program->get(literal); }
     ConstantCidr* get(const util::Cidr& literal) { return _program->get(literal); }
     ConstantRegExp* get(const util::RegExp& literal) { return _program->get(literal); }
@@ -1820,7 +2066,7 @@ class IRBuilder
     Value* createLoad(Value* value, const std::string& name = "");
     Instr* createStore(Value* lhs, Value* rhs, const std::string& name = "");
     Instr* createStore(Value* lhs, ConstantInt* index, Value* rhs, const std::string& name = "");
-    Instr* createPhi(const std::vector<Value*>& incomings, const std::string& name = "");
+    PhiNode* createPhi(LiteralType ty, const std::string& name = "");
 
     // boolean operations
     Value* createBNot(Value* rhs, const std::string& name = ""); // !
@@ -1858,6 +2104,7 @@ class IRBuilder
 
     // string ops
     Value* createSAdd(Value* lhs, Value* rhs, const std::string& name = ""); // +
+    Value* createSConcat(const std::vector<Value*>& pieces, const std::string& name = "");
     Value* createSCmpEQ(Value* lhs, Value* rhs,
                         const std::string& name = ""); // ==
     Value* createSCmpNE(Value* lhs, Value* rhs,
@@ -1906,6 +2153,7 @@ class IRBuilder
     // calls
     Instr* createCallFunction(IRBuiltinFunction* callee, std::vector<Value*> args, std::string name = "");
     Instr* createInvokeHandler(IRBuiltinHandler* callee, const std::vector<Value*>& args);
+    Instr* createInvoke(IRHandler* callee, std::vector<Value*> args, std::string name = "");
 
     // termination instructions
     Instr* createRet(Value* result);
@@ -1978,6 +2226,18 @@ class BasicBlock: public Value
      */
     Instr* push_back(std::unique_ptr<Instr> instr);
 
+    /**
+     * Inserts a new instruction, \p instr, right in front of \p before.
+     *
+     * The basic block will take over ownership of the given instruction.
+     */
+    Instr* insert(const Instr* before, std::unique_ptr<Instr> instr);
+
+    /**
+     * Retrieves the PHI nodes this basic block begins with.
+     */
+    [[nodiscard]] std::vector<PhiNode*> phiNodes() const;
+
     /**
      * Removes given instruction from this basic block.
      *
@@ -2066,10 +2326,14 @@ class BasicBlock: public Value
     [[nodiscard]] std::vector<BasicBlock*>& successors() { return _successors; }
     [[nodiscard]] const std::vector<BasicBlock*>& successors() const { return _successors; }
 
-    /** Retrieves all dominators of given basic block. */
+    /**
+     * Retrieves all dominators of given basic block, from the entry block down to this one.
+     *
+     * @see DominatorTree
+     */
     [[nodiscard]] std::vector<BasicBlock*> dominators();
 
-    /** Retrieves all immediate dominators of given basic block. */
+    /** Retrieves the immediate dominator of given basic block, if any. */
     [[nodiscard]] std::vector<BasicBlock*> immediateDominators();
 
     void dump();
@@ -2087,9 +2351,6 @@ class BasicBlock: public Value
      */
     void verify();
 
-  private:
-    void collectIDom(std::vector<BasicBlock*>& output);
-
   private:
     IRHandler* _handler;
     std::vector<std::unique_ptr<Instr>> _code;
@@ -2100,6 +2361,68 @@ class BasicBlock: public Value
     friend class Instr;
 };
 
+/**
+ * Dominator tree of a handler's control flow graph.
+ *
+ * A basic block dominates another one if every path from the entry block to the latter
+ * passes through it. The tree is computed with the iterative algorithm of Cooper, Harvey and
+ * Kennedy ("A Simple, Fast Dominance Algorithm") and reflects the control flow graph at the time
+ * of construction.
+ *
+ * Basic blocks that are unreachable from the entry block are not part of the tree.
+ */
+class DominatorTree
+{
+  public:
+    explicit DominatorTree(IRHandler* handler);
+
+    /**
+     * Retrieves all reachable basic blocks in reverse post-order, starting with the entry block.
+     *
+     * Each block comes after its immediate dominator in this order.
+     */
+    [[nodiscard]] const std::vector<BasicBlock*>& blocks() const noexcept { return _blocks; }
+
+    [[nodiscard]] bool isReachable(const BasicBlock* bb) const { return _index.contains(bb); }
+
+    /**
+     * Retrieves the immediate dominator of @p bb, or @c nullptr for the entry block.
+     */
+    [[nodiscard]] BasicBlock* immediateDominator(const BasicBlock* bb) const;
+
+    /**
+     * Retrieves the basic blocks immediately dominated by @p bb.
+     */
+    [[nodiscard]] const std::vector<BasicBlock*>& children(const BasicBlock* bb) const;
+
+    /**
+     * Tests whether @p a dominates @p b. Every basic block dominates itself.
+     */
+    [[nodiscard]] bool dominates(const BasicBlock* a, const BasicBlock* b) const;
+
+    /**
+     * Retrieves the dominance frontier of @p bb, that is, all blocks with a predecessor dominated
+     * by @p bb, which @p bb does not strictly dominate itself.
+     */
+    [[nodiscard]] const std::vector<BasicBlock*>& dominanceFrontier(const BasicBlock* bb) const;
+
+  private:
+    struct Node
+    {
+        size_t idom = 0;                   // index of the immediate dominator
+        size_t enter = 0;                  // pre-order number within the dominator tree
+        size_t leave = 0;                  // post-order number within the dominator tree
+        std::vector<BasicBlock*> children; // blocks immediately dominated by this one
+        std::vector<BasicBlock*> frontier; // dominance frontier
+    };
+
+    [[nodiscard]] const Node& node(const BasicBlock* bb) const;
+
+    std::vector<BasicBlock*> _blocks; // reverse post-order
+    std::vector<Node> _nodes;         // nodes of _blocks, at the same index
+    std::unordered_map<const BasicBlock*, size_t> _index;
+};
+
 class Runtime
 {
   public:
@@ -2428,9 +2751,29 @@ class TargetCodeGenerator: public InstructionVisitor
 
     std::unique_ptr<Program> generate(IRProgram* program);
 
+    /**
+     * Generates the handlers of @p programIR into the existing @p program.
+     *
+     * Constants and native callback signatures are shared with the handlers already
+     * in @p program, handlers of the same name are replaced, and all others are appended.
+     * @p program is left untouched if generation fails.
+     */
+    void generate(IRProgram* programIR, Program& program);
+
   protected:
     void generate(IRHandler* handler);
 
+    /**
+     * Translates @p handler out of SSA form, as far as the target code requires.
+     *
+     * Values are kept on the stack for just one user within the same basic block. PHI nodes and
+     * all other values (e.g. left behind by transform::promoteMemoryToRegisters()) are given
+     * a stack slot of their own instead, which is read right in front of each use.
+     *
+     * Handlers without PHI nodes and without values used across basic blocks are left untouched.
+     */
+    void eliminatePhiNodes(IRHandler* handler);
+
     void dumpCurrentStack();
 
     /**
@@ -2515,6 +2858,7 @@ class TargetCodeGenerator: public InstructionVisitor
     // calls
     void visit(CallInstr& instr) override;
     void visit(HandlerCallInstr& instr) override;
+    void visit(InvokeInstr& instr) override;
 
     // terminator
     void visit(CondBrInstr& instr) override;
@@ -2559,6 +2903,7 @@ class TargetCodeGenerator: public InstructionVisitor
     void visit(SLenInstr& instr) override;
     void visit(SIsEmptyInstr& instr) override;
     void visit(SAddInstr& instr) override;
+    void visit(SConcatInstr& instr) override;
     void visit(SSubStrInstr& instr) override;
     void visit(SCmpEQInstr& instr) override;
     void visit(SCmpNEInstr& instr) override;
@@ -2684,6 +3029,29 @@ bool mergeSameBlocks(IRHandler* handler);
  */
 bool eliminateUnusedBlocks(IRHandler* handler);
 
+/**
+ * Promotes variables that are only loaded and stored as a whole into SSA values (mem2reg),
+ * inserting PHI nodes where differing values of a variable meet.
+ *
+ * Only variables allocated in the entry block are promoted, and none of the global scope.
+ */
+bool promoteMemoryToRegisters(IRHandler* handler);
+
+/**
+ * Evaluates instructions on constant operands at compile time and replaces their values
+ * with the resulting constants (sparse conditional constant propagation).
+ *
+ * Conditions that become constant are left for foldConstantCondBr() to eliminate,
+ * whereas matches on a constant string are rewritten into a jump right away.
+ */
+bool propagateConstants(IRHandler* handler);
+
+/**
+ * Fuses trees of string concatenations within a block into a single SConcatInstr,
+ * joining adjacent string literals on the way.
+ */
+bool fuseStringConcatenations(IRHandler* handler);
+
 } // namespace CoreVM::transform
 
 export namespace CoreVM::diagnostics
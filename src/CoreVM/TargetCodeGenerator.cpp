@@ -4,8 +4,10 @@ module;
 
 #include <fmt/core.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdarg>
+#include <cstddef>
 #include <limits>
 #include <optional>
 #include <unordered_map>
@@ -41,7 +43,7 @@ std::unique_ptr<Program> TargetCodeGenerator::generate(IRProgram* programIR)
         generate(init);
 
     for (IRHandler* handler: programIR->handlers())
-        if (handler != init)
+        if (handler != init && !handler->empty())
             generate(handler);
 
     _cp.setModules(programIR->modules());
@@ -49,13 +51,160 @@ std::unique_ptr<Program> TargetCodeGenerator::generate(IRProgram* programIR)
     return std::make_unique<Program>(std::move(_cp));
 }
 
+void TargetCodeGenerator::generate(IRProgram* programIR, Program& program)
+{
+    // Generated into a copy, so that the program is left intact if generation fails.
+    _cp = program.constants().clone();
+    const size_t knownHandlers = _cp.getHandlers().size();
+
+    std::vector<size_t> handlerIds;
+    IRHandler* init = programIR->findHandler(GLOBAL_SCOPE_INIT_NAME);
+    if (init != nullptr)
+    {
+        generate(init);
+        handlerIds.push_back(_handlerId);
+    }
+
+    for (IRHandler* handler: programIR->handlers())
+    {
+        // functions merely declared were already generated into the program
+        if (handler != init && !handler->empty())
+        {
+            generate(handler);
+            handlerIds.push_back(_handlerId);
+        }
+    }
+
+    auto modules = _cp.getModules();
+    for (const auto& module: programIR->modules())
+        if (std::find(modules.begin(), modules.end(), module) == modules.end())
+            modules.push_back(module);
+    _cp.setModules(modules);
+
+    program.constants() = std::move(_cp);
+
+    // handlers that existed before keep their identity, as they may be referenced already
+    for (size_t id: handlerIds)
+        if (id < knownHandlers)
+            program.handler(id)->setCode(program.constants().getHandler(id).second);
+
+    program.update();
+}
+
+void TargetCodeGenerator::eliminatePhiNodes(IRHandler* handler)
+{
+    // Without PHI nodes and values used across basic blocks (i.e. in IR as created by the frontend),
+    // the stack keeps track of all values on its own.
+    const auto needsSlots = [](BasicBlock* bb) {
+        if (!bb->phiNodes().empty())
+            return true;
+        for (Instr* instr: bb->instructions())
+            for (Instr* user: instr->uses())
+                if (user->getBasicBlock() != bb)
+                    return true;
+        return false;
+    };
+
+    bool inSSA = false;
+    for (BasicBlock* bb: handler->basicBlocks())
+        inSSA = inSSA || needsSlots(bb);
+    if (!inSSA)
+        return;
+
+    BasicBlock* entry = handler->getEntryBlock();
+    IRProgram* program = handler->getProgram();
+
+    const auto createSlot = [&](Value* value) {
+        auto slot = std::make_unique<AllocaInstr>(value->type(), program->get(int64_t { 1 }), value->name());
+        return entry->insert(entry->front(), std::move(slot));
+    };
+
+    const auto createStore = [&](Value* slot, Value* value) {
+        return std::make_unique<StoreInstr>(slot, program->get(int64_t { 0 }), value, "");
+    };
+
+    const auto distinct = [](auto items) {
+        std::sort(items.begin(), items.end());
+        items.erase(std::unique(items.begin(), items.end()), items.end());
+        return items;
+    };
+
+    // PHI nodes are written at the end of each predecessor and read at the beginning of their block.
+    // Reading them right away keeps the value the block has been entered with, while the predecessors
+    // may be writing the next one already (e.g. at a loop's latch).
+    std::vector<std::pair<PhiNode*, Instr*>> phis;
+    for (BasicBlock* bb: handler->basicBlocks())
+        for (PhiNode* phi: bb->phiNodes())
+            phis.emplace_back(phi, createSlot(phi));
+
+    for (const auto& [phi, slot]: phis)
+    {
+        for (BasicBlock* pred: distinct(phi->getBasicBlock()->predecessors()))
+        {
+            Value* value = phi->incomingValue(pred);
+            COREVM_ASSERT(value != nullptr,
+                          fmt::format("BUG: PHI node {} lacks a value for predecessor {}.",
+                                      phi->name(),
+                                      pred->name()));
+            pred->insert(pred->getTerminator(), createStore(slot, value));
+        }
+    }
+
+    for (const auto& [phi, slot]: phis)
+        phi->getBasicBlock()->replace(phi, std::make_unique<LoadInstr>(slot, phi->name()));
+
+    // Values on the stack are consumed by their single user within the same basic block.
+    // All others are stored right after their definition and loaded right in front of each use.
+    for (BasicBlock* bb: handler->basicBlocks())
+    {
+        std::vector<Instr*> instructions;
+        for (Instr* instr: bb->instructions())
+            instructions.push_back(instr);
+
+        for (size_t i = 0, e = instructions.size(); i != e; ++i)
+        {
+            Instr* instr = instructions[i];
+            if (instr->type() == LiteralType::Void || dynamic_cast<AllocaInstr*>(instr) || !instr->isUsed())
+                continue;
+
+            if (instr->useCount() == 1 && instr->uses().front()->getBasicBlock() == bb)
+                continue;
+
+            const std::vector<Instr*> users = distinct(instr->uses());
+            Instr* slot = createSlot(instr);
+            if (i + 1 != e)
+                bb->insert(instructions[i + 1], createStore(slot, instr));
+            else
+                bb->push_back(createStore(slot, instr));
+
+            for (Instr* user: users)
+            {
+                for (size_t k = 0, n = user->operands().size(); k != n; ++k)
+                {
+                    if (user->operand(k) == instr)
+                    {
+                        auto load = std::make_unique<LoadInstr>(slot, instr->name());
+                        user->setOperand(k, user->getBasicBlock()->insert(user, std::move(load)));
+                    }
+                }
+            }
+        }
+    }
+}
+
 void TargetCodeGenerator::generate(IRHandler* handler)
 {
+    eliminatePhiNodes(handler);
+
     // explicitely forward-declare handler, so we can use its ID internally.
     _handlerId = _cp.makeHandler(handler);
 
     std::unordered_map<BasicBlock*, size_t> basicBlockEntryPoints;
 
+    // functions find their arguments in their first stack slots
+    for (IRArgument* argument: handler->arguments())
+        push(argument);
+
     // generate code for all basic blocks, sequentially
     for (BasicBlock* bb: handler->basicBlocks())
     {
@@ -311,6 +460,26 @@ void TargetCodeGenerator::visit(HandlerCallInstr& handlerCallInstr)
         pop(argc);
 }
 
+void TargetCodeGenerator::visit(InvokeInstr& invokeInstr)
+{
+    const int argc = static_cast<int>(invokeInstr.operands().size()) - 1;
+    for (int i = 1; i <= argc; ++i)
+        emitLoad(invokeInstr.operand(i));
+
+    emitInstr(Opcode::INVOKE, _cp.makeHandler(invokeInstr.callee()), argc, 1);
+
+    if (argc)
+        pop(argc);
+
+    push(&invokeInstr);
+
+    if (!invokeInstr.isUsed())
+    {
+        emitInstr(Opcode::DISCARD, 1);
+        pop(1);
+    }
+}
+
 Operand TargetCodeGenerator::getConstantInt(Value* value)
 {
     COREVM_ASSERT(dynamic_cast<ConstantInt*>(value) != nullptr, "Must be ConstantInt");
@@ -417,10 +586,13 @@ void TargetCodeGenerator::emitLoad(Value* value)
     if (si == getStackPointer() - 1)
         return;
 
-    if (value->useCount() == 1)
+    // Arguments must stay in their stack slot, as they may be used by other basic blocks.
+    if (value->useCount() == 1 && !dynamic_cast<IRArgument*>(value))
     {
         // XXX only used once, so move value to stack top
         emitInstr(Opcode::STACKROT, si);
+        _stack.erase(_stack.begin() + static_cast<ptrdiff_t>(si));
+        _stack.push_back(value);
         return;
     }
 
@@ -441,9 +613,8 @@ void TargetCodeGenerator::dumpCurrentStack()
 
 void TargetCodeGenerator::visit(PhiNode& /*phiInstr*/)
 {
-    fprintf(
-        stderr,
-        "Should never reach here, as PHI instruction nodes should have been replaced by target registers.");
+    fprintf(stderr,
+            "Should never reach here, as PHI instruction nodes should have been replaced by stack slots.");
     abort();
 }
 
@@ -479,7 +650,18 @@ void TargetCodeGenerator::visit(BrInstr& brInstr)
 
 void TargetCodeGenerator::visit(RetInstr& retInstr)
 {
-    emitInstr(Opcode::EXIT, getConstantInt(retInstr.operands()[0]));
+    if (!retInstr.getBasicBlock()->getHandler()->isFunction())
+    {
+        emitInstr(Opcode::EXIT, getConstantInt(retInstr.operands()[0]));
+        return;
+    }
+
+    // The result is returned on top of the stack, which is not to be seen by
+    // the code of any subsequent basic block.
+    const size_t stackSize = _stack.size();
+    emitLoad(retInstr.operand(0));
+    emitInstr(Opcode::RET, 1);
+    pop(_stack.size() - stackSize);
 }
 
 void TargetCodeGenerator::visit(MatchInstr& matchInstr)
@@ -685,7 +867,7 @@ void TargetCodeGenerator::visit(BAndInstr& instr)
 
 void TargetCodeGenerator::visit(BOrInstr& instr)
 {
-    emitBinary(instr, Opcode::BAND);
+    emitBinary(instr, Opcode::BOR);
 }
 
 void TargetCodeGenerator::visit(BXorInstr& instr)
@@ -708,6 +890,26 @@ void TargetCodeGenerator::visit(SAddInstr& instr)
     emitBinary(instr, Opcode::SADD);
 }
 
+void TargetCodeGenerator::visit(SConcatInstr& instr)
+{
+    const std::vector<Value*>& pieces = instr.operands();
+    COREVM_ASSERT(pieces.size() <= std::numeric_limits<Operand>::max(),
+                  "CoreVM: too many strings to concatenate");
+
+    // emit operands only if not already on stack in ordered form and just used by this instruction.
+    const auto justUsedHere = [](Value* piece) { return piece->useCount() == 1; };
+    if (!(_stack.size() >= pieces.size()
+          && std::equal(pieces.begin(), pieces.end(), _stack.end() - static_cast<ptrdiff_t>(pieces.size()))
+          && std::all_of(pieces.begin(), pieces.end(), justUsedHere)))
+    {
+        for (Value* piece: pieces)
+            emitLoad(piece);
+    }
+
+    emitInstr(Opcode::SCONCAT, static_cast<Operand>(pieces.size()));
+    changeStack(pieces.size(), &instr);
+}
+
 void TargetCodeGenerator::visit(SSubStrInstr& instr)
 {
     emitBinary(instr, Opcode::SSUBSTR);
@@ -1,4 +1,5 @@
 module;
+#include <cstddef>
 #include <cstdint>
 #include <string>
 export module CoreVM:enums;
@@ -107,8 +108,22 @@ enum Opcode : uint16_t
     // CALL A = id, B = argc
     CALL,    // calls A with B arguments, always pushes result to stack
     HANDLER, // calls A with B arguments (never leaves result on stack)
+
+    // INVOKE A = handler id, B = argc, C = number of results
+    INVOKE, // calls handler A of the same program with the topmost B stack items as arguments
+    RET,    // RET imm            ; returns to the invoking handler, leaving A results on the stack
+
+    // string
+    SCONCAT, // SCONCAT imm        ; push(concatenation of the topmost A strings)
 };
 
+/**
+ * Number of opcodes.
+ *
+ * New opcodes are appended (updating this count), so that compiled code keeps its meaning.
+ */
+constexpr size_t OpcodeCount = static_cast<size_t>(Opcode::SCONCAT) + 1;
+
 enum class MatchClass
 {
     Same,
@@ -276,7 +291,8 @@ constexpr inline unsigned getPrice(Opcode opcode)
         case Opcode::GSTORE:
         case Opcode::STORE: return 4;
         case Opcode::CALL:
-        case Opcode::HANDLER: return 8;
+        case Opcode::HANDLER:
+        case Opcode::INVOKE: return 8;
         default: return 1;
     }
 }
@@ -136,10 +136,49 @@ Instr* BasicBlock::push_back(std::unique_ptr<Instr> instr)
     return _code.back().get();
 }
 
+Instr* BasicBlock::insert(const Instr* before, std::unique_ptr<Instr> instr)
+{
+    assert(instr != nullptr);
+    assert(instr->getBasicBlock() == nullptr);
+    assert(before->getBasicBlock() == this);
+    assert(dynamic_cast<TerminateInstr*>(instr.get()) == nullptr && "Must not be a terminator instruction.");
+
+    auto i = std::find_if(_code.begin(), _code.end(), [&](const auto& obj) { return obj.get() == before; });
+    assert(i != _code.end());
+
+    instr->setParent(this);
+    return _code.insert(i, std::move(instr))->get();
+}
+
+std::vector<PhiNode*> BasicBlock::phiNodes() const
+{
+    std::vector<PhiNode*> result;
+    for (const std::unique_ptr<Instr>& instr: _code)
+    {
+        if (auto* phi = dynamic_cast<PhiNode*>(instr.get()))
+            result.push_back(phi);
+        else
+            break;
+    }
+    return result;
+}
+
 void BasicBlock::merge_back(BasicBlock* bb)
 {
     assert(getTerminator() == nullptr);
 
+    // with this block being its only predecessor, the PHI nodes of bb have just one incoming value
+    for (PhiNode* phi: bb->phiNodes())
+    {
+        phi->replaceAllUsesWith(phi->incomingValue(this));
+        bb->remove(phi);
+    }
+
+    // values are now flowing into bb's successors from here
+    for (BasicBlock* succ: bb->_successors)
+        for (PhiNode* phi: succ->phiNodes())
+            phi->replaceIncomingBlock(bb, this);
+
 #if 0
   for (const std::unique_ptr<Instr>& instr : bb->_code) {
     push_back(instr->clone());
@@ -249,25 +288,27 @@ void BasicBlock::unlinkSuccessor(BasicBlock* successor)
 
 std::vector<BasicBlock*> BasicBlock::dominators()
 {
+    const DominatorTree tree(_handler);
+    if (!tree.isReachable(this))
+        return { this };
+
     std::vector<BasicBlock*> result;
-    collectIDom(result);
-    result.push_back(this);
+    for (BasicBlock* bb = this; bb != nullptr; bb = tree.immediateDominator(bb))
+        result.push_back(bb);
+    std::reverse(result.begin(), result.end());
     return result;
 }
 
 std::vector<BasicBlock*> BasicBlock::immediateDominators()
 {
-    std::vector<BasicBlock*> result;
-    collectIDom(result);
-    return result;
-}
+    const DominatorTree tree(_handler);
+    if (!tree.isReachable(this))
+        return {};
 
-void BasicBlock::collectIDom(std::vector<BasicBlock*>& output)
-{
-    for (BasicBlock* p: _predecessors)
-    {
-        p->collectIDom(output);
-    }
+    if (BasicBlock* idom = tree.immediateDominator(this))
+        return { idom };
+
+    return {};
 }
 
 bool BasicBlock::isComplete() const
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+#include <CoreVM/util/assert.h>
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+module CoreVM;
+namespace CoreVM
+{
+
+DominatorTree::DominatorTree(IRHandler* handler)
+{
+    constexpr auto Undefined = std::numeric_limits<size_t>::max();
+
+    // number all reachable blocks in reverse post-order
+    {
+        std::vector<std::pair<BasicBlock*, size_t>> stack; // block and index of its next successor to visit
+        std::unordered_map<const BasicBlock*, bool> visited;
+        stack.emplace_back(handler->getEntryBlock(), 0);
+        visited[handler->getEntryBlock()] = true;
+        while (!stack.empty())
+        {
+            auto& [bb, next] = stack.back();
+            if (next < bb->successors().size())
+            {
+                BasicBlock* successor = bb->successors()[next++];
+                if (!visited[successor])
+                {
+                    visited[successor] = true;
+                    stack.emplace_back(successor, 0);
+                }
+            }
+            else
+            {
+                _blocks.push_back(bb);
+                stack.pop_back();
+            }
+        }
+        std::reverse(_blocks.begin(), _blocks.end());
+        for (size_t i = 0, e = _blocks.size(); i != e; ++i)
+            _index[_blocks[i]] = i;
+    }
+
+    // compute immediate dominators until they settle
+    _nodes.resize(_blocks.size());
+    for (size_t i = 1, e = _nodes.size(); i != e; ++i)
+        _nodes[i].idom = Undefined;
+
+    const auto intersect = [&](size_t a, size_t b) {
+        while (a != b)
+        {
+            while (a > b)
+                a = _nodes[a].idom;
+            while (b > a)
+                b = _nodes[b].idom;
+        }
+        return a;
+    };
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t i = 1, e = _blocks.size(); i != e; ++i)
+        {
+            size_t idom = Undefined;
+            for (BasicBlock* pred: _blocks[i]->predecessors())
+            {
+                auto p = _index.find(pred);
+                if (p == _index.end() || _nodes[p->second].idom == Undefined)
+                    continue; // unreachable or not yet processed
+
+                idom = idom == Undefined ? p->second : intersect(p->second, idom);
+            }
+            if (_nodes[i].idom != idom)
+            {
+                _nodes[i].idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 1, e = _blocks.size(); i != e; ++i)
+        _nodes[_nodes[i].idom].children.push_back(_blocks[i]);
+
+    // number the tree's nodes, so that dominance can be tested in constant time
+    {
+        size_t counter = 0;
+        std::vector<std::pair<size_t, size_t>> stack; // node and index of its next child to visit
+        stack.emplace_back(0, 0);
+        _nodes[0].enter = counter++;
+        while (!stack.empty())
+        {
+            auto& [i, next] = stack.back();
+            if (next < _nodes[i].children.size())
+            {
+                const size_t child = _index[_nodes[i].children[next++]];
+                _nodes[child].enter = counter++;
+                stack.emplace_back(child, 0);
+            }
+            else
+            {
+                _nodes[i].leave = counter++;
+                stack.pop_back();
+            }
+        }
+    }
+
+    // dominance frontiers are found by walking up from the predecessors of join points
+    for (size_t i = 0, e = _blocks.size(); i != e; ++i)
+    {
+        if (_blocks[i]->predecessors().size() < 2)
+            continue;
+
+        for (BasicBlock* pred: _blocks[i]->predecessors())
+        {
+            auto p = _index.find(pred);
+            if (p == _index.end())
+                continue;
+
+            // the entry block has no immediate dominator to stop at
+            const size_t stop = i == 0 ? Undefined : _nodes[i].idom;
+            for (size_t runner = p->second; runner != stop;
+                 runner = runner == 0 ? Undefined : _nodes[runner].idom)
+            {
+                auto& frontier = _nodes[runner].frontier;
+                if (std::find(frontier.begin(), frontier.end(), _blocks[i]) == frontier.end())
+                    frontier.push_back(_blocks[i]);
+            }
+        }
+    }
+}
+
+const DominatorTree::Node& DominatorTree::node(const BasicBlock* bb) const
+{
+    auto i = _index.find(bb);
+    COREVM_ASSERT(i != _index.end(), "BasicBlock must be reachable from the entry block.");
+    return _nodes[i->second];
+}
+
+BasicBlock* DominatorTree::immediateDominator(const BasicBlock* bb) const
+{
+    if (bb == _blocks.front())
+        return nullptr;
+
+    return _blocks[node(bb).idom];
+}
+
+const std::vector<BasicBlock*>& DominatorTree::children(const BasicBlock* bb) const
+{
+    return node(bb).children;
+}
+
+bool DominatorTree::dominates(const BasicBlock* a, const BasicBlock* b) const
+{
+    const Node& x = node(a);
+    const Node& y = node(b);
+    return x.enter <= y.enter && y.leave <= x.leave;
+}
+
+const std::vector<BasicBlock*>& DominatorTree::dominanceFrontier(const BasicBlock* bb) const
+{
+    return node(bb).frontier;
+}
+
+} // namespace CoreVM
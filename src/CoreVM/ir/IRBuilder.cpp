@@ -2,11 +2,14 @@
 module;
 #include <CoreVM/util/strings.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cinttypes>
 #include <cmath>
-#include <vector>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
 module CoreVM;
 namespace CoreVM
@@ -130,9 +133,9 @@ Instr* IRBuilder::createStore(Value* lhs, ConstantInt* index, Value* rhs, const
     return insert<StoreInstr>(lhs, index, rhs, makeName(name));
 }
 
-Instr* IRBuilder::createPhi(const std::vector<Value*>& incomings, const std::string& name)
+PhiNode* IRBuilder::createPhi(LiteralType ty, const std::string& name)
 {
-    return insert<PhiNode>(incomings, makeName(name));
+    return insert<PhiNode>(ty, makeName(name));
 }
 // }}}
 // {{{ boolean ops
@@ -165,7 +168,7 @@ Value* IRBuilder::createBXor(Value* lhs, Value* rhs, const std::string& name)
         if (auto* b = dynamic_cast<ConstantBoolean*>(rhs))
             return getBoolean(a->get() ^ b->get());
 
-    return insert<BAndInstr>(lhs, rhs, makeName(name));
+    return insert<BXorInstr>(lhs, rhs, makeName(name));
 }
 // }}}
 // {{{ numerical ops
@@ -422,6 +425,26 @@ Value* IRBuilder::createSAdd(Value* lhs, Value* rhs, const std::string& name)
     return insert<SAddInstr>(lhs, rhs, makeName(name));
 }
 
+/**
+ * Concatenates all strings in \p pieces at once.
+ */
+Value* IRBuilder::createSConcat(const std::vector<Value*>& pieces, const std::string& name)
+{
+    assert(std::all_of(
+        pieces.begin(), pieces.end(), [](Value* piece) { return piece->type() == LiteralType::String; }));
+
+    const auto isConstant = [](Value* piece) { return dynamic_cast<ConstantString*>(piece) != nullptr; };
+    if (std::all_of(pieces.begin(), pieces.end(), isConstant))
+    {
+        std::string result;
+        for (Value* piece: pieces)
+            result += static_cast<ConstantString*>(piece)->get();
+        return get(std::string_view { result });
+    }
+
+    return insert<SConcatInstr>(pieces, makeName(name));
+}
+
 Value* IRBuilder::createSCmpEQ(Value* lhs, Value* rhs, const std::string& name)
 {
     assert(lhs->type() == rhs->type());
@@ -681,6 +704,14 @@ Instr* IRBuilder::createInvokeHandler(IRBuiltinHandler* callee, const std::vecto
 {
     return insert<HandlerCallInstr>(callee, args);
 }
+
+Instr* IRBuilder::createInvoke(IRHandler* callee, std::vector<Value*> args, std::string name)
+{
+    assert(callee->isFunction() && "Only functions can be invoked.");
+    assert(callee->argumentCount() == args.size() || callee->empty());
+
+    return insert<InvokeInstr>(callee, std::move(args), makeName(std::move(name)));
+}
 // }}}
 // {{{ exit point creators
 Instr* IRBuilder::createRet(Value* result)
@@ -46,6 +46,12 @@ IRHandler::~IRHandler()
     }
 }
 
+IRArgument* IRHandler::addArgument(LiteralType type, const std::string& name)
+{
+    _arguments.emplace_back(std::make_unique<IRArgument>(type, name, this));
+    return _arguments.back().get();
+}
+
 BasicBlock* IRHandler::createBlock(const std::string& name)
 {
     _blocks.emplace_back(std::make_unique<BasicBlock>(name, this));
@@ -65,6 +71,12 @@ void IRHandler::setEntryBlock(BasicBlock* bb)
 
 void IRHandler::dump()
 {
+    if (empty())
+    {
+        printf(".declare %s\n\n", name().c_str());
+        return;
+    }
+
     printf(".handler %s %*c; entryPoint = %%%s\n",
            name().c_str(),
            10 - (int) name().size(),
@@ -128,6 +140,10 @@ void IRHandler::erase(BasicBlock* bb)
     auto i = std::find_if(_blocks.begin(), _blocks.end(), [&](const auto& obj) { return obj.get() == bb; });
     COREVM_ASSERT(i != _blocks.end(), "Given basic block must be a member of this handler to be removed.");
 
+    for (BasicBlock* successor: bb->successors())
+        for (PhiNode* phi: successor->phiNodes())
+            phi->removeIncoming(bb);
+
     for (Instr* instr: bb->instructions())
     {
         instr->clearOperands();
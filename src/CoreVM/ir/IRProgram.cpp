@@ -3,6 +3,8 @@ module;
 #include <cassert>
 #include <memory>
 #include <algorithm>
+#include <string>
+#include <string_view>
 module CoreVM;
 namespace CoreVM
 {
@@ -15,6 +17,12 @@ IRProgram::IRProgram(): _trueLiteral(true, "trueLiteral"), _falseLiteral(false,
 
 IRProgram::~IRProgram()
 {
+    // handlers may invoke each other, so unlink all of them before releasing any
+    for (IRHandler* handler: handlers())
+        for (BasicBlock* bb: handler->basicBlocks())
+            for (Instr* instr: bb->instructions())
+                instr->clearOperands();
+
     // first reset all standard handlers and *then* the global-scope initialization handler
     // in order to not cause confusion upon resource release
     {
@@ -33,6 +41,7 @@ IRProgram::~IRProgram()
 
     _constantArrays.clear();
     _numbers.clear();
+    _stringIndex.clear();
     _strings.clear();
     _ipaddrs.clear();
     _cidrs.clear();
@@ -40,6 +49,16 @@ IRProgram::~IRProgram()
     _builtinFunctions.clear();
 }
 
+ConstantString* IRProgram::get(std::string_view literal)
+{
+    if (auto const i = _stringIndex.find(literal); i != _stringIndex.end())
+        return i->second;
+
+    auto* const constant = _strings.emplace_back(std::make_unique<ConstantString>(std::string(literal))).get();
+    _stringIndex.emplace(constant->get(), constant);
+    return constant;
+}
+
 void IRProgram::dump()
 {
     printf("; IRProgram\n");
@@ -49,6 +49,7 @@ IS_SAME_INSTR_IMPL(LoadInstr)
 IS_SAME_INSTR_IMPL(PhiNode)
 IS_SAME_INSTR_IMPL(CallInstr)
 IS_SAME_INSTR_IMPL(HandlerCallInstr)
+IS_SAME_INSTR_IMPL(InvokeInstr)
 IS_SAME_INSTR_IMPL(CondBrInstr)
 IS_SAME_INSTR_IMPL(BrInstr)
 IS_SAME_INSTR_IMPL(RetInstr)
@@ -81,6 +82,7 @@ IS_SAME_INSTR_IMPL(BXorInstr)
 IS_SAME_INSTR_IMPL(SLenInstr)
 IS_SAME_INSTR_IMPL(SIsEmptyInstr)
 IS_SAME_INSTR_IMPL(SAddInstr)
+IS_SAME_INSTR_IMPL(SConcatInstr)
 IS_SAME_INSTR_IMPL(SSubStrInstr)
 IS_SAME_INSTR_IMPL(SCmpEQInstr)
 IS_SAME_INSTR_IMPL(SCmpNEInstr)
@@ -4,6 +4,7 @@ module;
 
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <cassert>
 #include <utility> // make_pair
 module CoreVM;
@@ -114,6 +115,22 @@ void CastInstr::accept(InstructionVisitor& v)
     v.visit(*this);
 }
 // }}}
+// {{{ SConcatInstr
+std::string SConcatInstr::to_string() const
+{
+    return formatOne("sconcat");
+}
+
+std::unique_ptr<Instr> SConcatInstr::clone()
+{
+    return std::make_unique<SConcatInstr>(operands(), name());
+}
+
+void SConcatInstr::accept(InstructionVisitor& v)
+{
+    v.visit(*this);
+}
+// }}}
 // {{{ CondBrInstr
 CondBrInstr::CondBrInstr(Value* cond, BasicBlock* trueBlock, BasicBlock* falseBlock):
     TerminateInstr({ cond, trueBlock, falseBlock })
@@ -292,19 +309,102 @@ void HandlerCallInstr::accept(InstructionVisitor& visitor)
     visitor.visit(*this);
 }
 // }}}
+// {{{ InvokeInstr
+InvokeInstr::InvokeInstr(const std::vector<Value*>& args, const std::string& name):
+    Instr(static_cast<IRHandler*>(args[0])->returnType(), args, name)
+{
+}
+
+InvokeInstr::InvokeInstr(IRHandler* callee, const std::vector<Value*>& args, const std::string& name):
+    Instr(callee->returnType(), join(callee, args), name)
+{
+}
+
+IRHandler* InvokeInstr::callee() const
+{
+    return static_cast<IRHandler*>(operand(0));
+}
+
+std::string InvokeInstr::to_string() const
+{
+    return formatOne("invoke");
+}
+
+std::unique_ptr<Instr> InvokeInstr::clone()
+{
+    return std::make_unique<InvokeInstr>(operands(), name());
+}
+
+void InvokeInstr::accept(InstructionVisitor& visitor)
+{
+    visitor.visit(*this);
+}
+// }}}
 // {{{ PhiNode
-PhiNode::PhiNode(const std::vector<Value*>& ops, const std::string& name): Instr(ops[0]->type(), ops, name)
+PhiNode::PhiNode(LiteralType ty, const std::string& name): Instr(ty, {}, name)
+{
+}
+
+void PhiNode::addIncoming(Value* value, BasicBlock* predecessor)
 {
+    auto i = std::find(_incomingBlocks.begin(), _incomingBlocks.end(), predecessor);
+    if (i == _incomingBlocks.end())
+    {
+        addOperand(value);
+        _incomingBlocks.push_back(predecessor);
+        return;
+    }
+
+    const auto index = static_cast<size_t>(i - _incomingBlocks.begin());
+    if (operand(index) != value)
+        setOperand(index, value);
+}
+
+void PhiNode::removeIncoming(BasicBlock* predecessor)
+{
+    auto i = std::find(_incomingBlocks.begin(), _incomingBlocks.end(), predecessor);
+    if (i == _incomingBlocks.end())
+        return;
+
+    // operands cannot be removed from the middle, so all others are added again
+    const auto index = i - _incomingBlocks.begin();
+    std::vector<Value*> values = operands();
+    std::vector<BasicBlock*> blocks = _incomingBlocks;
+    values.erase(values.begin() + index);
+    blocks.erase(blocks.begin() + index);
+
+    clearOperands();
+    _incomingBlocks.clear();
+    for (size_t k = 0, e = values.size(); k != e; ++k)
+        addIncoming(values[k], blocks[k]);
+}
+
+void PhiNode::replaceIncomingBlock(BasicBlock* oldPredecessor, BasicBlock* newPredecessor)
+{
+    std::replace(_incomingBlocks.begin(), _incomingBlocks.end(), oldPredecessor, newPredecessor);
+}
+
+Value* PhiNode::incomingValue(const BasicBlock* predecessor) const
+{
+    auto i = std::find(_incomingBlocks.begin(), _incomingBlocks.end(), predecessor);
+    return i != _incomingBlocks.end() ? operand(static_cast<size_t>(i - _incomingBlocks.begin())) : nullptr;
 }
 
 std::string PhiNode::to_string() const
 {
-    return formatOne("phi");
+    std::string blocks;
+    for (const BasicBlock* bb: _incomingBlocks)
+        blocks += fmt::format("{}%{}", blocks.empty() ? "" : ", ", bb->name());
+
+    return fmt::format("{} ; from {}", formatOne("phi"), blocks);
 }
 
 std::unique_ptr<Instr> PhiNode::clone()
 {
-    return std::make_unique<PhiNode>(operands(), name());
+    auto phi = std::make_unique<PhiNode>(type(), name());
+    for (size_t i = 0, e = _incomingBlocks.size(); i != e; ++i)
+        phi->addIncoming(operand(i), _incomingBlocks[i]);
+    return phi;
 }
 
 void PhiNode::accept(InstructionVisitor& visitor)
@@ -2,54 +2,188 @@
 module;
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 module CoreVM;
 namespace CoreVM
 {
 
-void PassManager::registerPass(std::string name, HandlerPass handlerPass)
+namespace
+{
+    bool isEnabled(const char* envVar)
+    {
+        const char* flag = getenv(envVar);
+        return flag && strcmp(flag, "1") == 0;
+    }
+
+    struct HandlerSize
+    {
+        int64_t instructions = 0;
+        int64_t blocks = 0;
+
+        explicit HandlerSize(IRHandler* handler)
+        {
+            for (BasicBlock* bb: handler->basicBlocks())
+            {
+                instructions += static_cast<int64_t>(bb->size());
+                blocks++;
+            }
+        }
+    };
+} // namespace
+
+PassManager::PassManager():
+#if defined(NDEBUG)
+    _verify { false },
+#else
+    _verify { true },
+#endif
+    _timePasses { isEnabled("COREVM_TIME_PASSES") }
 {
-    _handlerPasses.emplace_back(std::move(name), std::move(handlerPass));
+}
+
+void PassManager::registerPass(std::string name,
+                               HandlerPass handlerPass,
+                               unsigned modifies,
+                               unsigned dependsOn)
+{
+    _passes.emplace_back(Pass { .name = std::move(name),
+                                .run = std::move(handlerPass),
+                                .modifies = modifies,
+                                .dependsOn = dependsOn,
+                                .statistics = {} });
 }
 
 void PassManager::run(IRProgram* program)
 {
     for (IRHandler* handler: program->handlers())
     {
+        if (handler->empty())
+            continue; // merely declares a function defined by another program
+
         logDebug("optimizing handler {}", handler->name());
         run(handler);
     }
+
+    if (_timePasses)
+        fprintf(stderr, "%s", formatStatistics().c_str());
 }
 
 void PassManager::run(IRHandler* handler)
 {
-    for (;;)
+    // Every pass runs once, in order of registration. After that, a pass only runs again
+    // once a change was made that it depends on, always continuing with the first one pending.
+    std::vector<bool> pending(_passes.size(), true);
+    size_t changes = 0;
+    for (size_t i = 0; i < _passes.size();)
     {
-        int changes = 0;
-        for (const std::pair<std::string, HandlerPass>& pass: _handlerPasses)
+        if (!pending[i])
         {
-            logDebug("executing pass {}:", pass.first);
-            if (pass.second(handler))
-            {
-                logDebug("pass {}: changes detected", pass.first);
-                handler->verify();
-                changes++;
-            }
+            i++;
+            continue;
         }
-        logDebug("{} changes detected", changes);
-        if (!changes)
+
+        Pass& pass = _passes[i];
+        pending[i] = false;
+        if (!runPass(pass, handler))
+        {
+            i++;
+            continue;
+        }
+
+        changes++;
+        for (size_t k = 0; k < _passes.size(); ++k)
         {
-            break;
+            if (_passes[k].dependsOn & pass.modifies)
+            {
+                pending[k] = true;
+                i = std::min(i, k);
+            }
         }
     }
+    logDebug("{} changes detected", changes);
+}
+
+bool PassManager::runPass(Pass& pass, IRHandler* handler)
+{
+    logDebug("executing pass {}:", pass.name);
+
+    bool changed = false;
+    if (_timePasses)
+    {
+        auto const before = HandlerSize { handler };
+        auto const start = std::chrono::steady_clock::now();
+        changed = pass.run(handler);
+        pass.statistics.time += std::chrono::steady_clock::now() - start;
+        auto const after = HandlerSize { handler };
+        pass.statistics.instructionsRemoved += before.instructions - after.instructions;
+        pass.statistics.blocksRemoved += before.blocks - after.blocks;
+    }
+    else
+    {
+        changed = pass.run(handler);
+    }
+
+    pass.statistics.runs++;
+    if (!changed)
+        return false;
+
+    logDebug("pass {}: changes detected", pass.name);
+    pass.statistics.changes++;
+    if (_verify)
+        handler->verify();
+    return true;
+}
+
+const PassManager::Statistics* PassManager::statistics(std::string_view name) const
+{
+    for (const Pass& pass: _passes)
+        if (pass.name == name)
+            return &pass.statistics;
+
+    return nullptr;
+}
+
+std::string PassManager::formatStatistics() const
+{
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+
+    auto total = Statistics {};
+    std::string result = fmt::format(
+        "{:>12} {:>6} {:>8} {:>8} {:>8}  {}\n", "time (ms)", "runs", "changes", "-instrs", "-blocks", "pass");
+    for (const Pass& pass: _passes)
+    {
+        const Statistics& s = pass.statistics;
+        result += fmt::format("{:>12.3f} {:>6} {:>8} {:>8} {:>8}  {}\n",
+                              Milliseconds(s.time).count(),
+                              s.runs,
+                              s.changes,
+                              s.instructionsRemoved,
+                              s.blocksRemoved,
+                              pass.name);
+        total.runs += s.runs;
+        total.changes += s.changes;
+        total.time += s.time;
+        total.instructionsRemoved += s.instructionsRemoved;
+        total.blocksRemoved += s.blocksRemoved;
+    }
+    result += fmt::format("{:>12.3f} {:>6} {:>8} {:>8} {:>8}  {}\n",
+                          Milliseconds(total.time).count(),
+                          total.runs,
+                          total.changes,
+                          total.instructionsRemoved,
+                          total.blocksRemoved,
+                          "total");
+    return result;
 }
 
 void PassManager::logDebug(const std::string& msg)
 {
-    const char* debugFlag = getenv("COREVM_DEBUG_TRANSFORMS");
-    if (debugFlag && strcmp(debugFlag, "1") == 0)
+    if (isEnabled("COREVM_DEBUG_TRANSFORMS"))
     {
         fprintf(stderr, "PassManager: %s\n", msg.c_str());
     }
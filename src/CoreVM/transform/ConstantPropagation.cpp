@@ -0,0 +1,813 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+#include <CoreVM/util/strings.h>
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+module CoreVM;
+namespace CoreVM::transform
+{
+
+namespace
+{
+
+/*
+ * Sparse conditional constant propagation (Wegman & Zadeck).
+ *
+ * Every value starts out as unknown and is only ever lowered, to a constant or to overdefined,
+ * while walking the blocks that are found to be executable. Branches on constant conditions
+ * only mark the edge taken as executable, so values flowing in from dead paths do not spoil
+ * the PHI nodes they meet at.
+ *
+ * Instructions are evaluated the way the VM would evaluate them at runtime. Whatever the VM would
+ * fail on (such as a division by zero) is left to the VM.
+ */
+class ConstantPropagation: public InstructionVisitor
+{
+  public:
+    explicit ConstantPropagation(IRHandler* handler);
+
+    bool run();
+
+  private:
+    enum class State
+    {
+        Unknown,
+        Constant,
+        Overdefined,
+    };
+
+    struct LatticeValue
+    {
+        State state = State::Unknown;
+        Constant* constant = nullptr;
+    };
+
+    [[nodiscard]] LatticeValue valueOf(Value* value) const;
+    void setValue(Instr& instr, LatticeValue value);
+    void setConstant(Instr& instr, Constant* constant);
+    void setOverdefined(Instr& instr) { setValue(instr, { State::Overdefined, nullptr }); }
+    void markEdge(BasicBlock* from, BasicBlock* to);
+    [[nodiscard]] BasicBlock* matchTarget(MatchInstr& match, Constant* condition) const;
+
+    /*
+     * Evaluates @p instr by passing its constant operands, of the given types, to @p eval,
+     * once all of its operands are known.
+     */
+    template <typename A, typename Eval>
+    void fold(Instr& instr, Eval eval);
+    template <typename A, typename B, typename Eval>
+    void fold(Instr& instr, Eval eval);
+
+    Constant* get(bool value) { return _program->getBoolean(value); }
+    Constant* get(CoreNumber value) { return _program->get(value); }
+    Constant* get(const std::string& value) { return _program->get(std::string_view { value }); }
+
+    void visit(NopInstr& instr) override;
+
+    // storage
+    void visit(AllocaInstr& instr) override;
+    void visit(StoreInstr& instr) override;
+    void visit(LoadInstr& instr) override;
+    void visit(PhiNode& instr) override;
+
+    // calls
+    void visit(CallInstr& instr) override;
+    void visit(HandlerCallInstr& instr) override;
+    void visit(InvokeInstr& instr) override;
+
+    // terminator
+    void visit(CondBrInstr& instr) override;
+    void visit(BrInstr& instr) override;
+    void visit(RetInstr& instr) override;
+    void visit(MatchInstr& instr) override;
+
+    // regexp
+    void visit(RegExpGroupInstr& instr) override;
+
+    // type cast
+    void visit(CastInstr& instr) override;
+
+    // numeric
+    void visit(INegInstr& instr) override;
+    void visit(INotInstr& instr) override;
+    void visit(IAddInstr& instr) override;
+    void visit(ISubInstr& instr) override;
+    void visit(IMulInstr& instr) override;
+    void visit(IDivInstr& instr) override;
+    void visit(IRemInstr& instr) override;
+    void visit(IPowInstr& instr) override;
+    void visit(IAndInstr& instr) override;
+    void visit(IOrInstr& instr) override;
+    void visit(IXorInstr& instr) override;
+    void visit(IShlInstr& instr) override;
+    void visit(IShrInstr& instr) override;
+    void visit(ICmpEQInstr& instr) override;
+    void visit(ICmpNEInstr& instr) override;
+    void visit(ICmpLEInstr& instr) override;
+    void visit(ICmpGEInstr& instr) override;
+    void visit(ICmpLTInstr& instr) override;
+    void visit(ICmpGTInstr& instr) override;
+
+    // boolean
+    void visit(BNotInstr& instr) override;
+    void visit(BAndInstr& instr) override;
+    void visit(BOrInstr& instr) override;
+    void visit(BXorInstr& instr) override;
+
+    // string
+    void visit(SLenInstr& instr) override;
+    void visit(SIsEmptyInstr& instr) override;
+    void visit(SAddInstr& instr) override;
+    void visit(SConcatInstr& instr) override;
+    void visit(SSubStrInstr& instr) override;
+    void visit(SCmpEQInstr& instr) override;
+    void visit(SCmpNEInstr& instr) override;
+    void visit(SCmpLEInstr& instr) override;
+    void visit(SCmpGEInstr& instr) override;
+    void visit(SCmpLTInstr& instr) override;
+    void visit(SCmpGTInstr& instr) override;
+    void visit(SCmpREInstr& instr) override;
+    void visit(SCmpBegInstr& instr) override;
+    void visit(SCmpEndInstr& instr) override;
+    void visit(SInInstr& instr) override;
+
+    // ip
+    void visit(PCmpEQInstr& instr) override;
+    void visit(PCmpNEInstr& instr) override;
+    void visit(PInCidrInstr& instr) override;
+
+  private:
+    IRHandler* _handler;
+    IRProgram* _program;
+
+    // a regular expression match sets the groups that RegExpGroupInstr reads, so it must be kept then
+    bool _regexpGroupsUsed = false;
+
+    std::unordered_map<const Instr*, LatticeValue> _values;
+    std::set<std::pair<const BasicBlock*, const BasicBlock*>> _executableEdges;
+    std::unordered_set<const BasicBlock*> _executableBlocks;
+    std::deque<BasicBlock*> _blockWorklist;
+    std::deque<Instr*> _instrWorklist;
+};
+
+ConstantPropagation::ConstantPropagation(IRHandler* handler):
+    _handler(handler), _program(handler->getProgram())
+{
+    for (IRHandler* other: _program->handlers())
+        for (BasicBlock* bb: other->basicBlocks())
+            for (Instr* instr: bb->instructions())
+                if (dynamic_cast<RegExpGroupInstr*>(instr))
+                    _regexpGroupsUsed = true;
+}
+
+ConstantPropagation::LatticeValue ConstantPropagation::valueOf(Value* value) const
+{
+    if (auto* constant = dynamic_cast<Constant*>(value))
+        return { State::Constant, constant };
+
+    if (auto* instr = dynamic_cast<Instr*>(value))
+    {
+        if (auto i = _values.find(instr); i != _values.end())
+            return i->second;
+        return {};
+    }
+
+    // handler arguments
+    return { State::Overdefined, nullptr };
+}
+
+void ConstantPropagation::setValue(Instr& instr, LatticeValue value)
+{
+    LatticeValue& current = _values[&instr];
+    if (current.state == State::Overdefined || value.state == State::Unknown)
+        return;
+
+    if (current.state == value.state && current.constant == value.constant)
+        return;
+
+    current = value;
+    for (Instr* user: instr.uses())
+        _instrWorklist.push_back(user);
+}
+
+void ConstantPropagation::setConstant(Instr& instr, Constant* constant)
+{
+    if (constant != nullptr)
+        setValue(instr, { State::Constant, constant });
+    else
+        setOverdefined(instr);
+}
+
+void ConstantPropagation::markEdge(BasicBlock* from, BasicBlock* to)
+{
+    if (!_executableEdges.emplace(from, to).second)
+        return;
+
+    if (_executableBlocks.insert(to).second)
+    {
+        _blockWorklist.push_back(to);
+        return;
+    }
+
+    // another value may flow into the PHI nodes of an already visited block now
+    for (PhiNode* phi: to->phiNodes())
+        _instrWorklist.push_back(phi);
+}
+
+template <typename A, typename Eval>
+void ConstantPropagation::fold(Instr& instr, Eval eval)
+{
+    const LatticeValue a = valueOf(instr.operand(0));
+    if (a.state != State::Constant)
+        return setValue(instr, a);
+
+    auto* x = dynamic_cast<A*>(a.constant);
+    setConstant(instr, x ? eval(x->get()) : nullptr);
+}
+
+template <typename A, typename B, typename Eval>
+void ConstantPropagation::fold(Instr& instr, Eval eval)
+{
+    const LatticeValue a = valueOf(instr.operand(0));
+    const LatticeValue b = valueOf(instr.operand(1));
+    if (a.state == State::Overdefined || b.state == State::Overdefined)
+        return setOverdefined(instr);
+    if (a.state == State::Unknown || b.state == State::Unknown)
+        return;
+
+    auto* x = dynamic_cast<A*>(a.constant);
+    auto* y = dynamic_cast<B*>(b.constant);
+    setConstant(instr, x && y ? eval(x->get(), y->get()) : nullptr);
+}
+
+BasicBlock* ConstantPropagation::matchTarget(MatchInstr& match, Constant* condition) const
+{
+    auto* subject = dynamic_cast<ConstantString*>(condition);
+    if (subject == nullptr)
+        return nullptr;
+
+    switch (match.op())
+    {
+        case MatchClass::Same: {
+            // the last of equal labels wins, as with the VM's lookup table
+            BasicBlock* target = match.elseBlock();
+            for (auto const& [label, code]: match.cases())
+            {
+                auto* text = dynamic_cast<ConstantString*>(label);
+                if (text == nullptr)
+                    return nullptr;
+                if (text->get() == subject->get())
+                    target = code;
+            }
+            return target;
+        }
+        case MatchClass::RegExp: {
+            if (_regexpGroupsUsed)
+                return nullptr;
+
+            for (auto const& [label, code]: match.cases())
+            {
+                auto* re = dynamic_cast<ConstantRegExp*>(label);
+                if (re == nullptr)
+                    return nullptr;
+                if (re->get().match(subject->get()))
+                    return code;
+            }
+            return match.elseBlock();
+        }
+        default:
+            // prefix and suffix matches are left to the VM's lookup trees
+            return nullptr;
+    }
+}
+
+bool ConstantPropagation::run()
+{
+    BasicBlock* entry = _handler->getEntryBlock();
+    _executableBlocks.insert(entry);
+    _blockWorklist.push_back(entry);
+
+    while (!_blockWorklist.empty() || !_instrWorklist.empty())
+    {
+        while (!_instrWorklist.empty())
+        {
+            Instr* instr = _instrWorklist.front();
+            _instrWorklist.pop_front();
+            if (_executableBlocks.contains(instr->getBasicBlock()))
+                instr->accept(*this);
+        }
+
+        if (!_blockWorklist.empty())
+        {
+            BasicBlock* bb = _blockWorklist.front();
+            _blockWorklist.pop_front();
+            for (Instr* instr: bb->instructions())
+                instr->accept(*this);
+        }
+    }
+
+    // Replace the constant values, leaving it to the other passes to drop the branches not taken.
+    bool changed = false;
+    std::vector<Instr*> obsolete;
+    for (BasicBlock* bb: _handler->basicBlocks())
+    {
+        if (!_executableBlocks.contains(bb))
+            continue;
+
+        for (Instr* instr: bb->instructions())
+        {
+            if (auto i = _values.find(instr); i != _values.end() && i->second.state == State::Constant)
+            {
+                instr->replaceAllUsesWith(i->second.constant);
+                obsolete.push_back(instr);
+            }
+        }
+
+        // unlike condbr, which is folded by foldConstantCondBr()
+        auto* match = dynamic_cast<MatchInstr*>(bb->getTerminator());
+        if (match == nullptr)
+            continue;
+
+        const LatticeValue cond = valueOf(match->condition());
+        if (cond.state != State::Constant)
+            continue;
+
+        if (BasicBlock* target = matchTarget(*match, cond.constant))
+        {
+            std::unordered_set<BasicBlock*> dropped;
+            for (BasicBlock* successor: bb->successors())
+                if (successor != target)
+                    dropped.insert(successor);
+
+            bb->remove(match).reset();
+            bb->push_back(std::make_unique<BrInstr>(target));
+
+            // no value flows from here into the blocks not taken anymore
+            for (BasicBlock* successor: dropped)
+                for (PhiNode* phi: successor->phiNodes())
+                    phi->removeIncoming(bb);
+            changed = true;
+        }
+    }
+
+    for (Instr* instr: obsolete)
+    {
+        instr->clearOperands();
+        instr->getBasicBlock()->remove(instr);
+    }
+
+    return changed || !obsolete.empty();
+}
+
+// {{{ instructions without a constant result
+void ConstantPropagation::visit(NopInstr& /*instr*/)
+{
+}
+
+void ConstantPropagation::visit(AllocaInstr& instr)
+{
+    setOverdefined(instr);
+}
+
+void ConstantPropagation::visit(StoreInstr& /*instr*/)
+{
+}
+
+void ConstantPropagation::visit(LoadInstr& instr)
+{
+    setOverdefined(instr);
+}
+
+void ConstantPropagation::visit(CallInstr& instr)
+{
+    setOverdefined(instr);
+}
+
+void ConstantPropagation::visit(HandlerCallInstr& instr)
+{
+    setOverdefined(instr);
+}
+
+void ConstantPropagation::visit(InvokeInstr& instr)
+{
+    setOverdefined(instr);
+}
+
+void ConstantPropagation::visit(RegExpGroupInstr& instr)
+{
+    setOverdefined(instr);
+}
+// }}}
+// {{{ control flow
+void ConstantPropagation::visit(PhiNode& instr)
+{
+    LatticeValue result;
+    for (BasicBlock* pred: instr.incomingBlocks())
+    {
+        if (!_executableEdges.contains({ pred, instr.getBasicBlock() }))
+            continue;
+
+        const LatticeValue incoming = valueOf(instr.incomingValue(pred));
+        if (incoming.state == State::Unknown)
+            continue;
+
+        if (incoming.state == State::Overdefined
+            || (result.state == State::Constant && result.constant != incoming.constant))
+            return setOverdefined(instr);
+
+        result = incoming;
+    }
+    setValue(instr, result);
+}
+
+void ConstantPropagation::visit(CondBrInstr& instr)
+{
+    const LatticeValue cond = valueOf(instr.condition());
+    if (cond.state == State::Unknown)
+        return;
+
+    if (auto* value = dynamic_cast<ConstantBoolean*>(cond.constant))
+    {
+        markEdge(instr.getBasicBlock(), value->get() ? instr.trueBlock() : instr.falseBlock());
+        return;
+    }
+
+    markEdge(instr.getBasicBlock(), instr.trueBlock());
+    markEdge(instr.getBasicBlock(), instr.falseBlock());
+}
+
+void ConstantPropagation::visit(BrInstr& instr)
+{
+    markEdge(instr.getBasicBlock(), instr.targetBlock());
+}
+
+void ConstantPropagation::visit(RetInstr& /*instr*/)
+{
+}
+
+void ConstantPropagation::visit(MatchInstr& instr)
+{
+    const LatticeValue cond = valueOf(instr.condition());
+    if (cond.state == State::Unknown)
+        return;
+
+    if (cond.state == State::Constant)
+    {
+        if (BasicBlock* target = matchTarget(instr, cond.constant))
+        {
+            markEdge(instr.getBasicBlock(), target);
+            return;
+        }
+    }
+
+    for (BasicBlock* successor: instr.getBasicBlock()->successors())
+        markEdge(instr.getBasicBlock(), successor);
+}
+// }}}
+// {{{ type cast
+void ConstantPropagation::visit(CastInstr& instr)
+{
+    const LatticeValue source = valueOf(instr.source());
+    if (source.state != State::Constant)
+        return setValue(instr, source);
+
+    Constant* result = nullptr;
+    if (instr.type() == instr.source()->type())
+        result = source.constant;
+    else if (instr.type() == LiteralType::String)
+    {
+        if (auto* number = dynamic_cast<ConstantInt*>(source.constant))
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%" PRIi64 "", number->get());
+            result = get(std::string(buf));
+        }
+        else if (auto* boolean = dynamic_cast<ConstantBoolean*>(source.constant))
+            result = get(std::string(boolean->get() ? "true" : "false"));
+        else if (auto* ip = dynamic_cast<ConstantIP*>(source.constant))
+            result = get(ip->get().str());
+        else if (auto* cidr = dynamic_cast<ConstantCidr*>(source.constant))
+            result = get(cidr->get().str());
+        else if (auto* re = dynamic_cast<ConstantRegExp*>(source.constant))
+            result = get(re->get().pattern());
+    }
+    else if (instr.type() == LiteralType::Number)
+    {
+        if (auto* text = dynamic_cast<ConstantString*>(source.constant))
+        {
+            try
+            {
+                result = get(CoreNumber { std::stoi(text->get()) });
+            }
+            catch (...)
+            {
+                // the VM fails on this at runtime
+            }
+        }
+    }
+    setConstant(instr, result);
+}
+// }}}
+// {{{ numeric
+// The VM's arithmetic wraps around on overflow, as does the unsigned arithmetic used here.
+static CoreNumber wrap(uint64_t value)
+{
+    return static_cast<CoreNumber>(value);
+}
+
+void ConstantPropagation::visit(INegInstr& instr)
+{
+    fold<ConstantInt>(instr, [&](CoreNumber a) { return get(wrap(0 - static_cast<uint64_t>(a))); });
+}
+
+void ConstantPropagation::visit(INotInstr& instr)
+{
+    fold<ConstantInt>(instr, [&](CoreNumber a) { return get(CoreNumber { ~a }); });
+}
+
+void ConstantPropagation::visit(IAddInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) {
+        return get(wrap(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)));
+    });
+}
+
+void ConstantPropagation::visit(ISubInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) {
+        return get(wrap(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)));
+    });
+}
+
+void ConstantPropagation::visit(IMulInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) {
+        return get(wrap(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)));
+    });
+}
+
+void ConstantPropagation::visit(IDivInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) -> Constant* {
+        if (b == 0 || (b == -1 && a == std::numeric_limits<CoreNumber>::min()))
+            return nullptr;
+        return get(CoreNumber { a / b });
+    });
+}
+
+void ConstantPropagation::visit(IRemInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) -> Constant* {
+        if (b == 0 || (b == -1 && a == std::numeric_limits<CoreNumber>::min()))
+            return nullptr;
+        return get(CoreNumber { a % b });
+    });
+}
+
+void ConstantPropagation::visit(IPowInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) -> Constant* {
+        const long double result = powl(a, b);
+        const auto limit = -static_cast<long double>(std::numeric_limits<CoreNumber>::min()); // 2^63
+        if (!std::isfinite(result) || result < -limit || result >= limit)
+            return nullptr;
+        return get(static_cast<CoreNumber>(result));
+    });
+}
+
+void ConstantPropagation::visit(IAndInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(
+        instr, [&](CoreNumber a, CoreNumber b) { return get(CoreNumber { a & b }); });
+}
+
+void ConstantPropagation::visit(IOrInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(
+        instr, [&](CoreNumber a, CoreNumber b) { return get(CoreNumber { a | b }); });
+}
+
+void ConstantPropagation::visit(IXorInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(
+        instr, [&](CoreNumber a, CoreNumber b) { return get(CoreNumber { a ^ b }); });
+}
+
+void ConstantPropagation::visit(IShlInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) -> Constant* {
+        if (b < 0 || b >= 64)
+            return nullptr;
+        return get(CoreNumber { a << b });
+    });
+}
+
+void ConstantPropagation::visit(IShrInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) -> Constant* {
+        if (b < 0 || b >= 64)
+            return nullptr;
+        return get(CoreNumber { a >> b });
+    });
+}
+
+void ConstantPropagation::visit(ICmpEQInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) { return get(a == b); });
+}
+
+void ConstantPropagation::visit(ICmpNEInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) { return get(a != b); });
+}
+
+void ConstantPropagation::visit(ICmpLEInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) { return get(a <= b); });
+}
+
+void ConstantPropagation::visit(ICmpGEInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) { return get(a >= b); });
+}
+
+void ConstantPropagation::visit(ICmpLTInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) { return get(a < b); });
+}
+
+void ConstantPropagation::visit(ICmpGTInstr& instr)
+{
+    fold<ConstantInt, ConstantInt>(instr, [&](CoreNumber a, CoreNumber b) { return get(a > b); });
+}
+// }}}
+// {{{ boolean
+void ConstantPropagation::visit(BNotInstr& instr)
+{
+    fold<ConstantBoolean>(instr, [&](bool a) { return get(!a); });
+}
+
+void ConstantPropagation::visit(BAndInstr& instr)
+{
+    fold<ConstantBoolean, ConstantBoolean>(instr, [&](bool a, bool b) { return get(a && b); });
+}
+
+void ConstantPropagation::visit(BOrInstr& instr)
+{
+    fold<ConstantBoolean, ConstantBoolean>(instr, [&](bool a, bool b) { return get(a || b); });
+}
+
+void ConstantPropagation::visit(BXorInstr& instr)
+{
+    fold<ConstantBoolean, ConstantBoolean>(instr, [&](bool a, bool b) { return get(a != b); });
+}
+// }}}
+// {{{ string
+void ConstantPropagation::visit(SLenInstr& instr)
+{
+    fold<ConstantString>(instr, [&](const std::string& a) { return get(static_cast<CoreNumber>(a.size())); });
+}
+
+void ConstantPropagation::visit(SIsEmptyInstr& instr)
+{
+    fold<ConstantString>(instr, [&](const std::string& a) { return get(a.empty()); });
+}
+
+void ConstantPropagation::visit(SAddInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a + b); });
+}
+
+void ConstantPropagation::visit(SConcatInstr& instr)
+{
+    std::string result;
+    for (Value* operand: instr.operands())
+    {
+        const LatticeValue piece = valueOf(operand);
+        if (piece.state != State::Constant)
+            return setValue(instr, piece);
+
+        auto* text = dynamic_cast<ConstantString*>(piece.constant);
+        if (text == nullptr)
+            return setOverdefined(instr);
+        result += text->get();
+    }
+    setConstant(instr, get(result));
+}
+
+void ConstantPropagation::visit(SSubStrInstr& instr)
+{
+    // takes its offset and length from the stack, beyond what the IR passes as operands
+    setOverdefined(instr);
+}
+
+void ConstantPropagation::visit(SCmpEQInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a == b); });
+}
+
+void ConstantPropagation::visit(SCmpNEInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a != b); });
+}
+
+void ConstantPropagation::visit(SCmpLEInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a <= b); });
+}
+
+void ConstantPropagation::visit(SCmpGEInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a >= b); });
+}
+
+void ConstantPropagation::visit(SCmpLTInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a < b); });
+}
+
+void ConstantPropagation::visit(SCmpGTInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(a > b); });
+}
+
+void ConstantPropagation::visit(SCmpREInstr& instr)
+{
+    if (_regexpGroupsUsed)
+        return setOverdefined(instr);
+
+    fold<ConstantString, ConstantRegExp>(
+        instr, [&](const std::string& a, const util::RegExp& re) { return get(re.match(a)); });
+}
+
+void ConstantPropagation::visit(SCmpBegInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(beginsWith(a, b)); });
+}
+
+void ConstantPropagation::visit(SCmpEndInstr& instr)
+{
+    fold<ConstantString, ConstantString>(
+        instr, [&](const std::string& a, const std::string& b) { return get(endsWith(a, b)); });
+}
+
+void ConstantPropagation::visit(SInInstr& instr)
+{
+    fold<ConstantString, ConstantString>(instr, [&](const std::string& a, const std::string& b) {
+        return get(a.find(b) != std::string::npos);
+    });
+}
+// }}}
+// {{{ ip
+void ConstantPropagation::visit(PCmpEQInstr& instr)
+{
+    fold<ConstantIP, ConstantIP>(
+        instr, [&](const util::IPAddress& a, const util::IPAddress& b) { return get(a == b); });
+}
+
+void ConstantPropagation::visit(PCmpNEInstr& instr)
+{
+    fold<ConstantIP, ConstantIP>(
+        instr, [&](const util::IPAddress& a, const util::IPAddress& b) { return get(a != b); });
+}
+
+void ConstantPropagation::visit(PInCidrInstr& instr)
+{
+    fold<ConstantIP, ConstantCidr>(
+        instr, [&](const util::IPAddress& a, const util::Cidr& b) { return get(b.contains(a)); });
+}
+// }}}
+
+} // namespace
+
+bool propagateConstants(IRHandler* handler)
+{
+    if (handler->empty())
+        return false;
+
+    return ConstantPropagation(handler).run();
+}
+
+} // namespace CoreVM::transform
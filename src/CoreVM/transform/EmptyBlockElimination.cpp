@@ -1,12 +1,37 @@
 // SPDX-License-Identifier: Apache-2.0
 module;
 
+#include <algorithm>
 #include <list>
+#include <vector>
 
 module CoreVM;
 namespace CoreVM::transform
 {
 
+/*
+ * Tests whether the values flowing from the empty block @p bb into the PHI nodes of its successor
+ * can flow in from each of its predecessors directly, which is not the case if a predecessor
+ * already jumps to that successor with a different value.
+ */
+static bool canForwardIncomingValues(BasicBlock* bb, BasicBlock* successor)
+{
+    for (PhiNode* phi: successor->phiNodes())
+    {
+        Value* value = phi->incomingValue(bb);
+        for (BasicBlock* pred: bb->predecessors())
+        {
+            if (Value* other = phi->incomingValue(pred); other != nullptr && other != value)
+            {
+                const auto& preds = successor->predecessors();
+                if (std::find(preds.begin(), preds.end(), pred) != preds.end())
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
 bool emptyBlockElimination(IRHandler* handler)
 {
     std::list<BasicBlock*> eliminated;
@@ -19,16 +44,38 @@ bool emptyBlockElimination(IRHandler* handler)
         if (BrInstr* br = dynamic_cast<BrInstr*>(bb->getTerminator()))
         {
             BasicBlock* newSuccessor = br->targetBlock();
-            eliminated.push_back(bb);
+            if (newSuccessor == bb || !canForwardIncomingValues(bb, newSuccessor))
+                continue;
+
             if (bb == handler->getEntryBlock())
             {
-                handler->setEntryBlock(bb);
+                // The successor takes over as entry block, unless it is a join point itself
+                // (e.g. a loop's header), as the entry block must not be jumped to.
+                if (newSuccessor->predecessors().size() != 1)
+                    continue;
+
+                for (PhiNode* phi: newSuccessor->phiNodes())
+                {
+                    phi->replaceAllUsesWith(phi->incomingValue(bb));
+                    newSuccessor->remove(phi);
+                }
+
+                eliminated.push_back(bb);
+                handler->setEntryBlock(newSuccessor);
                 break;
             }
             else
             {
-                for (BasicBlock* pred: bb->predecessors())
+                eliminated.push_back(bb);
+
+                // relinking the predecessors removes them from bb's list
+                const std::vector<BasicBlock*> predecessors = bb->predecessors();
+                for (BasicBlock* pred: predecessors)
                 {
+                    for (PhiNode* phi: newSuccessor->phiNodes())
+                        if (Value* value = phi->incomingValue(bb))
+                            phi->addIncoming(value, pred);
+
                     pred->getTerminator()->replaceOperand(bb, newSuccessor);
                 }
             }
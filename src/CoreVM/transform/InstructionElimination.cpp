@@ -125,6 +125,11 @@ bool foldConstantCondBr(IRHandler* handler)
                 auto x = bb->remove(condbr);
                 x.reset(nullptr);
                 bb->push_back(std::make_unique<BrInstr>(use.first));
+
+                // no value flows from here into the block not taken anymore
+                if (use.second != use.first)
+                    for (PhiNode* phi: use.second->phiNodes())
+                        phi->removeIncoming(bb);
                 return true;
             }
         }
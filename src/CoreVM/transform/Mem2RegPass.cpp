@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+module CoreVM;
+namespace CoreVM::transform
+{
+
+#define GLOBAL_SCOPE_INIT_NAME "@__global_init__"
+
+/*
+ * Tests whether the variable allocated by @p alloca holds a single scalar that is only ever
+ * loaded and stored as a whole, so that its values can be kept in SSA values instead.
+ */
+static bool isPromotable(AllocaInstr* alloca)
+{
+    auto* size = dynamic_cast<ConstantInt*>(alloca->arraySize());
+    if (size == nullptr || size->get() != 1)
+        return false;
+
+    switch (alloca->type())
+    {
+        case LiteralType::Boolean:
+        case LiteralType::Number:
+        case LiteralType::String: break;
+        default: return false;
+    }
+
+    for (Instr* user: alloca->uses())
+    {
+        if (auto* load = dynamic_cast<LoadInstr*>(user); load && load->variable() == alloca)
+            continue;
+
+        if (auto* store = dynamic_cast<StoreInstr*>(user);
+            store && store->variable() == alloca && store->source() != alloca && store->index()->get() == 0)
+            continue;
+
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Value of a variable that has not been stored to yet, as initialized by the VM's ALLOCA.
+ */
+static Constant* initialValue(IRProgram* program, LiteralType type)
+{
+    switch (type)
+    {
+        case LiteralType::Boolean: return program->getBoolean(false);
+        case LiteralType::String: return program->get(std::string_view {});
+        default: return program->get(int64_t { 0 });
+    }
+}
+
+/*
+ * Removes the PHI nodes whose value is never used (but by other such PHI nodes),
+ * and replaces those that merge just a single value with that value.
+ */
+static void simplifyPhiNodes(const std::vector<PhiNode*>& phis)
+{
+    std::unordered_set<PhiNode*> live;
+    std::vector<PhiNode*> pending;
+    for (PhiNode* phi: phis)
+    {
+        for (Instr* user: phi->uses())
+        {
+            if (!dynamic_cast<PhiNode*>(user))
+            {
+                live.insert(phi);
+                pending.push_back(phi);
+                break;
+            }
+        }
+    }
+    while (!pending.empty())
+    {
+        PhiNode* phi = pending.back();
+        pending.pop_back();
+        for (Value* operand: phi->operands())
+            if (auto* other = dynamic_cast<PhiNode*>(operand); other && live.insert(other).second)
+                pending.push_back(other);
+    }
+
+    // dead PHI nodes may refer to each other, so they are unlinked before any is removed
+    std::vector<PhiNode*> remaining;
+    for (PhiNode* phi: phis)
+    {
+        if (live.contains(phi))
+            remaining.push_back(phi);
+        else
+            phi->clearOperands();
+    }
+    for (PhiNode* phi: phis)
+        if (!live.contains(phi))
+            phi->getBasicBlock()->remove(phi);
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (auto i = remaining.begin(); i != remaining.end();)
+        {
+            PhiNode* phi = *i;
+            Value* single = nullptr; // the only value merged, besides the PHI node itself
+            bool merging = false;
+            for (Value* operand: phi->operands())
+            {
+                if (operand == phi || operand == single)
+                    continue;
+                merging = single != nullptr;
+                single = operand;
+                if (merging)
+                    break;
+            }
+
+            if (single == nullptr || merging)
+            {
+                ++i;
+                continue;
+            }
+
+            phi->replaceAllUsesWith(single);
+            phi->clearOperands();
+            phi->getBasicBlock()->remove(phi);
+            i = remaining.erase(i);
+            changed = true;
+        }
+    }
+}
+
+bool promoteMemoryToRegisters(IRHandler* handler)
+{
+    // variables of the global scope are shared with all other handlers
+    if (handler->empty() || handler->name() == GLOBAL_SCOPE_INIT_NAME)
+        return false;
+
+    std::vector<AllocaInstr*> allocas;
+    for (Instr* instr: handler->getEntryBlock()->instructions())
+        if (auto* alloca = dynamic_cast<AllocaInstr*>(instr); alloca && isPromotable(alloca))
+            allocas.push_back(alloca);
+
+    if (allocas.empty())
+        return false;
+
+    const DominatorTree dominatorTree(handler);
+    IRProgram* program = handler->getProgram();
+
+    // A variable needs a PHI node wherever differing stores may meet,
+    // that is, at the iterated dominance frontier of the blocks storing to it.
+    std::unordered_map<PhiNode*, AllocaInstr*> phiVariables;
+    std::vector<PhiNode*> phis;
+    for (AllocaInstr* alloca: allocas)
+    {
+        std::vector<BasicBlock*> pending;
+        for (Instr* user: alloca->uses())
+            if (dynamic_cast<StoreInstr*>(user) && dominatorTree.isReachable(user->getBasicBlock()))
+                pending.push_back(user->getBasicBlock());
+
+        std::unordered_set<BasicBlock*> placed;
+        while (!pending.empty())
+        {
+            BasicBlock* bb = pending.back();
+            pending.pop_back();
+            for (BasicBlock* frontier: dominatorTree.dominanceFrontier(bb))
+            {
+                if (!placed.insert(frontier).second)
+                    continue;
+
+                auto* phi = static_cast<PhiNode*>(frontier->insert(
+                    frontier->front(), std::make_unique<PhiNode>(alloca->type(), alloca->name())));
+                phiVariables[phi] = alloca;
+                phis.push_back(phi);
+                pending.push_back(frontier);
+            }
+        }
+    }
+
+    // Rename the variables' loads to the value stored last, walking down the dominator tree.
+    std::unordered_map<const AllocaInstr*, Value*> current;
+    for (AllocaInstr* alloca: allocas)
+        current[alloca] = initialValue(program, alloca->type());
+
+    auto const variableOf = [&](Value* value) -> AllocaInstr* {
+        auto* alloca = dynamic_cast<AllocaInstr*>(value);
+        return alloca && current.contains(alloca) ? alloca : nullptr;
+    };
+
+    std::vector<Instr*> obsolete;                         // promoted loads and stores
+    std::vector<std::pair<AllocaInstr*, Value*>> undoLog; // values to restore when leaving a subtree
+    std::vector<std::pair<BasicBlock*, size_t>> pending;  // block and undo log size to leave it at, if any
+    pending.emplace_back(handler->getEntryBlock(), SIZE_MAX);
+    while (!pending.empty())
+    {
+        auto [bb, undoMark] = pending.back();
+        pending.pop_back();
+
+        if (undoMark != SIZE_MAX)
+        {
+            // leaving the subtree of bb
+            for (; undoLog.size() > undoMark; undoLog.pop_back())
+                current[undoLog.back().first] = undoLog.back().second;
+            continue;
+        }
+
+        pending.emplace_back(bb, undoLog.size());
+        for (Instr* instr: bb->instructions())
+        {
+            if (auto* phi = dynamic_cast<PhiNode*>(instr))
+            {
+                if (auto i = phiVariables.find(phi); i != phiVariables.end())
+                {
+                    undoLog.emplace_back(i->second, current[i->second]);
+                    current[i->second] = phi;
+                }
+            }
+            else if (auto* load = dynamic_cast<LoadInstr*>(instr))
+            {
+                if (AllocaInstr* alloca = variableOf(load->variable()))
+                {
+                    load->replaceAllUsesWith(current[alloca]);
+                    obsolete.push_back(load);
+                }
+            }
+            else if (auto* store = dynamic_cast<StoreInstr*>(instr))
+            {
+                if (AllocaInstr* alloca = variableOf(store->variable()))
+                {
+                    undoLog.emplace_back(alloca, current[alloca]);
+                    current[alloca] = store->source();
+                    obsolete.push_back(store);
+                }
+            }
+        }
+
+        for (BasicBlock* successor: bb->successors())
+            for (PhiNode* phi: successor->phiNodes())
+                if (auto i = phiVariables.find(phi); i != phiVariables.end())
+                    phi->addIncoming(current[i->second], bb);
+
+        for (BasicBlock* child: dominatorTree.children(bb))
+            pending.emplace_back(child, SIZE_MAX);
+    }
+
+    // loads and stores within unreachable blocks are left behind by the walk above
+    for (AllocaInstr* alloca: allocas)
+    {
+        for (Instr* user: std::vector<Instr*>(alloca->uses()))
+        {
+            if (dominatorTree.isReachable(user->getBasicBlock()))
+                continue;
+
+            if (dynamic_cast<LoadInstr*>(user))
+                user->replaceAllUsesWith(initialValue(program, alloca->type()));
+            obsolete.push_back(user);
+        }
+    }
+
+    for (Instr* instr: obsolete)
+    {
+        instr->clearOperands();
+        instr->getBasicBlock()->remove(instr);
+    }
+
+    for (AllocaInstr* alloca: allocas)
+        alloca->getBasicBlock()->remove(alloca);
+
+    simplifyPhiNodes(phis);
+
+    return true;
+}
+
+} // namespace CoreVM::transform
@@ -31,6 +31,22 @@ static bool isSameSuccessors(BasicBlock* a, BasicBlock* b)
     return true;
 }
 
+/*
+ * Tests whether PHI nodes tell @p bb apart from other blocks, as it either has PHI nodes itself
+ * or some of its successors do.
+ */
+static bool hasPhiNodes(BasicBlock* bb)
+{
+    if (!bb->phiNodes().empty())
+        return true;
+
+    for (BasicBlock* succ: bb->successors())
+        if (!succ->phiNodes().empty())
+            return true;
+
+    return false;
+}
+
 bool mergeSameBlocks(IRHandler* handler)
 {
     std::list<std::list<BasicBlock*>> uniques;
@@ -38,6 +54,13 @@ bool mergeSameBlocks(IRHandler* handler)
     for (BasicBlock* bb: handler->basicBlocks())
     {
         bool found = false;
+
+        if (hasPhiNodes(bb))
+        {
+            uniques.push_back({ bb });
+            continue;
+        }
+
         // check if we already have a BB that is equal
         for (auto& uniq: uniques)
         {
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+module CoreVM;
+namespace CoreVM::transform
+{
+
+static bool isConcatenation(const Value* value)
+{
+    return dynamic_cast<const SAddInstr*>(value) || dynamic_cast<const SConcatInstr*>(value);
+}
+
+/*
+ * Tests whether @p value is an intermediate result of a concatenation that is only used
+ * to be concatenated further by @p user, so that it can be fused into it.
+ */
+static bool isFusableInto(Value* value, Instr* user)
+{
+    auto* instr = dynamic_cast<Instr*>(value);
+    return instr && isConcatenation(instr) && instr->getBasicBlock() == user->getBasicBlock()
+           && instr->useCount() == 1;
+}
+
+/*
+ * Fuses the concatenation tree rooted at @p root into a single instruction.
+ */
+static bool fuseConcatenation(Instr* root)
+{
+    // collect the tree's leaves in order, with all its inner concatenations
+    std::vector<Value*> pieces;
+    std::vector<Instr*> fused;
+    std::vector<std::pair<Value*, Instr*>> pending; // value and the concatenation it flows into
+    for (auto i = root->operands().rbegin(), e = root->operands().rend(); i != e; ++i)
+        pending.emplace_back(*i, root);
+    while (!pending.empty())
+    {
+        auto [value, user] = pending.back();
+        pending.pop_back();
+        if (!isFusableInto(value, user))
+        {
+            pieces.push_back(value);
+            continue;
+        }
+
+        auto* instr = static_cast<Instr*>(value);
+        fused.push_back(instr);
+        for (auto i = instr->operands().rbegin(), e = instr->operands().rend(); i != e; ++i)
+            pending.emplace_back(*i, instr);
+    }
+
+    // join adjacent string literals, dropping empty ones
+    IRProgram* program = root->getBasicBlock()->getHandler()->getProgram();
+    std::vector<Value*> merged;
+    for (Value* piece: pieces)
+    {
+        if (auto* text = dynamic_cast<ConstantString*>(piece))
+        {
+            if (text->get().empty())
+                continue;
+
+            if (auto* last = merged.empty() ? nullptr : dynamic_cast<ConstantString*>(merged.back()))
+            {
+                merged.back() = program->get(std::string_view { last->get() + text->get() });
+                continue;
+            }
+        }
+        merged.push_back(piece);
+    }
+
+    if (fused.empty() && merged.size() == pieces.size())
+        return false;
+
+    BasicBlock* bb = root->getBasicBlock();
+    Value* result = nullptr;
+    if (merged.empty())
+        result = program->get(std::string_view {});
+    else if (merged.size() == 1)
+        result = merged.front();
+    else if (merged.size() == 2)
+        result = bb->insert(root, std::make_unique<SAddInstr>(merged[0], merged[1], root->name()));
+    else
+        result = bb->insert(root, std::make_unique<SConcatInstr>(merged, root->name()));
+
+    root->replaceAllUsesWith(result);
+
+    // the inner concatenations are used by each other, so they are unlinked before any is removed
+    root->clearOperands();
+    for (Instr* instr: fused)
+        instr->clearOperands();
+    bb->remove(root);
+    for (Instr* instr: fused)
+        bb->remove(instr);
+
+    return true;
+}
+
+bool fuseStringConcatenations(IRHandler* handler)
+{
+    bool changed = false;
+    for (BasicBlock* bb: handler->basicBlocks())
+    {
+        // Fused instructions always precede their root, so they are not visited after removal.
+        std::vector<Instr*> instructions;
+        for (Instr* instr: bb->instructions())
+            instructions.push_back(instr);
+
+        for (Instr* instr: instructions)
+        {
+            if (!isConcatenation(instr))
+                continue;
+
+            // not a root, if fused into its user later on
+            if (instr->useCount() == 1 && isConcatenation(instr->uses().front())
+                && instr->uses().front()->getBasicBlock() == bb)
+                continue;
+
+            changed |= fuseConcatenation(instr);
+        }
+    }
+    return changed;
+}
+
+} // namespace CoreVM::transform
@@ -1,6 +1,9 @@
 // SPDX-License-Identifier: Apache-2.0
 module;
+
 #include <list>
+#include <unordered_set>
+#include <vector>
 
 module CoreVM;
 namespace CoreVM::transform
@@ -8,22 +11,38 @@ namespace CoreVM::transform
 
 bool eliminateUnusedBlocks(IRHandler* handler)
 {
-    std::list<BasicBlock*> unused;
+    std::unordered_set<BasicBlock*> reachable;
+    std::vector<BasicBlock*> pending { handler->getEntryBlock() };
+    while (!pending.empty())
+    {
+        BasicBlock* bb = pending.back();
+        pending.pop_back();
+        if (reachable.insert(bb).second)
+            pending.insert(pending.end(), bb->successors().begin(), bb->successors().end());
+    }
 
+    std::list<BasicBlock*> unused;
     for (BasicBlock* bb: handler->basicBlocks())
     {
-        if (bb == handler->getEntryBlock())
-            continue;
+        if (!reachable.contains(bb))
+            unused.push_back(bb);
+    }
 
-        if (!bb->predecessors().empty())
-            continue;
+    // Unreachable blocks may jump to and use values of one another (e.g. within a loop),
+    // so all of them are unlinked before any is removed.
+    for (BasicBlock* bb: unused)
+    {
+        // COREVM_TRACE("CoreVM: removing unused BasicBlock {}", bb->name());
+        for (BasicBlock* successor: bb->successors())
+            for (PhiNode* phi: successor->phiNodes())
+                phi->removeIncoming(bb);
 
-        unused.push_back(bb);
+        for (Instr* instr: bb->instructions())
+            instr->clearOperands();
     }
 
     for (BasicBlock* bb: unused)
     {
-        // COREVM_TRACE("CoreVM: removing unused BasicBlock {}", bb->name());
         handler->erase(bb);
     }
 
@@ -2,8 +2,13 @@
 module;
 
 #include <cinttypes>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <fmt/core.h>
 
@@ -67,6 +72,23 @@ inline size_t ensureValue(std::vector<std::vector<T>>& vv, const U& array)
     return vv.size() - 1;
 }
 
+template <typename T>
+inline size_t ensureValue(std::vector<T>& table, std::unordered_map<T, size_t>& index, const T& literal)
+{
+    // the index is rebuilt if the table was populated without it (see deserialize())
+    if (index.size() != table.size())
+    {
+        index.clear();
+        for (size_t i = 0, e = table.size(); i != e; ++i)
+            index.try_emplace(table[i], i);
+    }
+
+    auto const [i, inserted] = index.try_emplace(literal, table.size());
+    if (inserted)
+        table.push_back(literal);
+    return i->second;
+}
+
 template <typename T, typename U>
 inline size_t ensureValue(std::vector<T>& table, const U& literal)
 {
@@ -81,12 +103,12 @@ inline size_t ensureValue(std::vector<T>& table, const U& literal)
 
 size_t ConstantPool::makeInteger(CoreNumber value)
 {
-    return ensureValue(_numbers, value);
+    return ensureValue(_numbers, _numberIndex, value);
 }
 
 size_t ConstantPool::makeString(const std::string& value)
 {
-    return ensureValue(_strings, value);
+    return ensureValue(_strings, _stringIndex, value);
 }
 
 size_t ConstantPool::makeIPAddress(const util::IPAddress& value)
@@ -151,7 +173,7 @@ size_t ConstantPool::makeNativeHandler(const IRBuiltinHandler* handler)
 
 size_t ConstantPool::makeNativeHandler(const std::string& sig)
 {
-    return ensureValue(_nativeHandlerSignatures, sig);
+    return ensureValue(_nativeHandlerSignatures, _nativeHandlerIndex, sig);
 }
 
 size_t ConstantPool::makeNativeFunction(const IRBuiltinFunction* function)
@@ -161,7 +183,7 @@ size_t ConstantPool::makeNativeFunction(const IRBuiltinFunction* function)
 
 size_t ConstantPool::makeNativeFunction(const std::string& sig)
 {
-    return ensureValue(_nativeFunctionSignatures, sig);
+    return ensureValue(_nativeFunctionSignatures, _nativeFunctionIndex, sig);
 }
 
 size_t ConstantPool::makeHandler(const IRHandler* handler)
@@ -189,6 +211,205 @@ size_t ConstantPool::makeHandler(const std::string& name)
     return i;
 }
 
+// {{{ serialization
+namespace
+{
+    constexpr uint32_t ImageMagic = 0xbeafbabe;
+    constexpr uint32_t ImageVersion = 1;
+
+    class ImageWriter
+    {
+      public:
+        template <typename T>
+        void writeValue(T value)
+        {
+            _data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        template <typename T>
+        void writeValues(const std::vector<T>& values)
+        {
+            writeValue<uint64_t>(values.size());
+            _data.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        }
+
+        void writeString(std::string_view value)
+        {
+            writeValue<uint64_t>(value.size());
+            _data.append(value);
+        }
+
+        void writeStrings(const std::vector<std::string>& values)
+        {
+            writeValue<uint64_t>(values.size());
+            for (const auto& value: values)
+                writeString(value);
+        }
+
+        [[nodiscard]] std::string take() { return std::move(_data); }
+
+      private:
+        std::string _data;
+    };
+
+    // Reads from an image, failing (rather than reading out of bounds) on truncated input.
+    class ImageReader
+    {
+      public:
+        explicit ImageReader(std::string_view image): _image { image } {}
+
+        [[nodiscard]] bool good() const noexcept { return _good; }
+        [[nodiscard]] bool atEnd() const noexcept { return _offset == _image.size(); }
+
+        template <typename T>
+        T readValue()
+        {
+            T value {};
+            if (!require(sizeof(T)))
+                return value;
+            std::memcpy(&value, _image.data() + _offset, sizeof(T));
+            _offset += sizeof(T);
+            return value;
+        }
+
+        std::string readString()
+        {
+            auto const length = readValue<uint64_t>();
+            if (!require(length))
+                return {};
+            auto value = std::string(_image.substr(_offset, length));
+            _offset += length;
+            return value;
+        }
+
+        // Reads an element count, each element being at least @p minElementSize bytes in size.
+        size_t readCount(size_t minElementSize)
+        {
+            auto const count = readValue<uint64_t>();
+            if (minElementSize != 0 && count > (_image.size() - _offset) / minElementSize)
+                _good = false;
+            return _good ? static_cast<size_t>(count) : 0;
+        }
+
+        template <typename T>
+        std::vector<T> readValues()
+        {
+            auto values = std::vector<T>(readCount(sizeof(T)));
+            if (!values.empty())
+            {
+                std::memcpy(values.data(), _image.data() + _offset, values.size() * sizeof(T));
+                _offset += values.size() * sizeof(T);
+            }
+            return values;
+        }
+
+        std::vector<std::string> readStrings()
+        {
+            auto values = std::vector<std::string>(readCount(sizeof(uint64_t)));
+            for (auto& value: values)
+                value = readString();
+            return values;
+        }
+
+      private:
+        bool require(size_t n)
+        {
+            if (n > _image.size() - _offset)
+                _good = false;
+            return _good;
+        }
+
+        std::string_view _image;
+        size_t _offset = 0;
+        bool _good = true;
+    };
+} // namespace
+
+std::optional<std::string> ConstantPool::serialize() const
+{
+    if (!_ipaddrs.empty() || !_cidrs.empty() || !_regularExpressions.empty() || !_ipaddrArrays.empty()
+        || !_cidrArrays.empty() || !_matchDefs.empty())
+        return std::nullopt;
+
+    ImageWriter writer;
+    writer.writeValue(ImageMagic);
+    writer.writeValue(ImageVersion);
+
+    writer.writeValues(_numbers);
+    writer.writeStrings(_strings);
+
+    writer.writeValue<uint64_t>(_intArrays.size());
+    for (const auto& array: _intArrays)
+        writer.writeValues(array);
+
+    writer.writeValue<uint64_t>(_stringArrays.size());
+    for (const auto& array: _stringArrays)
+        writer.writeStrings(array);
+
+    writer.writeValue<uint64_t>(_modules.size());
+    for (const auto& [name, path]: _modules)
+    {
+        writer.writeString(name);
+        writer.writeString(path);
+    }
+
+    writer.writeStrings(_nativeHandlerSignatures);
+    writer.writeStrings(_nativeFunctionSignatures);
+
+    writer.writeValue<uint64_t>(_handlers.size());
+    for (const auto& [name, code]: _handlers)
+    {
+        writer.writeString(name);
+        writer.writeValues(code);
+    }
+
+    return writer.take();
+}
+
+std::optional<ConstantPool> ConstantPool::deserialize(std::string_view image)
+{
+    ImageReader reader { image };
+    if (reader.readValue<uint32_t>() != ImageMagic || reader.readValue<uint32_t>() != ImageVersion)
+        return std::nullopt;
+
+    ConstantPool cp;
+    cp._numbers = reader.readValues<CoreNumber>();
+    cp._strings = reader.readStrings();
+
+    cp._intArrays.resize(reader.readCount(sizeof(uint64_t)));
+    for (auto& array: cp._intArrays)
+        array = reader.readValues<CoreNumber>();
+
+    cp._stringArrays.resize(reader.readCount(sizeof(uint64_t)));
+    for (auto& array: cp._stringArrays)
+        array = reader.readStrings();
+
+    cp._modules.resize(reader.readCount(2 * sizeof(uint64_t)));
+    for (auto& [name, path]: cp._modules)
+    {
+        name = reader.readString();
+        path = reader.readString();
+    }
+
+    cp._nativeHandlerSignatures = reader.readStrings();
+    cp._nativeFunctionSignatures = reader.readStrings();
+
+    cp._handlers.resize(reader.readCount(2 * sizeof(uint64_t)));
+    for (auto& [name, code]: cp._handlers)
+    {
+        name = reader.readString();
+        code = reader.readValues<Instruction>();
+        if (code.empty())
+            return std::nullopt;
+    }
+
+    if (!reader.good() || !reader.atEnd())
+        return std::nullopt;
+
+    return { std::move(cp) };
+}
+// }}}
+
 template <typename T>
 void dumpArrays(const std::vector<std::vector<T>>& vv, const char* name)
 {
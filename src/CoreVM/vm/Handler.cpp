@@ -24,7 +24,7 @@ void Handler::setCode(std::vector<Instruction> code)
 {
     _code = std::move(code);
 
-    if (opcode(_code.back()) != Opcode::EXIT)
+    if (_code.empty() || (opcode(_code.back()) != Opcode::EXIT && opcode(_code.back()) != Opcode::RET))
         _code.push_back(makeInstruction(Opcode::EXIT, false));
 
     _stackSize = computeStackSize(_code.data(), _code.size());
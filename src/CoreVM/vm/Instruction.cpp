@@ -147,7 +147,13 @@ static InstructionInfo instructionInfos[] = {
     // invokation
     IIDEF(CALL, III, 0, Void),
     IIDEF(HANDLER, II, 0, Void),
+    IIDEF(INVOKE, III, 0, Void),
+    IIDEF(RET, I, 0, Void),
+
+    // string
+    IIDEF(SCONCAT, I, 0, String),
 };
+static_assert(std::size(instructionInfos) == OpcodeCount, "instructionInfos must cover all opcodes");
 // }}}
 
 int getStackChange(Instruction instr)
@@ -157,7 +163,9 @@ int getStackChange(Instruction instr)
     {
         case Opcode::ALLOCA: return operandA(instr);
         case Opcode::DISCARD: return -operandA(instr);
+        case Opcode::SCONCAT: return 1 - operandA(instr);
         case Opcode::HANDLER: return -operandB(instr);
+        case Opcode::INVOKE: return operandC(instr) - operandB(instr);
         case Opcode::CALL:
             // TODO: handle void/non-void functions properly
             // return 1 - operandB(instr);
@@ -353,6 +361,11 @@ std::string disassemble(Instruction pc, size_t ip, size_t sp, const ConstantPool
                 line << word;
                 n += word.size();
                 break;
+            case Opcode::INVOKE:
+                word = fmt::format("{}, {}", cp->getHandler(A).first, B);
+                line << word;
+                n += word.size();
+                break;
             default:
                 switch (operandSignature(opc))
                 {
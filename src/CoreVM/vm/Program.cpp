@@ -10,34 +10,29 @@ module CoreVM;
 namespace CoreVM
 {
 
-/* {{{ possible binary file format
+/* {{{ binary image format (see ConstantPool::serialize())
  * ----------------------------------------------
+ * All integers are stored in host byte order, as images are only meant to be cached on the
+ * machine that created them.
+ *
  * u32                  magic number (0xbeafbabe)
  * u32                  version
- * u64                  flags
- * u64                  register count
- * u64                  code start
- * u64                  code size
- * u64                  integer const-table start
- * u64                  integer const-table element count
- * u64                  string const-table start
- * u64                  string const-table element count
- * u64                  regex const-table start (stored as string)
- * u64                  regex const-table element count
- * u64                  debug source-lines-table start
- * u64                  debug source-lines-table element count
+ * u64, i64[]           integer const-table
+ * u64, string[]        string const-table
+ * u64, {u64, i64[]}[]  integer array const-table
+ * u64, {u64, string[]} string array const-table
+ * u64, {string, string}[] modules (name, path)
+ * u64, string[]        native handler signatures
+ * u64, string[]        native function signatures
+ * u64, {string, u64, u64[]}[] handlers (name, code segment)
  *
- * u32[]                code segment
- * u64[]                integer const-table segment
- * u64[]                string const-table segment
- * {u32, u8[]}[]        strings
- * {u32, u32, u32}[]    debug source lines segment
+ * with string being {u64 length, u8[] data}.
  */  // }}}
 
 Program::Program(ConstantPool&& cp):
     _cp(std::move(cp)), _runtime(nullptr), _handlers(), _matches(), _nativeHandlers(), _nativeFunctions()
 {
-    setup();
+    update();
 }
 
 Handler* Program::handler(size_t index) const
@@ -45,13 +40,14 @@ Handler* Program::handler(size_t index) const
     return _handlers[index].get();
 }
 
-void Program::setup()
+void Program::update()
 {
-    for (const auto& handler: _cp.getHandlers())
-        createHandler(handler.first, handler.second);
+    const auto& handlers = _cp.getHandlers();
+    for (size_t i = _handlers.size(), e = handlers.size(); i != e; ++i)
+        createHandler(handlers[i].first, handlers[i].second);
 
     const std::vector<MatchDef>& matches = _cp.getMatchDefs();
-    for (size_t i = 0, e = matches.size(); i != e; ++i)
+    for (size_t i = _matches.size(), e = matches.size(); i != e; ++i)
     {
         const MatchDef& def = matches[i];
         switch (def.op)
@@ -113,6 +109,9 @@ void Program::dump()
  * Maps all native functions/handlers to their implementations (report
  *unresolved symbols)
  *
+ * Linking again against the same runtime only resolves the native symbols
+ * that were added since (see update()).
+ *
  * \param runtime the runtime to link this program against, resolving any
  *external native symbols.
  * \retval true Linking succeed.
@@ -121,12 +120,20 @@ void Program::dump()
  */
 bool Program::link(Runtime* runtime, diagnostics::Report* report)
 {
+    if (_runtime != runtime)
+    {
+        _importedModules = 0;
+        _nativeHandlers.clear();
+        _nativeFunctions.clear();
+    }
     _runtime = runtime;
     int errors = 0;
 
     // load runtime modules
-    for (const auto& module: _cp.getModules())
+    const auto& modules = _cp.getModules();
+    for (; _importedModules < modules.size(); ++_importedModules)
     {
+        const auto& module = modules[_importedModules];
         if (!runtime->import(module.first, module.second, nullptr))
         {
             errors++;
@@ -134,41 +141,31 @@ bool Program::link(Runtime* runtime, diagnostics::Report* report)
     }
 
     // link nattive handlers
-    _nativeHandlers.resize(_cp.getNativeHandlerSignatures().size());
-    size_t i = 0;
-    for (const auto& signature: _cp.getNativeHandlerSignatures())
+    const auto& handlerSignatures = _cp.getNativeHandlerSignatures();
+    for (size_t i = _nativeHandlers.size(); i < handlerSignatures.size(); ++i)
     {
+        const auto& signature = handlerSignatures[i];
         // map to _nativeHandlers[i]
-        if (NativeCallback* cb = runtime->find(signature))
+        _nativeHandlers.push_back(runtime->find(signature));
+        if (!_nativeHandlers.back())
         {
-            _nativeHandlers[i] = cb;
-        }
-        else
-        {
-            _nativeHandlers[i] = nullptr;
             report->linkError("Unresolved symbol to native handler signature: {}", signature);
             // TODO _unresolvedSymbols.push_back(signature);
             errors++;
         }
-        ++i;
     }
 
     // link nattive functions
-    _nativeFunctions.resize(_cp.getNativeFunctionSignatures().size());
-    i = 0;
-    for (const auto& signature: _cp.getNativeFunctionSignatures())
+    const auto& functionSignatures = _cp.getNativeFunctionSignatures();
+    for (size_t i = _nativeFunctions.size(); i < functionSignatures.size(); ++i)
     {
-        if (NativeCallback* cb = runtime->find(signature))
-        {
-            _nativeFunctions[i] = cb;
-        }
-        else
+        const auto& signature = functionSignatures[i];
+        _nativeFunctions.push_back(runtime->find(signature));
+        if (!_nativeFunctions.back())
         {
-            _nativeFunctions[i] = nullptr;
             report->linkError("Unresolved native function signature: {}", signature);
             errors++;
         }
-        ++i;
     }
 
     return errors == 0;
@@ -9,6 +9,7 @@ module;
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iterator>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -65,11 +66,11 @@ namespace CoreVM
             }
     #define instr(NAME) \
         case NAME: tracelog();
-    #define get_pc() (pc - code.data())
+    #define get_pc() (pc - code->data())
     #define set_pc(offset)               \
         do                               \
         {                                \
-            pc = code.data() + (offset); \
+            pc = code->data() + (offset); \
         } while (0)
     #define next  \
         if (true) \
@@ -89,11 +90,11 @@ namespace CoreVM
     #define instr(name) \
         l_##name: ++pc; \
         tracelog();
-    #define get_pc() ((pc - code.data()) / 2)
+    #define get_pc() ((pc - code->data()) / 2)
     #define set_pc(offset)                  \
         do                                  \
         {                                   \
-            pc = code.data() + (offset) *2; \
+            pc = code->data() + (offset) *2; \
         } while (0)
     #define next  \
         do        \
@@ -111,11 +112,11 @@ namespace CoreVM
     #define LOOP_BEGIN() jump;
     #define LOOP_END()
     #define instr(name) l_##name: tracelog();
-    #define get_pc()    (pc - code.data())
+    #define get_pc()    (pc - code->data())
     #define set_pc(offset)               \
         do                               \
         {                                \
-            pc = code.data() + (offset); \
+            pc = code->data() + (offset); \
         } while (0)
     #define next  \
         do        \
@@ -196,6 +197,20 @@ CoreString* Runner::catString(const CoreString& a, const CoreString& b)
     return &_stringGarbage.back();
 }
 
+CoreString* Runner::concatStrings(int count)
+{
+    size_t length = 0;
+    for (int i = -count; i != 0; ++i)
+        length += getString(i).size();
+
+    CoreString& result = _stringGarbage.emplace_back();
+    result.reserve(length);
+    for (int i = -count; i != 0; ++i)
+        result += getString(i);
+
+    return &result;
+}
+
 bool Runner::run()
 {
     assert(_state == Inactive);
@@ -216,6 +231,12 @@ bool Runner::resume()
 
 void Runner::rewind()
 {
+    if (!_frames.empty())
+    {
+        _handler = _frames.front().handler;
+        _frames.clear();
+    }
+    _base = 0;
     _ip = 0;
 }
 
@@ -323,33 +344,44 @@ bool Runner::loop()
         // invokation
         label(CALL),
         label(HANDLER),
+        label(INVOKE),
+        label(RET),
+
+        // string
+        label(SCONCAT),
     };
+    static_assert(std::size(ops) == OpcodeCount, "ops must cover all opcodes");
 #endif
 // }}}
 // {{{ direct threaded code initialization
 #if defined(COREVM_DIRECT_THREADED_VM)
-    std::vector<uint64_t>& code = const_cast<Handler*>(_handler)->directThreadedCode();
-    if (code.empty())
-    {
-        const std::vector<Instruction>& source = _handler->code();
-        code.resize(source.size() * 2);
-
-        uint64_t* pc = code.data();
-        for (size_t i = 0, e = source.size(); i != e; ++i)
+    auto const codeOf = [](const Handler* handler) -> const std::vector<uint64_t>* {
+        std::vector<uint64_t>& code = const_cast<Handler*>(handler)->directThreadedCode();
+        if (code.empty())
         {
-            Instruction instr = source[i];
+            const std::vector<Instruction>& source = handler->code();
+            code.resize(source.size() * 2);
 
-            *pc++ = (uint64_t) ops[opcode(instr)];
-            *pc++ = instr;
+            uint64_t* pc = code.data();
+            for (size_t i = 0, e = source.size(); i != e; ++i)
+            {
+                Instruction instr = source[i];
+
+                *pc++ = (uint64_t) ops[opcode(instr)];
+                *pc++ = instr;
+            }
         }
-    }
+        return &code;
+    };
 #else
-    std::vector<Instruction> const& code = _handler->code();
+    auto const codeOf = [](const Handler* handler) { return &handler->code(); };
 #endif
+    // the code being executed, which changes upon INVOKE and RET
+    auto code = codeOf(_handler);
     // }}}
 
     _state = Running;
-    decltype(code.data()) pc {};
+    decltype(code->data()) pc {};
     set_pc(_ip);
 
     LOOP_BEGIN()
@@ -375,7 +407,7 @@ bool Runner::loop()
 
     instr(STACKROT)
     {
-        _stack.rotate(A);
+        _stack.rotate(_base + A);
         next;
     }
 
@@ -459,13 +491,13 @@ bool Runner::loop()
     // {{{ load & store
     instr(LOAD)
     {
-        push(_stack[A]);
+        push(_stack[_base + A]);
         next;
     }
 
     instr(STORE)
     { // STORE imm
-        _stack[A] = pop();
+        _stack[_base + A] = pop();
         next;
     }
     // }}}
@@ -661,6 +693,13 @@ bool Runner::loop()
         next;
     }
 
+    instr(SCONCAT)
+    {
+        SP(-A) = (Value) concatStrings(A);
+        _stack.discard(A - 1);
+        next;
+    }
+
     instr(SSUBSTR)
     {
         SP(-2) = (Value) newString(getString(-3).substr(getNumber(-2), getNumber(-1)));
@@ -933,6 +972,52 @@ bool Runner::loop()
         set_pc(_ip);
         jump;
     }
+
+    instr(INVOKE)
+    {
+        {
+            const Handler* callee = _program->handler(A);
+            if (_frames.size() == MaxCallDepth)
+                throw CallDepthExceeded {};
+
+            incr_pc();
+            _frames.push_back(Frame { _handler, static_cast<size_t>(get_pc()), _base });
+
+            // the arguments become the first stack slots of the callee
+            _base = _stack.size() - B;
+            _handler = callee;
+            code = codeOf(callee);
+        }
+        set_pc(0);
+        jump;
+    }
+
+    instr(RET)
+    {
+        if (_frames.empty())
+        {
+            // the entry handler itself has been run as function
+            _state = Inactive;
+            _ip = get_pc();
+            return true;
+        }
+
+        {
+            const Value result = A != 0 ? pop() : 0;
+            _stack.discard(_stack.size() - _base);
+            if (A != 0)
+                push(result);
+
+            const Frame frame = _frames.back();
+            _frames.pop_back();
+            _base = frame.base;
+            _handler = frame.handler;
+            _ip = frame.returnAddress;
+            code = codeOf(_handler);
+        }
+        set_pc(_ip);
+        jump;
+    }
     // }}}
 
     LOOP_END()
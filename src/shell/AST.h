@@ -6,9 +6,14 @@
 
 #include <fmt/format.h>
 
+#include <cstring>
 #include <filesystem>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -27,6 +32,73 @@ struct Node
     virtual void accept(Visitor&) const = 0;
 };
 
+// Deleter of AST nodes, which are not destroyed individually, but released along with their Arena.
+struct ArenaDeleter
+{
+    template <typename T>
+    void operator()(T const* /*node*/) const noexcept
+    {
+    }
+};
+
+// Pointer to a child node, which is owned by its parent only nominally (see Arena).
+template <typename T>
+using Ptr = std::unique_ptr<T, ArenaDeleter>;
+
+// List of child nodes, allocated from the same Arena as their parent.
+template <typename T>
+using List = std::pmr::vector<Ptr<T>>;
+
+// Memory of an AST, i.e. of all of its nodes and lists, which is released all at once.
+//
+// Nodes are bump-allocated and never destroyed, so that releasing an AST frees a few chunks of memory
+// rather than calling a destructor and free() per node. Hence, all memory owned by a node must be
+// allocated from the same arena as the node itself (i.e. lists are to be created via list() or names()),
+// and strings are views, either into the parsed source or stored into the arena.
+class Arena
+{
+  public:
+    Arena() = default;
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+    Arena(Arena&&) = delete;
+    Arena& operator=(Arena&&) = delete;
+
+    template <typename T, typename... Args>
+    [[nodiscard]] Ptr<T> make(Args&&... args)
+    {
+        static_assert(std::is_base_of_v<Node, T>);
+        void* const memory = _resource.allocate(sizeof(T), alignof(T));
+        return Ptr<T>(::new (memory) T(std::forward<Args>(args)...));
+    }
+
+    template <typename T>
+    [[nodiscard]] List<T> list()
+    {
+        return List<T>(&_resource);
+    }
+
+    [[nodiscard]] std::pmr::vector<std::string_view> names()
+    {
+        return std::pmr::vector<std::string_view>(&_resource);
+    }
+
+    // Copies @p text into the arena.
+    [[nodiscard]] std::string_view store(std::string_view text)
+    {
+        if (text.empty())
+            return {};
+        auto* const data = static_cast<char*>(_resource.allocate(text.size(), 1));
+        std::memcpy(data, text.data(), text.size());
+        return { data, text.size() };
+    }
+
+  private:
+    static constexpr size_t InitialSize = 4096;
+
+    std::pmr::monotonic_buffer_resource _resource { InitialSize };
+};
+
 struct FileDescriptor final: public Node
 {
     int value;
@@ -40,12 +112,6 @@ struct Expr: public Node
 {
 };
 
-// <FILE
-struct InputRedirect final: public Node
-{
-    void accept(Visitor& visitor) const override { visitor.visit(*this); }
-};
-
 // "string that may contain spaces"
 // 'string that may contain spaces'
 // string
@@ -53,32 +119,63 @@ struct InputRedirect final: public Node
 // This is a literal parameter.
 // It is a string.
 // It may be quoted.
+// It refers to the parsed source (see Lexer), until IR generation interns it into the program's constants.
 struct LiteralExpr final: Expr
 {
-    std::string value;
+    std::string_view value;
+
+    explicit LiteralExpr(std::string_view value): value(value) {}
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+using RedirectTarget = std::variant<Ptr<FileDescriptor>, Ptr<LiteralExpr>>;
+
+// <FILE
+// 0<FILE
+// 0<&3
+//
+// This is an input redirect.
+// It is a file descriptor, followed by a target.
+// The target is either a file descriptor or a path.
+// If the target is a file descriptor, then the file descriptor becomes a duplicate of the target.
+// If the target is a path, then the file descriptor is reading from the file at the path.
+// If the source is omitted, then file descriptor 0 is redirected.
+struct InputRedirect final: public Expr
+{
+    Ptr<FileDescriptor> source;
+    RedirectTarget target;
 
-    explicit LiteralExpr(std::string value): value(std::move(value)) {}
+    InputRedirect(Ptr<FileDescriptor> source, RedirectTarget target):
+        source(std::move(source)), target(std::move(target))
+    {
+    }
 
     void accept(Visitor& visitor) const override { visitor.visit(*this); }
 };
 
 // >FILE
 // 1>FILE
+// 1>>FILE
 // 1>&2
+// 2>&-
 //
 // This is an output redirect.
 // It is a file descriptor, followed by a target.
 // The target is either a file descriptor or a path.
 // If the target is a file descriptor, then the output of the file descriptor is redirected to the target.
-// If the target is a path, then the output of the file descriptor is redirected to the file at the path.
+// A target file descriptor of -1 closes the file descriptor instead.
+// If the target is a path, then the output of the file descriptor is redirected to the file at the path,
+// which is either truncated or appended to.
 // If the source is omitted, then the output of file descriptor 1 is redirected.
 struct OutputRedirect final: public Expr
 {
-    std::unique_ptr<FileDescriptor> source;
-    std::variant<std::unique_ptr<FileDescriptor>, std::unique_ptr<LiteralExpr>> target;
+    Ptr<FileDescriptor> source;
+    RedirectTarget target;
+    bool append = false;
 
-    OutputRedirect(std::unique_ptr<FileDescriptor> source, std::unique_ptr<FileDescriptor> target):
-        source(std::move(source)), target(std::move(target))
+    OutputRedirect(Ptr<FileDescriptor> source, RedirectTarget target, bool append = false):
+        source(std::move(source)), target(std::move(target)), append(append)
     {
     }
 
@@ -90,9 +187,21 @@ struct OutputRedirect final: public Expr
 // This is a bashism, but it's useful for endo.
 // It's a way to pass the output of a command as a file (e.g. to a program that expects a file).
 // It is the path to the file descriptor of the command's output, which is a pipe.
+// The command is run concurrently to the program receiving the path, which sees the pipe as @c fd.
 struct CommandFileSubst final: public Expr
 {
-    std::unique_ptr<Node> command;
+    std::reference_wrapper<CoreVM::NativeCallback const> beginCallback;
+    std::reference_wrapper<CoreVM::NativeCallback const> endCallback;
+    Ptr<Node> command;
+    int fd;
+
+    CommandFileSubst(CoreVM::NativeCallback const& beginCallback,
+                     CoreVM::NativeCallback const& endCallback,
+                     Ptr<Node> command,
+                     int fd):
+        beginCallback(beginCallback), endCallback(endCallback), command(std::move(command)), fd(fd)
+    {
+    }
 
     void accept(Visitor& visitor) const override { visitor.visit(*this); }
 };
@@ -104,10 +213,10 @@ struct Statement: public Node
 struct BuiltinExitStmt final: public Statement
 {
     std::reference_wrapper<CoreVM::NativeCallback const> callback;
-    std::unique_ptr<Expr> code;
+    Ptr<Expr> code;
 
     BuiltinExitStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback,
-                    std::unique_ptr<Expr> code):
+                    Ptr<Expr> code):
         callback { callback }, code { std::move(code) }
     {
     }
@@ -118,10 +227,10 @@ struct BuiltinExitStmt final: public Statement
 struct BuiltinExportStmt final: public Statement
 {
     std::reference_wrapper<CoreVM::NativeCallback const> callback;
-    std::string name;
+    std::string_view name;
 
-    BuiltinExportStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback, std::string name):
-        callback { callback }, name { std::move(name) }
+    BuiltinExportStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback, std::string_view name):
+        callback { callback }, name { name }
     {
     }
 
@@ -141,10 +250,22 @@ struct BuiltinFalseStmt final: public Statement
 struct BuiltinReadStmt final: public Statement
 {
     std::reference_wrapper<CoreVM::NativeCallback const> callback;
-    std::vector<std::unique_ptr<Expr>> parameters;
+    List<Expr> parameters;
+
+    BuiltinReadStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback, List<Expr> parameters):
+        callback { callback }, parameters { std::move(parameters) }
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+struct BuiltinHashStmt final: public Statement
+{
+    std::reference_wrapper<CoreVM::NativeCallback const> callback;
+    List<Expr> parameters;
 
-    BuiltinReadStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback,
-                    std::vector<std::unique_ptr<Expr>> parameters = {}):
+    BuiltinHashStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback, List<Expr> parameters):
         callback { callback }, parameters { std::move(parameters) }
     {
     }
@@ -152,15 +273,51 @@ struct BuiltinReadStmt final: public Statement
     void accept(Visitor& visitor) const override { visitor.visit(*this); }
 };
 
+// jobs, fg, bg, wait, parallel
+struct BuiltinJobControlStmt final: public Statement
+{
+    std::string_view name;
+    std::reference_wrapper<CoreVM::NativeCallback const> callback;
+    List<Expr> parameters;
+
+    BuiltinJobControlStmt(std::string_view name,
+                          std::reference_wrapper<CoreVM::NativeCallback const> callback,
+                          List<Expr> parameters):
+        name { name }, callback { callback }, parameters { std::move(parameters) }
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+struct BuiltinTimeStmt final: public Statement
+{
+    std::reference_wrapper<CoreVM::NativeCallback const> callback;
+    std::reference_wrapper<CoreVM::NativeCallback const> reportCallback;
+    Ptr<Statement> command;
+
+    BuiltinTimeStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback,
+                    std::reference_wrapper<CoreVM::NativeCallback const> reportCallback,
+                    Ptr<Statement> command):
+        callback { callback }, reportCallback { reportCallback }, command { std::move(command) }
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// set NAME VALUE
+// let NAME = VALUE
+// let NAME = FUNCTION ARGS...
 struct BuiltinSetStmt final: public Statement
 {
     std::reference_wrapper<CoreVM::NativeCallback const> callback;
-    std::unique_ptr<Expr> name;
-    std::unique_ptr<Expr> value;
+    Ptr<Expr> name;
+    Ptr<Node> value; // an Expr or a FunctionCall
 
     BuiltinSetStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback,
-                   std::unique_ptr<Expr> name,
-                   std::unique_ptr<Expr> value):
+                   Ptr<Expr> name,
+                   Ptr<Node> value):
         callback { callback }, name {std::move( name )}, value { std::move(value) }
     {
     }
@@ -171,10 +328,10 @@ struct BuiltinSetStmt final: public Statement
 struct BuiltinChDirStmt final: public Statement
 {
     std::reference_wrapper<CoreVM::NativeCallback const> callback;
-    std::unique_ptr<Expr> path;
+    Ptr<Expr> path;
 
     BuiltinChDirStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback,
-                     std::unique_ptr<Expr> path):
+                     Ptr<Expr> path):
         callback { callback }, path { std::move(path) }
     {
     }
@@ -183,25 +340,36 @@ struct BuiltinChDirStmt final: public Statement
 };
 
 // /bin/ls -hal
+// FOO=1 BAR=2 /bin/ls -hal
 //
 // This is a program call.
 // It is a path to an executable, followed by arguments.
-// It may also have input and output redirects.
+// It may also have input and output redirects, which are applied in order of appearance.
+// It may be preceded by NAME=VALUE assignments, which are only exported to the program itself.
 struct ProgramCall final: public Statement
 {
-    std::string program;
-    std::vector<std::unique_ptr<Expr>> parameters;
-    std::vector<std::unique_ptr<OutputRedirect>> outputRedirects;
+    std::string_view program; // refers to the parsed source, as LiteralExpr does
+    List<Expr> parameters;
+    List<Expr> redirects; // InputRedirect or OutputRedirect
+    List<Expr> environment; // NAME=VALUE
     std::reference_wrapper<CoreVM::NativeCallback const> callback;
+    CoreVM::NativeCallback const* environmentCallback = nullptr; // required if environment is not empty
+    CoreVM::NativeCallback const* argumentCallback = nullptr;    // required if a parameter is not constant
 
     ProgramCall(CoreVM::NativeCallback const& callback,
-                std::string program,
-                std::vector<std::unique_ptr<Expr>> parameters,
-                std::vector<std::unique_ptr<OutputRedirect>> outputRedirects):
-        program(std::move(program)),
+                std::string_view program,
+                List<Expr> parameters,
+                List<Expr> redirects,
+                List<Expr> environment,
+                CoreVM::NativeCallback const* environmentCallback = nullptr,
+                CoreVM::NativeCallback const* argumentCallback = nullptr):
+        program(program),
         parameters(std::move(parameters)),
-        outputRedirects(std::move(outputRedirects)),
-        callback(callback)
+        redirects(std::move(redirects)),
+        environment(std::move(environment)),
+        callback(callback),
+        environmentCallback(environmentCallback),
+        argumentCallback(argumentCallback)
     {
     }
 
@@ -213,9 +381,108 @@ struct ProgramCall final: public Statement
 //
 // This is a substitution parameter.
 // It is a parameter, because it can be used as an argument to a program call.
+// It evaluates to the output of the command, with trailing newlines removed.
 struct SubstitutionExpr final: public Expr
 {
-    std::unique_ptr<Statement> pipeline;
+    std::reference_wrapper<CoreVM::NativeCallback const> beginCallback;
+    std::reference_wrapper<CoreVM::NativeCallback const> endCallback;
+    Ptr<Statement> pipeline;
+
+    SubstitutionExpr(CoreVM::NativeCallback const& beginCallback,
+                     CoreVM::NativeCallback const& endCallback,
+                     Ptr<Statement> pipeline):
+        beginCallback(beginCallback), endCallback(endCallback), pipeline(std::move(pipeline))
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// $NAME
+// $1
+// $?
+//
+// This is a variable parameter.
+// It evaluates to the variable's value at runtime, or an empty string if unset.
+struct VariableExpr final: public Expr
+{
+    std::reference_wrapper<CoreVM::NativeCallback const> callback;
+    std::string_view name;
+
+    VariableExpr(CoreVM::NativeCallback const& callback, std::string_view name):
+        callback(callback), name(name)
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// $NAME within the body of a function, with NAME being one of the function's parameters
+//
+// This is a parameter of the enclosing function.
+// It evaluates to the respective argument of the function call, as passed on the VM stack.
+struct ParameterExpr final: Expr
+{
+    std::string_view name;
+    size_t index;
+
+    ParameterExpr(std::string_view name, size_t index): name(name), index(index) {}
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// let NAME (PARAM, PARAM...): TYPE =
+//     BODY
+// let NAME PARAM PARAM...: TYPE = STATEMENT
+//
+// This is a function definition.
+// The function is compiled into a handler of its own, that is invoked in-process by FunctionCall.
+// Its parameters are strings and its return type is either str or int (also spelled bool),
+// with the latter being treated as exit code (0 means success) when used as a condition.
+struct FunctionDef final: public Statement
+{
+    std::string_view name;
+    std::pmr::vector<std::string_view> parameters;
+    CoreVM::LiteralType returnType;
+    Ptr<Statement> body;
+
+    FunctionDef(std::string_view name,
+                std::pmr::vector<std::string_view> parameters,
+                CoreVM::LiteralType returnType,
+                Ptr<Statement> body):
+        name(name), parameters(std::move(parameters)), returnType(returnType), body(std::move(body))
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// NAME ARGS...
+//
+// This is a call to a user-defined function (see FunctionDef).
+// It evaluates to the function's return value.
+struct FunctionCall final: public Statement
+{
+    std::string_view name;
+    CoreVM::LiteralType returnType;
+    List<Expr> arguments;
+
+    FunctionCall(std::string_view name, CoreVM::LiteralType returnType, List<Expr> arguments):
+        name(name), returnType(returnType), arguments(std::move(arguments))
+    {
+    }
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// return [VALUE]
+//
+// Returns from the enclosing function, with VALUE converted to the function's return type.
+struct ReturnStmt final: public Statement
+{
+    Ptr<Node> value; // an Expr or a FunctionCall, if any
+
+    explicit ReturnStmt(Ptr<Node> value): value(std::move(value)) {}
 
     void accept(Visitor& visitor) const override { visitor.visit(*this); }
 };
@@ -226,9 +493,28 @@ struct SubstitutionExpr final: public Expr
 // It is a sequence of program calls, separated by pipes.
 struct CallPipeline final: public Statement
 {
-    std::vector<std::unique_ptr<ProgramCall>> calls;
+    List<ProgramCall> calls;
+
+    CallPipeline(List<ProgramCall> calls): calls(std::move(calls)) {}
+
+    void accept(Visitor& visitor) const override { visitor.visit(*this); }
+};
+
+// a | b &
+//
+// Runs the given pipeline as background job.
+struct BackgroundStmt final: public Statement
+{
+    std::reference_wrapper<CoreVM::NativeCallback const> callback;
+    std::reference_wrapper<CoreVM::NativeCallback const> endCallback;
+    Ptr<Statement> command;
 
-    CallPipeline(std::vector<std::unique_ptr<ProgramCall>> calls): calls(std::move(calls)) {}
+    BackgroundStmt(std::reference_wrapper<CoreVM::NativeCallback const> callback,
+                   std::reference_wrapper<CoreVM::NativeCallback const> endCallback,
+                   Ptr<Statement> command):
+        callback { callback }, endCallback { endCallback }, command { std::move(command) }
+    {
+    }
 
     void accept(Visitor& visitor) const override { visitor.visit(*this); }
 };
@@ -239,7 +525,9 @@ struct CallPipeline final: public Statement
 // It is a sequence of statements, separated by semicolons.
 struct CompoundStmt final: public Statement
 {
-    std::vector<std::unique_ptr<Node>> statements;
+    List<Node> statements;
+
+    explicit CompoundStmt(List<Node> statements): statements(std::move(statements)) {}
 
     void accept(Visitor& visitor) const override { visitor.visit(*this); }
 };
@@ -250,13 +538,13 @@ struct CompoundStmt final: public Statement
 // It is a condition, followed by a then block, followed by an optional else block.
 struct IfStmt final: public Statement
 {
-    std::unique_ptr<Statement> condition;
-    std::unique_ptr<Statement> thenBlock;
-    std::unique_ptr<Statement> elseBlock;
+    Ptr<Statement> condition;
+    Ptr<Statement> thenBlock;
+    Ptr<Statement> elseBlock;
 
-    IfStmt(std::unique_ptr<Statement> condition,
-           std::unique_ptr<Statement> thenBlock,
-           std::unique_ptr<Statement> elseBlock):
+    IfStmt(Ptr<Statement> condition,
+           Ptr<Statement> thenBlock,
+           Ptr<Statement> elseBlock):
         condition(std::move(condition)), thenBlock(std::move(thenBlock)), elseBlock(std::move(elseBlock))
     {
     }
@@ -270,10 +558,10 @@ struct IfStmt final: public Statement
 // It is a condition, followed by a body.
 struct WhileStmt final: public Statement
 {
-    std::unique_ptr<Statement> condition;
-    std::unique_ptr<Statement> body;
+    Ptr<Statement> condition;
+    Ptr<Statement> body;
 
-    WhileStmt(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> body):
+    WhileStmt(Ptr<Statement> condition, Ptr<Statement> body):
         condition(std::move(condition)), body(std::move(body))
     {
     }
@@ -27,20 +27,39 @@ export class ASTPrinter: public Visitor
     }
 
     void visit(FileDescriptor const& node) override { _result += fmt::format("{}", node.value); }
-    void visit(InputRedirect const& node) override { crispy::ignore_unused(node); }
-    void visit(OutputRedirect const& node) override
+    void visit(InputRedirect const& node) override
     {
-        if (std::holds_alternative<std::unique_ptr<LiteralExpr>>(node.target))
+        if (std::holds_alternative<Ptr<LiteralExpr>>(node.target))
         {
             _result += fmt::format(
-                " {}>{}", node.source->value, std::get<std::unique_ptr<LiteralExpr>>(node.target)->value);
+                " {}<{}", node.source->value, std::get<Ptr<LiteralExpr>>(node.target)->value);
         }
         else
             _result += fmt::format(
-                " {}>&{}", node.source->value, std::get<std::unique_ptr<FileDescriptor>>(node.target)->value);
+                " {}<&{}", node.source->value, std::get<Ptr<FileDescriptor>>(node.target)->value);
+    }
+    void visit(OutputRedirect const& node) override
+    {
+        if (std::holds_alternative<Ptr<LiteralExpr>>(node.target))
+        {
+            _result += fmt::format(" {}{}{}",
+                                   node.source->value,
+                                   node.append ? ">>" : ">",
+                                   std::get<Ptr<LiteralExpr>>(node.target)->value);
+        }
+        else if (auto const fd = std::get<Ptr<FileDescriptor>>(node.target)->value; fd == -1)
+            _result += fmt::format(" {}>&-", node.source->value);
+        else
+            _result += fmt::format(" {}>&{}", node.source->value, fd);
     }
     void visit(ProgramCall const& node) override
     {
+        for (auto const& assignment: node.environment)
+        {
+            assignment->accept(*this);
+            _result += ' ';
+        }
+
         _result += fmt::format("{}", node.program);
 
         for (auto const& param: node.parameters)
@@ -49,7 +68,7 @@ export class ASTPrinter: public Visitor
             param->accept(*this);
         }
 
-        for (auto const& redirect: node.outputRedirects)
+        for (auto const& redirect: node.redirects)
         {
             redirect->accept(*this);
         }
@@ -64,6 +83,12 @@ export class ASTPrinter: public Visitor
         }
     }
 
+    void visit(BackgroundStmt const& node) override
+    {
+        node.command->accept(*this);
+        _result += " &";
+    }
+
     void visit(BuiltinChDirStmt const& node) override
     {
         _result += "cd";
@@ -99,8 +124,31 @@ export class ASTPrinter: public Visitor
             node.code->accept(*this);
         }
     }
-    void visit(BuiltinExportStmt const& node) override { _result += "export " + node.name; }
+    void visit(BuiltinExportStmt const& node) override { _result += fmt::format("export {}", node.name); }
     void visit(BuiltinFalseStmt const&) override { _result += "false"; }
+    void visit(BuiltinHashStmt const& node) override
+    {
+        _result += "hash";
+        for (auto const& param: node.parameters)
+        {
+            _result += ' ';
+            param->accept(*this);
+        }
+    }
+    void visit(BuiltinJobControlStmt const& node) override
+    {
+        _result += node.name;
+        for (auto const& param: node.parameters)
+        {
+            _result += ' ';
+            param->accept(*this);
+        }
+    }
+    void visit(BuiltinTimeStmt const& node) override
+    {
+        _result += "time ";
+        _result += print(*node.command);
+    }
     void visit(BuiltinReadStmt const& node) override
     {
         _result += "read";
@@ -145,9 +193,52 @@ export class ASTPrinter: public Visitor
         _result += "done";
     }
 
+    void visit(FunctionDef const& node) override
+    {
+        _result += fmt::format("let {}(", node.name);
+        for (size_t i = 0; i < node.parameters.size(); ++i)
+        {
+            if (i != 0)
+                _result += ", ";
+            _result += node.parameters[i];
+        }
+        _result += fmt::format("): {} = ", node.returnType == CoreVM::LiteralType::String ? "str" : "int");
+        node.body->accept(*this);
+    }
+    void visit(FunctionCall const& node) override
+    {
+        _result += node.name;
+        for (auto const& argument: node.arguments)
+        {
+            _result += ' ';
+            argument->accept(*this);
+        }
+    }
+    void visit(ReturnStmt const& node) override
+    {
+        _result += "return";
+        if (node.value)
+        {
+            _result += ' ';
+            node.value->accept(*this);
+        }
+    }
+
     void visit(LiteralExpr const& node) override { _result += fmt::format("{}", node.value); }
-    void visit(SubstitutionExpr const& node) override { crispy::ignore_unused(node); }
-    void visit(CommandFileSubst const& node) override { crispy::ignore_unused(node); }
+    void visit(SubstitutionExpr const& node) override
+    {
+        _result += "$(";
+        node.pipeline->accept(*this);
+        _result += ")";
+    }
+    void visit(VariableExpr const& node) override { _result += fmt::format("${}", node.name); }
+    void visit(ParameterExpr const& node) override { _result += fmt::format("${}", node.name); }
+    void visit(CommandFileSubst const& node) override
+    {
+        _result += "<(";
+        node.command->accept(*this);
+        _result += ")";
+    }
 };
 
 } // namespace endo::ast
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+#include <fmt/format.h>
+
+#include <crispy/logstore.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+import CoreVM;
+
+export module BytecodeCache;
+
+namespace endo
+{
+
+auto inline cacheLog = logstore::category("cache ", "Bytecode cache log", logstore::category::state::Disabled);
+
+// Caches compiled scripts on disk, so that re-running an unchanged script skips
+// lexing, parsing, IR generation, optimization and target code generation altogether.
+//
+// Entries are keyed by a hash of the script's source, the compiler version, the instruction set
+// and the native callbacks of the runtime. They contain the script's constant pool (including all
+// handler code) as created by CoreVM::ConstantPool::serialize(), and are linked against the runtime
+// after loading.
+export class BytecodeCache
+{
+  public:
+    // Must be bumped whenever the same source compiles to different code, invalidating all entries.
+    //
+    // Changes to the instruction set itself (such as added or renumbered opcodes) and to the signatures
+    // of native callbacks invalidate all entries on their own, see instructionSetHash() and
+    // nativeSignaturesHash().
+    static constexpr uint64_t CompilerVersion = 4;
+
+    // Identifies a cache entry.
+    struct Key
+    {
+        uint64_t hash;       // hash of the source, the compiler version, the runtime and the compile options
+        uint64_t sourceSize; // size of the source in bytes
+        uint64_t checksum;   // second hash of the source, guarding against hash collisions
+
+        bool operator==(Key const&) const noexcept = default;
+    };
+
+    struct Statistics
+    {
+        size_t hits = 0;   // number of programs loaded from the cache
+        size_t misses = 0; // number of lookups that found no (valid or linkable) entry
+        size_t stores = 0; // number of entries written
+    };
+
+    explicit BytecodeCache(std::filesystem::path directory): _directory { std::move(directory) } {}
+
+    // Returns $XDG_CACHE_HOME/endo, falling back to $HOME/.cache/endo.
+    [[nodiscard]] static std::filesystem::path defaultDirectory()
+    {
+        if (auto const* cacheHome = std::getenv("XDG_CACHE_HOME"); cacheHome && *cacheHome)
+            return std::filesystem::path(cacheHome) / "endo";
+        if (auto const* home = std::getenv("HOME"); home && *home)
+            return std::filesystem::path(home) / ".cache" / "endo";
+        return std::filesystem::temp_directory_path() / "endo";
+    }
+
+    // Returns the key of @p source, compiled to be linked against @p runtime.
+    [[nodiscard]] static Key keyOf(std::string_view source, bool optimized, CoreVM::Runtime& runtime)
+    {
+        auto const seed = 0xcbf29ce484222325ULL ^ instructionSetHash() ^ nativeSignaturesHash(runtime)
+                          ^ (CompilerVersion << 1) ^ (optimized ? 1 : 0);
+        return Key {
+            .hash = hash(source, seed),
+            .sourceSize = source.size(),
+            .checksum = hash(source, 0x84222325cbf29ce4ULL),
+        };
+    }
+
+    [[nodiscard]] std::filesystem::path const& directory() const noexcept { return _directory; }
+    [[nodiscard]] Statistics const& statistics() const noexcept { return _statistics; }
+
+    // Loads the program cached under @p key, or returns nullptr if there is none.
+    [[nodiscard]] std::unique_ptr<CoreVM::Program> load(Key const& key)
+    {
+        auto const path = entryPath(key);
+
+        int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            ++_statistics.misses;
+            return nullptr;
+        }
+
+        struct stat st {};
+        void* data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(Key))
+            data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            ++_statistics.misses;
+            return nullptr;
+        }
+
+        auto const image = std::string_view(static_cast<char const*>(data), static_cast<size_t>(st.st_size));
+        auto header = Key {};
+        std::memcpy(&header, image.data(), sizeof(header));
+
+        auto constants = std::optional<CoreVM::ConstantPool> {};
+        if (header == key)
+            constants = CoreVM::ConstantPool::deserialize(image.substr(sizeof(Key)));
+        munmap(data, image.size());
+
+        if (!constants)
+        {
+            cacheLog()("Ignoring stale or malformed cache entry {}", path.string());
+            ++_statistics.misses;
+            return nullptr;
+        }
+
+        cacheLog()("Loaded {}", path.string());
+        ++_statistics.hits;
+        return std::make_unique<CoreVM::Program>(std::move(*constants));
+    }
+
+    // Accounts for the program just loaded from under @p key being unusable after all (e.g. as it
+    // failed to link), so that it is compiled again and its entry overwritten.
+    void reject(Key const& key)
+    {
+        cacheLog()("Rejecting cache entry {}", entryPath(key).string());
+        --_statistics.hits;
+        ++_statistics.misses;
+    }
+
+    // Stores the program represented by its @p constants under @p key.
+    //
+    // Failing to write the entry is not an error, the script is just compiled again next time.
+    void store(Key const& key, CoreVM::ConstantPool const& constants)
+    {
+        auto const image = constants.serialize();
+        if (!image)
+            return;
+
+        auto ec = std::error_code {};
+        std::filesystem::create_directories(_directory, ec);
+
+        auto const path = entryPath(key);
+
+        // Written to a temporary file first and then renamed, so that concurrent shells
+        // never observe a partially written entry.
+        auto const temporaryPath = path.string() + fmt::format(".{}", getpid());
+        int const fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            cacheLog()("Failed to create {}: {}", temporaryPath, strerror(errno));
+            return;
+        }
+
+        bool const written = writeAll(fd, &key, sizeof(key)) && writeAll(fd, image->data(), image->size());
+        ::close(fd);
+
+        if (!written || ::rename(temporaryPath.c_str(), path.c_str()) == -1)
+        {
+            cacheLog()("Failed to write {}: {}", path.string(), strerror(errno));
+            ::unlink(temporaryPath.c_str());
+            return;
+        }
+
+        cacheLog()("Stored {} ({} bytes)", path.string(), sizeof(key) + image->size());
+        ++_statistics.stores;
+    }
+
+  private:
+    // Hashes the mnemonics and operand signatures of all opcodes, in the order of their values.
+    static uint64_t instructionSetHash() noexcept
+    {
+        static uint64_t const value = [] {
+            uint64_t result = 0x84222325cbf29ce4ULL;
+            for (size_t i = 0; i < CoreVM::OpcodeCount; ++i)
+            {
+                auto const opcode = static_cast<CoreVM::Opcode>(i);
+                result = hash(CoreVM::mnemonic(opcode), result);
+                result = hash(std::to_string(static_cast<int>(CoreVM::operandSignature(opcode))), result);
+            }
+            return result;
+        }();
+        return value;
+    }
+
+    // Hashes the signatures of all native callbacks of @p runtime, which cached programs link against.
+    static uint64_t nativeSignaturesHash(CoreVM::Runtime& runtime)
+    {
+        auto signatures = std::vector<std::string> {};
+        for (CoreVM::NativeCallback const* callback: runtime.builtins())
+            signatures.push_back(callback->signature().to_s());
+        std::ranges::sort(signatures);
+
+        uint64_t result = 0xcbf29ce484222325ULL;
+        for (auto const& signature: signatures)
+            result = hash(signature, hash("\n", result));
+        return result;
+    }
+
+    // FNV-1a
+    static uint64_t hash(std::string_view data, uint64_t seed) noexcept
+    {
+        uint64_t value = seed;
+        for (char const ch: data)
+        {
+            value ^= static_cast<uint8_t>(ch);
+            value *= 0x100000001b3ULL;
+        }
+        return value;
+    }
+
+    [[nodiscard]] std::filesystem::path entryPath(Key const& key) const
+    {
+        return _directory / fmt::format("{:016x}.endoc", key.hash);
+    }
+
+    static bool writeAll(int fd, void const* data, size_t size) noexcept
+    {
+        auto const* bytes = static_cast<char const*>(data);
+        while (size != 0)
+        {
+            ssize_t const n = ::write(fd, bytes, size);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::filesystem::path _directory;
+    Statistics _statistics;
+};
+
+} // namespace endo
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+#include <fmt/format.h>
+
+#include <crispy/logstore.h>
+#include <crispy/utils.h>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#if defined(__linux__)
+    #include <sys/inotify.h>
+#endif
+
+#include <unistd.h>
+
+import UnixPipe;
+
+export module CommandHash;
+
+namespace endo
+{
+
+auto inline hashLog = logstore::category("hash  ", "Command hash log", logstore::category::state::Disabled);
+
+// Caches the resolved location of programs found via $PATH (like bash's command hash table),
+// so that repeatedly spawning the same program does not walk $PATH over and over again.
+//
+// The cache must be flushed by the owner whenever $PATH changes.
+// It flushes itself whenever one of the watched $PATH directories is modified,
+// i.e. when a program is being installed, removed or renamed. On Linux, the owner's
+// event loop has to call processNotifications() whenever notificationFd() becomes readable,
+// so that lookups served by the cache do not issue any system call.
+//
+// Programs found in relative $PATH entries (such as "." or an empty one) are never cached,
+// as their location depends on the current working directory.
+export class CommandHash
+{
+  public:
+    struct Entry
+    {
+        std::filesystem::path path;
+        size_t hits = 0;
+    };
+
+    struct Statistics
+    {
+        size_t hits = 0;   // number of lookups served by the cache
+        size_t misses = 0; // number of lookups that had to walk $PATH
+        size_t probes = 0; // number of filesystem probes (stat calls) issued while walking $PATH
+    };
+
+    CommandHash()
+    {
+#if defined(__linux__)
+        _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_inotifyFd == -1)
+            hashLog()("inotify_init1 failed: {}", strerror(errno));
+#endif
+    }
+
+    ~CommandHash() { saveClose(&_inotifyFd); }
+
+    CommandHash(CommandHash const&) = delete;
+    CommandHash& operator=(CommandHash const&) = delete;
+    CommandHash(CommandHash&&) = delete;
+    CommandHash& operator=(CommandHash&&) = delete;
+
+    // Returns the file descriptor that becomes readable once a watched directory got modified,
+    // or -1 if there is none.
+    [[nodiscard]] int notificationFd() const noexcept { return _inotifyFd; }
+
+    // Flushes the cache if any of the watched directories got modified since the last call.
+    void processNotifications()
+    {
+#if defined(__linux__)
+        if (drainEvents() && _watching)
+            clear();
+#endif
+    }
+
+    // Resolves @p program against the colon separated directory list @p pathValue.
+    //
+    // Programs containing a slash are never looked up in $PATH nor cached.
+    [[nodiscard]] std::optional<std::filesystem::path> lookup(std::string const& program,
+                                                              std::string_view pathValue)
+    {
+        if (program.find('/') != std::string::npos)
+        {
+            ++_statistics.probes;
+            if (isExecutableFile(program))
+                return std::filesystem::path(program);
+            return std::nullopt;
+        }
+
+#if !defined(__linux__)
+        flushIfDirectoriesChanged();
+#endif
+
+        if (auto i = _entries.find(program); i != _entries.end())
+        {
+            ++_statistics.hits;
+            ++i->second.hits;
+            return i->second.path;
+        }
+
+        ++_statistics.misses;
+
+        if (!_watching)
+            watchDirectories(pathValue);
+
+        for (auto const& directory: crispy::split(pathValue, ':'))
+        {
+            auto programPath = std::filesystem::path(directory.empty() ? "." : directory) / program;
+            ++_statistics.probes;
+            if (isExecutableFile(programPath.c_str()))
+            {
+                if (programPath.is_relative())
+                    return programPath;
+
+                hashLog()("Hashing {} -> {}", program, programPath.string());
+                _entries[program] = Entry { .path = programPath, .hits = 1 };
+                return programPath;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // Removes a single program from the cache, e.g. after it failed to execute.
+    void forget(std::string const& program) { _entries.erase(program); }
+
+    // Flushes all cached entries and stops watching the $PATH directories.
+    void clear()
+    {
+        hashLog()("Flushing command hash ({} entries)", _entries.size());
+        _entries.clear();
+        unwatchDirectories();
+    }
+
+    [[nodiscard]] std::unordered_map<std::string, Entry> const& entries() const noexcept { return _entries; }
+    [[nodiscard]] Statistics const& statistics() const noexcept { return _statistics; }
+
+  private:
+    static bool isExecutableFile(char const* path) noexcept
+    {
+        struct stat st {};
+        return ::stat(path, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+    }
+
+    static bool isExecutableFile(std::string const& path) noexcept { return isExecutableFile(path.c_str()); }
+
+#if defined(__linux__)
+    void watchDirectories(std::string_view pathValue)
+    {
+        _watching = true;
+        if (_inotifyFd == -1)
+            return;
+
+        auto constexpr Mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF
+                              | IN_MOVE_SELF | IN_ONLYDIR;
+
+        for (auto const& directory: crispy::split(pathValue, ':'))
+        {
+            if (!directory.starts_with('/'))
+                continue; // not cached anyway
+
+            auto const path = std::string(directory);
+            int const wd = inotify_add_watch(_inotifyFd, path.c_str(), Mask);
+            if (wd != -1)
+                _watches.push_back(wd);
+        }
+    }
+
+    void unwatchDirectories()
+    {
+        for (int const wd: _watches)
+            inotify_rm_watch(_inotifyFd, wd);
+        _watches.clear();
+        drainEvents();
+        _watching = false;
+    }
+
+    bool drainEvents()
+    {
+        if (_inotifyFd == -1)
+            return false;
+
+        bool changed = false;
+        alignas(inotify_event) char buffer[4096];
+        while (::read(_inotifyFd, buffer, sizeof(buffer)) > 0)
+            changed = true;
+        return changed;
+    }
+#else
+    // Without inotify we fall back to comparing the directories' mtime,
+    // which is rate limited as every check costs one stat per $PATH directory.
+    void watchDirectories(std::string_view pathValue)
+    {
+        _watching = true;
+        _lastCheck = std::chrono::steady_clock::now();
+        for (auto const& directory: crispy::split(pathValue, ':'))
+        {
+            if (!directory.starts_with('/'))
+                continue; // not cached anyway
+
+            auto path = std::string(directory);
+            struct stat st {};
+            auto const mtime = ::stat(path.c_str(), &st) == 0 ? st.st_mtime : time_t {};
+            _watches.emplace_back(std::move(path), mtime);
+        }
+    }
+
+    void unwatchDirectories()
+    {
+        _watches.clear();
+        _watching = false;
+    }
+
+    void flushIfDirectoriesChanged()
+    {
+        auto constexpr CheckInterval = std::chrono::seconds(1);
+
+        auto const now = std::chrono::steady_clock::now();
+        if (!_watching || now - _lastCheck < CheckInterval)
+            return;
+
+        _lastCheck = now;
+        for (auto const& [path, mtime]: _watches)
+        {
+            struct stat st {};
+            if (::stat(path.c_str(), &st) != 0 || st.st_mtime != mtime)
+            {
+                clear();
+                return;
+            }
+        }
+    }
+#endif
+
+    std::unordered_map<std::string, Entry> _entries;
+    Statistics _statistics;
+    bool _watching = false;
+    int _inotifyFd = -1;
+#if defined(__linux__)
+    std::vector<int> _watches;
+#else
+    std::vector<std::pair<std::string, time_t>> _watches;
+    std::chrono::steady_clock::time_point _lastCheck;
+#endif
+};
+
+} // namespace endo
@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+#include <fmt/format.h>
+
+#include <crispy/logstore.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+import UnixPipe;
+
+export module EventLoop;
+
+namespace endo
+{
+
+auto inline eventLog = logstore::category("event ", "Event loop log", logstore::category::state::Disabled);
+using namespace std::string_literals;
+
+// Central event loop of the shell.
+//
+// Child processes are being reaped as soon as they terminate, in whatever order they do,
+// and their exit status and resource usage is handed to the registered handler right away.
+// Each child is being watched through a pidfd, falling back to a signalfd on SIGCHLD
+// on kernels without pidfd support (< 5.3).
+//
+// With job control enabled, children are additionally observed via SIGCHLD,
+// so that stopped and continued children are reported as well.
+//
+// Arbitrary file descriptors can be watched as well, so that the shell can react to
+// other input (e.g. terminal input or redraw requests) while waiting for children.
+export class EventLoop
+{
+  public:
+    using ProcessHandler = std::function<void(pid_t pid, int wstatus, rusage const& usage)>;
+    using FdHandler = std::function<void(int fd)>;
+
+    EventLoop()
+    {
+        _epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epollFd == -1)
+            throw std::runtime_error { "Failed to create epoll instance. "s + strerror(errno) };
+    }
+
+    ~EventLoop()
+    {
+        if (_signalFd != -1)
+        {
+            sigset_t mask {};
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGCHLD);
+            sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+        }
+        for (auto const& [pidfd, _]: _pidfds)
+            ::close(pidfd);
+        saveClose(&_signalFd);
+        saveClose(&_epollFd);
+    }
+
+    EventLoop(EventLoop const&) = delete;
+    EventLoop& operator=(EventLoop const&) = delete;
+    EventLoop(EventLoop&&) = delete;
+    EventLoop& operator=(EventLoop&&) = delete;
+
+    // Enables reporting of stopped and continued children (as needed for job control).
+    void setReportStops(bool enabled)
+    {
+        _reportStops = enabled;
+        if (enabled)
+            ensureSignalFd();
+    }
+
+    [[nodiscard]] bool reportStops() const noexcept { return _reportStops; }
+
+    // Starts watching the child process @p pid and invokes @p handler once it terminated
+    // (and whenever it stopped or continued, if enabled via setReportStops()).
+    void watchProcess(pid_t pid, ProcessHandler handler)
+    {
+        _processes[pid] = std::move(handler);
+
+        int const pidfd = openPidFd(pid);
+        if (pidfd != -1)
+        {
+            _pidfds[pidfd] = pid;
+            addToEpoll(pidfd);
+        }
+        else
+        {
+            eventLog()("pidfd_open({}) failed ({}), falling back to signalfd", pid, strerror(errno));
+            ensureSignalFd();
+            // The child may have terminated before SIGCHLD got blocked.
+            reapExited();
+        }
+    }
+
+    // Starts watching @p fd for readability.
+    //
+    // A @p passive watch is served while waiting for anything else,
+    // but is not something to wait for on its own (e.g. file change notifications).
+    void watchFd(int fd, FdHandler handler, bool passive = false)
+    {
+        _fds[fd] = std::move(handler);
+        if (passive)
+            _passiveFds.insert(fd);
+        addToEpoll(fd);
+    }
+
+    void unwatchFd(int fd)
+    {
+        _passiveFds.erase(fd);
+        if (_fds.erase(fd))
+            epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    [[nodiscard]] bool isWatching(pid_t pid) const noexcept { return _processes.contains(pid); }
+    [[nodiscard]] size_t pendingProcesses() const noexcept { return _processes.size(); }
+
+    // Waits for at most @p timeoutMs milliseconds (-1 for infinity) for events and dispatches them.
+    //
+    // @returns false if there is nothing to wait for, true otherwise.
+    bool runOnce(int timeoutMs = -1)
+    {
+        if (_processes.empty() && _fds.size() == _passiveFds.size())
+            return false;
+
+        epoll_event events[16];
+        int const count = epoll_wait(_epollFd, events, static_cast<int>(std::size(events)), timeoutMs);
+        if (count == -1)
+        {
+            if (errno != EINTR)
+                eventLog()("epoll_wait failed: {}", strerror(errno));
+            return true;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            int const fd = events[i].data.fd;
+            if (fd == _signalFd)
+            {
+                signalfd_siginfo info {};
+                while (::read(_signalFd, &info, sizeof(info)) == sizeof(info))
+                    ;
+                reapExited();
+            }
+            else if (auto const p = _pidfds.find(fd); p != _pidfds.end())
+                reap(p->second);
+            else if (auto const h = _fds.find(fd); h != _fds.end())
+            {
+                // Copy the handler, as it may unwatch itself.
+                auto const handler = h->second;
+                handler(fd);
+            }
+        }
+
+        return true;
+    }
+
+    // Runs the event loop until @p done returns true or there is nothing left to wait for.
+    template <typename Predicate>
+    void runUntil(Predicate done)
+    {
+        while (!done() && runOnce())
+            ;
+    }
+
+  private:
+    static int openPidFd(pid_t pid) noexcept
+    {
+#if defined(SYS_pidfd_open)
+        int const fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+        if (fd != -1)
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+#else
+        (void) pid;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    void addToEpoll(int fd)
+    {
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+            eventLog()("epoll_ctl({}) failed: {}", fd, strerror(errno));
+    }
+
+    void ensureSignalFd()
+    {
+        if (_signalFd != -1)
+            return;
+
+        sigset_t mask {};
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+
+        _signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (_signalFd == -1)
+            throw std::runtime_error { "Failed to create signalfd. "s + strerror(errno) };
+        addToEpoll(_signalFd);
+    }
+
+    // Reaps all watched children whose state changed (signalfd mode).
+    void reapExited()
+    {
+        std::vector<pid_t> pids;
+        for (auto const& [pid, _]: _processes)
+            if (_reportStops || !isPidFdWatched(pid))
+                pids.push_back(pid);
+
+        for (pid_t const pid: pids)
+            reap(pid);
+    }
+
+    [[nodiscard]] bool isPidFdWatched(pid_t pid) const noexcept
+    {
+        for (auto const& [_, watchedPid]: _pidfds)
+            if (watchedPid == pid)
+                return true;
+        return false;
+    }
+
+    void forgetPidFd(pid_t pid)
+    {
+        for (auto i = _pidfds.begin(); i != _pidfds.end(); ++i)
+        {
+            if (i->second == pid)
+            {
+                epoll_ctl(_epollFd, EPOLL_CTL_DEL, i->first, nullptr);
+                ::close(i->first);
+                _pidfds.erase(i);
+                return;
+            }
+        }
+    }
+
+    void reap(pid_t pid)
+    {
+        int const options = WNOHANG | (_reportStops ? WUNTRACED | WCONTINUED : 0);
+
+        int wstatus = 0;
+        rusage usage {};
+        pid_t result = 0;
+        do
+            result = wait4(pid, &wstatus, options, &usage);
+        while (result == -1 && errno == EINTR);
+
+        if (result == 0)
+            return; // no state change
+
+        auto const i = _processes.find(pid);
+        if (i == _processes.end())
+            return;
+
+        if (result != -1 && (WIFSTOPPED(wstatus) || WIFCONTINUED(wstatus)))
+        {
+            eventLog()("PID {} {}", pid, WIFSTOPPED(wstatus) ? "stopped" : "continued");
+            auto const handler = i->second; // keep watching
+            if (handler)
+                handler(pid, wstatus, usage);
+            return;
+        }
+
+        auto const handler = std::move(i->second);
+        _processes.erase(i);
+        forgetPidFd(pid);
+
+        if (result == -1)
+        {
+            eventLog()("wait4({}) failed: {}", pid, strerror(errno));
+            wstatus = 0xFF00; // report as exit code 255
+        }
+
+        eventLog()("Reaped PID {} (status {})", pid, wstatus);
+        if (handler)
+            handler(pid, wstatus, usage);
+    }
+
+    int _epollFd = -1;
+    int _signalFd = -1;
+    bool _reportStops = false;
+    std::unordered_map<pid_t, ProcessHandler> _processes;
+    std::unordered_map<int, pid_t> _pidfds;
+    std::unordered_map<int, FdHandler> _fds;
+    std::unordered_set<int> _passiveFds;
+};
+
+} // namespace endo
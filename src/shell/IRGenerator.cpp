@@ -3,7 +3,10 @@ module;
 #include <shell/AST.h>
 #include <shell/ScopedLogger.h>
 
+#include <cassert>
+#include <string>
 #include <typeinfo>
+#include <variant>
 
 // {{{ trace macros
 // clang-format off
@@ -98,7 +101,7 @@ export class IRGenerator final: public CoreVM::IRBuilder, public ast::Visitor
         {
 
             callArguments.push_back(codegen(node.name.get()));
-            callArguments.push_back(codegen(node.value.get()));
+            callArguments.push_back(convert(codegen(node.value.get()), CoreVM::LiteralType::String));
         }
 
         _result = createCallFunction(getBuiltinFunction(node.callback.get()), callArguments, "set");
@@ -106,6 +109,25 @@ export class IRGenerator final: public CoreVM::IRBuilder, public ast::Visitor
 
     void visit(ast::BuiltinFalseStmt const&) override { _result = get(CoreVM::CoreNumber(1)); }
 
+    void visit(ast::BuiltinHashStmt const& node) override
+    {
+        auto callArguments = std::vector<CoreVM::Value*> {};
+        if (!node.parameters.empty())
+            callArguments.emplace_back(get(createCallArgs(node.parameters)));
+
+        _result = createCallFunction(getBuiltinFunction(node.callback.get()), callArguments, "hash");
+    }
+
+    void visit(ast::BuiltinJobControlStmt const& node) override
+    {
+        auto callArguments = std::vector<CoreVM::Value*> {};
+        if (!node.parameters.empty())
+            callArguments.emplace_back(get(createCallArgs(node.parameters)));
+
+        _result =
+            createCallFunction(getBuiltinFunction(node.callback.get()), callArguments, std::string(node.name));
+    }
+
     void visit(ast::BuiltinReadStmt const& node) override
     {
         auto callArguments = std::vector<CoreVM::Value*> {};
@@ -115,6 +137,13 @@ export class IRGenerator final: public CoreVM::IRBuilder, public ast::Visitor
         _result = createCallFunction(getBuiltinFunction(node.callback.get()), callArguments, "read");
     }
 
+    void visit(ast::BuiltinTimeStmt const& node) override
+    {
+        createCallFunction(getBuiltinFunction(node.callback.get()), {}, "time");
+        codegen(node.command.get());
+        _result = createCallFunction(getBuiltinFunction(node.reportCallback.get()), {}, "time.report");
+    }
+
     void visit(ast::BuiltinTrueStmt const&) override { _result = get(CoreVM::CoreNumber(0)); }
 
     void visit(ast::CallPipeline const& node) override
@@ -130,19 +159,38 @@ export class IRGenerator final: public CoreVM::IRBuilder, public ast::Visitor
 
         for (size_t i = 0; i < node.calls.size(); ++i)
         {
-            std::unique_ptr<ast::ProgramCall> const& call = node.calls[i];
+            ast::Ptr<ast::ProgramCall> const& call = node.calls[i];
             bool const lastInChain = i == node.calls.size() - 1;
+            auto programArguments = createProgramArgs(*call);
             std::vector<CoreVM::Value*> callArguments {};
             callArguments.push_back(get(lastInChain));
-            callArguments.push_back(get(createCallArgs(call->program, call->parameters)));
+            callArguments.push_back(get(programArguments.constant));
+            if (!call->redirects.empty())
+                callArguments.push_back(get(createRedirects(call->redirects)));
+            stageArguments(*call, programArguments.staged);
+            createEnvironmentOverrides(*call);
             _result =
                 createCallFunction(getBuiltinFunction(call->callback.get()), callArguments, "callProcess");
         }
     }
 
-    void visit(ast::CommandFileSubst const&) override
+    void visit(ast::BackgroundStmt const& node) override
+    {
+        createCallFunction(getBuiltinFunction(node.callback.get()), {}, "background");
+        codegen(node.command.get());
+        createCallFunction(getBuiltinFunction(node.endCallback.get()), {}, "background.end");
+    }
+
+    // Runs the command concurrently, with its output connected to the next program call's file
+    // descriptor node.fd, and evaluates to the path of that file descriptor.
+    void visit(ast::CommandFileSubst const& node) override
     {
-        // TODO
+        createCallFunction(getBuiltinFunction(node.beginCallback.get()), {}, "subst.begin");
+        codegen(node.command.get());
+        createCallFunction(getBuiltinFunction(node.endCallback.get()),
+                           { get(CoreVM::CoreNumber { node.fd }) },
+                           "subst.end");
+        _result = get(fmt::format("/dev/fd/{}", node.fd));
     }
     void visit(ast::CompoundStmt const& node) override
     {
@@ -174,45 +222,48 @@ export class IRGenerator final: public CoreVM::IRBuilder, public ast::Visitor
         createBr(end);
 
         setInsertPoint(end);
+        _result = nullptr;
     }
 
-    void visit(ast::InputRedirect const&) override
+    // Redirects are lowered into the redirect table (see createRedirects()).
+    void visit(ast::InputRedirect const& node) override
     {
-        // TODO
+        appendRedirect(node.source->value, "<", "<&", node.target);
     }
     void visit(ast::LiteralExpr const& node) override { _result = get(node.value); }
 
-    void visit(ast::OutputRedirect const&) override
+    void visit(ast::OutputRedirect const& node) override
     {
-        // TODO
+        appendRedirect(node.source->value, node.append ? ">>" : ">", ">&", node.target);
     }
     void visit(ast::ProgramCall const& node) override
     {
         TRACE_SCOPE("ProgramCall");
 
-        // auto redirectsArg = std::vector<CoreVM::Constant*> {};
-        // redirectsArg.push_back(get(STDOUT_FILENO));
-        // redirectsArg.push_back(get(STDERR_FILENO));
-        // for (auto const& redirect: node.outputRedirects)
-        // {
-        //     auto* value = codegen(redirect.target.get());
-        //     if (auto* constant = dynamic_cast<CoreVM::Constant*>(value); constant != nullptr)
-        //         redirectsArg.push_back(constant);
-        //     else
-        //         fmt::print("Warning: non-constant argument passed to program call\n");
-        // }
-
+        auto programArguments = createProgramArgs(node);
         auto callArguments = std::vector<CoreVM::Value*> {};
-        callArguments.push_back(get(createCallArgs(node.program, node.parameters)));
-        // callArguments.push_back(get(redirectsArg));
+        callArguments.push_back(get(programArguments.constant));
+        if (!node.redirects.empty())
+            callArguments.push_back(get(createRedirects(node.redirects)));
+        // Staged after evaluating the arguments, as these may spawn processes on their own.
+        stageArguments(node, programArguments.staged);
+        createEnvironmentOverrides(node);
 
         _result = createCallFunction(getBuiltinFunction(node.callback.get()), callArguments, "callProcess");
     }
 
-    void visit(ast::SubstitutionExpr const&) override
+    void visit(ast::SubstitutionExpr const& node) override
+    {
+        createCallFunction(getBuiltinFunction(node.beginCallback.get()), {}, "capture.begin");
+        codegen(node.pipeline.get());
+        _result = createCallFunction(getBuiltinFunction(node.endCallback.get()), {}, "capture.end");
+    }
+
+    void visit(ast::VariableExpr const& node) override
     {
-        // TODO
+        _result = createCallFunction(getBuiltinFunction(node.callback.get()), { get(node.name) }, "variable");
     }
+
     void visit(ast::WhileStmt const& node) override
     {
         CoreVM::BasicBlock* cond = createBlock("while.cond");
@@ -229,40 +280,187 @@ export class IRGenerator final: public CoreVM::IRBuilder, public ast::Visitor
         createBr(cond);
 
         setInsertPoint(end);
+        _result = nullptr;
     }
 
-    CoreVM::Value* toBool(CoreVM::Value* value) { return createNCmpEQ(value, get(CoreVM::CoreNumber(0))); }
+    // Compiles the function into a handler of its own, receiving its parameters as handler arguments.
+    void visit(ast::FunctionDef const& node) override
+    {
+        CoreVM::IRHandler* const outerHandler = handler();
+        CoreVM::BasicBlock* const outerInsertPoint = getInsertPoint();
+        CoreVM::IRHandler* const outerFunction = _function;
+
+        CoreVM::IRHandler* function = getHandler(std::string(node.name));
+        function->setReturnType(node.returnType);
+        for (auto const& parameter: node.parameters)
+            function->addArgument(CoreVM::LiteralType::String, std::string(parameter));
+
+        setHandler(function);
+        setInsertPoint(createBlock("EntryPoint"));
+        _function = function;
+
+        // The value of a single statement body is returned implicitly.
+        CoreVM::Value* result = codegen(node.body.get());
+        createRet(convert(result, node.returnType));
+
+        _function = outerFunction;
+        setHandler(outerHandler);
+        setInsertPoint(outerInsertPoint);
+        _result = nullptr;
+    }
 
-    static std::vector<CoreVM::Constant*> createArray(std::vector<std::unique_ptr<ast::Expr>> const& expressions)
+    void visit(ast::FunctionCall const& node) override
+    {
+        CoreVM::IRHandler* callee = getHandler(std::string(node.name));
+        if (!callee->isFunction())
+            callee->setReturnType(node.returnType); // defined by a previous input
+
+        auto arguments = std::vector<CoreVM::Value*> {};
+        for (auto const& argument: node.arguments)
+            arguments.push_back(convert(codegen(argument.get()), CoreVM::LiteralType::String));
+
+        _result = createInvoke(callee, std::move(arguments), std::string(node.name));
+    }
+
+    void visit(ast::ParameterExpr const& node) override { _result = _function->argument(node.index); }
+
+    void visit(ast::ReturnStmt const& node) override
+    {
+        assert(_function != nullptr);
+        createRet(convert(codegen(node.value.get()), _function->returnType()));
+
+        // Anything following the return statement is unreachable.
+        setInsertPoint(createBlock("return.unreachable"));
+        _result = nullptr;
+    }
+
+    // Converts @p value to @p type, with a missing value being the type's default (0 or "").
+    CoreVM::Value* convert(CoreVM::Value* value, CoreVM::LiteralType type)
+    {
+        if (value && value->type() == type)
+            return value;
+
+        if (type == CoreVM::LiteralType::String)
+        {
+            if (value && value->type() == CoreVM::LiteralType::Number)
+                return createN2S(value);
+            return get(std::string {});
+        }
+
+        if (value && value->type() == CoreVM::LiteralType::String)
+            return createS2N(value);
+        return get(CoreVM::CoreNumber(0));
+    }
+
+    CoreVM::Value* toBool(CoreVM::Value* value)
+    {
+        return createNCmpEQ(convert(value, CoreVM::LiteralType::Number), get(CoreVM::CoreNumber(0)));
+    }
+
+    std::vector<CoreVM::Constant*> createArray(ast::List<ast::Expr> const& expressions)
     {
         auto irArray = std::vector<CoreVM::Constant*> {};
         for (auto const& expr: expressions)
         {
             TRACE_SCOPE(fmt::format("Parameter: ", ast::ASTPrinter::print(*expr)));
-            if (auto* constant = dynamic_cast<CoreVM::Constant*>(expr.get()); constant != nullptr)
+            if (auto* constant = dynamic_cast<CoreVM::Constant*>(codegen(expr.get())); constant != nullptr)
                 irArray.push_back(constant);
             else
-                assert(!"TODO");
+                assert(!"Arrays cannot be built at runtime, so the parser rejects computed elements");
         }
         return irArray;
     }
 
-    std::vector<CoreVM::Constant*> createCallArgs(std::vector<std::unique_ptr<ast::Expr>> const& args)
+    std::vector<CoreVM::Constant*> createCallArgs(ast::List<ast::Expr> const& args)
     {
         TRACE_SCOPE("createCallArgs");
-        return IRGenerator::createArray(args);
+        return createArray(args);
     }
 
-    std::vector<CoreVM::Constant*> createCallArgs(std::string const& programName,
-                                                  std::vector<std::unique_ptr<ast::Expr>> const& args)
+    struct ProgramArguments
     {
-        TRACE_SCOPE("createCallArgs");
-        auto callArguments = IRGenerator::createArray(args);
-        callArguments.insert(callArguments.begin(), get(programName));
-        return callArguments;
+        std::vector<CoreVM::Constant*> constant; // program name and leading constant arguments
+        std::vector<CoreVM::Value*> staged;      // all arguments from the first non-constant one on
+    };
+
+    // Evaluates the program name and arguments of a program call.
+    //
+    // Arrays cannot be built at runtime, so only the leading constant arguments are passed as
+    // constant array, whereas the remaining ones (e.g. command substitutions) are to be staged
+    // one by one right before the call (see stageArguments()).
+    ProgramArguments createProgramArgs(ast::ProgramCall const& node)
+    {
+        TRACE_SCOPE("createProgramArgs");
+        auto result = ProgramArguments {};
+        result.constant.push_back(get(node.program));
+        for (auto const& parameter: node.parameters)
+        {
+            CoreVM::Value* value = codegen(parameter.get());
+            auto* constant = dynamic_cast<CoreVM::Constant*>(value);
+            if (constant != nullptr && result.staged.empty())
+                result.constant.push_back(constant);
+            else
+                result.staged.push_back(value);
+        }
+        return result;
+    }
+
+    void stageArguments(ast::ProgramCall const& node, std::vector<CoreVM::Value*> const& values)
+    {
+        for (CoreVM::Value* value: values)
+            createCallFunction(getBuiltinFunction(*node.argumentCallback), { value }, "argument");
+    }
+
+    // Stages the NAME=VALUE assignments preceding a program call, to be exported to that program only.
+    void createEnvironmentOverrides(ast::ProgramCall const& node)
+    {
+        if (node.environment.empty())
+            return;
+
+        assert(node.environmentCallback != nullptr);
+        createCallFunction(getBuiltinFunction(*node.environmentCallback),
+                           { get(createArray(node.environment)) },
+                           "environment");
+    }
+
+    // Builds the redirect table of a program call, a flat string array of
+    // (file descriptor, operator, target) triples in order of appearance,
+    // with operator being one of "<", ">", ">>", "<&", ">&" and a target of "-" closing the descriptor.
+    std::vector<CoreVM::Constant*> createRedirects(ast::List<ast::Expr> const& redirects)
+    {
+        TRACE_SCOPE("createRedirects");
+        auto table = std::vector<CoreVM::Constant*> {};
+        _redirects = &table;
+        for (auto const& redirect: redirects)
+            redirect->accept(*this);
+        _redirects = nullptr;
+        return table;
+    }
+
+    void appendRedirect(int fd,
+                        std::string const& fileOperator,
+                        std::string const& dupOperator,
+                        ast::RedirectTarget const& target)
+    {
+        assert(_redirects != nullptr);
+        _redirects->push_back(get(std::to_string(fd)));
+        if (auto const* path = std::get_if<ast::Ptr<ast::LiteralExpr>>(&target))
+        {
+            _redirects->push_back(get(fileOperator));
+            _redirects->push_back(get((*path)->value));
+        }
+        else
+        {
+            auto const targetFd = std::get<ast::Ptr<ast::FileDescriptor>>(target)->value;
+            _redirects->push_back(get(dupOperator));
+            _redirects->push_back(get(targetFd == -1 ? std::string("-") : std::to_string(targetFd)));
+        }
+        _result = nullptr;
     }
 
     CoreVM::Value* _result = nullptr;
+    CoreVM::IRHandler* _function = nullptr; // function being generated, if any
+    std::vector<CoreVM::Constant*>* _redirects = nullptr;
     // CoreVM::NativeCallback _processCallCallback;
     // CoreVM::IRBuiltinFunction* _processCallFunction = nullptr;
     CoreVM::Signature _processCallSignature;
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+
+#include <shell/AST.h>
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+import Lexer;
+import Parser;
+import CoreVM;
+
+export module IncrementalParser;
+
+namespace endo
+{
+
+// Keeps a buffer that is being edited (e.g. the prompt's input) parsed into its top-level statements,
+// for syntax highlighting and error marking as the user types.
+//
+// After an edit, only the statements touching the edited range are lexed and parsed again,
+// all others (along with their AST) are reused as they are. Thus the work per keystroke is
+// proportional to the edited statements rather than to the whole buffer, apart from shifting
+// the offsets of the statements following the edit.
+//
+// The re-parsed range is widened as long as its statements would not end where the following
+// (reused) statement starts, e.g. after opening an 'if' whose 'fi' is further down, or after
+// changing a function definition that later statements may be calling.
+//
+// Unlike Parser::parse(), parsing resumes on the next line after a statement failed to parse,
+// so that each statement carries its own syntax errors.
+export class IncrementalParser
+{
+  private:
+    // A parser along with its source (a copy of the re-parsed part of the buffer) and its diagnostics,
+    // which all statements parsed by it share, as their AST refers to them.
+    struct Session
+    {
+        FunctionTable functions; // functions defined before the parsed part of the buffer
+        CoreVM::diagnostics::BufferedReport report;
+        Parser parser;
+
+        Session(CoreVM::Runtime& runtime, std::string text, FunctionTable knownFunctions):
+            functions { std::move(knownFunctions) },
+            parser { runtime, report, std::make_unique<StringSource>(std::move(text)), &functions }
+        {
+        }
+    };
+
+  public:
+    // A top-level statement of the buffer.
+    //
+    // It spans from its first token up to the next statement's first token (or the end of the buffer).
+    struct Statement
+    {
+        size_t begin;                           // offset of the statement's first token within the buffer
+        ast::Statement const* node = nullptr;   // nullptr if the statement has syntax errors
+        std::vector<std::string> errors;        // syntax errors of this statement
+        std::shared_ptr<Session const> session; // owner of the AST
+    };
+
+    struct Statistics
+    {
+        size_t reparsedBytes = 0;    // number of bytes lexed and parsed by the last update
+        size_t reusedStatements = 0; // number of statements kept as they were by the last update
+    };
+
+    // @param functions functions defined by previously parsed sources, that may be called from this one.
+    explicit IncrementalParser(CoreVM::Runtime& runtime, FunctionTable const* functions = nullptr):
+        _runtime { runtime }, _functions { functions }
+    {
+    }
+
+    // Replaces the whole buffer, parsing it from scratch.
+    void assign(std::string text)
+    {
+        _text = std::move(text);
+        _statistics = {};
+        _statements = parseRegion(0, _text.size(), functionsBefore(0)).statements;
+    }
+
+    // Replaces the @p removed bytes at @p offset with @p inserted.
+    void edit(size_t offset, size_t removed, std::string_view inserted)
+    {
+        assert(offset + removed <= _text.size());
+        _statistics = {};
+
+        if (_statements.empty())
+        {
+            _text.replace(offset, removed, inserted);
+            _statements = parseRegion(0, _text.size(), functionsBefore(0)).statements;
+            return;
+        }
+
+        // An edit right in front of a statement may as well continue the previous one,
+        // e.g. by indenting a line following a function definition.
+        auto first = statementAt(offset);
+        if (first != 0 && _statements[first].begin == offset)
+            --first;
+        auto last = std::max(first, statementAt(removed == 0 ? offset : offset + removed - 1));
+
+        // Re-parsing starts at the beginning of a line, as the lexer tracks the indentation of lines.
+        while (first != 0 && !startsLine(_statements[first].begin))
+            --first;
+        auto const begin = first == 0 ? 0 : lineStartOf(_statements[first].begin);
+
+        _text.replace(offset, removed, inserted);
+
+        // Maps offsets behind the edited range to the edited buffer.
+        auto const shift = [&](size_t oldOffset) { return oldOffset + inserted.size() - removed; };
+        auto const endOf = [&](size_t index) {
+            return index + 1 < _statements.size() ? shift(_statements[index + 1].begin) : _text.size();
+        };
+
+        auto const functions = functionsBefore(first);
+        auto region = parseRegion(begin, endOf(last), functions);
+        while (last + 1 < _statements.size())
+        {
+            if (!region.complete)
+                last = std::min(_statements.size() - 1, last + (last - first + 1));
+            else if (defineSameFunctions(std::span(_statements).subspan(first, last - first + 1),
+                                         region.statements))
+                break;
+            else
+                last = _statements.size() - 1; // any following statement may be calling the changed functions
+            region = parseRegion(begin, endOf(last), functions);
+        }
+
+        for (auto i = last + 1; i < _statements.size(); ++i)
+            _statements[i].begin = shift(_statements[i].begin);
+        _statistics.reusedStatements = _statements.size() - (last - first + 1);
+
+        auto const at = _statements.erase(_statements.begin() + static_cast<ptrdiff_t>(first),
+                                          _statements.begin() + static_cast<ptrdiff_t>(last + 1));
+        _statements.insert(at,
+                           std::make_move_iterator(region.statements.begin()),
+                           std::make_move_iterator(region.statements.end()));
+    }
+
+    [[nodiscard]] std::string const& text() const noexcept { return _text; }
+    [[nodiscard]] std::vector<Statement> const& statements() const noexcept { return _statements; }
+    [[nodiscard]] Statistics const& statistics() const noexcept { return _statistics; }
+
+    // Returns the index of the statement spanning @p offset (the first one, if @p offset precedes it).
+    [[nodiscard]] size_t statementAt(size_t offset) const noexcept
+    {
+        auto const i = std::upper_bound(_statements.begin(),
+                                        _statements.end(),
+                                        offset,
+                                        [](size_t value, Statement const& s) { return value < s.begin; });
+        return i == _statements.begin() ? 0 : static_cast<size_t>(std::distance(_statements.begin(), i)) - 1;
+    }
+
+    [[nodiscard]] bool hasErrors() const noexcept
+    {
+        return std::any_of(
+            _statements.begin(), _statements.end(), [](Statement const& s) { return !s.errors.empty(); });
+    }
+
+  private:
+    struct Region
+    {
+        std::vector<Statement> statements;
+        bool complete = true; // whether the statements end where the region ends
+    };
+
+    // Parses the statements within [@p begin, @p end) of the buffer.
+    Region parseRegion(size_t begin, size_t end, FunctionTable const& functions)
+    {
+        auto region = Region {};
+        auto knownFunctions = functions;
+        bool truncated = false; // whether the last statement ran into the end of the region
+        _statistics.reparsedBytes += end - begin;
+
+        while (begin < end)
+        {
+            auto session =
+                std::make_shared<Session>(_runtime, _text.substr(begin, end - begin), knownFunctions);
+            bool failed = false;
+            while (!failed)
+            {
+                auto const errorCount = session->report.size();
+                auto next = session->parser.parseNext();
+                if (!next)
+                    break;
+
+                auto statement = Statement { .begin = begin + next->offset,
+                                             .node = next->statement.release(), // owned by the session
+                                             .errors = {},
+                                             .session = session };
+                for (size_t i = errorCount; i < session->report.size(); ++i)
+                    statement.errors.emplace_back(session->report[i].text);
+                failed = statement.node == nullptr;
+                // e.g. an 'if' being typed yields a node lacking its condition, which no consumer expects
+                if (!statement.errors.empty())
+                    statement.node = nullptr;
+                truncated = !statement.errors.empty() && session->parser.atEndOfInput();
+                region.statements.emplace_back(std::move(statement));
+            }
+            if (!failed)
+                break;
+
+            // Resumes on the line following the failed statement.
+            for (auto const& [name, signature]: session->parser.definedFunctions())
+                knownFunctions.insert_or_assign(name, signature);
+            auto const lineFeed = _text.find('\n', begin + session->parser.currentOffset());
+            begin = lineFeed < end ? lineFeed + 1 : end;
+        }
+
+        region.complete = end == _text.size()
+                          || (!truncated && endsStatement(end) && !continuesFunctionBody(region, end));
+        return region;
+    }
+
+    // Whether the text in front of @p offset terminates a statement.
+    [[nodiscard]] bool endsStatement(size_t offset) const noexcept
+    {
+        auto const i = offset == 0 ? std::string::npos : _text.find_last_not_of(" \t", offset - 1);
+        return i != std::string::npos && (_text[i] == '\n' || _text[i] == ';' || _text[i] == '&');
+    }
+
+    // Whether the statement at @p offset would be part of the body of a function defined last in @p region,
+    // as function bodies span all following lines indented deeper than the function's definition.
+    [[nodiscard]] bool continuesFunctionBody(Region const& region, size_t offset) const noexcept
+    {
+        if (region.statements.empty())
+            return false;
+        auto const& last = region.statements.back();
+        return dynamic_cast<ast::FunctionDef const*>(last.node) != nullptr
+               && indentationAt(offset) > indentationAt(last.begin);
+    }
+
+    [[nodiscard]] size_t lineStartOf(size_t offset) const noexcept
+    {
+        auto const lineFeed = offset == 0 ? std::string::npos : _text.rfind('\n', offset - 1);
+        return lineFeed == std::string::npos ? 0 : lineFeed + 1;
+    }
+
+    // Whether the token at @p offset is the first one of its line.
+    [[nodiscard]] bool startsLine(size_t offset) const noexcept
+    {
+        return _text.find_first_not_of(" \t", lineStartOf(offset)) == offset;
+    }
+
+    // Number of blanks the line containing @p offset is indented by.
+    [[nodiscard]] size_t indentationAt(size_t offset) const noexcept
+    {
+        auto const lineStart = lineStartOf(offset);
+        auto const indentEnd = _text.find_first_not_of(" \t", lineStart);
+        return (indentEnd == std::string::npos ? _text.size() : indentEnd) - lineStart;
+    }
+
+    // Returns the functions callable from the statement at @p index.
+    [[nodiscard]] FunctionTable functionsBefore(size_t index) const
+    {
+        auto functions = _functions ? *_functions : FunctionTable {};
+        for (auto const& statement: std::span(_statements).first(std::min(index, _statements.size())))
+            if (auto const* function = dynamic_cast<ast::FunctionDef const*>(statement.node))
+                functions.insert_or_assign(
+                    std::string(function->name),
+                    FunctionSignature { .parameterCount = function->parameters.size(),
+                                        .returnType = function->returnType });
+        return functions;
+    }
+
+    // Whether both statement ranges define the same functions with the same signatures.
+    [[nodiscard]] static bool defineSameFunctions(std::span<Statement const> a, std::span<Statement const> b)
+    {
+        auto const functionsOf = [](std::span<Statement const> statements) {
+            auto functions = std::vector<ast::FunctionDef const*> {};
+            for (auto const& statement: statements)
+                if (auto const* function = dynamic_cast<ast::FunctionDef const*>(statement.node))
+                    functions.push_back(function);
+            return functions;
+        };
+        return std::ranges::equal(
+            functionsOf(a), functionsOf(b), [](ast::FunctionDef const* x, ast::FunctionDef const* y) {
+                return x->name == y->name && x->parameters.size() == y->parameters.size()
+                       && x->returnType == y->returnType;
+            });
+    }
+
+    CoreVM::Runtime& _runtime;       // NOLINT(cppcoreguidelines-avoid-const-or-ref-data-members)
+    FunctionTable const* _functions; // functions defined by previous sources
+    std::string _text;               // the buffer being edited
+    std::vector<Statement> _statements;
+    Statistics _statistics;
+};
+
+} // namespace endo
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <shell/AST.h>
+
+#include <fmt/format.h>
+
+#include <catch2/catch.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+import ASTPrinter;
+import IncrementalParser;
+import Shell;
+import TTY;
+
+namespace
+{
+
+struct TestRuntime
+{
+    endo::TestPTY pty;
+    endo::TestEnvironment env;
+    endo::Shell shell { pty, env };
+};
+
+// Renders the parsed statements, so that incrementally and freshly parsed buffers can be compared.
+std::vector<std::string> render(endo::IncrementalParser const& parser)
+{
+    auto result = std::vector<std::string> {};
+    for (auto const& statement: parser.statements())
+        result.emplace_back(fmt::format("{}: {} ({} errors)",
+                                        statement.begin,
+                                        statement.node ? endo::ast::ASTPrinter::print(*statement.node) : "-",
+                                        statement.errors.size()));
+    return result;
+}
+
+std::vector<std::string> parseFromScratch(endo::Shell& shell, std::string const& text)
+{
+    auto parser = endo::IncrementalParser(shell);
+    parser.assign(text);
+    return render(parser);
+}
+
+} // namespace
+
+TEST_CASE("IncrementalParser.reuses_unchanged_statements")
+{
+    auto runtime = TestRuntime {};
+    auto text = std::string {};
+    for (int i = 0; i < 100; ++i)
+        text += fmt::format("echo line {}\n", i);
+
+    auto parser = endo::IncrementalParser(runtime.shell);
+    parser.assign(text);
+    REQUIRE(parser.statements().size() == 100);
+    auto const before = parser.statements();
+
+    auto const offset = text.find("line 50");
+    parser.edit(offset, 4, "word");
+
+    REQUIRE(parser.statements().size() == 100);
+    CHECK(parser.statistics().reusedStatements >= 98);
+    CHECK(parser.statistics().reparsedBytes < 3 * std::string_view("echo line 50\n").size());
+    CHECK(parser.statements()[10].node == before[10].node);
+    CHECK(parser.statements()[90].node == before[90].node);
+    CHECK(parser.statements()[50].node != before[50].node);
+    CHECK(parser.text().substr(offset, 7) == "word 50");
+    CHECK(render(parser) == parseFromScratch(runtime.shell, parser.text()));
+}
+
+TEST_CASE("IncrementalParser.matches_full_parse")
+{
+    struct Edit
+    {
+        std::string_view find; // the edit takes place at the first occurrence
+        size_t removed;
+        std::string_view inserted;
+    };
+
+    auto const edits = std::vector<Edit> {
+        { "echo b", 0, "if true; then\n" },   // opens an 'if' spanning the following statements
+        { "echo d", 0, "fi\n" },              // closes it again
+        { "echo c", 6, "" },                  // removes a statement within the 'if'
+        { "\necho e", 1, "" },                // joins two lines
+        { "echo e", 0, "\n" },                // splits them again
+        { "echo f", 0, "let f =\n    echo" }, // defines a function, whose body continues on the next line
+        { "echo g", 0, "    " },              // indents a line following the function
+        { "if", 2, "iff" },                   // turns the 'if' into a program call
+    };
+
+    auto runtime = TestRuntime {};
+    auto parser = endo::IncrementalParser(runtime.shell);
+    parser.assign("echo a\necho b\necho c\necho d\necho e\n echo f\necho g\necho h\n");
+
+    for (auto const& edit: edits)
+    {
+        auto const offset = parser.text().find(edit.find);
+        REQUIRE(offset != std::string::npos);
+        parser.edit(offset, edit.removed, edit.inserted);
+        INFO(parser.text());
+        CHECK(render(parser) == parseFromScratch(runtime.shell, parser.text()));
+    }
+}
+
+TEST_CASE("IncrementalParser.errors")
+{
+    auto runtime = TestRuntime {};
+    auto parser = endo::IncrementalParser(runtime.shell);
+    parser.assign("echo a\necho b\necho c\n");
+    CHECK_FALSE(parser.hasErrors());
+
+    // Each statement carries its own errors, and parsing resumes after a failed statement.
+    parser.edit(parser.text().find("echo b"), 0, "fi\n");
+    REQUIRE(parser.statements().size() == 4);
+    CHECK(parser.statements()[1].node == nullptr);
+    CHECK(parser.statements()[1].errors.size() == 1);
+    CHECK(parser.statements()[2].errors.empty());
+    CHECK(parser.hasErrors());
+
+    parser.edit(parser.text().find("fi\n"), 3, "");
+    CHECK(parser.statements().size() == 3);
+    CHECK_FALSE(parser.hasErrors());
+}
+
+TEST_CASE("IncrementalParser.oversized_file_descriptor")
+{
+    // Typing a file descriptor too large to be one, digit by digit, is a syntax error of its statement.
+    auto runtime = TestRuntime {};
+    auto parser = endo::IncrementalParser(runtime.shell);
+    parser.assign("echo a\necho b >x\necho c\n");
+    auto const offset = parser.text().find(">x");
+    for (size_t i = 0; i < 11; ++i)
+        parser.edit(offset + i, 0, "9");
+
+    CHECK(parser.text() == "echo a\necho b 99999999999>x\necho c\n");
+    REQUIRE(parser.statements().size() == 3);
+    CHECK(parser.statements()[1].node == nullptr);
+    CHECK(parser.statements()[1].errors.size() == 1);
+    CHECK(parser.statements()[2].errors.empty());
+    CHECK(render(parser) == parseFromScratch(runtime.shell, parser.text()));
+}
+
+TEST_CASE("IncrementalParser.typing_compound_statements")
+{
+    // Statements being typed lack e.g. their condition, so erroneous ones must not expose any node.
+    for (std::string_view const text:
+         { "if true; then echo a; fi\n", "while false\ndo echo a\ndone\n", "while\ndo\ndone\n" })
+    {
+        auto runtime = TestRuntime {};
+        auto parser = endo::IncrementalParser(runtime.shell);
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            parser.edit(i, 0, text.substr(i, 1));
+            INFO(parser.text());
+            for (auto const& statement: parser.statements())
+                CHECK((statement.errors.empty() || statement.node == nullptr));
+            CHECK(render(parser) == parseFromScratch(runtime.shell, parser.text()));
+        }
+    }
+}
@@ -3,12 +3,31 @@ module;
 
 #include <fmt/format.h>
 #include <crispy/logstore.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <utility>
 #include <vector>
 
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 
 auto inline lexerLog = logstore::category("lexer ", "Lexer logger ", logstore::category::state::Enabled );
 
@@ -23,20 +42,25 @@ export enum class Token
 {
     Invalid,
 
+    Amp,            // &
     AmpNumber,      // '&' DIGIT+
     Backslash,      // '\'
+    Backtick,       // `
     DollarDollar,   // $$
     DollarName,     // $NAME
     DollarNot,      // $!
     DollarQuestion, // $?
+    DollarRndOpen,  // $(
     DollarNumber,   // '$' DIGIT+
     EndOfInput,     // EOF
     LineFeed,       // LF
     Equal,          // =
     Greater,        // >
+    GreaterAmp,     // >&
     GreaterEqual,   // >=
     GreaterGreater, // >>
     Less,           // <
+    LessAmp,        // <&
     LessEqual,      // <=
     LessLess,       // <<
     LessRndOpen,    // <(
@@ -84,10 +108,14 @@ export struct SourceLocationRange
     std::string_view name; // e.g. stdin, or a filename
 };
 
+// A token along with its literal.
+//
+// The literal refers to the source the token was read from (or to the lexer's string arena,
+// if it had to be unescaped), and thus remains valid only as long as the lexer that produced it.
 export struct TokenInfo
 {
     Token token;
-    std::string literal;
+    std::string_view literal;
     SourceLocationRange location;
 };
 
@@ -96,251 +124,579 @@ export class Source
   public:
     virtual ~Source() = default;
 
-    virtual void rewind() = 0;
-    [[nodiscard]] virtual char32_t readChar() = 0;
-    [[nodiscard]] virtual std::string_view readGraphemeCluster() = 0;
-    [[nodiscard]] virtual SourceLocation currentSourceLocation() const noexcept = 0;
+    // Returns the complete input, which the lexer scans in place.
+    [[nodiscard]] virtual std::string_view contents() const noexcept = 0;
+
+    // Returns the name of the source, e.g. stdin, or a filename.
+    [[nodiscard]] virtual std::string_view name() const noexcept = 0;
 };
 
 export class StringSource final: public Source
 {
   public:
     explicit StringSource(std::string source): _source { std::move(source) } {}
-    void rewind() override
-    {
-        _location.line = 0;
-        _location.column = 0;
-    }
-    [[nodiscard]] char32_t readChar() override
+
+    [[nodiscard]] std::string_view contents() const noexcept override { return _source; }
+    [[nodiscard]] std::string_view name() const noexcept override { return {}; }
+
+  private:
+    std::string _source;
+};
+
+// Source of a script file, which is memory mapped rather than read into a string,
+// so that the lexer reads straight from the page cache.
+export class MappedFileSource final: public Source
+{
+  public:
+    // @throws std::system_error if the file cannot be opened or mapped.
+    explicit MappedFileSource(std::string path): _path { std::move(path) }
     {
-        if (_offset >= _source.size())
-            return -1;
+        int const fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), _path);
 
-        auto const ch = _source[_offset];
+        struct stat st {};
+        if (fstat(fd, &st) == -1)
+        {
+            int const error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), _path);
+        }
 
-        ++_offset;
-        ++_location.column;
-        if (ch == '\n')
+        _size = static_cast<size_t>(st.st_size);
+        if (_size != 0)
         {
-            ++_location.line;
-            _location.column = 0;
+            void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                int const error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), _path);
+            }
+            _data = static_cast<char const*>(data);
+            madvise(data, _size, MADV_SEQUENTIAL);
         }
+        ::close(fd);
+    }
 
-        return ch;
+    ~MappedFileSource() override
+    {
+        if (_data)
+            munmap(const_cast<char*>(_data), _size);
     }
 
-    [[nodiscard]] std::string_view readGraphemeCluster() override
+    MappedFileSource(MappedFileSource const&) = delete;
+    MappedFileSource& operator=(MappedFileSource const&) = delete;
+    MappedFileSource(MappedFileSource&&) = delete;
+    MappedFileSource& operator=(MappedFileSource&&) = delete;
+
+    // Returns the file's contents.
+    [[nodiscard]] std::string_view contents() const noexcept override { return { _data, _size }; }
+    [[nodiscard]] std::string_view name() const noexcept override { return _path; }
+
+  private:
+    std::string _path;
+    char const* _data = nullptr;
+    size_t _size = 0;
+};
+
+// Owns strings that do not exist verbatim in the source, e.g. string literals that had to be unescaped.
+//
+// Strings are appended to fixed size chunks that are never moved nor freed before the arena itself,
+// so that views to them remain valid as long as the arena lives.
+class StringArena
+{
+  public:
+    std::string_view store(std::string_view text)
     {
-        if (_offset >= _source.size())
-            return {};
+        if (text.size() > _available)
+        {
+            auto const size = std::max(text.size(), ChunkSize);
+            _chunks.emplace_back(std::make_unique<char[]>(size));
+            _next = _chunks.back().get();
+            _available = size;
+        }
 
-        return std::string_view(_source.data() + _offset, 1);
+        auto* const result = _next;
+        std::memcpy(result, text.data(), text.size());
+        _next += text.size();
+        _available -= text.size();
+        return { result, text.size() };
     }
-    [[nodiscard]] SourceLocation currentSourceLocation() const noexcept override { return _location; }
 
   private:
-    SourceLocation _location;
-    std::string _source;
-    size_t _offset = 0;
+    static constexpr size_t ChunkSize = 4096;
+
+    std::vector<std::unique_ptr<char[]>> _chunks;
+    char* _next = nullptr;
+    size_t _available = 0;
 };
 
+// {{{ lexical grammar
+namespace grammar
+{
+    // Operators and the tokens they are recognized as.
+    //
+    // The operator DFA (see OperatorDfa) is generated from these rules at compile time,
+    // matching the longest operator at the current position.
+    struct OperatorRule
+    {
+        std::string_view pattern;
+        Token token;
+    };
+
+    // clang-format off
+    constexpr auto OperatorRules = std::array {
+        OperatorRule { "\n",  Token::LineFeed },
+        OperatorRule { "\r\n", Token::LineFeed },
+        OperatorRule { ";",   Token::Semicolon },
+        OperatorRule { "=",   Token::Equal },
+        OperatorRule { "|",   Token::Pipe },
+        OperatorRule { "&",   Token::Amp },
+        OperatorRule { ">",   Token::Greater },
+        OperatorRule { ">>",  Token::GreaterGreater },
+        OperatorRule { ">&",  Token::GreaterAmp },
+        OperatorRule { ">=",  Token::GreaterEqual },
+        OperatorRule { "<",   Token::Less },
+        OperatorRule { "<<",  Token::LessLess },
+        OperatorRule { "<&",  Token::LessAmp },
+        OperatorRule { "<=",  Token::LessEqual },
+        OperatorRule { "<(",  Token::LessRndOpen },
+        OperatorRule { "(",   Token::RndOpen },
+        OperatorRule { ")",   Token::RndClose },
+        OperatorRule { "\\",  Token::Backslash },
+        OperatorRule { "`",   Token::Backtick },
+        OperatorRule { "!",   Token::Not },
+        OperatorRule { "$$",  Token::DollarDollar },
+        OperatorRule { "$!",  Token::DollarNot },
+        OperatorRule { "$?",  Token::DollarQuestion },
+        OperatorRule { "$(",  Token::DollarRndOpen },
+    };
+    // clang-format on
+
+    // Symbols ending an identifier (and thus a $NAME).
+    constexpr auto ReservedSymbols = "|&<>()[]{}!$'\"`\t\r\n ;"sv;
+
+    // Classifies a byte by the token it starts.
+    enum class Start : uint8_t
+    {
+        Identifier, // anything else, including UTF-8 sequences
+        Blank,      // ' ' and '\t'
+        Comment,    // '#'
+        Digit,      // '0'..'9'
+        Quote,      // '"' and '\''
+        Operator,   // first byte of any operator rule, except '$'
+        Dollar,     // '$'
+        Symbol,     // reserved symbol starting no token, lexed as identifier on its own, e.g. '['
+    };
+
+    constexpr auto StartClasses = [] {
+        auto classes = std::array<Start, 256> {};
+        classes.fill(Start::Identifier);
+        for (char const ch: ReservedSymbols)
+            classes[static_cast<uint8_t>(ch)] = Start::Symbol;
+        for (auto const& rule: OperatorRules)
+            classes[static_cast<uint8_t>(rule.pattern.front())] = Start::Operator;
+        for (char ch = '0'; ch <= '9'; ++ch)
+            classes[static_cast<uint8_t>(ch)] = Start::Digit;
+        classes[' '] = Start::Blank;
+        classes['\t'] = Start::Blank;
+        classes['#'] = Start::Comment;
+        classes['"'] = Start::Quote;
+        classes['\''] = Start::Quote;
+        classes['$'] = Start::Dollar;
+        return classes;
+    }();
+
+    // Deterministic finite automaton recognizing all operator rules.
+    //
+    // State 0 is the initial state, as well as the error state, as no transition leads back to it.
+    template <size_t StateCount>
+    struct OperatorDfa
+    {
+        std::array<std::array<uint8_t, 256>, StateCount> transitions {};
+        std::array<Token, StateCount> accepts {}; // Token::Invalid for non-accepting states
+
+        // Builds the trie of all rules, which already is the minimal DFA for a set of literals.
+        // Returns the number of states used, or StateCount + 1 if they do not fit.
+        constexpr size_t build()
+        {
+            size_t used = 1;
+            for (auto const& rule: OperatorRules)
+            {
+                size_t state = 0;
+                for (char const ch: rule.pattern)
+                {
+                    auto& next = transitions[state][static_cast<uint8_t>(ch)];
+                    if (next == 0)
+                    {
+                        if (used == StateCount)
+                            return StateCount + 1;
+                        next = static_cast<uint8_t>(used++);
+                    }
+                    state = next;
+                }
+                accepts[state] = rule.token;
+            }
+            return used;
+        }
+
+        // Matches the longest operator at the beginning of @p input.
+        // Returns the matched token and its length, or Token::Invalid and 0 if none matched.
+        constexpr std::pair<Token, size_t> match(std::string_view input) const noexcept
+        {
+            auto result = std::pair { Token::Invalid, size_t { 0 } };
+            size_t state = 0;
+            for (size_t i = 0; i < input.size(); ++i)
+            {
+                state = transitions[state][static_cast<uint8_t>(input[i])];
+                if (state == 0)
+                    break;
+                if (accepts[state] != Token::Invalid)
+                    result = { accepts[state], i + 1 };
+            }
+            return result;
+        }
+    };
+
+    constexpr size_t MaxOperatorStates = 64;
+    constexpr size_t OperatorStateCount = [] {
+        auto dfa = OperatorDfa<MaxOperatorStates> {};
+        return dfa.build();
+    }();
+    static_assert(OperatorStateCount <= MaxOperatorStates, "too many operator rules");
+
+    constexpr auto Operators = [] {
+        auto dfa = OperatorDfa<OperatorStateCount> {};
+        dfa.build();
+        return dfa;
+    }();
+
+    static_assert(Operators.match(">>x") == std::pair { Token::GreaterGreater, size_t { 2 } });
+    static_assert(Operators.match("\r\n") == std::pair { Token::LineFeed, size_t { 2 } });
+    static_assert(Operators.match("$x").first == Token::Invalid);
+} // namespace grammar
+// }}}
+
+// {{{ run scanning
+// Finds the end of runs of bytes (identifiers, blanks, string contents), 16 bytes at a time
+// using SSE2 where available, and byte by byte using a lookup table otherwise and for the remainder.
+namespace scan
+{
+    template <char... Set>
+    constexpr auto Contains = [] {
+        auto table = std::array<bool, 256> {};
+        ((table[static_cast<uint8_t>(Set)] = true), ...);
+        return table;
+    }();
+
+#if defined(__SSE2__)
+    // Returns a bit mask of the bytes of the 16 byte block at @p data being one of Set.
+    template <char... Set>
+    unsigned matchBlock(char const* data) noexcept
+    {
+        auto const block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data));
+        auto matches = _mm_setzero_si128();
+        ((matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8(Set)))), ...);
+        return static_cast<unsigned>(_mm_movemask_epi8(matches));
+    }
+#endif
+
+    // Returns the offset of the first byte at or after @p offset being one of Set, or input.size().
+    template <char... Set>
+    size_t findFirstOf(std::string_view input, size_t offset) noexcept
+    {
+#if defined(__SSE2__)
+        for (; offset + 16 <= input.size(); offset += 16)
+            if (auto const mask = matchBlock<Set...>(input.data() + offset); mask != 0)
+                return offset + static_cast<size_t>(std::countr_zero(mask));
+#endif
+        while (offset < input.size() && !Contains<Set...>[static_cast<uint8_t>(input[offset])])
+            ++offset;
+        return offset;
+    }
+
+    // Returns the offset of the first byte at or after @p offset not being one of Set, or input.size().
+    template <char... Set>
+    size_t findFirstNotOf(std::string_view input, size_t offset) noexcept
+    {
+#if defined(__SSE2__)
+        for (; offset + 16 <= input.size(); offset += 16)
+            if (auto const mask = ~matchBlock<Set...>(input.data() + offset) & 0xFFFFu; mask != 0)
+                return offset + static_cast<size_t>(std::countr_zero(mask));
+#endif
+        while (offset < input.size() && Contains<Set...>[static_cast<uint8_t>(input[offset])])
+            ++offset;
+        return offset;
+    }
+
+    template <size_t... I>
+    size_t findIdentifierEnd(std::string_view input, size_t offset, std::index_sequence<I...>) noexcept
+    {
+        return findFirstOf<grammar::ReservedSymbols[I]...>(input, offset);
+    }
+
+    // Returns the offset of the first byte at or after @p offset ending an identifier, or input.size().
+    size_t findIdentifierEnd(std::string_view input, size_t offset) noexcept
+    {
+        return findIdentifierEnd(input, offset, std::make_index_sequence<grammar::ReservedSymbols.size()> {});
+    }
+} // namespace scan
+// }}}
+
+// Splits a source into tokens.
+//
+// The source's contents are scanned in place, byte by byte, with each byte classified
+// by compile-time generated tables (see the grammar namespace above),
+// so that there is no virtual call nor per-character copy involved.
+//
+// Token literals are views into the source rather than copies. Only string literals containing
+// escape sequences are materialized (into the lexer's string arena). Hence, literals, and anything
+// that is holding on to them (such as the parser's AST), must not outlive the lexer.
 export class Lexer
 {
   public:
-    explicit Lexer(std::unique_ptr<Source> source): _source { std::move(source) }
+    explicit Lexer(std::unique_ptr<Source> source):
+        _source { std::move(source) }, _input { _source->contents() }, _name { _source->name() }
     {
-        nextChar();
         nextToken();
     }
+
     Token nextToken()
     {
-        // auto const postLogger = crispy::finally { [this]() mutable {
-        //     lexerLog()("Lexer.nextToken ~> {}\n", _currentToken);
-        // } };
+        _currentToken.literal = {};
 
         consumeWhitespace();
-        switch (_currentChar)
+        _tokenOffset = _offset;
+        _currentToken.location.name = _name;
+        _currentToken.location.begin = { .line = _line, .column = column() };
+
+        if (_offset == _input.size())
+            return confirmToken(Token::EndOfInput);
+
+        switch (grammar::StartClasses[static_cast<uint8_t>(_input[_offset])])
         {
-            case (char32_t) -1: return confirmToken(Token::EndOfInput);
-            case '\r':
-                nextChar();
-                if (_currentChar == '\n')
-                    return consumeCharAndConfirmToken(Token::LineFeed);
-                return confirmToken(Token::Invalid);
-            case '\n': return consumeCharAndConfirmToken(Token::LineFeed);
-            case ';': return consumeCharAndConfirmToken(Token::Semicolon);
-            case '=': return consumeCharAndConfirmToken(Token::Equal);
-            case '|': return consumeCharAndConfirmToken(Token::Pipe);
-            case '>':
-                nextChar();
-                if (_currentChar == '>')
-                    return consumeCharAndConfirmToken(Token::GreaterGreater);
-                else if (_currentChar == '=')
-                    return consumeCharAndConfirmToken(Token::GreaterEqual);
-                else
-                    return consumeCharAndConfirmToken(Token::Greater);
-            case '<':
-                nextChar();
-                if (_currentChar == '<')
-                    return consumeCharAndConfirmToken(Token::LessLess);
-                else if (_currentChar == '=')
-                    return consumeCharAndConfirmToken(Token::LessEqual);
-                else if (_currentChar == '(')
-                    return consumeCharAndConfirmToken(Token::LessRndOpen);
-                else
-                    return confirmToken(Token::Less);
-            case '(': return consumeCharAndConfirmToken(Token::RndOpen);
-            case ')': return consumeCharAndConfirmToken(Token::RndClose);
-            case '\\': return consumeCharAndConfirmToken(Token::Backslash);
-            case '!': return consumeCharAndConfirmToken(Token::Not);
-            case '$':
-                nextChar();
-                if (_currentChar == '$')
-                    return consumeCharAndConfirmToken(Token::DollarDollar);
-                else if (_currentChar == '!')
-                    return consumeCharAndConfirmToken(Token::DollarNot);
-                else if (_currentChar == '?')
-                    return consumeCharAndConfirmToken(Token::DollarQuestion);
-                else if (_currentChar < 0x80 && std::isalpha(static_cast<char>(_currentChar)))
-                    return consumeIdentifier(Token::DollarName);
-                else if (_currentChar < 0x80 && std::isdigit(static_cast<char>(_currentChar)))
-                    return consumeCharAndConfirmToken(Token::DollarNumber);
-                else
-                    return confirmToken(Token::Invalid);
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9': return consumeNumber();
-            case '"':
-            case '\'': return consumeString();
-            default: return consumeIdentifier();
+            case grammar::Start::Operator: return consumeOperator();
+            case grammar::Start::Dollar: return consumeDollar();
+            case grammar::Start::Digit: return consumeNumber();
+            case grammar::Start::Quote: return consumeString();
+            case grammar::Start::Symbol:
+                _currentToken.literal = _input.substr(_offset, 1);
+                advance(1);
+                return confirmToken(Token::Identifier);
+            case grammar::Start::Identifier:
+            case grammar::Start::Blank:
+            case grammar::Start::Comment: break;
         }
-        return confirmToken(Token::Invalid);
-        // crispy::unreachable();
+        return consumeIdentifier(Token::Identifier);
     }
 
     [[nodiscard]] Token currentToken() const noexcept { return _currentToken.token; }
-    [[nodiscard]] std::string const& currentLiteral() const noexcept { return _currentToken.literal; }
-    [[nodiscard]] SourceLocationRange currentRange() const noexcept { return _currentRange; }
+    [[nodiscard]] std::string_view currentLiteral() const noexcept { return _currentToken.literal; }
+    [[nodiscard]] SourceLocationRange currentRange() const noexcept { return _currentToken.location; }
+
+    // Offset of the current token's first byte within the source.
+    [[nodiscard]] size_t currentOffset() const noexcept { return _tokenOffset; }
+
+    // Number of blanks the line of the current token is indented by.
+    [[nodiscard]] int currentIndentation() const noexcept { return _indentation; }
 
     [[nodiscard]] bool isDirective(std::string_view name) const noexcept
     {
         return currentToken() == Token::Identifier && currentLiteral() == name;
     }
 
-    static std::vector<TokenInfo> tokenize(std::unique_ptr<Source> source)
-{
-    auto tokens = std::vector<TokenInfo> {};
-    auto lexer = Lexer { std::move(source) };
-
-    while (lexer.currentToken() != Token::EndOfInput)
+    // Consumes all remaining tokens.
+    //
+    // The tokens' literals remain valid as long as this lexer lives.
+    std::vector<TokenInfo> tokenize()
     {
-        tokens.emplace_back(TokenInfo { lexer.currentToken(), lexer.currentLiteral(), lexer.currentRange() });
-        lexer.nextToken();
+        auto tokens = std::vector<TokenInfo> {};
+        while (currentToken() != Token::EndOfInput)
+        {
+            tokens.emplace_back(_currentToken);
+            nextToken();
+        }
+        return tokens;
     }
 
-    return tokens;
-}
-
   private:
-    [[nodiscard]] bool eof() const noexcept { return _currentChar == char32_t(-1); }
-    [[nodiscard]] char32_t currentChar() const noexcept { return _currentChar; }
+    [[nodiscard]] int column() const noexcept { return static_cast<int>(_offset - _lineOffset); }
 
-    void consumeWhitespace()
+    // Advances by @p count bytes, none of which may be a line feed.
+    void advance(size_t count) noexcept { _offset += count; }
+
+    // Advances past the line feed at the current offset.
+    void advanceLine() noexcept
     {
-        _nextToken.literal = {};
+        ++_offset;
+        ++_line;
+        _lineOffset = _offset;
+    }
 
-        while (strchr(" \t", (int) _currentChar))
-            nextChar();
+    void consumeWhitespace()
+    {
+        auto const start = _offset;
+        _offset = scan::findFirstNotOf<' ', '\t'>(_input, _offset);
+        if (_lineStart)
+            _indentation = static_cast<int>(_offset - start);
 
-        auto const [line, column, name] = _source->currentSourceLocation();
-        _nextToken.location.name = name;
-        _nextToken.location.begin = { .line = line, .column = column };
-        _nextToken.location.end = _nextToken.location.begin;
+        // # comment until end of line
+        if (_offset != _input.size() && _input[_offset] == '#')
+        {
+            auto const lineFeed = _input.find('\n', _offset);
+            _offset = lineFeed == std::string_view::npos ? _input.size() : lineFeed;
+        }
     }
 
-    Token consumeNumber()
+    Token consumeOperator()
     {
-        while (strchr("0123456789", (int) _currentChar))
+        auto const [token, length] = grammar::Operators.match(_input.substr(_offset));
+        if (token == Token::LineFeed)
         {
-            _nextToken.literal += static_cast<char>(_currentChar); // TODO: UTF-8
-            nextChar();
+            advance(length - 1); // CR of CR LF
+            advanceLine();
+            return confirmToken(token);
         }
 
-        return confirmToken(Token::Number);
+        // A lone CR is the only operator prefix not being an operator on its own.
+        advance(std::max(length, size_t { 1 }));
+        return confirmToken(token);
     }
 
-    Token consumeIdentifier() { return consumeIdentifier(Token::Identifier); }
-
-    Token consumeIdentifier(Token token)
+    // $NAME, $DIGIT, $#, or any of the $-operators.
+    Token consumeDollar()
     {
-        auto constexpr ReservedSymbols = U"|<>()[]{}!$'\"\t\r\n ;"sv;
+        if (auto const [token, length] = grammar::Operators.match(_input.substr(_offset)); length != 0)
+        {
+            advance(length);
+            return confirmToken(token);
+        }
+
+        advance(1);
+        if (_offset == _input.size())
+            return confirmToken(Token::Invalid);
 
-        while (!eof() && ReservedSymbols.find(_currentChar) == std::string_view::npos)
+        auto const ch = static_cast<unsigned char>(_input[_offset]);
+        if (ch < 0x80 && std::isalpha(ch))
+            return consumeIdentifier(Token::DollarName);
+        if (ch < 0x80 && std::isdigit(ch))
         {
-            _nextToken.literal += static_cast<char>(_currentChar); // TODO: UTF-8
-            nextChar();
-            // lexerLog()("consumeIdentifier: '{}'\n", (char) _currentChar);
+            _currentToken.literal = _input.substr(_offset, 1);
+            advance(1);
+            return confirmToken(Token::DollarNumber);
         }
-        lexerLog()("consumeIdentifier: result: '{}'\n", _nextToken.literal);
-        return confirmToken(token);
+        if (ch == '#')
+        {
+            _currentToken.literal = _input.substr(_offset, 1);
+            advance(1);
+            return confirmToken(Token::DollarName);
+        }
+        return confirmToken(Token::Invalid);
     }
 
-    Token consumeString()
+    Token consumeNumber()
     {
-        auto const quote = _currentChar;
-        nextChar();
-        while (_currentChar != quote)
+        auto const start = _offset;
+        while (_offset != _input.size() && std::isdigit(static_cast<unsigned char>(_input[_offset])))
+            ++_offset;
+        _currentToken.literal = _input.substr(start, _offset - start);
+
+        // N>FILE, N>>FILE, N>&M, N<FILE, N<&M
+        // The file descriptor number preceding a redirect operator is kept as the token's literal.
+        // Any other operator (e.g. the ">=" of "3>=2") is a token of its own, following the number.
+        switch (grammar::Operators.match(_input.substr(_offset)).first)
         {
-            if (_currentChar == '\\')
-                nextChar();
-            _nextToken.literal += static_cast<char>(_currentChar); // TODO: UTF-8
-            nextChar();
+            case Token::Greater:
+            case Token::GreaterGreater:
+            case Token::GreaterAmp:
+            case Token::Less:
+            case Token::LessAmp: return consumeOperator();
+            default: return confirmToken(Token::Number);
         }
-        nextChar();
-        return confirmToken(Token::String);
     }
 
-    char32_t nextChar()
+    Token consumeIdentifier(Token token)
     {
-        _currentChar = _source->readChar();
-        // lexerLog()("Lexer.nextChar: '{}'\n", (char) _currentChar);
-        return _currentChar;
+        auto const start = _offset;
+        _offset = scan::findIdentifierEnd(_input, _offset);
+        _currentToken.literal = _input.substr(start, _offset - start);
+        return confirmToken(token);
     }
 
-    Token consumeCharAndConfirmToken(Token token)
-{
-    nextChar();
-    return confirmToken(token);
-}
+    // Returns the offset of the next closing @p quote, backslash, or line feed.
+    [[nodiscard]] size_t findStringDelimiter(char quote, size_t offset) const noexcept
+    {
+        return quote == '"' ? scan::findFirstOf<'"', '\\', '\n'>(_input, offset)
+                            : scan::findFirstOf<'\'', '\\', '\n'>(_input, offset);
+    }
 
-    Token confirmToken(Token token)
-{
-    _nextToken.token = token;
-    _nextToken.literal = _nextToken.literal;
-    auto const [a, b, _] = _source->currentSourceLocation();
-    _nextToken.location.end = { .line = a, .column = b };
-    _currentToken = _nextToken;
+    // "..." or '...', with a backslash escaping the character following it.
+    //
+    // The literal is a view into the source, unless it contains escapes and thus has to be unescaped.
+    Token consumeString()
+    {
+        auto const quote = _input[_offset];
+        advance(1);
 
-    _nextToken.literal = {};
-    _nextToken.location.name = _source->currentSourceLocation().name;
-    _nextToken.location.begin = _nextToken.location.end;
+        auto const start = _offset;
+        bool escaped = false;
+        _unescaped.clear();
+        while (true)
+        {
+            auto const runStart = _offset;
+            _offset = findStringDelimiter(quote, _offset);
+            if (escaped)
+                _unescaped.append(_input.substr(runStart, _offset - runStart));
+
+            if (_offset == _input.size() || _input[_offset] == quote)
+                break;
+
+            if (_input[_offset] == '\\')
+            {
+                if (!escaped)
+                    _unescaped.assign(_input.substr(start, _offset - start));
+                escaped = true;
+                ++_offset;
+                if (_offset == _input.size())
+                    break;
+            }
+
+            if (escaped)
+                _unescaped += _input[_offset];
+            if (_input[_offset] == '\n')
+                advanceLine();
+            else
+                ++_offset;
+        }
 
-    return token;
-}
+        _currentToken.literal = escaped ? _strings.store(_unescaped) : _input.substr(start, _offset - start);
 
+        if (_offset != _input.size())
+            advance(1); // closing quote
+        return confirmToken(Token::String);
+    }
+
+    Token confirmToken(Token token)
+    {
+        _currentToken.token = token;
+        _currentToken.location.end = { .line = _line, .column = column() };
+        _lineStart = token == Token::LineFeed;
+        return token;
+    }
 
     std::unique_ptr<Source> _source;
-    char32_t _currentChar = 0;
+    std::string_view _input; // contents of the source
+    std::string_view _name;  // name of the source
+    size_t _offset = 0;      // offset of the next byte to scan
+    size_t _tokenOffset = 0; // offset of the current token's first byte
+    size_t _lineOffset = 0;  // offset of the first byte of the current line
+    int _line = 0;
     TokenInfo _currentToken = TokenInfo {};
-    TokenInfo _nextToken = TokenInfo {};
-    SourceLocationRange _currentRange {};
+    bool _lineStart = true; // whether the next token is the first one of its line
+    int _indentation = 0;
+    std::string _unescaped; // scratch buffer for unescaping string literals
+    StringArena _strings;   // literals not found verbatim in the source
 };
 } // namespace endo
 
@@ -384,21 +740,26 @@ struct fmt::formatter<endo::Token>: fmt::formatter<std::string_view>
         using enum endo::Token;
         switch (token)
         {
+            case Amp: name = "&"; break;
             case AmpNumber: name = "AmpNumber"; break;
             case Backslash: name = "\\"; break;
+            case Backtick: name = "`"; break;
             case DollarDollar: name = "$$"; break;
             case DollarName: name = "DollarName"; break;
             case DollarNot: name = "$!"; break;
             case DollarQuestion: name = "$?"; break;
+            case DollarRndOpen: name = "$("; break;
             case DollarNumber: name = "DollarNumber"; break;
             case EndOfInput: name = "EndOfInput"; break;
             case Equal: name = "="; break;
             case Greater: name = ">"; break;
+            case GreaterAmp: name = ">&"; break;
             case GreaterEqual: name = ">="; break;
             case GreaterGreater: name = ">>"; break;
             case Identifier: name = "Identifier"; break;
             case Invalid: name = "Invalid"; break;
             case Less: name = "<"; break;
+            case LessAmp: name = "<&"; break;
             case LessEqual: name = "<="; break;
             case LessLess: name = "<<"; break;
             case LessRndOpen: name = "<("; break;
@@ -1,6 +1,11 @@
 // SPDX-License-Identifier: Apache-2.0
 #include <catch2/catch.hpp>
 
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+
 import Lexer;
 
 TEST_CASE("Lexer.basic")
@@ -24,3 +29,169 @@ TEST_CASE("Lexer.basic")
     lexer.nextToken();
     CHECK(lexer.currentToken() == endo::Token::EndOfInput);
 }
+
+TEST_CASE("Lexer.background")
+{
+    auto lexer = endo::Lexer(std::make_unique<endo::StringSource>("sleep 1&"));
+    CHECK(lexer.currentToken() == endo::Token::Identifier);
+    CHECK(lexer.currentLiteral() == "sleep");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::Number);
+    CHECK(lexer.currentLiteral() == "1");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::Amp);
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::EndOfInput);
+}
+
+TEST_CASE("Lexer.redirects")
+{
+    auto lexer = endo::Lexer(std::make_unique<endo::StringSource>("cmd >out 2>&1 3>>log <in"));
+    CHECK(lexer.currentToken() == endo::Token::Identifier);
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::Greater);
+    CHECK(lexer.currentLiteral().empty());
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::Identifier);
+    CHECK(lexer.currentLiteral() == "out");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::GreaterAmp);
+    CHECK(lexer.currentLiteral() == "2");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::Number);
+    CHECK(lexer.currentLiteral() == "1");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::GreaterGreater);
+    CHECK(lexer.currentLiteral() == "3");
+
+    lexer.nextToken();
+    CHECK(lexer.currentLiteral() == "log");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::Less);
+
+    lexer.nextToken();
+    CHECK(lexer.currentLiteral() == "in");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::EndOfInput);
+}
+
+TEST_CASE("Lexer.number_before_operator")
+{
+    // Only redirect operators take a preceding number as their file descriptor.
+    auto lexer = endo::Lexer(std::make_unique<endo::StringSource>("3>=2 1<<x 2<(cmd) 2>x"));
+    auto const tokens = lexer.tokenize();
+
+    auto constexpr Expected = std::array {
+        std::pair { endo::Token::Number, "3" },       std::pair { endo::Token::GreaterEqual, "" },
+        std::pair { endo::Token::Number, "2" },       std::pair { endo::Token::Number, "1" },
+        std::pair { endo::Token::LessLess, "" },      std::pair { endo::Token::Identifier, "x" },
+        std::pair { endo::Token::Number, "2" },       std::pair { endo::Token::LessRndOpen, "" },
+        std::pair { endo::Token::Identifier, "cmd" }, std::pair { endo::Token::RndClose, "" },
+        std::pair { endo::Token::Greater, "2" },      std::pair { endo::Token::Identifier, "x" },
+    };
+
+    REQUIRE(tokens.size() == Expected.size());
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        INFO("token #" << i);
+        CHECK(tokens[i].token == Expected[i].first);
+        CHECK(tokens[i].literal == Expected[i].second);
+    }
+}
+
+TEST_CASE("Lexer.comments")
+{
+    auto lexer = endo::Lexer(std::make_unique<endo::StringSource>("# comment\necho $1 # $2\n"));
+    CHECK(lexer.currentToken() == endo::Token::LineFeed);
+
+    lexer.nextToken();
+    CHECK(lexer.currentLiteral() == "echo");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::DollarNumber);
+    CHECK(lexer.currentLiteral() == "1");
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::LineFeed);
+
+    lexer.nextToken();
+    CHECK(lexer.currentToken() == endo::Token::EndOfInput);
+}
+
+TEST_CASE("Lexer.operators")
+{
+    // Operators are matched greedily, and a reserved symbol starting no token is an identifier on its own.
+    auto lexer = endo::Lexer(
+        std::make_unique<endo::StringSource>("a<(b)|c>=d $$ $? $(e) [ 'f\\'g' \"h\r\ni\"\r\n"));
+    auto const tokens = lexer.tokenize();
+
+    auto constexpr Expected = std::array {
+        std::pair { endo::Token::Identifier, "a" },     std::pair { endo::Token::LessRndOpen, "" },
+        std::pair { endo::Token::Identifier, "b" },     std::pair { endo::Token::RndClose, "" },
+        std::pair { endo::Token::Pipe, "" },            std::pair { endo::Token::Identifier, "c" },
+        std::pair { endo::Token::GreaterEqual, "" },    std::pair { endo::Token::Identifier, "d" },
+        std::pair { endo::Token::DollarDollar, "" },    std::pair { endo::Token::DollarQuestion, "" },
+        std::pair { endo::Token::DollarRndOpen, "" },   std::pair { endo::Token::Identifier, "e" },
+        std::pair { endo::Token::RndClose, "" },        std::pair { endo::Token::Identifier, "[" },
+        std::pair { endo::Token::String, "f'g" },       std::pair { endo::Token::String, "h\r\ni" },
+        std::pair { endo::Token::LineFeed, "" },
+    };
+
+    REQUIRE(tokens.size() == Expected.size());
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        INFO("token #" << i);
+        CHECK(tokens[i].token == Expected[i].first);
+        CHECK(tokens[i].literal == Expected[i].second);
+    }
+    CHECK(tokens.back().location.begin.line == 1);
+}
+
+TEST_CASE("Lexer.long_runs")
+{
+    // Runs spanning several 16 byte blocks, ending at every position within a block.
+    for (size_t length = 1; length <= 40; ++length)
+    {
+        INFO("length " << length);
+        auto const word = std::string(length, 'x');
+        auto const text = std::string(length, ' ') + "\"" + word + "\\\"" + word + "\" " + word + "|" + word;
+
+        auto lexer = endo::Lexer(std::make_unique<endo::StringSource>(text));
+        auto const tokens = lexer.tokenize();
+        REQUIRE(tokens.size() == 4);
+        CHECK(tokens[0].token == endo::Token::String);
+        CHECK(tokens[0].literal == word + "\"" + word);
+        CHECK(tokens[1].literal == word);
+        CHECK(tokens[2].token == endo::Token::Pipe);
+        CHECK(tokens[3].literal == word);
+        CHECK(tokens[0].location.begin.column == static_cast<int>(length));
+    }
+}
+
+TEST_CASE("Lexer.literals_refer_to_source")
+{
+    auto lexer = endo::Lexer(std::make_unique<endo::StringSource>("echo plain 'quoted' \"esc\\\"aped\""));
+    auto const tokens = lexer.tokenize();
+    REQUIRE(tokens.size() == 4);
+
+    // Literals spelled verbatim in the source are views into it,
+    auto const* const source = tokens[0].literal.data();
+    CHECK(tokens[1].literal == "plain");
+    CHECK(tokens[1].literal.data() == source + 5);
+    CHECK(tokens[2].literal == "quoted");
+    CHECK(tokens[2].literal.data() == source + 12);
+
+    // whereas unescaped ones are materialized.
+    CHECK(tokens[3].literal == "esc\"aped");
+    CHECK(tokens[3].literal.data() != source + 21);
+}
@@ -7,14 +7,27 @@ module;
 #include <crispy/utils.h>
 #include <crispy/logstore.h>
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <map>
 #include <memory>
+#include <memory_resource>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
 
 auto inline parserLog = logstore::category("parser", "Parser logger", logstore::category::state::Enabled);
 #define TRACE_SCOPE(message) ScopedLogger _logger { message, parserLog };
 #define TRACE_FMT(message, ...) do { parserLog()(ScopedLogger::write(::fmt::format(message, __VA_ARGS__))); } while (0)
 #define TRACE(message) do { parserLog()(ScopedLogger::write(::fmt::format(message))); } while (0)
 
+using namespace std::string_view_literals;
+
 
 import ASTPrinter;
 import Lexer;
@@ -25,17 +38,69 @@ export module Parser;
 namespace endo
 {
 
+// Describes how a user-defined function is to be called.
+export struct FunctionSignature
+{
+    size_t parameterCount;
+    CoreVM::LiteralType returnType;
+};
+
+// Maps function names to their signatures.
+export using FunctionTable = std::map<std::string, FunctionSignature, std::less<>>;
+
 export class Parser
 {
   public:
+    // @param functions functions defined by previously parsed sources, that may be called from this one.
     explicit Parser(CoreVM::Runtime& runtime,
                     CoreVM::diagnostics::Report& report,
-                    std::unique_ptr<Source> source):
-        _runtime { runtime }, _report { report }, _lexer { std::move(source) }
+                    std::unique_ptr<Source> source,
+                    FunctionTable const* functions = nullptr):
+        _runtime { runtime }, _report { report }, _lexer { std::move(source) }, _functions { functions }
     {
     }
 
-    std::unique_ptr<ast::Statement> parse() { return parseBlock("global"); }
+    // Parses the whole source.
+    //
+    // The returned AST is allocated from this parser's arena and refers to the source's text,
+    // thus it must not outlive this parser, which releases it all at once.
+    ast::Ptr<ast::Statement> parse() { return parseBlock("global"); }
+
+    // A statement of the source's top-level block, see parseNext().
+    struct TopLevelStatement
+    {
+        size_t offset;                      // offset of the statement's first token within the source
+        ast::Ptr<ast::Statement> statement; // nullptr if the statement failed to parse
+    };
+
+    // Parses the source's next top-level statement, or returns std::nullopt at the end of the source.
+    //
+    // Unlike parse(), this leaves it to the caller how far to parse, and tells where each statement
+    // starts, which is what incremental reparsing builds on (see IncrementalParser).
+    std::optional<TopLevelStatement> parseNext()
+    {
+        consumeUntilNotOneOf(Token::Semicolon, Token::LineFeed);
+        if (_lexer.currentToken() == Token::EndOfInput)
+            return std::nullopt;
+
+        auto const offset = _lexer.currentOffset();
+        if (isEndOfBlock())
+        {
+            // parse() silently stops here, e.g. at a 'fi' without an 'if'.
+            _report.syntaxError(CoreVM::SourceLocation(), "Unexpected '{}'", _lexer.currentLiteral());
+            return TopLevelStatement { .offset = offset, .statement = nullptr };
+        }
+        return TopLevelStatement { .offset = offset, .statement = parseStmt() };
+    }
+
+    // Whether the whole source has been consumed.
+    [[nodiscard]] bool atEndOfInput() const noexcept { return _lexer.currentToken() == Token::EndOfInput; }
+
+    // Offset of the current token within the source.
+    [[nodiscard]] size_t currentOffset() const noexcept { return _lexer.currentOffset(); }
+
+    // Returns the functions defined by the parsed source.
+    [[nodiscard]] FunctionTable const& definedFunctions() const noexcept { return _definedFunctions; }
 
   private:
     [[nodiscard]] bool isEndOfBlock() const noexcept
@@ -55,15 +120,29 @@ export class Parser
     return _lexer.currentToken() == Token::EndOfInput
         || _lexer.currentToken() == Token::LineFeed
         || _lexer.currentToken() == Token::Pipe
+        || _lexer.currentToken() == Token::Amp
+        || _lexer.currentToken() == Token::RndClose
+        || _lexer.currentToken() == Token::Backtick
         || _lexer.currentToken() == Token::Semicolon;
         // clang-format on
     }
 
-    std::unique_ptr<ast::Statement> parseBlock(std::string_view traceMessage = {})
+    [[nodiscard]] bool isRedirect() const noexcept
+    {
+        // clang-format off
+    return _lexer.currentToken() == Token::Greater
+        || _lexer.currentToken() == Token::GreaterGreater
+        || _lexer.currentToken() == Token::GreaterAmp
+        || _lexer.currentToken() == Token::Less
+        || _lexer.currentToken() == Token::LessAmp;
+        // clang-format on
+    }
+
+    ast::Ptr<ast::Statement> parseBlock(std::string_view traceMessage = {})
     {
         TRACE_SCOPE(
             fmt::format("parseBlock{}", traceMessage.empty() ? "" : fmt::format(" ({})", traceMessage)));
-        auto scope = std::make_unique<ast::CompoundStmt>();
+        auto scope = _arena.make<ast::CompoundStmt>(_arena.list<ast::Node>());
         while (!isEndOfBlock())
         {
             if (consumeUntilNotOneOf(Token::Semicolon, Token::LineFeed))
@@ -84,7 +163,7 @@ export class Parser
         return scope;
     }
 
-    std::unique_ptr<ast::Statement> parseStmt()
+    ast::Ptr<ast::Statement> parseStmt()
     {
         TRACE_SCOPE("parseStmt");
         switch (_lexer.currentToken())
@@ -98,55 +177,111 @@ export class Parser
                 else if (_lexer.isDirective("exit"))
                 {
                     _lexer.nextToken();
-                    std::unique_ptr<ast::Expr> code;
+                    ast::Ptr<ast::Expr> code;
                     if (!isEndOfStmt())
                         code = parseParameter();
                     assert(_runtime.find("exit(I)V") != nullptr);
-                    return std::make_unique<ast::BuiltinExitStmt>(*_runtime.find("exit(I)V"),
-                                                                  std::move(code));
+                    return _arena.make<ast::BuiltinExitStmt>(*_runtime.find("exit(I)V"), std::move(code));
                 }
                 else if (_lexer.isDirective("true"))
                 {
                     _lexer.nextToken();
-                    return std::make_unique<ast::BuiltinTrueStmt>();
+                    return _arena.make<ast::BuiltinTrueStmt>();
                 }
                 else if (_lexer.isDirective("false"))
                 {
                     _lexer.nextToken();
-                    return std::make_unique<ast::BuiltinFalseStmt>();
+                    return _arena.make<ast::BuiltinFalseStmt>();
                 }
                 else if (_lexer.isDirective("read"))
                 {
                     _lexer.nextToken();
-                    std::vector<std::unique_ptr<ast::Expr>> parameters = parseParameterList();
+                    auto parameters = parseParameterList();
+                    if (!requireConstantParameters("read", parameters))
+                        return nullptr;
                     CoreVM::NativeCallback const& callback =
                         *_runtime.find(parameters.empty() ? "read()S" : "read(s)S");
-                    return std::make_unique<ast::BuiltinReadStmt>(callback, std::move(parameters));
+                    return _arena.make<ast::BuiltinReadStmt>(callback, std::move(parameters));
+                }
+                else if (_lexer.isDirective("hash"))
+                {
+                    _lexer.nextToken();
+                    auto parameters = parseParameterList();
+                    if (!requireConstantParameters("hash", parameters))
+                        return nullptr;
+                    CoreVM::NativeCallback const& callback =
+                        *_runtime.find(parameters.empty() ? "hash()B" : "hash(s)B");
+                    return _arena.make<ast::BuiltinHashStmt>(callback, std::move(parameters));
+                }
+                else if (_lexer.isDirective("jobs"))
+                {
+                    _lexer.nextToken();
+                    return _arena.make<ast::BuiltinJobControlStmt>(
+                        "jobs", *_runtime.find("jobs()B"), _arena.list<ast::Expr>());
+                }
+                else if (_lexer.isDirective("fg") || _lexer.isDirective("bg") || _lexer.isDirective("wait"))
+                {
+                    auto name = consumeLiteral();
+                    auto parameters = parseParameterList();
+                    if (!requireConstantParameters(name, parameters))
+                        return nullptr;
+                    auto const signature = fmt::format("{}({})I", name, parameters.empty() ? "" : "s");
+                    CoreVM::NativeCallback const* callback = _runtime.find(signature);
+                    assert(callback != nullptr);
+                    return _arena.make<ast::BuiltinJobControlStmt>(name, *callback, std::move(parameters));
+                }
+                else if (_lexer.isDirective("parallel"))
+                {
+                    _lexer.nextToken();
+                    auto parameters = parseParameterList();
+                    if (parameters.empty())
+                    {
+                        _report.syntaxError(CoreVM::SourceLocation(), "parallel: missing command");
+                        return nullptr;
+                    }
+                    if (!requireConstantParameters("parallel", parameters))
+                        return nullptr;
+                    return _arena.make<ast::BuiltinJobControlStmt>(
+                        "parallel", *_runtime.find("parallel(s)I"), std::move(parameters));
+                }
+                else if (_lexer.isDirective("time"))
+                {
+                    _lexer.nextToken();
+                    auto command = parseStmt();
+                    if (!command)
+                        return nullptr;
+                    return _arena.make<ast::BuiltinTimeStmt>(
+                        *_runtime.find("time()V"), *_runtime.find("internal.time_report()V"), std::move(command));
                 }
                 else if (_lexer.isDirective("export"))
                 {
                     _lexer.nextToken();
                     auto name = consumeLiteral();
-                    return std::make_unique<ast::BuiltinExportStmt>(*_runtime.find("export(S)V"), name);
+                    return _arena.make<ast::BuiltinExportStmt>(*_runtime.find("export(S)V"), name);
                 }
                 else if (_lexer.isDirective("set"))
                 {
                     _lexer.nextToken();
                     auto name = parseParameter();
                     auto value = parseParameter();
-                    return std::make_unique<ast::BuiltinSetStmt>(
+                    return _arena.make<ast::BuiltinSetStmt>(
                         *_runtime.find("set(SS)B"), std::move(name), std::move(value));
                 }
+                else if (_lexer.isDirective("let"))
+                    return parseLet();
+                else if (_lexer.isDirective("return"))
+                    return parseReturn();
+                else if (_lexer.currentToken() == Token::Identifier && findFunction(_lexer.currentLiteral()))
+                    return parseFunctionCall();
                 else if (_lexer.isDirective("cd"))
                 {
                     _lexer.nextToken();
                     if (isEndOfStmt())
-                        return std::make_unique<ast::BuiltinChDirStmt>(*_runtime.find("cd()B"), nullptr);
+                        return _arena.make<ast::BuiltinChDirStmt>(*_runtime.find("cd()B"), nullptr);
                     else
                     {
                         auto param = parseParameter();
-                        return std::make_unique<ast::BuiltinChDirStmt>(*_runtime.find("cd(S)B"),
-                                                                       std::move(param));
+                        return _arena.make<ast::BuiltinChDirStmt>(*_runtime.find("cd(S)B"), std::move(param));
                     }
                 }
                 else
@@ -162,26 +297,31 @@ export class Parser
         return nullptr;
     }
 
-    std::string consumeLiteral()
+    // Returns the current token's literal, which remains valid as long as the lexer lives.
+    std::string_view consumeLiteral()
     {
         auto literal = _lexer.currentLiteral();
         _lexer.nextToken();
         return literal;
     }
 
-    std::unique_ptr<ast::IfStmt> parseIf()
+    ast::Ptr<ast::IfStmt> parseIf()
     {
         TRACE_SCOPE("parseIf");
         // 'if' statement (LF | ';') statement ('else' statement)?
         _lexer.nextToken();
         auto condition = parseStmt();
-        assert(condition != nullptr);
         if (!condition)
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Expected condition after 'if'");
             return nullptr;
+        }
 
         if (!consumeOneOf(Token::Semicolon, Token::LineFeed))
         {
-            TRACE_FMT("Expected ';' or LF after if condition but got '{}'", _lexer.currentLiteral());
+            _report.syntaxError(CoreVM::SourceLocation(),
+                                "Expected ';' or LF after if condition but got '{}'",
+                                _lexer.currentLiteral());
             return nullptr;
         }
 
@@ -195,10 +335,12 @@ export class Parser
 
         TRACE_FMT("Parsed if then branch: {}", ast::ASTPrinter::print(*thenBranch));
 
-        std::unique_ptr<ast::Statement> elseBranch;
+        ast::Ptr<ast::Statement> elseBranch;
         if (_lexer.isDirective("elif"))
         {
             elseBranch = parseIf();
+            if (!elseBranch)
+                return nullptr;
             TRACE_FMT("Parsed elif branch: {}", ast::ASTPrinter::print(*elseBranch));
         }
         else if (_lexer.isDirective("else"))
@@ -220,52 +362,476 @@ export class Parser
         TRACE_FMT("Parsed if statement finished. Current token: {}", _lexer.currentLiteral());
         consumeDirective("fi");
 
-        return std::make_unique<ast::IfStmt>(
+        return _arena.make<ast::IfStmt>(
             std::move(condition), std::move(thenBranch), std::move(elseBranch));
     }
 
-    std::unique_ptr<ast::WhileStmt> parseWhile()
+    ast::Ptr<ast::WhileStmt> parseWhile()
     {
         TRACE_SCOPE("parseStmt");
         // 'while' statement (LF | ';') statement 'done'
         _lexer.nextToken(); // consume 'while'
         auto condition = parseStmt();
+        if (!condition)
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Expected condition after 'while'");
+            return nullptr;
+        }
+
         if (!consumeOneOf(Token::Semicolon, Token::LineFeed))
         {
-            TRACE_FMT("Expected ';' or LF after if condition but got '{}'", _lexer.currentLiteral());
+            _report.syntaxError(CoreVM::SourceLocation(),
+                                "Expected ';' or LF after while condition but got '{}'",
+                                _lexer.currentLiteral());
             return nullptr;
         }
 
         consumeDirective("do");
         auto body = parseBlock("whileBody");
+        if (!body)
+            return nullptr;
         consumeDirective("done");
-        return std::make_unique<ast::WhileStmt>(std::move(condition), std::move(body));
+        return _arena.make<ast::WhileStmt>(std::move(condition), std::move(body));
+    }
+
+    // 'let' NAME '=' (FUNCTION_CALL | PARAMETER)
+    // 'let' NAME ['(' PARAM (',' PARAM)* ')' | PARAM*] [':' TYPE] '=' (LF BLOCK | STATEMENT)
+    ast::Ptr<ast::Statement> parseLet()
+    {
+        TRACE_SCOPE("parseLet");
+        int const indentation = _lexer.currentIndentation();
+        _lexer.nextToken(); // consume 'let'
+
+        if (_lexer.currentToken() != Token::Identifier)
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Expected name after 'let'");
+            return nullptr;
+        }
+        auto name = consumeLiteral();
+
+        // Everything up to '=' makes up the function's parameter list and return type.
+        auto header = std::string {};
+        while (_lexer.currentToken() != Token::Equal)
+        {
+            switch (_lexer.currentToken())
+            {
+                case Token::RndOpen:
+                case Token::RndClose: header += ' '; break;
+                case Token::Identifier:
+                    header += _lexer.currentLiteral();
+                    header += ' ';
+                    break;
+                default:
+                    _report.syntaxError(
+                        CoreVM::SourceLocation(), "Expected '=' but got '{}'", _lexer.currentLiteral());
+                    return nullptr;
+            }
+            _lexer.nextToken();
+        }
+        _lexer.nextToken(); // consume '='
+
+        // let NAME = VALUE
+        if (header.empty() && _lexer.currentToken() != Token::LineFeed)
+        {
+            auto value = parseValue();
+            if (!value)
+                return nullptr;
+            return _arena.make<ast::BuiltinSetStmt>(
+                *_runtime.find("set(SS)B"), _arena.make<ast::LiteralExpr>(name), std::move(value));
+        }
+
+        std::replace(header.begin(), header.end(), ',', ' ');
+        auto typeName = std::string {};
+        if (auto const colon = header.find(':'); colon != std::string::npos)
+        {
+            auto const typeText = header.substr(colon + 1);
+            for (auto const& part: crispy::split(typeText, ' '))
+            {
+                if (part.empty())
+                    continue;
+                if (!typeName.empty())
+                    typeName += ' ';
+                typeName += part;
+            }
+            header.resize(colon);
+        }
+
+        auto returnType = CoreVM::LiteralType::Number; // int, bool, or omitted: the exit code (0 is success)
+        if (typeName == "str")
+            returnType = CoreVM::LiteralType::String;
+        else if (!typeName.empty() && typeName != "int" && typeName != "bool")
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Unknown return type '{}' of {}", typeName, name);
+            return nullptr;
+        }
+
+        auto parameters = _arena.names();
+        for (auto const& parameter: crispy::split(header, ' '))
+        {
+            if (parameter.empty())
+                continue;
+            if (!std::all_of(parameter.begin(), parameter.end(), [](char ch) {
+                    return ch == '_' || std::isalnum(static_cast<unsigned char>(ch));
+                }))
+            {
+                _report.syntaxError(CoreVM::SourceLocation(), "Invalid parameter name '{}' of {}", parameter, name);
+                return nullptr;
+            }
+            parameters.emplace_back(_arena.store(parameter));
+        }
+
+        if (_definedFunctions.contains(name))
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Function {} is already defined", name);
+            return nullptr;
+        }
+        if (auto const* existing = findFunction(name);
+            existing && (existing->parameterCount != parameters.size() || existing->returnType != returnType))
+        {
+            // Already compiled callers would invoke it with the previous signature.
+            _report.syntaxError(
+                CoreVM::SourceLocation(), "Function {} is redefined with a different signature", name);
+            return nullptr;
+        }
+
+        // Registered before parsing the body, so that the function may call itself.
+        _definedFunctions.insert_or_assign(
+            std::string(name),
+            FunctionSignature { .parameterCount = parameters.size(), .returnType = returnType });
+
+        auto const* const outerParameters = _parameters;
+        _parameters = &parameters;
+        auto body = parseFunctionBody(indentation);
+        _parameters = outerParameters;
+        if (!body)
+            return nullptr;
+
+        return _arena.make<ast::FunctionDef>(name, std::move(parameters), returnType, std::move(body));
+    }
+
+    // A single statement on the same line as the function's name,
+    // or all following lines indented deeper than the line defining the function.
+    ast::Ptr<ast::Statement> parseFunctionBody(int indentation)
+    {
+        TRACE_SCOPE("parseFunctionBody");
+        if (_lexer.currentToken() != Token::LineFeed)
+            return parseStmt();
+
+        auto body = _arena.make<ast::CompoundStmt>(_arena.list<ast::Node>());
+        consumeUntilNotOneOf(Token::Semicolon, Token::LineFeed);
+        while (!isEndOfBlock() && _lexer.currentIndentation() > indentation)
+        {
+            auto stmt = parseStmt();
+            if (!stmt)
+                return nullptr;
+            body->statements.emplace_back(std::move(stmt));
+            consumeUntilNotOneOf(Token::Semicolon, Token::LineFeed);
+        }
+
+        if (body->statements.empty())
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Expected function body");
+            return nullptr;
+        }
+        return body;
+    }
+
+    // 'return' [FUNCTION_CALL | PARAMETER]
+    ast::Ptr<ast::Statement> parseReturn()
+    {
+        TRACE_SCOPE("parseReturn");
+        if (!_parameters)
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "'return' outside of a function");
+            return nullptr;
+        }
+        _lexer.nextToken(); // consume 'return'
+
+        if (isEndOfStmt())
+            return _arena.make<ast::ReturnStmt>(nullptr);
+
+        auto value = parseValue();
+        if (!value)
+            return nullptr;
+        return _arena.make<ast::ReturnStmt>(std::move(value));
+    }
+
+    // FUNCTION_CALL | PARAMETER
+    ast::Ptr<ast::Node> parseValue()
+    {
+        if (_lexer.currentToken() == Token::Identifier && findFunction(_lexer.currentLiteral()))
+            return parseFunctionCall();
+        return parseParameter();
+    }
+
+    // FUNCTION ARGS...
+    ast::Ptr<ast::Statement> parseFunctionCall()
+    {
+        TRACE_SCOPE("parseFunctionCall");
+        auto name = consumeLiteral();
+        auto const& signature = *findFunction(name);
+        auto arguments = parseParameterList();
+
+        if (arguments.size() != signature.parameterCount)
+        {
+            _report.syntaxError(CoreVM::SourceLocation(),
+                                "Function {} expects {} arguments but got {}",
+                                name,
+                                signature.parameterCount,
+                                arguments.size());
+            return nullptr;
+        }
+
+        // Functions run within the shell process, thus there is no process to pipe into or from.
+        if (_lexer.currentToken() == Token::Pipe || _lexer.currentToken() == Token::Amp)
+        {
+            _report.syntaxError(
+                CoreVM::SourceLocation(), "Function {} cannot be piped nor run in background", name);
+            return nullptr;
+        }
+
+        return _arena.make<ast::FunctionCall>(name, signature.returnType, std::move(arguments));
+    }
+
+    [[nodiscard]] FunctionSignature const* findFunction(std::string_view name) const
+    {
+        if (auto i = _definedFunctions.find(name); i != _definedFunctions.end())
+            return &i->second;
+        if (_functions)
+            if (auto i = _functions->find(name); i != _functions->end())
+                return &i->second;
+        return nullptr;
+    }
+
+    // NAME=VALUE
+    [[nodiscard]] bool isAssignment() const noexcept
+    {
+        if (_lexer.currentToken() != Token::Identifier)
+            return false;
+
+        auto const& literal = _lexer.currentLiteral();
+        auto const eq = literal.find('=');
+        if (eq == 0 || eq == std::string::npos || std::isdigit(static_cast<unsigned char>(literal[0])))
+            return false;
+
+        return std::all_of(literal.begin(), literal.begin() + static_cast<ptrdiff_t>(eq), [](char ch) {
+            return ch == '_' || std::isalnum(static_cast<unsigned char>(ch));
+        });
+    }
+
+    ast::List<ast::Expr> parseAssignments()
+    {
+        auto assignments = _arena.list<ast::Expr>();
+        while (isAssignment())
+            assignments.emplace_back(_arena.make<ast::LiteralExpr>(consumeLiteral()));
+        return assignments;
     }
 
-    std::unique_ptr<ast::ProgramCall> parseCall(bool piped = false)
+    // FOO=1 BAR=2 without a program to call sets shell variables.
+    ast::Ptr<ast::Statement> createSetStatements(ast::List<ast::Expr> assignments)
+    {
+        auto scope = _arena.make<ast::CompoundStmt>(_arena.list<ast::Node>());
+        for (auto const& assignment: assignments)
+        {
+            auto const& literal = static_cast<ast::LiteralExpr const&>(*assignment).value;
+            auto const eq = literal.find('=');
+            scope->statements.emplace_back(
+                _arena.make<ast::BuiltinSetStmt>(*_runtime.find("set(SS)B"),
+                                                 _arena.make<ast::LiteralExpr>(literal.substr(0, eq)),
+                                                 _arena.make<ast::LiteralExpr>(literal.substr(eq + 1))));
+        }
+        return scope;
+    }
+
+    ast::Ptr<ast::ProgramCall> parseCall(ast::List<ast::Expr> environment,
+                                                bool piped = false)
     {
         TRACE_SCOPE("parseCall");
-        std::string program = consumeLiteral();
-        std::vector<std::unique_ptr<ast::Expr>> arguments = parseParameterList();
-        std::vector<std::unique_ptr<ast::OutputRedirect>> outputRedirects;
+        auto const program = consumeLiteral();
+        auto arguments = _arena.list<ast::Expr>();
+        auto redirects = _arena.list<ast::Expr>();
+        int substitutionFd = FirstSubstitutionFd;
 
-        // TODO: parse outputRedirects
-        // outputRedirects.emplace_back(std::make_unique<ast::OutputRedirect>(
-        //     std::make_unique<ast::FileDescriptor>(1), std::make_unique<ast::FileDescriptor>(2)));
+        // Redirects may appear anywhere between the arguments, e.g.: echo >FILE hello 2>&1 world
+        while (!isEndOfStmt())
+        {
+            if (isRedirect())
+            {
+                auto redirect = parseRedirect();
+                if (!redirect)
+                    return nullptr;
+                redirects.emplace_back(std::move(redirect));
+            }
+            else if (_lexer.currentToken() == Token::LessRndOpen)
+            {
+                auto substitution = parseCommandFileSubst(substitutionFd--);
+                if (!substitution)
+                    return nullptr;
+                arguments.emplace_back(std::move(substitution));
+            }
+            else if (auto arg = parseParameter(); arg)
+                arguments.emplace_back(std::move(arg));
+            else
+                break;
+        }
 
-        CoreVM::NativeCallback const* builtinCallProcess = _lexer.currentToken() == Token::Pipe || piped
-                                                               ? _runtime.find("callproc(Bs)I")
-                                                               : _runtime.find("callproc(s)I");
+        // The redirect table is only passed when there is one, as empty arrays cannot be represented.
+        bool const pipelined = _lexer.currentToken() == Token::Pipe || piped;
+        CoreVM::NativeCallback const* builtinCallProcess =
+            redirects.empty() ? _runtime.find(pipelined ? "callproc(Bs)I" : "callproc(s)I")
+                              : _runtime.find(pipelined ? "callproc(Bss)I" : "callproc(ss)I");
         assert(builtinCallProcess != nullptr);
 
-        return std::make_unique<ast::ProgramCall>(
-            *builtinCallProcess, std::move(program), std::move(arguments), std::move(outputRedirects));
+        CoreVM::NativeCallback const* environmentCallback =
+            environment.empty() ? nullptr : _runtime.find("internal.environment(s)V");
+        assert(environment.empty() || environmentCallback != nullptr);
+
+        CoreVM::NativeCallback const* argumentCallback = _runtime.find("internal.argument(S)V");
+        assert(argumentCallback != nullptr);
+
+        return _arena.make<ast::ProgramCall>(*builtinCallProcess,
+                                             program,
+                                             std::move(arguments),
+                                             std::move(redirects),
+                                             std::move(environment),
+                                             environmentCallback,
+                                             argumentCallback);
+    }
+
+    // $NAME, $0..$9, $#, $?
+    ast::Ptr<ast::Expr> parseVariable()
+    {
+        TRACE_SCOPE("parseVariable");
+        auto const name = _lexer.currentToken() == Token::DollarQuestion ? "?"sv : _lexer.currentLiteral();
+        _lexer.nextToken();
+
+        if (_parameters)
+            if (auto i = std::find(_parameters->begin(), _parameters->end(), name); i != _parameters->end())
+                return _arena.make<ast::ParameterExpr>(
+                    name, static_cast<size_t>(std::distance(_parameters->begin(), i)));
+
+        CoreVM::NativeCallback const* callback = _runtime.find("internal.variable(S)S");
+        assert(callback != nullptr);
+        return _arena.make<ast::VariableExpr>(*callback, name);
+    }
+
+    // $(command)
+    // `command`
+    ast::Ptr<ast::Expr> parseSubstitution()
+    {
+        TRACE_SCOPE("parseSubstitution");
+        Token const closingToken = _lexer.currentToken() == Token::Backtick ? Token::Backtick : Token::RndClose;
+        _lexer.nextToken();
+
+        auto pipeline = parseCallPipeline();
+        if (!pipeline)
+            return nullptr;
+
+        if (!tryConsumeToken(closingToken))
+        {
+            _report.syntaxError(CoreVM::SourceLocation(),
+                                "Expected '{}' but got '{}'",
+                                closingToken,
+                                _lexer.currentLiteral());
+            return nullptr;
+        }
+
+        CoreVM::NativeCallback const* beginCallback = _runtime.find("internal.capture_begin()V");
+        CoreVM::NativeCallback const* endCallback = _runtime.find("internal.capture_end()S");
+        assert(beginCallback != nullptr && endCallback != nullptr);
+        return _arena.make<ast::SubstitutionExpr>(*beginCallback, *endCallback, std::move(pipeline));
+    }
+
+    // <(command)
+    //
+    // Each substitution of a program call is handed to it as its own file descriptor,
+    // counting down from FirstSubstitutionFd (as bash does), so that its /dev/fd path is known upfront.
+    ast::Ptr<ast::Expr> parseCommandFileSubst(int fd)
+    {
+        TRACE_SCOPE("parseCommandFileSubst");
+        _lexer.nextToken(); // <(
+
+        auto command = parseCallPipeline();
+        if (!command)
+            return nullptr;
+
+        if (!tryConsumeToken(Token::RndClose))
+        {
+            _report.syntaxError(
+                CoreVM::SourceLocation(), "Expected ')' but got '{}'", _lexer.currentLiteral());
+            return nullptr;
+        }
+
+        CoreVM::NativeCallback const* beginCallback = _runtime.find("internal.subst_begin()V");
+        CoreVM::NativeCallback const* endCallback = _runtime.find("internal.subst_end(I)V");
+        assert(beginCallback != nullptr && endCallback != nullptr);
+        return _arena.make<ast::CommandFileSubst>(*beginCallback, *endCallback, std::move(command), fd);
+    }
+
+    // Converts @p literal (a Number token) into a file descriptor,
+    // reporting a syntax error if it does not fit into one.
+    std::optional<int> toFileDescriptor(std::string_view literal)
+    {
+        int fd = 0;
+        auto const [_, ec] = std::from_chars(literal.data(), literal.data() + literal.size(), fd);
+        if (ec != std::errc {})
+        {
+            _report.syntaxError(CoreVM::SourceLocation(), "Invalid file descriptor {}", literal);
+            return std::nullopt;
+        }
+        return fd;
+    }
+
+    // [N]<FILE, [N]<&M, [N]>FILE, [N]>>FILE, [N]>&M, [N]>&-
+    ast::Ptr<ast::Expr> parseRedirect()
+    {
+        TRACE_SCOPE("parseRedirect");
+        Token const op = _lexer.currentToken();
+        bool const isInput = op == Token::Less || op == Token::LessAmp;
+        bool const duplicate = op == Token::GreaterAmp || op == Token::LessAmp;
+        auto const fdLiteral = _lexer.currentLiteral();
+        auto const fd = fdLiteral.empty() ? std::optional { isInput ? STDIN_FILENO : STDOUT_FILENO }
+                                          : toFileDescriptor(fdLiteral);
+        if (!fd)
+            return nullptr;
+        auto source = _arena.make<ast::FileDescriptor>(*fd);
+        _lexer.nextToken();
+
+        ast::RedirectTarget target;
+        if (duplicate && _lexer.currentToken() == Token::Number)
+        {
+            auto const targetFd = toFileDescriptor(consumeLiteral());
+            if (!targetFd)
+                return nullptr;
+            target = _arena.make<ast::FileDescriptor>(*targetFd);
+        }
+        else if (duplicate && _lexer.isDirective("-"))
+        {
+            _lexer.nextToken();
+            target = _arena.make<ast::FileDescriptor>(-1);
+        }
+        else if (!duplicate
+                 && (_lexer.currentToken() == Token::Identifier || _lexer.currentToken() == Token::String
+                     || _lexer.currentToken() == Token::Number))
+            target = _arena.make<ast::LiteralExpr>(consumeLiteral());
+        else
+        {
+            _report.syntaxError(
+                CoreVM::SourceLocation(), "Unexpected redirect target '{}'", _lexer.currentLiteral());
+            return nullptr;
+        }
+
+        if (isInput)
+            return _arena.make<ast::InputRedirect>(std::move(source), std::move(target));
+
+        return _arena.make<ast::OutputRedirect>(
+            std::move(source), std::move(target), op == Token::GreaterGreater);
     }
 
-    std::vector<std::unique_ptr<ast::Expr>> parseParameterList()
+    ast::List<ast::Expr> parseParameterList()
     {
         TRACE_SCOPE("parseParameterList");
-        std::vector<std::unique_ptr<ast::Expr>> parameters;
+        auto parameters = _arena.list<ast::Expr>();
         while (!isEndOfStmt())
         {
             auto arg = parseParameter();
@@ -278,36 +844,60 @@ export class Parser
         return parameters;
     }
 
-    std::unique_ptr<ast::Expr> parseParameter()
+    // Builtin arguments are passed as a constant array, as arrays cannot be built at runtime.
+    // So none of them may be computed, e.g. by a command substitution or variable.
+    bool requireConstantParameters(std::string_view builtin, ast::List<ast::Expr> const& parameters)
+    {
+        for (auto const& parameter: parameters)
+        {
+            if (dynamic_cast<ast::LiteralExpr const*>(parameter.get()) == nullptr)
+            {
+                _report.syntaxError(CoreVM::SourceLocation(), "{}: Arguments must not be computed", builtin);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ast::Ptr<ast::Expr> parseParameter()
     {
         TRACE_FMT("parseParameter: {} \"{}\"", _lexer.currentToken(), _lexer.currentLiteral());
         switch (_lexer.currentToken())
         {
             case Token::String:
             case Token::Number:
-            case Token::Identifier: return std::make_unique<ast::LiteralExpr>(consumeLiteral()); break;
+            case Token::Identifier: return _arena.make<ast::LiteralExpr>(consumeLiteral()); break;
+            case Token::DollarRndOpen:
+            case Token::Backtick: return parseSubstitution();
+            case Token::DollarName:
+            case Token::DollarNumber:
+            case Token::DollarQuestion: return parseVariable();
             default: _report.syntaxError(CoreVM::SourceLocation(), "Expected parameter"); return nullptr;
         }
     }
 
-    std::unique_ptr<ast::Statement> parseCallPipeline()
+    ast::Ptr<ast::Statement> parseCallPipeline()
     {
         TRACE_SCOPE("parseCallPipeline");
 
-        auto call = parseCall();
+        auto environment = parseAssignments();
+        if (!environment.empty() && isEndOfStmt())
+            return createSetStatements(std::move(environment));
+
+        auto call = parseCall(std::move(environment));
         if (!call)
             return nullptr;
 
         if (_lexer.currentToken() != Token::Pipe)
-            return call;
+            return parseBackground(std::move(call));
 
-        std::vector<std::unique_ptr<ast::ProgramCall>> calls;
+        auto calls = _arena.list<ast::ProgramCall>();
         calls.emplace_back(std::move(call));
         while (_lexer.currentToken() == Token::Pipe)
         {
             _lexer.nextToken();
             TRACE_FMT("Parsing call pipeline item (NT: {})", _lexer.currentLiteral());
-            if (auto nextCall = parseCall(true); nextCall)
+            if (auto nextCall = parseCall(parseAssignments(), true); nextCall)
             {
                 calls.emplace_back(std::move(nextCall));
                 TRACE_FMT("Parsed call pipeline item: {} (NT: {})",
@@ -316,7 +906,19 @@ export class Parser
             }
         }
 
-        return std::make_unique<ast::CallPipeline>(std::move(calls));
+        return parseBackground(_arena.make<ast::CallPipeline>(std::move(calls)));
+    }
+
+    ast::Ptr<ast::Statement> parseBackground(ast::Ptr<ast::Statement> command)
+    {
+        // pipeline '&'
+        if (!tryConsumeToken(Token::Amp))
+            return command;
+
+        CoreVM::NativeCallback const* callback = _runtime.find("internal.background()V");
+        CoreVM::NativeCallback const* endCallback = _runtime.find("internal.background_end()V");
+        assert(callback != nullptr && endCallback != nullptr);
+        return _arena.make<ast::BackgroundStmt>(*callback, *endCallback, std::move(command));
     }
 
     bool tryConsumeToken(Token token)
@@ -364,9 +966,18 @@ export class Parser
                                 _lexer.currentLiteral());
     }
 
+    // File descriptor of the first process substitution of a program call.
+    static constexpr int FirstSubstitutionFd = 63;
+
     CoreVM::Runtime& _runtime;            // NOLINT(cppcoreguidelines-avoid-const-or-ref-data-members)
     CoreVM::diagnostics::Report& _report; // NOLINT(cppcoreguidelines-avoid-const-or-ref-data-members)
     Lexer _lexer;
+    ast::Arena _arena;               // memory of the parsed AST
+    FunctionTable const* _functions; // functions defined by previous sources
+    FunctionTable _definedFunctions; // functions defined by this source
+
+    // Parameters of the function being parsed, if any.
+    std::pmr::vector<std::string_view> const* _parameters = {};
 };
 
 } // namespace endo
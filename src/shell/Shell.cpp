@@ -1,25 +1,42 @@
 // SPDX-License-Identifier: Apache-2.0
 module;
-#include <shell/ProcessGroup.h>
-
 #include <crispy/assert.h>
 #include <crispy/utils.h>
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <csignal>
 #include <cstdio>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
 
+#include <sys/resource.h>
 #include <sys/wait.h>
 
 #include <fcntl.h>
+#include <glob.h>
 
 import TTY;
 import UnixPipe;
+import CommandHash;
+import EventLoop;
+import Spawn;
 import Prompt;
 import Lexer;
 import ASTPrinter;
 import IRGenerator;
 import Parser;
+import BytecodeCache;
 
 import CoreVM;
 
@@ -44,6 +61,18 @@ std::vector<char const*> constructArgv(CoreVM::CoreStringArray const& args)
     return argv;
 }
 
+std::string formatCommandLine(CoreVM::CoreStringArray const& args)
+{
+    std::string result;
+    for (auto const& arg: args)
+    {
+        if (!result.empty())
+            result += ' ';
+        result += arg;
+    }
+    return result;
+}
+
 std::string readLine(TTY& tty, std::string_view prompt)
 {
     // Most super-native implementation, yet to be replaced by a proper line editor.
@@ -73,6 +102,8 @@ std::string readLine(TTY& tty, std::string_view prompt)
 class Environment
 {
   public:
+    using ChangeListener = std::function<void(std::string_view name)>;
+
     virtual ~Environment() = default;
 
     virtual void set(std::string_view name, std::string_view value) = 0;
@@ -85,6 +116,25 @@ class Environment
         set(name, value);
         exportVariable(name);
     }
+
+    // Returns the exported variables, as to be passed to child processes.
+    [[nodiscard]] EnvironmentBlock& exported() noexcept { return _exported; }
+
+    // Registers a callback that is invoked whenever a variable is being set or exported.
+    void setChangeListener(ChangeListener listener) { _changeListener = std::move(listener); }
+
+  protected:
+    void notifyChange(std::string_view name)
+    {
+        if (_changeListener)
+            _changeListener(name);
+    }
+
+    // Variables inherited from the shell's own environment are exported right away.
+    EnvironmentBlock _exported;
+
+  private:
+    ChangeListener _changeListener;
 };
 
 struct PipelineBuilder
@@ -99,63 +149,166 @@ struct PipelineBuilder
     int defaultStdoutFd = STDOUT_FILENO;
     std::optional<UnixPipe> currentPipe = std::nullopt;
 
+    // Buffer size of the pipes between pipeline stages in bytes (0 for the system default).
+    int pipeSize = 0;
+
     auto requestShellPipe(bool lastInChain) -> IODescriptors;
+
+    // Closes the shell's copies of the file descriptors handed to a spawned stage.
+    //
+    // The read end of a pipe must not stay open in the shell, otherwise the upstream stage
+    // would never receive SIGPIPE, and the descriptors would leak.
+    void release(IODescriptors const& descriptors) const noexcept;
 };
 
 inline auto PipelineBuilder::requestShellPipe(bool lastInChain) -> IODescriptors
 {
     int const stdinFd = !currentPipe ? defaultStdinFd : currentPipe->releaseReader();
-    currentPipe = lastInChain ? std::nullopt : std::make_optional<UnixPipe>();
+    currentPipe = lastInChain ? std::nullopt : std::make_optional<UnixPipe>(O_CLOEXEC);
+    if (currentPipe && pipeSize > 0)
+        currentPipe->setCapacity(pipeSize);
     int const stdoutFd = lastInChain ? defaultStdoutFd : currentPipe->writer();
     return IODescriptors { .reader = stdinFd, .writer = stdoutFd };
 }
 
+inline void PipelineBuilder::release(IODescriptors const& descriptors) const noexcept
+{
+    if (descriptors.reader != defaultStdinFd)
+        ::close(descriptors.reader);
+}
+
+// The redirects of a single program call, compiled into the file descriptor actions of its child.
+//
+// Files are opened by the shell (close-on-exec, above all descriptors referenced by the redirects,
+// so that no action can clobber them) and closed again once the child has been spawned.
+struct RedirectTable
+{
+    std::vector<FileAction> actions;
+    std::vector<int> openedFds;
+
+    RedirectTable() = default;
+    RedirectTable(RedirectTable const&) = delete;
+    RedirectTable& operator=(RedirectTable const&) = delete;
+    RedirectTable(RedirectTable&& other) noexcept:
+        actions(std::move(other.actions)), openedFds(std::exchange(other.openedFds, {}))
+    {
+    }
+    RedirectTable& operator=(RedirectTable&&) = delete;
+    ~RedirectTable()
+    {
+        for (int const fd: openedFds)
+            ::close(fd);
+    }
+
+    // Compiles the redirect table as generated by the IRGenerator,
+    // a flat list of (file descriptor, operator, target) triples.
+    //
+    // @throws std::runtime_error if a file cannot be opened or the table is malformed.
+    static RedirectTable compile(CoreVM::CoreStringArray const& table);
+};
+
+inline RedirectTable RedirectTable::compile(CoreVM::CoreStringArray const& table)
+{
+    if (table.size() % 3 != 0)
+        throw std::runtime_error("Malformed redirect table.");
+
+    auto const toFd = [](std::string const& value) -> int {
+        int fd = -1;
+        auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), fd);
+        if (ec != std::errc {} || end != value.data() + value.size() || fd < 0)
+            throw std::runtime_error(fmt::format("Invalid file descriptor '{}'.", value));
+        return fd;
+    };
+
+    int minOpenFd = 10;
+    for (size_t i = 0; i < table.size(); i += 3)
+    {
+        minOpenFd = std::max(minOpenFd, toFd(table[i]) + 1);
+        if (table[i + 1].ends_with('&') && table[i + 2] != "-")
+            minOpenFd = std::max(minOpenFd, toFd(table[i + 2]) + 1);
+    }
+
+    auto result = RedirectTable {};
+    for (size_t i = 0; i < table.size(); i += 3)
+    {
+        int const fd = toFd(table[i]);
+        std::string const& op = table[i + 1];
+        std::string const& target = table[i + 2];
+
+        if (op == "<&" || op == ">&")
+        {
+            result.actions.push_back(FileAction { .fd = fd, .source = target == "-" ? -1 : toFd(target) });
+            continue;
+        }
+
+        int const oflags = op == "<"    ? O_RDONLY
+                           : op == ">>" ? O_WRONLY | O_CREAT | O_APPEND
+                                        : O_WRONLY | O_CREAT | O_TRUNC;
+        int const openedFd = ::open(target.c_str(), oflags | O_CLOEXEC, 0666);
+        if (openedFd == -1)
+            throw std::runtime_error(fmt::format("Failed to open file '{}': {}", target, strerror(errno)));
+
+        int const movedFd = fcntl(openedFd, F_DUPFD_CLOEXEC, minOpenFd);
+        ::close(openedFd);
+        if (movedFd == -1)
+            throw std::runtime_error(fmt::format("Failed to open file '{}': {}", target, strerror(errno)));
+
+        result.openedFds.push_back(movedFd);
+        result.actions.push_back(FileAction { .fd = fd, .source = movedFd });
+    }
+    return result;
+}
+
 export class TestEnvironment: public Environment
 {
   public:
     void set(std::string_view name, std::string_view value) override
     {
         _values[std::string(name)] = std::string(value);
+        if (_exported.contains(name))
+            _exported.set(name, value);
+        notifyChange(name);
     }
     [[nodiscard]] std::optional<std::string_view> get(std::string_view name) const override
     {
-        if (auto i = _values.find(name.data()); i != _values.end())
+        if (auto i = _values.find(name); i != _values.end())
             return i->second;
-        else if (auto const* value = getenv(name.data()))
-            return std::string_view { value };
-        else
-            return std::nullopt;
+        return _exported.get(name);
     }
     void exportVariable(std::string_view name) override
     {
-        if (auto i = _values.find(name.data()); i != _values.end())
-            setenv(name.data(), i->second.data(), 1);
+        if (auto i = _values.find(name); i != _values.end())
+            _exported.set(name, i->second);
+        notifyChange(name);
     }
 
   private:
-    std::map<std::string, std::string> _values;
+    std::map<std::string, std::string, std::less<>> _values;
 };
 
+// Exported variables are not pushed into the shell's own process environment (via setenv()),
+// but passed to child processes explicitly.
 export class SystemEnvironment: public Environment
 {
   public:
     void set(std::string_view name, std::string_view value) override
     {
         _values[std::string(name)] = std::string(value);
+        if (_exported.contains(name))
+            _exported.set(name, value);
+        notifyChange(name);
     }
     [[nodiscard]] std::optional<std::string_view> get(std::string_view name) const override
     {
-        if (auto i = _values.find(name.data()); i != _values.end())
+        if (auto i = _values.find(name); i != _values.end())
             return i->second;
-        else if (auto const* value = getenv(name.data()))
-            return std::string_view { value };
-        else
-            return std::nullopt;
+        return _exported.get(name);
     }
     void exportVariable(std::string_view name) override
     {
-        if (auto i = _values.find(name.data()); i != _values.end())
-            setenv(name.data(), i->second.data(), 1);
+        if (auto i = _values.find(name); i != _values.end())
+            _exported.set(name, i->second);
+        notifyChange(name);
     }
 
     static SystemEnvironment& instance()
@@ -165,9 +318,247 @@ export class SystemEnvironment: public Environment
     }
 
   private:
-    std::map<std::string, std::string> _values;
+    std::map<std::string, std::string, std::less<>> _values;
+};
+
+// Exit status and resource usage of a single process of a pipeline.
+export struct PipelineStage
+{
+    std::string program;
+    std::string command; // program and its arguments, for display purposes
+    pid_t pid = -1;
+    bool terminated = false;
+    bool stopped = false;
+    int wstatus = 0;
+    rusage usage {};
+    std::chrono::steady_clock::time_point started {};
+    std::chrono::steady_clock::time_point finished {};
+
+    // Exit code as it would be reported by $? (128 + N if terminated by signal N).
+    [[nodiscard]] int exitCode() const noexcept
+    {
+        if (WIFEXITED(wstatus))
+            return WEXITSTATUS(wstatus);
+        if (WIFSIGNALED(wstatus))
+            return 128 + WTERMSIG(wstatus);
+        return EXIT_FAILURE;
+    }
+
+    [[nodiscard]] std::chrono::microseconds realTime() const noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(finished - started);
+    }
+
+    [[nodiscard]] std::chrono::microseconds userTime() const noexcept
+    {
+        return std::chrono::seconds(usage.ru_utime.tv_sec) + std::chrono::microseconds(usage.ru_utime.tv_usec);
+    }
+
+    [[nodiscard]] std::chrono::microseconds systemTime() const noexcept
+    {
+        return std::chrono::seconds(usage.ru_stime.tv_sec) + std::chrono::microseconds(usage.ru_stime.tv_usec);
+    }
+};
+
+// A job, i.e. a pipeline whose processes share one process group.
+export struct ProcessGroup
+{
+    int id = 0;                        // job number, as referred to via %N
+    pid_t leader = -1;                 // process group ID (PID of the first stage), or -1 if none
+    std::vector<PipelineStage> stages; // processes of the pipeline, in pipeline order
+
+    [[nodiscard]] bool done() const noexcept
+    {
+        return std::ranges::all_of(stages, [](PipelineStage const& stage) { return stage.terminated; });
+    }
+
+    [[nodiscard]] bool stopped() const noexcept
+    {
+        return !done() && std::ranges::any_of(stages, [](PipelineStage const& stage) { return stage.stopped; });
+    }
+
+    [[nodiscard]] int exitCode() const noexcept { return stages.empty() ? 0 : stages.back().exitCode(); }
+
+    // Returns the job's state as displayed by the "jobs" builtin.
+    [[nodiscard]] std::string status() const
+    {
+        if (done())
+            return exitCode() == 0 ? "Done" : fmt::format("Exit {}", exitCode());
+        if (stopped())
+            return "Stopped";
+        return "Running";
+    }
+
+    [[nodiscard]] std::string command() const
+    {
+        std::string result;
+        for (PipelineStage const& stage: stages)
+        {
+            if (!result.empty())
+                result += " | ";
+            result += stage.command;
+        }
+        return result;
+    }
+};
+
+// Command line options of the "parallel" builtin.
+struct ParallelOptions
+{
+    size_t maxJobs = std::max(1u, std::thread::hardware_concurrency());
+    bool unordered = false;
+    bool report = false;
+    bool readInputsFromStdin = true;
+    std::vector<std::string> commandTemplate;
+    std::vector<std::string> inputs;
+
+    // @throws std::invalid_argument on invalid command lines.
+    static ParallelOptions parse(CoreVM::CoreStringArray const& args)
+    {
+        auto options = ParallelOptions {};
+        size_t i = 0;
+        for (; i < args.size() && args[i].starts_with('-'); ++i)
+        {
+            if (args[i] == "-j" || args[i] == "--jobs")
+            {
+                if (i + 1 == args.size() || std::atoi(args[i + 1].c_str()) <= 0)
+                    throw std::invalid_argument { fmt::format("{} expects a positive number", args[i]) };
+                options.maxJobs = static_cast<size_t>(std::atoi(args[++i].c_str()));
+            }
+            else if (args[i] == "--unordered")
+                options.unordered = true;
+            else if (args[i] == "-k" || args[i] == "--keep-order")
+                options.unordered = false;
+            else if (args[i] == "--report")
+                options.report = true;
+            else
+                throw std::invalid_argument { fmt::format("unknown option {}", args[i]) };
+        }
+
+        for (; i < args.size() && args[i] != ":::"; ++i)
+            options.commandTemplate.push_back(args[i]);
+
+        if (options.commandTemplate.empty())
+            throw std::invalid_argument { "missing command" };
+
+        if (i < args.size())
+        {
+            options.readInputsFromStdin = false;
+            for (++i; i < args.size(); ++i)
+                expandGlob(args[i], options.inputs);
+        }
+
+        return options;
+    }
+
+    // Instantiates the command template for the given input.
+    [[nodiscard]] CoreVM::CoreStringArray expandTemplate(std::string const& input) const
+    {
+        auto args = CoreVM::CoreStringArray {};
+        bool substituted = false;
+        for (std::string const& arg: commandTemplate)
+        {
+            auto expanded = std::string {};
+            for (size_t offset = 0;;)
+            {
+                auto const placeholder = arg.find("{}", offset);
+                expanded += arg.substr(offset, placeholder - offset);
+                if (placeholder == std::string::npos)
+                    break;
+                expanded += input;
+                substituted = true;
+                offset = placeholder + 2;
+            }
+            args.emplace_back(std::move(expanded));
+        }
+        if (!substituted)
+            args.push_back(input);
+        return args;
+    }
+
+  private:
+    static void expandGlob(std::string const& pattern, std::vector<std::string>& output)
+    {
+        glob_t matches {};
+        if (pattern.find_first_of("*?[") != std::string::npos
+            && glob(pattern.c_str(), 0, nullptr, &matches) == 0)
+        {
+            for (size_t i = 0; i < matches.gl_pathc; ++i)
+                output.emplace_back(matches.gl_pathv[i]);
+        }
+        else
+            output.push_back(pattern);
+        globfree(&matches);
+    }
+};
+
+// State of a process substitution, <(command), while its command is being spawned.
+struct ProcessSubstitution
+{
+    UnixPipe pipe;
+    int savedStdoutFd = STDOUT_FILENO;
+    std::optional<UnixPipe> savedPipe;
+};
+
+// Read end of a completed process substitution, to be handed to the program call it is an argument of.
+struct PendingSubstitution
+{
+    size_t depth = 0; // number of enclosing process substitutions
+    FileAction action;
+};
+
+// State of a command substitution, $(command), while its command is being run,
+// along with the state of the enclosing command, which is restored afterwards.
+struct CommandCapture
+{
+    UnixPipe pipe;
+    std::string output;
+    int savedStdoutFd = STDOUT_FILENO;
+    std::optional<UnixPipe> savedPipe;
+    ProcessGroup savedJob;
+    bool savedRunInBackground = false;
+    std::vector<ProcessSubstitution> savedSubstitutions;
+    std::vector<PendingSubstitution> savedSubstitutionFds;
+};
+
+// Pipe buffer size used for capturing the output of command substitutions.
+auto constexpr CapturePipeSize = 1024 * 1024;
+
+// State of a single job of the "parallel" builtin.
+struct ParallelJob
+{
+    ptrdiff_t stage = -1;    // index into the current job's stages
+    pid_t processGroup = -1; // process group the job was placed into, or -1 if none
+    int outputFd = -1;       // read end of the job's stdout, until EOF
+    std::string output;      // captured output not yet written
+    bool started = false;
+    bool reaped = false;
+    bool written = false;
+    bool streaming = false; // next in line with nothing buffered, so its output is forwarded right away
 };
 
+// Reads all lines from @p fd until EOF.
+std::vector<std::string> readLines(int fd)
+{
+    auto lines = std::vector<std::string> {};
+    auto data = std::string {};
+    char buffer[4096];
+    while (true)
+    {
+        ssize_t const n = ::read(fd, buffer, sizeof(buffer));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        data.append(buffer, static_cast<size_t>(n));
+    }
+
+    for (auto const line: crispy::split(data, '\n'))
+        if (!line.empty())
+            lines.emplace_back(line);
+    return lines;
+}
+
 export class Shell final: public CoreVM::Runtime
 {
   public:
@@ -178,8 +569,30 @@ export class Shell final: public CoreVM::Runtime
         _currentPipelineBuilder.defaultStdinFd = _tty.inputFd();
         _currentPipelineBuilder.defaultStdoutFd = _tty.outputFd();
 
+        _env.setChangeListener([this](std::string_view name) {
+            if (name == "PATH")
+                _commandHash.clear();
+            else if (name == "ENDO_PIPE_SIZE")
+                _currentPipelineBuilder.pipeSize = std::atoi(std::string(_env.get(name).value_or("0")).c_str());
+        });
         _env.setAndExport("SHELL", "endo");
 
+        // Descriptors the shell inherited must not leak into its children either.
+        setInheritedDescriptorsCloseOnExec();
+
+        if (int const fd = _commandHash.notificationFd(); fd != -1)
+            _eventLoop.watchFd(fd, [this](int) { _commandHash.processNotifications(); }, true);
+
+        // Job control is only available if we are in the foreground of the controlling terminal.
+        _jobControl = isatty(_tty.inputFd()) && tcgetpgrp(_tty.inputFd()) == getpgrp();
+        if (_jobControl)
+        {
+            signal(SIGTSTP, SIG_IGN);
+            signal(SIGTTIN, SIG_IGN);
+            signal(SIGTTOU, SIG_IGN);
+            _eventLoop.setReportStops(true);
+        }
+
         // NB: These lines could go away once we have a proper command line parser and
         //     the ability to set these options from the command line.
         registerBuiltinFunctions();
@@ -188,15 +601,53 @@ export class Shell final: public CoreVM::Runtime
         //      fmt::print("builtin: {}\n", callback->signature().to_s());
     }
 
+    ~Shell() override { _env.setChangeListener({}); }
+
     [[nodiscard]] Environment& environment() noexcept { return _env; }
     [[nodiscard]] Environment const& environment() const noexcept { return _env; }
 
+    [[nodiscard]] CommandHash& commandHash() noexcept { return _commandHash; }
+    [[nodiscard]] CommandHash const& commandHash() const noexcept { return _commandHash; }
+
     void setOptimize(bool optimize) { _optimize = optimize; }
 
+    // Returns the program of this shell's session, if anything was executed yet.
+    [[nodiscard]] CoreVM::Program const* program() const noexcept { return _currentProgram.get(); }
+
+    // Returns all processes of the most recently completed pipeline.
+    [[nodiscard]] std::vector<PipelineStage> const& lastPipeline() const noexcept { return _lastPipeline; }
+
+    // Returns all background and stopped jobs.
+    [[nodiscard]] std::vector<ProcessGroup> const& jobs() const noexcept { return processGroups; }
+
+    [[nodiscard]] bool jobControl() const noexcept { return _jobControl; }
+
+    // Reports (and forgets) all background jobs that terminated since the last notification.
+    void notifyJobs()
+    {
+        _eventLoop.runOnce(0);
+
+        std::erase_if(processGroups, [this](ProcessGroup const& job) {
+            if (!job.done())
+                return false;
+            _tty.writeToStdout("[{}]  {:<24}{}\n", job.id, job.status(), job.command());
+            return true;
+        });
+    }
+
+    // Sets the buffer size of pipes between pipeline stages (also settable via $ENDO_PIPE_SIZE).
+    void setPipeSize(int size) noexcept { _currentPipelineBuilder.pipeSize = size; }
+    [[nodiscard]] int pipeSize() const noexcept { return _currentPipelineBuilder.pipeSize; }
+
+    void setSpawnMethod(SpawnMethod method) noexcept { _spawnMethod = method; }
+    [[nodiscard]] SpawnMethod spawnMethod() const noexcept { return _spawnMethod; }
+
     int run()
     {
         while (!_quit && prompt.ready())
         {
+            notifyJobs();
+
             auto const lineBuffer = prompt.read();
             debugLog()("input buffer: {}", lineBuffer);
 
@@ -206,81 +657,219 @@ export class Shell final: public CoreVM::Runtime
 
         return _quit ? _exitCode : EXIT_SUCCESS;
     }
-    int execute(std::string const& lineBuffer)
+    int execute(std::string const& lineBuffer) { return execute(std::make_unique<StringSource>(lineBuffer)); }
+
+    // Executes the script file at @p path (see MappedFileSource).
+    int executeScript(std::string const& path)
     {
+        std::unique_ptr<MappedFileSource> source;
         try
         {
-            CoreVM::diagnostics::ConsoleReport report;
-            auto parser = endo::Parser(*this, report, std::make_unique<endo::StringSource>(lineBuffer));
-            auto const rootNode = parser.parse();
-            if (!rootNode)
-            {
-                error("Failed to parse input");
-                return EXIT_FAILURE;
-            }
+            source = std::make_unique<MappedFileSource>(path);
+        }
+        catch (std::system_error const& e)
+        {
+            error("endo: {}", e.what());
+            return 127;
+        }
+
+        if (!_bytecodeCache)
+            return execute(std::move(source));
 
-            debugLog()("Parsed & printed: {}", endo::ast::ASTPrinter::print(*rootNode));
+        resetExecutionState();
 
-            CoreVM::IRProgram* irProgram = IRGenerator::generate(*rootNode);
-            if (irProgram == nullptr)
+        try
+        {
+            CoreVM::diagnostics::BufferedReport linkReport;
+            auto const key = BytecodeCache::keyOf(source->contents(), _optimize, *this);
+            auto program = _bytecodeCache->load(key);
+            if (program && !program->link(this, &linkReport))
             {
-                error("Failed to generate IR program");
-                return EXIT_FAILURE;
+                // e.g. a native callback changed without the cache key reflecting it
+                _bytecodeCache->reject(key);
+                program = nullptr;
             }
-
-            if (_optimize)
+            if (!program)
             {
-                CoreVM::PassManager pm;
-
-                // clang-format off
-            pm.registerPass("eliminate-empty-blocks", &CoreVM::transform::emptyBlockElimination);
-            pm.registerPass("eliminate-linear-br", &CoreVM::transform::eliminateLinearBr);
-            pm.registerPass("eliminate-unused-blocks", &CoreVM::transform::eliminateUnusedBlocks);
-            pm.registerPass("eliminate-unused-instr", &CoreVM::transform::eliminateUnusedInstr);
-            pm.registerPass("fold-constant-condbr", &CoreVM::transform::foldConstantCondBr);
-            pm.registerPass("rewrite-br-to-exit", &CoreVM::transform::rewriteBrToExit);
-            pm.registerPass("rewrite-cond-br-to-same-branches", &CoreVM::transform::rewriteCondBrToSameBranches);
-                // clang-format on
-
-                pm.run(irProgram);
+                program = compile(std::move(source));
+                if (!program)
+                    return EXIT_FAILURE;
+                _bytecodeCache->store(key, program->constants());
             }
+            return run(std::move(program));
+        }
+        catch (std::exception const& e)
+        {
+            error("Exception caught: {}", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Enables caching of compiled scripts in @p directory (see BytecodeCache).
+    void setBytecodeCache(std::filesystem::path directory) { _bytecodeCache.emplace(std::move(directory)); }
+    [[nodiscard]] BytecodeCache const* bytecodeCache() const noexcept
+    {
+        return _bytecodeCache ? &*_bytecodeCache : nullptr;
+    }
+
+    // Sets $0 (the script or shell name) and the positional parameters $1..$N, as well as $#.
+    void setPositionalParameters(std::vector<std::string> parameters)
+    {
+        _positionalParameters = std::move(parameters);
+    }
 
-            debugLog()("================================================\n");
-            debugLog()("Optimized IR program:\n");
-            if (debugLog.is_enabled())
-                irProgram->dump();
+    // Executes @p source within this shell's session.
+    //
+    // The compiled program is kept alive across calls, and each call only generates code for
+    // its own input into it, sharing the constants and linked native callbacks of earlier calls.
+    int execute(std::unique_ptr<Source> source)
+    {
+        resetExecutionState();
 
-            _currentProgram = CoreVM::TargetCodeGenerator {}.generate(irProgram);
-            if (!_currentProgram)
-            {
-                error("Failed to generate target code");
+        try
+        {
+            auto const irProgram = generateIR(std::move(source));
+            if (!irProgram)
                 return EXIT_FAILURE;
-            }
-            _currentProgram->link(this, &report);
 
-            debugLog()("================================================\n");
-            debugLog()("Linked target code:\n");
-            if (debugLog.is_enabled())
-                _currentProgram->dump();
+            if (!_currentProgram)
+                _currentProgram = generateTargetCode(irProgram.get());
+            else
+                CoreVM::TargetCodeGenerator {}.generate(irProgram.get(), *_currentProgram);
 
-            CoreVM::Handler* main = _currentProgram->findHandler("@main");
-            assert(main != nullptr);
-            auto runner =
-                CoreVM::Runner(main, nullptr, &_globals, std::bind(&Shell::trace, this, _1, _2, _3));
-            _runner = &runner;
-            runner.run();
-            return _exitCode;
+            if (!_currentProgram)
+                return EXIT_FAILURE;
+            return run();
         }
         catch (std::exception const& e)
         {
             error("Exception caught: {}", e.what());
             return EXIT_FAILURE;
         }
+    }
+
+  private:
+    // Discards any state left behind by a previously aborted program.
+    void resetExecutionState()
+    {
+        _runInBackground = false;
+        _pendingFunctions.clear();
+        while (!_captures.empty())
+            endCapture();
+        while (!_substitutions.empty())
+            ::close(endProcessSubstitution());
+        discardPendingCallState();
+    }
+
+    // Compiles @p source into a program of its own, reporting errors and returning nullptr on failure.
+    std::unique_ptr<CoreVM::Program> compile(std::unique_ptr<Source> source)
+    {
+        auto const irProgram = generateIR(std::move(source));
+        if (!irProgram)
+            return nullptr;
+        return generateTargetCode(irProgram.get());
+    }
+
+    std::unique_ptr<CoreVM::Program> generateTargetCode(CoreVM::IRProgram* irProgram)
+    {
+        auto program = CoreVM::TargetCodeGenerator {}.generate(irProgram);
+        if (!program)
+            error("Failed to generate target code");
+        return program;
+    }
+
+    // Parses @p source and lowers it into an (optionally optimized) IR program.
+    std::unique_ptr<CoreVM::IRProgram> generateIR(std::unique_ptr<Source> source)
+    {
+        CoreVM::diagnostics::ConsoleReport report;
+        auto parser = endo::Parser(*this, report, std::move(source), &_functions);
+        auto const rootNode = parser.parse();
+        if (!rootNode)
+        {
+            error("Failed to parse input");
+            return nullptr;
+        }
+
+        debugLog()("Parsed & printed: {}", endo::ast::ASTPrinter::print(*rootNode));
+
+        auto irProgram = std::unique_ptr<CoreVM::IRProgram>(IRGenerator::generate(*rootNode));
+        if (!irProgram)
+        {
+            error("Failed to generate IR program");
+            return nullptr;
+        }
+
+        // Only made known to later inputs once the program defining them ran, see run().
+        _pendingFunctions = parser.definedFunctions();
+
+        if (_optimize)
+        {
+            CoreVM::PassManager pm;
+
+            // clang-format off
+            using enum CoreVM::PassManager::Changes;
+            pm.registerPass("eliminate-empty-blocks", &CoreVM::transform::emptyBlockElimination, AnyChanges, AnyChanges);
+            pm.registerPass("eliminate-linear-br", &CoreVM::transform::eliminateLinearBr, AnyChanges, ControlFlow);
+            pm.registerPass("eliminate-unused-blocks", &CoreVM::transform::eliminateUnusedBlocks, AnyChanges, ControlFlow);
+            pm.registerPass("eliminate-unused-instr", &CoreVM::transform::eliminateUnusedInstr, Instructions, Instructions);
+            pm.registerPass("propagate-constants", &CoreVM::transform::propagateConstants, AnyChanges, AnyChanges);
+            pm.registerPass("fuse-string-concatenations", &CoreVM::transform::fuseStringConcatenations, Instructions, Instructions);
+            pm.registerPass("fold-constant-condbr", &CoreVM::transform::foldConstantCondBr, AnyChanges, Instructions);
+            pm.registerPass("rewrite-br-to-exit", &CoreVM::transform::rewriteBrToExit, AnyChanges, AnyChanges);
+            pm.registerPass("rewrite-cond-br-to-same-branches", &CoreVM::transform::rewriteCondBrToSameBranches, AnyChanges, ControlFlow);
+            // clang-format on
+
+            pm.run(irProgram.get());
+        }
+
+        debugLog()("================================================\n");
+        debugLog()("Optimized IR program:\n");
+        if (debugLog.is_enabled())
+            irProgram->dump();
+
+        return irProgram;
+    }
+
+    // Links @p program against this shell and runs it.
+    int run(std::unique_ptr<CoreVM::Program> program)
+    {
+        _currentProgram = std::move(program);
+        return run();
+    }
+
+    // Links the current program against this shell (resolving only what is new to it) and runs it.
+    int run()
+    {
+        CoreVM::diagnostics::ConsoleReport report;
+        if (!_currentProgram->link(this, &report))
+        {
+            error("Failed to link program");
+            return EXIT_FAILURE;
+        }
+
+        debugLog()("================================================\n");
+        debugLog()("Linked target code:\n");
+        if (debugLog.is_enabled())
+            _currentProgram->dump();
+
+        CoreVM::Handler* main = _currentProgram->findHandler("@main");
+        assert(main != nullptr);
+        auto runner =
+            CoreVM::Runner(main, nullptr, &_globals, std::bind(&Shell::trace, this, _1, _2, _3));
+        _runner = &runner;
+        runner.run();
 
-        return EXIT_SUCCESS;
+        // Functions remain callable by later inputs, as their handlers are kept in the current program.
+        for (auto const& [name, signature]: std::exchange(_pendingFunctions, {}))
+            _functions.insert_or_assign(name, signature);
+
+        return _exitCode;
     }
 
+  public:
     Prompt prompt;
+
+    // Background and stopped jobs, ordered by job number.
     std::vector<ProcessGroup> processGroups;
 
   private:
@@ -328,17 +917,37 @@ export class Shell final: public CoreVM::Runtime
 
     registerFunction("callproc")
         .param<std::vector<std::string>>("args")
-        //.param<std::vector<CoreVM::CoreNumber>>("redirects")
         .returnType(CoreVM::LiteralType::Number)
         .bind(&Shell::builtinCallProcess, this);
 
+    registerFunction("callproc")
+        .param<std::vector<std::string>>("args")
+        .param<std::vector<std::string>>("redirects")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinCallProcess, this);
+
+    registerFunction("callproc")
+        .param<bool>("last_in_chain")
+        .param<std::vector<std::string>>("args")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinCallProcessShellPiped, this);
+
     registerFunction("callproc")
         .param<bool>("last_in_chain")
         .param<std::vector<std::string>>("args")
-        //.param<std::vector<CoreVM::CoreNumber>>("redirects")
+        .param<std::vector<std::string>>("redirects")
         .returnType(CoreVM::LiteralType::Number)
         .bind(&Shell::builtinCallProcessShellPiped, this);
 
+    registerFunction("hash")
+        .returnType(CoreVM::LiteralType::Boolean)
+        .bind(&Shell::builtinHashList, this);
+
+    registerFunction("hash")
+        .param<std::vector<std::string>>("args")
+        .returnType(CoreVM::LiteralType::Boolean)
+        .bind(&Shell::builtinHash, this);
+
     registerFunction("read")
         .returnType(CoreVM::LiteralType::String)
         .bind(&Shell::builtinReadDefault, this);
@@ -348,32 +957,121 @@ export class Shell final: public CoreVM::Runtime
         .returnType(CoreVM::LiteralType::String)
         .bind(&Shell::builtinRead, this);
 
-    // used to redirect file to stdin
-    registerFunction("internal.open_read")
-        .param<std::string>("path")
+    registerFunction("jobs")
+        .returnType(CoreVM::LiteralType::Boolean)
+        .bind(&Shell::builtinJobs, this);
+
+    registerFunction("fg")
         .returnType(CoreVM::LiteralType::Number)
-        .bind(&Shell::builtinOpenRead, this);
+        .bind(&Shell::builtinForeground, this);
 
-    // used for redirecting output to a file
-    registerFunction("internal.open_write")
-        .param<std::string>("path")
-        .param<CoreVM::CoreNumber>("oflags")
+    registerFunction("fg")
+        .param<std::vector<std::string>>("job")
         .returnType(CoreVM::LiteralType::Number)
-        .bind(&Shell::builtinOpenWrite, this);
-        // clang-format on
-    }
+        .bind(&Shell::builtinForeground, this);
 
-    // builtins that match to shell commands
-    void builtinExit(CoreVM::Params& context)
-    {
-        _exitCode = static_cast<int>(context.getInt(1));
+    registerFunction("bg")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinBackground, this);
+
+    registerFunction("bg")
+        .param<std::vector<std::string>>("job")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinBackground, this);
+
+    registerFunction("wait")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinWait, this);
+
+    registerFunction("wait")
+        .param<std::vector<std::string>>("jobs")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinWait, this);
+
+    registerFunction("parallel")
+        .param<std::vector<std::string>>("args")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinParallel, this);
+
+    // used to run the following pipeline as background job ("&" suffix)
+    registerFunction("internal.background")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinRunInBackground, this);
+    registerFunction("internal.background_end")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinEndRunInBackground, this);
+
+    // used to implement process substitution, <(command)
+    registerFunction("internal.subst_begin")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinBeginProcessSubstitution, this);
+
+    registerFunction("internal.subst_end")
+        .param<CoreVM::CoreNumber>("fd")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinEndProcessSubstitution, this);
+
+    // used to implement command substitution, $(command)
+    registerFunction("internal.capture_begin")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinBeginCapture, this);
+
+    registerFunction("internal.capture_end")
+        .returnType(CoreVM::LiteralType::String)
+        .bind(&Shell::builtinEndCapture, this);
+
+    // used to pass non-constant arguments to the following program call
+    registerFunction("internal.argument")
+        .param<std::string>("value")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinStageArgument, this);
+
+    // used to expand $NAME, $0..$9, $# and $?
+    registerFunction("internal.variable")
+        .param<std::string>("name")
+        .returnType(CoreVM::LiteralType::String)
+        .bind(&Shell::builtinVariable, this);
+
+    // used to export NAME=VALUE assignments to the following program call only
+    registerFunction("internal.environment")
+        .param<std::vector<std::string>>("assignments")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinEnvironmentOverrides, this);
+
+    registerFunction("time")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinTime, this);
+
+    // used to print the timings after the command passed to "time" completed
+    registerFunction("internal.time_report")
+        .returnType(CoreVM::LiteralType::Void)
+        .bind(&Shell::builtinTimeReport, this);
+
+    // used to redirect file to stdin
+    registerFunction("internal.open_read")
+        .param<std::string>("path")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinOpenRead, this);
+
+    // used for redirecting output to a file
+    registerFunction("internal.open_write")
+        .param<std::string>("path")
+        .param<CoreVM::CoreNumber>("oflags")
+        .returnType(CoreVM::LiteralType::Number)
+        .bind(&Shell::builtinOpenWrite, this);
+        // clang-format on
+    }
+
+    // builtins that match to shell commands
+    void builtinExit(CoreVM::Params& context)
+    {
+        _exitCode = static_cast<int>(context.getInt(1));
         _runner->suspend();
         _quit = true;
     }
     void builtinCallProcess(CoreVM::Params& context)
     {
-        CoreVM::CoreStringArray const& args = context.getStringArray(1);
-        std::vector<char const*> const argv = constructArgv(args);
+        CoreVM::CoreStringArray const& args = programArguments(context.getStringArray(1));
         std::string const& program = args.at(0);
         std::optional<std::filesystem::path> const programPath = resolveProgram(program);
 
@@ -383,121 +1081,342 @@ export class Shell final: public CoreVM::Runtime
         if (!programPath.has_value())
         {
             error("Failed to resolve program '{}'", program);
+            discardPendingCallState();
             context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
             return;
         }
 
-        // TODO: setup redirects
-        // CoreVM::CoreIntArray const& outputRedirects = context.getIntArray(1);
-        // for (size_t i = 0; i + 2 < outputRedirects.size(); i += 2)
-        //     debugLog()("redirect: {} -> {}\n", outputRedirects[i], outputRedirects[i + 1]);
+        auto redirects = compileRedirects(context, 2);
+        if (!redirects)
+        {
+            discardPendingCallState();
+            context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
+            return;
+        }
 
-        pid_t const pid = fork();
-        switch (pid)
+        auto const spawned = spawn(program,
+                                   SpawnRequest { .program = *programPath,
+                                                  .argv = constructArgv(args),
+                                                  .stdinFd = stdinFd,
+                                                  .stdoutFd = stdoutFd,
+                                                  .processGroup = nextProcessGroup(),
+                                                  .foregroundTerminal = nextForegroundTerminal(),
+                                                  .fileActions = std::move(redirects->actions) });
+        if (!spawned.good())
         {
-            case -1:
-                error("Failed to fork(): {}", strerror(errno));
-                context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
-                return;
-            case 0: {
-                // child process
-                if (stdinFd != STDIN_FILENO)
-                    dup2(stdinFd, STDIN_FILENO);
-                if (stdoutFd != STDOUT_FILENO)
-                    dup2(stdoutFd, STDOUT_FILENO);
-                execvp(programPath->c_str(), const_cast<char* const*>(argv.data()));
-                error("Failed to execve({}): {}", programPath->string(), strerror(errno));
-                _exit(EXIT_FAILURE);
-            }
-            default:
-                // parent process
-                int wstatus = 0;
-                waitpid(pid, &wstatus, 0);
-                if (WIFSIGNALED(wstatus))
-                    error("child process exited with signal {}", WTERMSIG(wstatus));
-                else if (WIFEXITED(wstatus))
-                    error("child process exited with code {}", _exitCode = WEXITSTATUS(wstatus));
-                else if (WIFSTOPPED(wstatus))
-                    error("child process stopped with signal {}", WSTOPSIG(wstatus));
-                else
-                    error("child process exited with unknown status {}", wstatus);
-                break;
+            context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
+            return;
         }
 
+        addPipelineStage(args, spawned.pid);
+        finishPipeline();
+
         context.setResult(CoreVM::CoreNumber(_exitCode));
     }
     void builtinCallProcessShellPiped(CoreVM::Params& context)
     {
         bool const lastInChain = context.getBool(1);
-        CoreVM::CoreStringArray const& args = context.getStringArray(2);
+        CoreVM::CoreStringArray const& args = programArguments(context.getStringArray(2));
 
-        std::vector<char const*> const argv = constructArgv(args);
         std::string const& program = args.at(0);
         std::optional<std::filesystem::path> const programPath = resolveProgram(program);
 
         if (!programPath.has_value())
         {
             error("Failed to resolve program '{}'", program);
+            discardPendingCallState();
             context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
             return;
         }
 
-        auto const [stdinFd, stdoutFd] = _currentPipelineBuilder.requestShellPipe(lastInChain);
+        auto const descriptors = _currentPipelineBuilder.requestShellPipe(lastInChain);
+        auto const [stdinFd, stdoutFd] = descriptors;
+
+        auto redirects = compileRedirects(context, 3);
+        auto const spawned = !redirects ? SpawnResult {}
+                                        : spawn(program,
+                                                SpawnRequest { .program = *programPath,
+                                                               .argv = constructArgv(args),
+                                                               .stdinFd = stdinFd,
+                                                               .stdoutFd = stdoutFd,
+                                                               .processGroup = nextProcessGroup(),
+                                                               .foregroundTerminal = nextForegroundTerminal(),
+                                                               .fileActions = std::move(redirects->actions) });
+        _currentPipelineBuilder.release(descriptors);
+        discardPendingCallState();
+        if (spawned.good())
+        {
+            _leftPid = _rightPid;
+            _rightPid = spawned.pid;
+            addPipelineStage(args, spawned.pid);
+        }
+
+        if (lastInChain)
+        {
+            finishPipeline();
+            _leftPid = std::nullopt;
+            _rightPid = std::nullopt;
+        }
+
+        context.setResult(CoreVM::CoreNumber(spawned.good() ? _exitCode : EXIT_FAILURE));
+    }
 
-        // TODO: setup redirects
-        // CoreVM::CoreIntArray const& outputRedirects = context.getIntArray(1);
-        // for (size_t i = 0; i + 2 < outputRedirects.size(); i += 2)
-        //     debugLog()("redirect: {} -> {}\n", outputRedirects[i], outputRedirects[i + 1]);
+    // Compiles the optional redirect table argument at position @p index of a callproc builtin.
+    //
+    // @returns std::nullopt (after reporting the error) if the redirects cannot be set up.
+    [[nodiscard]] std::optional<RedirectTable> compileRedirects(CoreVM::Params& context, int index)
+    {
+        if (context.count() < index)
+            return RedirectTable {};
 
-        pid_t const pid = fork();
-        switch (pid)
+        try
         {
-            case -1:
-                error("Failed to fork(): {}", strerror(errno));
-                context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
-                return;
-            case 0: {
-                // child process
-                setpgid(0, !_currentProcessGroupPids.empty() ? _currentProcessGroupPids.front() : 0);
-                if (stdinFd != STDIN_FILENO)
-                    dup2(stdinFd, STDIN_FILENO);
-                if (stdoutFd != STDOUT_FILENO)
-                    dup2(stdoutFd, STDOUT_FILENO);
-                execvp(programPath->c_str(), const_cast<char* const*>(argv.data()));
-                error("Failed to execve({}): {}", programPath->string(), strerror(errno));
-                _exit(EXIT_FAILURE);
-            }
-            default:
-                // parent process
-                _leftPid = _rightPid;
-                _rightPid = pid;
-                _currentProcessGroupPids.push_back(pid);
-                if (lastInChain)
-                {
-                    // This is the last process in the chain, so we need to wait for all
-                    for (pid_t const pid: _currentProcessGroupPids)
-                    {
-                        int wstatus = 0;
-                        waitpid(pid, &wstatus, 0);
-                        if (WIFSIGNALED(wstatus))
-                            error("child process {}, exited with signal {}", pid, WTERMSIG(wstatus));
-                        else if (WIFEXITED(wstatus))
-                            error("child process {} exited with code {}",
-                                  pid,
-                                  _exitCode = WEXITSTATUS(wstatus));
-                        else if (WIFSTOPPED(wstatus))
-                            error("child process {} stopped with signal {}", pid, WSTOPSIG(wstatus));
-                        else
-                            error("child process {} exited with unknown status {}", pid, wstatus);
-                    }
-                    _currentProcessGroupPids.clear();
-                    _leftPid = std::nullopt;
-                    _rightPid = std::nullopt;
-                }
-                break;
+            return RedirectTable::compile(context.getStringArray(index));
         }
+        catch (std::runtime_error const& e)
+        {
+            error("{}", e.what());
+            return std::nullopt;
+        }
+    }
 
-        context.setResult(CoreVM::CoreNumber(_exitCode));
+    // Returns the process group the next spawned pipeline stage is to be placed into.
+    //
+    // Jobs get their own process group if job control is enabled or if they are run in
+    // the background, so that terminal generated signals are only delivered to the foreground job.
+    [[nodiscard]] pid_t nextProcessGroup() const noexcept
+    {
+        if ((!_jobControl && !_runInBackground) || !_substitutions.empty())
+            return -1;
+        return _currentJob.stages.empty() ? 0 : _currentJob.stages.front().pid;
+    }
+
+    // Returns the terminal the next spawned pipeline stage is to take over, or -1 if none.
+    //
+    // The leader of a foreground job takes over the terminal right in the child, so that no stage
+    // of the job is stopped by SIGTTIN for reading from it before the shell handed it over.
+    [[nodiscard]] int nextForegroundTerminal() const noexcept
+    {
+        if (!_jobControl || _runInBackground || nextProcessGroup() != 0)
+            return -1;
+        return _tty.inputFd();
+    }
+
+    // Appends the spawned child process @p pid to the current pipeline
+    // and lets the event loop record its exit status and resource usage once it terminated.
+    void addPipelineStage(CoreVM::CoreStringArray const& args, pid_t pid)
+    {
+        if (!_substitutions.empty())
+        {
+            // Producers of a process substitution are not part of any job,
+            // they are only being reaped once they terminated.
+            _eventLoop.watchProcess(pid, {});
+            return;
+        }
+
+        if (_currentJob.stages.empty() && nextProcessGroup() == 0)
+        {
+            _currentJob.leader = pid;
+            // Also done by the child, whichever comes first.
+            if (!_runInBackground)
+                setForegroundProcessGroup(pid);
+        }
+
+        _currentJob.stages.emplace_back(PipelineStage { .program = args.at(0),
+                                                        .command = formatCommandLine(args),
+                                                        .pid = pid,
+                                                        .started = std::chrono::steady_clock::now() });
+
+        _eventLoop.watchProcess(pid, [this](pid_t pid, int wstatus, rusage const& usage) {
+            processStatusChanged(pid, wstatus, usage);
+        });
+    }
+
+    [[nodiscard]] PipelineStage* findPipelineStage(pid_t pid) noexcept
+    {
+        auto const findIn = [pid](ProcessGroup& job) -> PipelineStage* {
+            for (PipelineStage& stage: job.stages)
+                if (stage.pid == pid && !stage.terminated)
+                    return &stage;
+            return nullptr;
+        };
+
+        if (auto* stage = findIn(_currentJob))
+            return stage;
+        for (ProcessGroup& job: processGroups)
+            if (auto* stage = findIn(job))
+                return stage;
+        return nullptr;
+    }
+
+    void processStatusChanged(pid_t pid, int wstatus, rusage const& usage)
+    {
+        PipelineStage* stage = findPipelineStage(pid);
+        if (!stage)
+            return;
+
+        if (WIFSTOPPED(wstatus))
+        {
+            stage->stopped = true;
+            stage->wstatus = wstatus;
+            return;
+        }
+
+        if (WIFCONTINUED(wstatus))
+        {
+            stage->stopped = false;
+            return;
+        }
+
+        stage->stopped = false;
+        stage->terminated = true;
+        stage->wstatus = wstatus;
+        stage->usage = usage;
+        stage->finished = std::chrono::steady_clock::now();
+    }
+
+    // Completes the current pipeline, i.e. either puts it into the background or waits for it.
+    void finishPipeline()
+    {
+        if (!_substitutions.empty())
+            return; // runs concurrently to the program receiving its output
+
+        if (!std::exchange(_runInBackground, false) || _currentJob.stages.empty())
+        {
+            waitForForegroundJob();
+            return;
+        }
+
+        auto& job = processGroups.emplace_back(std::exchange(_currentJob, ProcessGroup {}));
+        job.id = nextJobId();
+        _tty.writeToStdout("[{}] {}\n", job.id, job.stages.back().pid);
+        _env.set("!", std::to_string(job.stages.back().pid));
+        _exitCode = EXIT_SUCCESS;
+    }
+
+    [[nodiscard]] int nextJobId() const noexcept
+    {
+        int id = 1;
+        for (ProcessGroup const& job: processGroups)
+            id = std::max(id, job.id + 1);
+        return id;
+    }
+
+    // Hands the terminal over to the process group @p pgid (if job control is enabled).
+    void setForegroundProcessGroup(pid_t pgid) const noexcept
+    {
+        if (_jobControl && pgid > 0 && tcsetpgrp(_tty.inputFd(), pgid) == -1)
+            debugLog()("tcsetpgrp({}) failed: {}", pgid, strerror(errno));
+    }
+
+    // Waits for all stages of the current job to terminate (or the job to be stopped).
+    //
+    // The children are being reaped in whatever order they terminate,
+    // but reported in pipeline order. The exit code of the last stage becomes the shell's
+    // exit code, and the exit codes of all stages are exposed via $PIPESTATUS.
+    void waitForForegroundJob()
+    {
+        setForegroundProcessGroup(_currentJob.leader);
+        _eventLoop.runUntil([&]() { return _currentJob.done() || _currentJob.stopped(); });
+        setForegroundProcessGroup(getpgrp());
+
+        if (_currentJob.stopped())
+        {
+            auto& job = processGroups.emplace_back(std::exchange(_currentJob, ProcessGroup {}));
+            if (job.id == 0)
+                job.id = nextJobId();
+            std::ranges::sort(processGroups, {}, &ProcessGroup::id);
+            auto const signo = WSTOPSIG(std::ranges::find_if(job.stages, &PipelineStage::stopped)->wstatus);
+            _tty.writeToStdout("\n[{}]  {:<24}{}\n", job.id, job.status(), job.command());
+            _exitCode = 128 + signo;
+            return;
+        }
+
+        std::string pipeStatus;
+        for (PipelineStage const& stage: _currentJob.stages)
+        {
+            int const wstatus = stage.wstatus;
+            if (WIFSIGNALED(wstatus))
+                error("child process {}, exited with signal {}", stage.pid, WTERMSIG(wstatus));
+            else if (WIFEXITED(wstatus))
+                error("child process {} exited with code {}", stage.pid, WEXITSTATUS(wstatus));
+            else if (WIFSTOPPED(wstatus))
+                error("child process {} stopped with signal {}", stage.pid, WSTOPSIG(wstatus));
+            else
+                error("child process {} exited with unknown status {}", stage.pid, wstatus);
+
+            if (!pipeStatus.empty())
+                pipeStatus += ' ';
+            pipeStatus += std::to_string(stage.exitCode());
+        }
+
+        if (!_currentJob.stages.empty())
+        {
+            _exitCode = _currentJob.exitCode();
+            _env.set("PIPESTATUS", pipeStatus);
+        }
+
+        _lastPipeline = std::move(_currentJob.stages);
+        _currentJob = ProcessGroup {};
+    }
+
+    // Resolves a job specification (%N, N, %+, %%, %-), defaulting to the most recent job.
+    [[nodiscard]] ProcessGroup* findJob(CoreVM::CoreStringArray const& args) noexcept
+    {
+        if (processGroups.empty())
+            return nullptr;
+
+        if (args.empty() || args.front() == "%+" || args.front() == "%%")
+            return &processGroups.back();
+
+        if (args.front() == "%-")
+            return processGroups.size() >= 2 ? &processGroups[processGroups.size() - 2] : nullptr;
+
+        auto spec = std::string_view(args.front());
+        if (spec.starts_with('%'))
+            spec.remove_prefix(1);
+        int const id = std::atoi(std::string(spec).c_str());
+        auto const i = std::ranges::find(processGroups, id, &ProcessGroup::id);
+        return i != processGroups.end() ? &*i : nullptr;
+    }
+
+    void continueJob(ProcessGroup& job)
+    {
+        for (PipelineStage& stage: job.stages)
+            stage.stopped = false;
+        if (job.leader > 0)
+            kill(-job.leader, SIGCONT);
+        else
+            for (PipelineStage const& stage: job.stages)
+                if (!stage.terminated)
+                    kill(stage.pid, SIGCONT);
+    }
+
+    // Launches a child process via the configured spawn method and reports exec failures.
+    //
+    // The child receives the exported variables, along with any pending NAME=VALUE overrides.
+    SpawnResult spawn(std::string const& program, SpawnRequest request)
+    {
+        auto overrides = std::exchange(_environmentOverrides, {});
+        auto const overlay = overrides.empty() ? std::vector<char*> {} : _env.exported().overlay(overrides);
+        request.envp = overlay.empty() ? _env.exported().data() : overlay.data();
+
+        // Process substitutions are set up first, so that redirects cannot clobber their pipes.
+        auto substitutionActions = std::vector<FileAction> {};
+        for (auto const& pending: _substitutionFds)
+            if (pending.depth == _substitutions.size())
+                substitutionActions.push_back(pending.action);
+        request.fileActions.insert(
+            request.fileActions.begin(), substitutionActions.begin(), substitutionActions.end());
+
+        auto const result = spawnProcess(request, _spawnMethod);
+        discardPendingCallState();
+        if (!result.good())
+        {
+            error("Failed to execute {}: {}", request.program.string(), strerror(result.error));
+            _commandHash.forget(program);
+        }
+        return result;
     }
 
     void builtinChDir(CoreVM::Params& context)
@@ -537,6 +1456,37 @@ export class Shell final: public CoreVM::Runtime
     void builtinExport(CoreVM::Params& context) { _env.exportVariable(context.getString(1)); }
     void builtinTrue(CoreVM::Params& context) { context.setResult(true); }
     void builtinFalse(CoreVM::Params& context) { context.setResult(false); }
+    void builtinHashList(CoreVM::Params& context)
+    {
+        if (_commandHash.entries().empty())
+        {
+            _tty.writeToStdout("hash: hash table empty\n");
+            context.setResult(true);
+            return;
+        }
+
+        _tty.writeToStdout("hits\tcommand\n");
+        for (auto const& [program, entry]: _commandHash.entries())
+            _tty.writeToStdout("{:4}\t{}\n", entry.hits, entry.path.string());
+        context.setResult(true);
+    }
+    void builtinHash(CoreVM::Params& context)
+    {
+        // hash -r          flushes the command hash
+        // hash NAME...     resolves and remembers the given programs
+        bool result = true;
+        for (std::string const& arg: context.getStringArray(1))
+        {
+            if (arg == "-r")
+                _commandHash.clear();
+            else if (!resolveProgram(arg).has_value())
+            {
+                error("hash: {}: not found", arg);
+                result = false;
+            }
+        }
+        context.setResult(result);
+    }
     void builtinReadDefault(CoreVM::Params& context)
     {
         std::string const line =
@@ -554,11 +1504,550 @@ export class Shell final: public CoreVM::Runtime
         context.setResult(line);
     }
 
+    void builtinJobs(CoreVM::Params& context)
+    {
+        _eventLoop.runOnce(0);
+        for (ProcessGroup const& job: processGroups)
+        {
+            char marker = ' ';
+            if (&job == &processGroups.back())
+                marker = '+';
+            else if (processGroups.size() >= 2 && &job == &processGroups.end()[-2])
+                marker = '-';
+            _tty.writeToStdout("[{}]{} {:<24}{}\n", job.id, marker, job.status(), job.command());
+        }
+        std::erase_if(processGroups, [](ProcessGroup const& job) { return job.done(); });
+        context.setResult(true);
+    }
+    void builtinForeground(CoreVM::Params& context)
+    {
+        auto const args = context.count() > 0 ? context.getStringArray(1) : CoreVM::CoreStringArray {};
+        ProcessGroup* job = findJob(args);
+        if (!job)
+        {
+            error("fg: {}: no such job", args.empty() ? "current" : args.front());
+            context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
+            return;
+        }
+
+        _currentJob = std::move(*job);
+        processGroups.erase(processGroups.begin() + (job - processGroups.data()));
+        _tty.writeToStdout("{}\n", _currentJob.command());
+
+        setForegroundProcessGroup(_currentJob.leader);
+        continueJob(_currentJob);
+        waitForForegroundJob();
+        context.setResult(CoreVM::CoreNumber(_exitCode));
+    }
+    void builtinBackground(CoreVM::Params& context)
+    {
+        auto const args = context.count() > 0 ? context.getStringArray(1) : CoreVM::CoreStringArray {};
+        ProcessGroup* job = findJob(args);
+        if (!job)
+        {
+            error("bg: {}: no such job", args.empty() ? "current" : args.front());
+            context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
+            return;
+        }
+
+        continueJob(*job);
+        _tty.writeToStdout("[{}] {} &\n", job->id, job->command());
+        context.setResult(CoreVM::CoreNumber(EXIT_SUCCESS));
+    }
+    void builtinWait(CoreVM::Params& context)
+    {
+        // wait            waits for all background jobs
+        // wait JOB...     waits for the given jobs (%N or N) and returns the exit code of the last one
+        auto jobIds = std::vector<int> {};
+        if (context.count() > 0)
+        {
+            for (std::string const& arg: context.getStringArray(1))
+            {
+                if (ProcessGroup const* job = findJob({ arg }))
+                    jobIds.push_back(job->id);
+                else
+                {
+                    error("wait: {}: no such job", arg);
+                    context.setResult(CoreVM::CoreNumber(127));
+                    return;
+                }
+            }
+        }
+        else
+        {
+            for (ProcessGroup const& job: processGroups)
+                jobIds.push_back(job.id);
+        }
+
+        auto const isWaitedFor = [&](ProcessGroup const& job) {
+            return std::ranges::find(jobIds, job.id) != jobIds.end();
+        };
+
+        _eventLoop.runUntil([&]() {
+            return std::ranges::all_of(processGroups, [&](ProcessGroup const& job) {
+                return !isWaitedFor(job) || job.done() || job.stopped();
+            });
+        });
+
+        int exitCode = EXIT_SUCCESS;
+        for (int const id: jobIds)
+            if (auto const i = std::ranges::find(processGroups, id, &ProcessGroup::id); i != processGroups.end())
+                exitCode = i->done() ? i->exitCode() : 128 + SIGTSTP;
+
+        std::erase_if(processGroups, [&](ProcessGroup const& job) { return isWaitedFor(job) && job.done(); });
+        _exitCode = exitCode;
+        context.setResult(CoreVM::CoreNumber(exitCode));
+    }
+    void builtinRunInBackground(CoreVM::Params& /*context*/) { _runInBackground = true; }
+
+    // Ends the scope of a preceding "internal.background", in case the command spawned no job
+    // (e.g. a builtin, or a program that failed to spawn).
+    void builtinEndRunInBackground(CoreVM::Params& /*context*/) { _runInBackground = false; }
+
+    // <(command)
+    //
+    // The command's output is connected to a pipe, whose read end is handed
+    // to the next program call as the file descriptor given to builtinEndProcessSubstitution().
+    void builtinBeginProcessSubstitution(CoreVM::Params& /*context*/)
+    {
+        auto& substitution = _substitutions.emplace_back(
+            ProcessSubstitution { .pipe = UnixPipe { O_CLOEXEC },
+                                  .savedStdoutFd = _currentPipelineBuilder.defaultStdoutFd,
+                                  .savedPipe = std::exchange(_currentPipelineBuilder.currentPipe, std::nullopt) });
+        if (_currentPipelineBuilder.pipeSize > 0)
+            substitution.pipe.setCapacity(_currentPipelineBuilder.pipeSize);
+        _currentPipelineBuilder.defaultStdoutFd = substitution.pipe.writer();
+    }
+
+    void builtinEndProcessSubstitution(CoreVM::Params& context)
+    {
+        int const fd = static_cast<int>(context.getInt(1));
+        int const reader = endProcessSubstitution();
+        _substitutionFds.push_back(PendingSubstitution { .depth = _substitutions.size(),
+                                                         .action = FileAction { .fd = fd, .source = reader } });
+    }
+
+    // Restores the pipeline state of the enclosing command and closes the shell's write end,
+    // so that the receiving program sees EOF once all producers terminated.
+    //
+    // @returns the read end of the substitution's pipe, now owned by the caller.
+    int endProcessSubstitution()
+    {
+        auto substitution = std::move(_substitutions.back());
+        _substitutions.pop_back();
+        _currentPipelineBuilder.defaultStdoutFd = substitution.savedStdoutFd;
+        _currentPipelineBuilder.currentPipe = std::move(substitution.savedPipe);
+        substitution.pipe.closeWriter();
+        return substitution.pipe.releaseReader();
+    }
+
+    // Drops the state staged for the next program call, e.g. when it cannot be spawned.
+    void discardPendingCallState()
+    {
+        _environmentOverrides.clear();
+        _stagedArguments.clear();
+        std::erase_if(_substitutionFds, [depth = _substitutions.size()](PendingSubstitution const& pending) {
+            if (pending.depth < depth)
+                return false; // belongs to a program call enclosing the current one
+            ::close(pending.action.source);
+            return true;
+        });
+    }
+
+    // $(command)
+    //
+    // The command's output is captured into memory while the shell waits for it,
+    // and returned by builtinEndCapture().
+    //
+    // The command is run as a job on its own, independent of the program call
+    // the substitution is an argument of.
+    void builtinBeginCapture(CoreVM::Params& /*context*/)
+    {
+        auto& capture = _captures.emplace_back(CommandCapture {
+            .pipe = UnixPipe { O_CLOEXEC },
+            .output = {},
+            .savedStdoutFd = _currentPipelineBuilder.defaultStdoutFd,
+            .savedPipe = std::exchange(_currentPipelineBuilder.currentPipe, std::nullopt),
+            .savedJob = std::exchange(_currentJob, ProcessGroup {}),
+            .savedRunInBackground = std::exchange(_runInBackground, false),
+            .savedSubstitutions = std::exchange(_substitutions, {}),
+            .savedSubstitutionFds = std::exchange(_substitutionFds, {}),
+        });
+
+        // A larger pipe buffer means fewer wakeups of the shell for large outputs.
+        capture.pipe.setCapacity(std::max(_currentPipelineBuilder.pipeSize, CapturePipeSize));
+        int const reader = capture.pipe.reader();
+        fcntl(reader, F_SETFL, fcntl(reader, F_GETFL) | O_NONBLOCK);
+        _currentPipelineBuilder.defaultStdoutFd = capture.pipe.writer();
+
+        // Drain the pipe while waiting for the command, so that it never blocks on a full pipe.
+        _eventLoop.watchFd(reader, [this, index = _captures.size() - 1](int fd) {
+            if (!readInto(fd, _captures[index].output))
+                _eventLoop.unwatchFd(fd);
+        });
+    }
+
+    void builtinEndCapture(CoreVM::Params& context) { context.setResult(endCapture()); }
+
+    // Restores the state of the enclosing command and returns the captured output,
+    // with trailing newlines removed.
+    std::string endCapture()
+    {
+        auto capture = std::move(_captures.back());
+        _captures.pop_back();
+
+        int const reader = capture.pipe.reader();
+        _eventLoop.unwatchFd(reader);
+        _currentPipelineBuilder.defaultStdoutFd = capture.savedStdoutFd;
+        _currentPipelineBuilder.currentPipe = std::move(capture.savedPipe);
+        _currentJob = std::move(capture.savedJob);
+        _runInBackground = capture.savedRunInBackground;
+        _substitutions = std::move(capture.savedSubstitutions);
+        _substitutionFds = std::move(capture.savedSubstitutionFds);
+
+        // Read whatever is left until all writers (e.g. background children) closed the pipe.
+        capture.pipe.closeWriter();
+        fcntl(reader, F_SETFL, fcntl(reader, F_GETFL) & ~O_NONBLOCK);
+        while (readInto(reader, capture.output))
+            ;
+
+        auto const end = capture.output.find_last_not_of('\n');
+        capture.output.resize(end == std::string::npos ? 0 : end + 1);
+        return std::move(capture.output);
+    }
+
+    void builtinStageArgument(CoreVM::Params& context) { _stagedArguments.push_back(context.getString(1)); }
+
+    // Returns the arguments of a program call, i.e. the constant ones,
+    // followed by the ones staged via internal.argument (if any).
+    [[nodiscard]] CoreVM::CoreStringArray const& programArguments(CoreVM::CoreStringArray const& constant)
+    {
+        if (_stagedArguments.empty())
+            return constant;
+
+        _programArguments.assign(constant.begin(), constant.end());
+        std::ranges::move(_stagedArguments, std::back_inserter(_programArguments));
+        _stagedArguments.clear();
+        return _programArguments;
+    }
+
+    void builtinVariable(CoreVM::Params& context) { context.setResult(variable(context.getString(1))); }
+
+    // Returns the value of the (possibly special) variable @p name, or an empty string if unset.
+    [[nodiscard]] std::string variable(std::string const& name) const
+    {
+        if (name == "?")
+            return std::to_string(_exitCode < 0 ? 0 : _exitCode);
+
+        if (name == "#")
+            return std::to_string(_positionalParameters.empty() ? 0 : _positionalParameters.size() - 1);
+
+        if (name.size() == 1 && std::isdigit(static_cast<unsigned char>(name[0])))
+        {
+            auto const index = static_cast<size_t>(name[0] - '0');
+            return index < _positionalParameters.size() ? _positionalParameters[index] : std::string {};
+        }
+
+        return std::string(_env.get(name).value_or(""));
+    }
+
+    void builtinEnvironmentOverrides(CoreVM::Params& context)
+    {
+        auto const& assignments = context.getStringArray(1);
+        _environmentOverrides.assign(assignments.begin(), assignments.end());
+    }
+
+    void builtinTime(CoreVM::Params& /*context*/)
+    {
+        _lastPipeline.clear();
+        _timeStarted = std::chrono::steady_clock::now();
+    }
+    void builtinTimeReport(CoreVM::Params& /*context*/)
+    {
+        if (!_timeStarted.has_value())
+            return;
+
+        auto const total = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - *_timeStarted);
+        _timeStarted = std::nullopt;
+
+        writeStageTimings(_lastPipeline, &PipelineStage::program);
+        _tty.writeToStdout("{:>9} {:>51}  {}\n", formatSeconds(total), "", "total");
+    }
+
+    static std::string formatSeconds(std::chrono::microseconds value)
+    {
+        return fmt::format("{:.3f}s", std::chrono::duration<double>(value).count());
+    }
+
+    // Prints exit code, timings and resource usage of each of the given processes,
+    // labelled by the given member (program name or full command line).
+    void writeStageTimings(std::vector<PipelineStage> const& stages, std::string PipelineStage::*label)
+    {
+        _tty.writeToStdout("{:>9} {:>9} {:>9} {:>10} {:>6} {:>6} {:>6}  {}\n",
+                           "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "status", "command");
+        for (PipelineStage const& stage: stages)
+            _tty.writeToStdout("{:>9} {:>9} {:>9} {:>9}K {:>6} {:>6} {:>6}  {}\n",
+                               formatSeconds(stage.realTime()),
+                               formatSeconds(stage.userTime()),
+                               formatSeconds(stage.systemTime()),
+                               stage.usage.ru_maxrss,
+                               stage.usage.ru_nvcsw,
+                               stage.usage.ru_nivcsw,
+                               stage.exitCode(),
+                               stage.*label);
+    }
+
+    // parallel [-j N] [--unordered] [--report] COMMAND [ARGS...] [::: INPUT...]
+    //
+    // Runs COMMAND once per input, with at most N (default: number of CPU cores) children at a time.
+    // Each "{}" in the command template is replaced by the input, otherwise the input is appended.
+    // Inputs are taken from the arguments after ":::" (with glob patterns being expanded),
+    // or from the lines of standard input, unless that is a terminal.
+    //
+    // The output of each job is captured and written in input order (the output of the oldest
+    // running job is streamed right away), or as soon as the job completes with --unordered.
+    void builtinParallel(CoreVM::Params& context)
+    {
+        auto options = std::optional<ParallelOptions> {};
+        try
+        {
+            options = ParallelOptions::parse(context.getStringArray(1));
+        }
+        catch (std::invalid_argument const& e)
+        {
+            error("parallel: {}", e.what());
+            error("usage: parallel [-j N] [--unordered] [--report] COMMAND [ARGS...] [::: INPUT...]");
+            context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
+            return;
+        }
+
+        if (options->readInputsFromStdin && isatty(_currentPipelineBuilder.defaultStdinFd))
+        {
+            // Reading until EOF would block without any prompt.
+            error("parallel: Refusing to read inputs from a terminal, pass them after \":::\" instead");
+            context.setResult(CoreVM::CoreNumber(EXIT_FAILURE));
+            return;
+        }
+
+        std::vector<std::string> const inputs =
+            options->readInputsFromStdin ? readLines(_currentPipelineBuilder.defaultStdinFd) : options->inputs;
+
+        // Jobs must not compete for the input the shell just consumed.
+        int const stdinFd = options->readInputsFromStdin ? open("/dev/null", O_RDONLY | O_CLOEXEC)
+                                                         : _currentPipelineBuilder.defaultStdinFd;
+
+        auto jobs = std::vector<ParallelJob>(inputs.size());
+        size_t nextJob = 0;    // index of the next job to be started
+        size_t nextOutput = 0; // index of the next job whose output is to be written (ordered mode)
+        size_t running = 0;
+
+        auto const jobCompleted = [&](ParallelJob const& job) {
+            return job.outputFd == -1
+                   && (job.stage == -1 || _currentJob.stages[static_cast<size_t>(job.stage)].terminated);
+        };
+
+        // Under job control, the jobs running at a time share a process group that owns the terminal,
+        // so that they receive ^C as one job. A new group is formed whenever all members of the current
+        // one terminated, as the group ceased to exist then.
+        auto const nextParallelProcessGroup = [&]() -> pid_t {
+            if (!_jobControl)
+                return -1;
+            for (ParallelJob const& job: jobs)
+                if (_currentJob.leader > 0 && job.processGroup == _currentJob.leader
+                    && !_currentJob.stages[static_cast<size_t>(job.stage)].terminated)
+                    return _currentJob.leader;
+            return 0;
+        };
+
+        auto const flushOutputs = [&]() {
+            if (options->unordered)
+            {
+                for (ParallelJob& job: jobs)
+                {
+                    if (!job.written && job.started && jobCompleted(job))
+                    {
+                        writeToOutput(job.output);
+                        job.output.clear();
+                        job.written = true;
+                    }
+                }
+                return;
+            }
+
+            while (nextOutput < nextJob)
+            {
+                ParallelJob& job = jobs[nextOutput];
+                writeToOutput(job.output);
+                job.output.clear();
+                if (!jobCompleted(job))
+                {
+                    job.streaming = true;
+                    break;
+                }
+                job.written = true;
+                ++nextOutput;
+            }
+        };
+
+        while (true)
+        {
+            for (ParallelJob& job: jobs)
+            {
+                if (job.started && !job.reaped && jobCompleted(job))
+                {
+                    job.reaped = true;
+                    --running;
+                }
+            }
+
+            // The builtin itself cannot be suspended, so jobs stopped by ^Z are continued right away.
+            if (_currentJob.stopped())
+                killpg(_currentJob.leader, SIGCONT);
+
+            // Like GNU parallel, no more jobs are started once one got interrupted (e.g. by ^C).
+            bool const interrupted = std::ranges::any_of(_currentJob.stages, [](PipelineStage const& stage) {
+                return stage.terminated && WIFSIGNALED(stage.wstatus) && WTERMSIG(stage.wstatus) == SIGINT;
+            });
+
+            while (!interrupted && running < options->maxJobs && nextJob < inputs.size())
+            {
+                startParallelJob(jobs[nextJob],
+                                 options->expandTemplate(inputs[nextJob]),
+                                 stdinFd,
+                                 nextParallelProcessGroup());
+                ++nextJob;
+                ++running;
+            }
+
+            flushOutputs();
+
+            if (running == 0)
+                break;
+
+            _eventLoop.runOnce();
+        }
+
+        setForegroundProcessGroup(getpgrp());
+        if (options->readInputsFromStdin)
+            ::close(stdinFd);
+
+        std::string pipeStatus;
+        int failedJobs = 0;
+        for (PipelineStage const& stage: _currentJob.stages)
+        {
+            if (!pipeStatus.empty())
+                pipeStatus += ' ';
+            pipeStatus += std::to_string(stage.exitCode());
+            if (stage.exitCode() != EXIT_SUCCESS)
+                ++failedJobs;
+        }
+        _env.set("PIPESTATUS", pipeStatus);
+        _lastPipeline = std::move(_currentJob.stages);
+        _currentJob = ProcessGroup {};
+
+        if (options->report)
+            writeStageTimings(_lastPipeline, &PipelineStage::command);
+
+        // Like GNU parallel, the exit code is the number of failed jobs (capped at 101).
+        _exitCode = std::min(failedJobs, 101);
+        context.setResult(CoreVM::CoreNumber(_exitCode));
+    }
+
+    // Spawns a single job of the "parallel" builtin into @p processGroup (as with SpawnRequest),
+    // with its stdout connected to a pipe that is being drained by the event loop.
+    void startParallelJob(ParallelJob& job,
+                          CoreVM::CoreStringArray const& args,
+                          int stdinFd,
+                          pid_t processGroup)
+    {
+        job.started = true;
+
+        std::string const& program = args.at(0);
+        std::optional<std::filesystem::path> const programPath = resolveProgram(program);
+        if (!programPath.has_value())
+        {
+            error("parallel: Failed to resolve program '{}'", program);
+            _currentJob.stages.emplace_back(PipelineStage {
+                .program = program, .command = formatCommandLine(args), .terminated = true, .wstatus = 127 << 8 });
+            job.stage = static_cast<ptrdiff_t>(_currentJob.stages.size() - 1);
+            return;
+        }
+
+        auto output = UnixPipe { O_CLOEXEC };
+        int const terminal = processGroup == 0 ? _tty.inputFd() : -1;
+        auto const spawned = spawn(program,
+                                   SpawnRequest { .program = *programPath,
+                                                  .argv = constructArgv(args),
+                                                  .stdinFd = stdinFd,
+                                                  .stdoutFd = output.writer(),
+                                                  .processGroup = processGroup,
+                                                  .foregroundTerminal = terminal });
+        output.closeWriter();
+
+        if (!spawned.good())
+        {
+            _currentJob.stages.emplace_back(PipelineStage {
+                .program = program, .command = formatCommandLine(args), .terminated = true, .wstatus = 126 << 8 });
+            job.stage = static_cast<ptrdiff_t>(_currentJob.stages.size() - 1);
+            return;
+        }
+
+        addPipelineStage(args, spawned.pid);
+        job.stage = static_cast<ptrdiff_t>(_currentJob.stages.size() - 1);
+        job.outputFd = output.releaseReader();
+        if (processGroup != -1)
+        {
+            job.processGroup = processGroup == 0 ? spawned.pid : processGroup;
+            if (processGroup == 0)
+            {
+                _currentJob.leader = spawned.pid;
+                setForegroundProcessGroup(spawned.pid);
+            }
+        }
+
+        _eventLoop.watchFd(job.outputFd, [this, &job](int fd) {
+            ssize_t n = 0;
+            if (job.streaming)
+            {
+                // moved inside the kernel, if our stdout is a pipe or file
+                n = transfer(fd, _currentPipelineBuilder.defaultStdoutFd, 1024 * 1024);
+            }
+            else
+            {
+                char buffer[64 * 1024];
+                n = ::read(fd, buffer, sizeof(buffer));
+                if (n > 0)
+                    job.output.append(buffer, static_cast<size_t>(n));
+            }
+            if (n == 0 || (n == -1 && errno != EINTR && errno != EAGAIN))
+            {
+                _eventLoop.unwatchFd(fd);
+                ::close(fd);
+                job.outputFd = -1;
+            }
+        });
+    }
+
+    void writeToOutput(std::string_view data) const
+    {
+        int const fd = _currentPipelineBuilder.defaultStdoutFd;
+        while (!data.empty())
+        {
+            ssize_t const n = ::write(fd, data.data(), data.size());
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            data.remove_prefix(static_cast<size_t>(n));
+        }
+    }
+
     // helper-builtins for redirects and pipes
     void builtinOpenRead(CoreVM::Params& context)
     {
         std::string const& path = context.getString(1);
-        int const fd = open(path.data(), O_RDONLY);
+        int const fd = open(path.data(), O_RDONLY | O_CLOEXEC);
         if (fd == -1)
         {
             error("Failed to open file '{}': {}", path, strerror(errno));
@@ -573,7 +2062,7 @@ export class Shell final: public CoreVM::Runtime
     {
         std::string const& path = context.getString(1);
         int const oflags = static_cast<int>(context.getInt(2));
-        int const fd = open(path.data(), oflags ? oflags : (O_WRONLY | O_CREAT | O_TRUNC));
+        int const fd = open(path.data(), (oflags ? oflags : (O_WRONLY | O_CREAT | O_TRUNC)) | O_CLOEXEC, 0666);
         if (fd == -1)
         {
             error("Failed to open file '{}': {}", path, strerror(errno));
@@ -583,27 +2072,16 @@ export class Shell final: public CoreVM::Runtime
 
         context.setResult(CoreVM::CoreNumber(fd));
     }
-    [[nodiscard]] std::optional<std::filesystem::path> resolveProgram(std::string const& program) const
+    [[nodiscard]] std::optional<std::filesystem::path> resolveProgram(std::string const& program)
     {
         auto const pathEnv = _env.get("PATH");
         if (!pathEnv.has_value())
             return std::nullopt;
 
-        auto const pathEnvValue = pathEnv.value();
-        auto const paths = crispy::split(pathEnvValue, ':');
-
-        for (auto const& pathStr: paths)
-        {
-            auto path = std::filesystem::path(pathStr);
-            auto const programPath = path / program;
-            if (std::filesystem::exists(programPath))
-            {
-                debugLog()("Found program: {}", programPath.string());
-                return programPath;
-            }
-        }
-
-        return std::nullopt;
+        auto programPath = _commandHash.lookup(program, pathEnv.value());
+        if (programPath)
+            debugLog()("Found program: {}", programPath->string());
+        return programPath;
     }
 
     void trace(CoreVM::Instruction instr, size_t ip, size_t sp)
@@ -626,17 +2104,60 @@ export class Shell final: public CoreVM::Runtime
     std::unique_ptr<CoreVM::Program> _currentProgram;
     CoreVM::Runner::Globals _globals;
 
+    // User-defined functions of the current program.
+    FunctionTable _functions;        // functions defined by earlier inputs
+    FunctionTable _pendingFunctions; // functions defined by the input being executed
+
     bool _optimize = false;
+    SpawnMethod _spawnMethod = SpawnMethod::PosixSpawn;
 
     PipelineBuilder _currentPipelineBuilder;
 
-    // This stores the PIDs of all processes in the pipeline's process group.
-    std::vector<pid_t> _currentProcessGroupPids;
+    CommandHash _commandHash;
+
+    // Compiled scripts, if enabled.
+    std::optional<BytecodeCache> _bytecodeCache;
+
+    // Reaps child processes as they terminate.
+    EventLoop _eventLoop;
+
+    // Job control is enabled if the shell runs interactively in the foreground of its terminal.
+    bool _jobControl = false;
+
+    // Set by a trailing "&", the pipeline being built is to be run in the background.
+    bool _runInBackground = false;
+
+    // NAME=VALUE assignments preceding the next program call, exported to that program only.
+    std::vector<std::string> _environmentOverrides;
+
+    // Process substitutions whose command is currently being spawned (innermost last).
+    std::vector<ProcessSubstitution> _substitutions;
+
+    // Read ends of completed process substitutions, to be handed to the next program call
+    // spawned at the same nesting depth.
+    std::vector<PendingSubstitution> _substitutionFds;
+
+    // Command substitutions whose command is currently being run (innermost last).
+    std::vector<CommandCapture> _captures;
+
+    // Non-constant arguments of the next program call, e.g. the output of a command substitution.
+    std::vector<std::string> _stagedArguments;
+    CoreVM::CoreStringArray _programArguments;
+
+    // This stores all processes of the pipeline's process group (the first one being the leader).
+    ProcessGroup _currentJob;
+    std::vector<PipelineStage> _lastPipeline;
     std::optional<pid_t> _leftPid;
     std::optional<pid_t> _rightPid;
 
+    // Start of the currently timed command, if any (see builtin "time").
+    std::optional<std::chrono::steady_clock::time_point> _timeStarted;
+
+    // $0 followed by the positional parameters $1..$N.
+    std::vector<std::string> _positionalParameters;
+
     // This stores the exit code of the last process in the pipeline.
-    // TODO: remember exit codes from all processes in the pipeline's process group
+    // The exit codes of all processes are to be found in _lastPipeline and $PIPESTATUS.
     int _exitCode = -1;
 
     CoreVM::Runner* _runner = nullptr;
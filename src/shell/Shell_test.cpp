@@ -2,17 +2,38 @@
 
 #include <crispy/escape.h>
 
+#include <fmt/format.h>
+
 #include <catch2/catch.hpp>
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 using namespace std::string_literals;
 using namespace std::string_view_literals;
 
 using crispy::escape;
+import BytecodeCache;
 import Shell;
+import Spawn;
 import TTY;
+import UnixPipe;
 
 namespace
 {
+std::string readFile(std::filesystem::path const& path)
+{
+    auto stream = std::stringstream {};
+    stream << std::ifstream(path).rdbuf();
+    return stream.str();
+}
+
 struct TestShell
 {
     endo::TestPTY pty;
@@ -87,6 +108,540 @@ TEST_CASE("shell.builtin.get_variable")
     shell("$BRU");
 }
 
+TEST_CASE("shell.environment.export")
+{
+    TestShell shell;
+    shell("set ENDO_TEST_VAR hello");
+    shell("sh -c 'echo \"[$ENDO_TEST_VAR]\"'");
+    CHECK(escape(shell.output()) == escape("[]\n"));
+
+    TestShell exported;
+    exported("set ENDO_TEST_VAR hello");
+    exported("export ENDO_TEST_VAR");
+    exported("sh -c 'echo \"[$ENDO_TEST_VAR]\"'");
+    CHECK(escape(exported.output()) == escape("[hello]\n"));
+    CHECK(exported.env.exported().get("ENDO_TEST_VAR").value_or("NONE") == "hello");
+}
+
+TEST_CASE("shell.environment.overrides")
+{
+    TestShell shell;
+    shell("set ENDO_TEST_VAR hello");
+    shell("export ENDO_TEST_VAR");
+    shell("ENDO_TEST_VAR=world ENDO_OTHER_VAR=1 sh -c 'echo \"$ENDO_TEST_VAR $ENDO_OTHER_VAR\"'");
+    CHECK(escape(shell.output()) == escape("world 1\n"));
+
+    // Overrides only apply to the very program call they precede.
+    CHECK(shell.env.get("ENDO_TEST_VAR").value_or("NONE") == "hello");
+    CHECK(!shell.env.get("ENDO_OTHER_VAR").has_value());
+}
+
+TEST_CASE("shell.environment.assignment")
+{
+    TestShell shell;
+    shell("ENDO_TEST_VAR=hello");
+    CHECK(shell.env.get("ENDO_TEST_VAR").value_or("NONE") == "hello");
+    CHECK(!shell.env.exported().contains("ENDO_TEST_VAR"));
+}
+
+TEST_CASE("shell.builtin.hash")
+{
+    TestShell shell;
+    CHECK(shell.shell.commandHash().entries().empty());
+
+    shell("sleep 0");
+    REQUIRE(shell.shell.commandHash().entries().contains("sleep"));
+    auto const probes = shell.shell.commandHash().statistics().probes;
+
+    // A warm cache must not touch the filesystem anymore.
+    shell("sleep 0");
+    CHECK(shell.shell.commandHash().statistics().probes == probes);
+    CHECK(shell.shell.commandHash().statistics().hits == 1);
+
+    shell("hash -r");
+    CHECK(shell.shell.commandHash().entries().empty());
+}
+
+TEST_CASE("shell.builtin.hash.path_change")
+{
+    TestShell shell;
+    shell("sleep 0");
+    CHECK(!shell.shell.commandHash().entries().empty());
+
+    shell.env.set("PATH", shell.env.get("PATH").value_or("/usr/bin:/bin"));
+    CHECK(shell.shell.commandHash().entries().empty());
+}
+
+TEST_CASE("shell.builtin.hash.relative_path")
+{
+    // Programs found relative to the working directory must not be remembered,
+    // as they are gone once it changes (too many "..", as in here, stop at the root).
+    TestShell shell;
+    shell.env.set("PATH", "../../../../../../../../../../../../../../../../usr/bin");
+    CHECK(shell("sleep 0").exitCode == 0);
+    CHECK(shell.shell.commandHash().entries().empty());
+}
+
+TEST_CASE("shell.builtin.hash.benchmark", "[.benchmark]")
+{
+    TestShell shell;
+
+    BENCHMARK("spawn with cold command hash")
+    {
+        shell.shell.commandHash().clear();
+        return shell("sleep 0").exitCode;
+    };
+
+    BENCHMARK("spawn with warm command hash")
+    {
+        return shell("sleep 0").exitCode;
+    };
+}
+
+TEST_CASE("shell.spawn.fork_fallback")
+{
+    TestShell shell;
+    shell.shell.setSpawnMethod(endo::SpawnMethod::Fork);
+    CHECK(escape(shell("echo hello | grep ll").output()) == escape("hello\n"));
+}
+
+TEST_CASE("shell.pipeline.reaping")
+{
+    // The stages terminate in arbitrary order, but all of them must be reaped.
+    TestShell shell;
+    CHECK(escape(shell("sleep 0 | echo hello | grep ll").output()) == escape("hello\n"));
+    CHECK(shell.exitCode == 0);
+}
+
+TEST_CASE("shell.pipeline.PIPESTATUS")
+{
+    TestShell shell;
+    shell("sh -c \"exit 3\" | sleep 0");
+    CHECK(shell.exitCode == 0);
+    CHECK(shell.env.get("PIPESTATUS").value_or("") == "3 0");
+
+    auto const& stages = shell.shell.lastPipeline();
+    REQUIRE(stages.size() == 2);
+    CHECK(stages[0].program == "sh");
+    CHECK(stages[0].exitCode() == 3);
+    CHECK(stages[1].program == "sleep");
+    CHECK(stages[1].usage.ru_maxrss > 0);
+}
+
+TEST_CASE("shell.builtin.time")
+{
+    TestShell shell;
+    auto const output = shell("time echo hello | grep ll").output();
+    CHECK(output.starts_with("hello\n"));
+    CHECK(output.find("maxrss") != std::string::npos);
+    CHECK(output.find("  echo\n") != std::string::npos);
+    CHECK(output.find("  grep\n") != std::string::npos);
+    CHECK(output.find("  total\n") != std::string::npos);
+}
+
+TEST_CASE("shell.pipeline.pipe_size")
+{
+    TestShell shell;
+    shell.env.set("ENDO_PIPE_SIZE", "1048576");
+    CHECK(shell.shell.pipeSize() == 1048576);
+    CHECK(escape(shell("echo hello | grep ll").output()) == escape("hello\n"));
+}
+
+TEST_CASE("shell.redirect.output")
+{
+    auto const path = std::filesystem::temp_directory_path() / "endo_redirect_test.txt";
+    std::filesystem::remove(path);
+
+    TestShell shell;
+    CHECK(shell(fmt::format("echo hello > \"{}\"", path.string())).exitCode == 0);
+    CHECK(readFile(path) == "hello\n");
+    CHECK(shell.output().empty());
+
+    shell(fmt::format("echo world >> \"{}\"", path.string()));
+    CHECK(readFile(path) == "hello\nworld\n");
+
+    shell(fmt::format("echo truncated 1>\"{}\"", path.string()));
+    CHECK(readFile(path) == "truncated\n");
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("shell.redirect.input")
+{
+    auto const path = std::filesystem::temp_directory_path() / "endo_redirect_input_test.txt";
+    std::ofstream(path) << "hello\nworld\n";
+
+    TestShell shell;
+    shell(fmt::format("grep wor < \"{}\"", path.string()));
+    CHECK(escape(shell.output()) == escape("world\n"));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("shell.redirect.duplicate")
+{
+    auto const path = std::filesystem::temp_directory_path() / "endo_redirect_dup_test.txt";
+    std::filesystem::remove(path);
+
+    TestShell shell;
+    // Redirects are applied from left to right.
+    shell(fmt::format("sh -c \"echo out; echo err 1>&2\" > \"{}\" 2>&1", path.string()));
+    CHECK(readFile(path) == "out\nerr\n");
+
+    shell("sh -c \"echo err 1>&2\" 2>&1 | grep err");
+    CHECK(escape(shell.output()) == escape("err\n"));
+
+    std::filesystem::remove(path);
+}
+
+#if defined(__linux__)
+TEST_CASE("shell.redirect.no_leaked_descriptors")
+{
+    // Only stdin, stdout, stderr and the descriptor of the listed directory itself are expected.
+    TestShell shell;
+    shell("ls /proc/self/fd");
+    CHECK(escape(shell.output()) == escape("0\n1\n2\n3\n"));
+}
+
+TEST_CASE("shell.redirect.no_leaked_descriptors_below_redirects")
+{
+    // A descriptor lacking close-on-exec, below the highest redirected one, must not leak either.
+    for (auto const method: { endo::SpawnMethod::PosixSpawn, endo::SpawnMethod::Fork })
+    {
+        int const leaking = ::open("/dev/null", O_RDONLY);
+        REQUIRE(leaking != -1);
+        REQUIRE(leaking < 9);
+        TestShell shell;
+        shell.shell.setSpawnMethod(method);
+        shell("ls /proc/self/fd 9>/dev/null");
+        CHECK(escape(shell.output()) == escape("0\n1\n2\n3\n9\n"));
+        ::close(leaking);
+    }
+}
+#endif
+
+TEST_CASE("shell.process_substitution")
+{
+    TestShell shell;
+    shell("cat <(echo hello) <(echo world)");
+    CHECK(escape(shell.output()) == escape("hello\nworld\n"));
+    CHECK(shell.shell.jobs().empty());
+}
+
+TEST_CASE("shell.process_substitution.concurrent")
+{
+    // The producer's output exceeds the pipe buffer, so it must run concurrently to its consumer.
+    TestShell shell;
+    shell("wc -l <(seq 100000)");
+    CHECK(escape(shell.output()) == escape("100000 /dev/fd/63\n"));
+}
+
+TEST_CASE("shell.process_substitution.nested")
+{
+    TestShell shell;
+    shell("cat <(grep 2 <(seq 3)) | cat");
+    CHECK(escape(shell.output()) == escape("2\n"));
+}
+
+TEST_CASE("shell.command_substitution")
+{
+    CHECK(escape(TestShell()("echo $(echo hello) world").output()) == escape("hello world\n"));
+    CHECK(escape(TestShell()("echo `echo hello` world").output()) == escape("hello world\n"));
+    CHECK(escape(TestShell()("echo $(printf 'a\n\n\n')").output()) == escape("a\n"));
+
+    TestShell shell;
+    shell("set VAR $(echo hello | tr a-z A-Z)");
+    CHECK(shell.env.get("VAR").value_or("NONE") == "HELLO");
+}
+
+TEST_CASE("shell.command_substitution.builtin_arguments")
+{
+    // Builtin arguments are passed as constant array, so computed ones are rejected by the parser.
+    TestShell shell;
+    CHECK(shell("hash $(echo ls)").exitCode == EXIT_FAILURE);
+    CHECK(shell("wait `echo 1`").exitCode == EXIT_FAILURE);
+    CHECK(shell("parallel echo ::: $(echo a)").exitCode == EXIT_FAILURE);
+    CHECK(shell("read $(echo VAR)").exitCode == EXIT_FAILURE);
+    CHECK(shell.output().empty());
+    CHECK(escape(shell("echo $(echo ok)").output()) == escape("ok\n"));
+}
+
+TEST_CASE("shell.command_substitution.large_output")
+{
+    // The output exceeds the pipe buffer, so it must be drained while waiting for the command.
+    TestShell shell;
+    shell("echo $(seq 200000) | wc -c");
+    CHECK(escape(shell.output()) == escape("1288895\n"));
+}
+
+TEST_CASE("shell.script")
+{
+    auto const path = std::filesystem::temp_directory_path() / fmt::format("endo-script-{}.endo", getpid());
+    std::ofstream(path) << "# greets the given name\n"
+                           "echo hello $1 # trailing comment\n"
+                           "echo $# $0\n";
+
+    TestShell shell;
+    shell.shell.setPositionalParameters({ "greet", "world", "ignored" });
+    CHECK(shell.shell.executeScript(path.string()) == 0);
+    CHECK(escape(shell.output()) == escape("hello world\n2 greet\n"));
+    std::filesystem::remove(path);
+
+    CHECK(TestShell().shell.executeScript(path.string()) == 127);
+}
+
+TEST_CASE("shell.script.bytecode_cache")
+{
+    auto const directory = std::filesystem::temp_directory_path() / fmt::format("endo-cache-{}", getpid());
+    auto const path = directory / "script.endo";
+    std::filesystem::create_directories(directory);
+    std::ofstream(path) << "echo cached $1\n";
+
+    for (auto const run: { 1, 2 })
+    {
+        TestShell shell;
+        shell.shell.setBytecodeCache(directory / "cache");
+        shell.shell.setPositionalParameters({ "script", std::to_string(run) });
+        CHECK(shell.shell.executeScript(path.string()) == 0);
+        CHECK(escape(shell.output()) == escape(fmt::format("cached {}\n", run)));
+        CHECK(shell.shell.bytecodeCache()->statistics().hits == (run == 1 ? 0 : 1));
+    }
+
+    // Changing the script invalidates its cache entry.
+    std::ofstream(path) << "echo changed\n";
+    TestShell shell;
+    shell.shell.setBytecodeCache(directory / "cache");
+    CHECK(shell.shell.executeScript(path.string()) == 0);
+    CHECK(escape(shell.output()) == escape("changed\n"));
+    CHECK(shell.shell.bytecodeCache()->statistics().hits == 0);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("shell.script.bytecode_cache.unlinkable")
+{
+    auto const directory = std::filesystem::temp_directory_path() / fmt::format("endo-link-{}", getpid());
+    auto const path = directory / "script.endo";
+    std::filesystem::create_directories(directory);
+    std::ofstream(path) << "echo relinked\n";
+
+    // Let the cached program refer to a native callback the runtime does not provide.
+    TestShell shell;
+    shell.shell.setBytecodeCache(directory / "cache");
+    CHECK(shell.shell.executeScript(path.string()) == 0);
+    auto cache = endo::BytecodeCache(directory / "cache");
+    auto const key = endo::BytecodeCache::keyOf("echo relinked\n", false, shell.shell);
+    auto program = cache.load(key);
+    REQUIRE(program != nullptr);
+    program->constants().makeNativeFunction("removed()V");
+    cache.store(key, program->constants());
+
+    // It fails to link, so the script is compiled again and its entry replaced.
+    for (auto const run: { 1, 2 })
+    {
+        TestShell rerun;
+        rerun.shell.setBytecodeCache(directory / "cache");
+        CHECK(rerun.shell.executeScript(path.string()) == 0);
+        CHECK(escape(rerun.output()) == escape("relinked\n"));
+        CHECK(rerun.shell.bytecodeCache()->statistics().hits == (run == 1 ? 0 : 1));
+        CHECK(rerun.shell.bytecodeCache()->statistics().stores == (run == 1 ? 1 : 0));
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("shell.session")
+{
+    TestShell shell;
+    shell("echo one");
+    shell("echo two | tr a-z A-Z");
+    REQUIRE(shell.shell.program() != nullptr);
+    auto const& constants = shell.shell.program()->constants();
+    auto const signatures = constants.getNativeFunctionSignatures().size();
+
+    // Repeated input only replaces the entry handler, reusing the already linked native callbacks.
+    shell("echo one");
+    CHECK(escape(shell.output()) == escape("one\nTWO\none\n"));
+    CHECK(shell.shell.program()->handlerNames().size() == 1);
+    CHECK(constants.getNativeFunctionSignatures().size() == signatures);
+}
+
+TEST_CASE("shell.session.definitions")
+{
+    // Variables and functions defined by one input are used by the following ones.
+    TestShell shell;
+    shell("let greeting = hello");
+    shell("let greet name: bool = echo $greeting $name");
+    shell("greet world");
+    shell("let greeting = bye");
+    shell("greet world");
+    CHECK(escape(shell.output()) == escape("hello world\nbye world\n"));
+}
+
+TEST_CASE("shell.variables")
+{
+    TestShell shell;
+    shell.env.set("NAME", "endo");
+    shell("sh -c 'exit 3'");
+    shell("echo $NAME $?");
+    CHECK(escape(shell.output()) == escape("endo 3\n"));
+}
+
+TEST_CASE("shell.function")
+{
+    for (bool const optimize: { false, true })
+    {
+        INFO("optimize: " << optimize);
+        TestShell shell;
+        shell.shell.setOptimize(optimize);
+        shell("let greet (greeting, name): str =\n"
+              "    echo $greeting $name\n"
+              "    return $name\n"
+              "let who = greet hello world\n"
+              "echo $who");
+        CHECK(escape(shell.output()) == escape("hello world\nworld\n"));
+
+        // Functions defined by earlier inputs remain callable (declared, but not defined, by later
+        // programs), and bool results are exit codes.
+        shell("let is_empty value: bool = test -z $value");
+        shell("if is_empty ''; then echo empty; else echo not empty; fi");
+        shell("if is_empty x; then echo empty; else echo not empty; fi");
+        CHECK(escape(shell.output()) == escape("hello world\nworld\nempty\nnot empty\n"));
+    }
+}
+
+TEST_CASE("shell.function.recursion")
+{
+    // Endless recursion fails the input, whose functions then remain unknown to later inputs.
+    TestShell shell;
+    CHECK(shell("let loop x: bool = loop $x\nloop 1").exitCode == EXIT_FAILURE);
+    CHECK(shell("let loop a b: bool = echo $a $b\nloop redefined loop").exitCode == EXIT_SUCCESS);
+    CHECK(escape(shell.output()) == escape("redefined loop\n"));
+}
+
+TEST_CASE("UnixPipe.transfer")
+{
+    auto const data = std::string(100'000, 'x') + "\n";
+
+    std::FILE* source = std::tmpfile();
+    std::FILE* target = std::tmpfile();
+    REQUIRE(source != nullptr);
+    REQUIRE(target != nullptr);
+    REQUIRE(::write(fileno(source), data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+    REQUIRE(::lseek(fileno(source), 0, SEEK_SET) == 0);
+
+    auto const transferAll = [](int source, int target) {
+        ssize_t total = 0;
+        while (ssize_t const n = endo::transfer(source, target, 64 * 1024))
+        {
+            if (n == -1)
+                return n;
+            total += n;
+        }
+        return total;
+    };
+
+    // file to file
+    CHECK(transferAll(fileno(source), fileno(target)) == static_cast<ssize_t>(data.size()));
+
+    // file to pipe (and pipe to file)
+    auto pipe = endo::UnixPipe {};
+    REQUIRE(pipe.setCapacity(static_cast<int>(data.size())));
+    CHECK(pipe.capacity() >= static_cast<int>(data.size()));
+    REQUIRE(::lseek(fileno(source), 0, SEEK_SET) == 0);
+    CHECK(transferAll(fileno(source), pipe.writer()) == static_cast<ssize_t>(data.size()));
+    pipe.closeWriter();
+    CHECK(transferAll(pipe.reader(), fileno(target)) == static_cast<ssize_t>(data.size()));
+
+    auto result = std::string(2 * data.size(), '\0');
+    REQUIRE(::lseek(fileno(target), 0, SEEK_SET) == 0);
+    CHECK(::read(fileno(target), result.data(), result.size()) == static_cast<ssize_t>(result.size()));
+    CHECK(result == data + data);
+
+    std::fclose(source);
+    std::fclose(target);
+}
+
+TEST_CASE("shell.job.background")
+{
+    TestShell shell;
+    CHECK(shell("sleep 1 &").exitCode == 0);
+    REQUIRE(shell.shell.jobs().size() == 1);
+    CHECK(shell.shell.jobs()[0].id == 1);
+    CHECK(shell.shell.jobs()[0].command() == "sleep 1");
+    CHECK(shell.shell.jobs()[0].leader == shell.shell.jobs()[0].stages[0].pid);
+    CHECK(shell.env.get("!").value_or("") == std::to_string(shell.shell.jobs()[0].leader));
+
+    shell("sh -c \"exit 3\" &");
+    REQUIRE(shell.shell.jobs().size() == 2);
+    CHECK(shell.shell.jobs()[1].id == 2);
+
+    CHECK(shell("wait %2").exitCode == 3);
+    CHECK(shell.shell.jobs().size() == 1);
+
+    CHECK(shell("wait").exitCode == 0);
+    CHECK(shell.shell.jobs().empty());
+}
+
+TEST_CASE("shell.job.background_without_job")
+{
+    // A "&" that started no job must not put the next pipeline into the background.
+    TestShell shell;
+    shell("nosuchcmd &\nsleep 0");
+    CHECK(shell.shell.jobs().empty());
+    shell("true &\nsleep 0");
+    CHECK(shell.shell.jobs().empty());
+}
+
+TEST_CASE("shell.job.fg_bg")
+{
+    TestShell shell;
+    shell("sleep 1 | sleep 1 &");
+    REQUIRE(shell.shell.jobs().size() == 1);
+    auto const leader = shell.shell.jobs()[0].leader;
+    CHECK(shell.shell.jobs()[0].stages[1].pid != leader);
+
+    CHECK(shell("bg %1").exitCode == 0);
+    CHECK(shell("fg").exitCode == 0);
+    CHECK(shell.shell.jobs().empty());
+    CHECK(shell.shell.lastPipeline().size() == 2);
+}
+
+TEST_CASE("shell.builtin.parallel")
+{
+    TestShell shell;
+    shell("parallel -j 3 sh -c \"sleep 0.$(( 3 - {} )); echo {}\" ::: 1 2 3");
+    CHECK(shell.exitCode == 0);
+    CHECK(escape(shell.output()) == escape("1\n2\n3\n"));
+    CHECK(shell.env.get("PIPESTATUS").value_or("") == "0 0 0");
+    REQUIRE(shell.shell.lastPipeline().size() == 3);
+    CHECK(shell.shell.lastPipeline()[0].command == "sh -c sleep 0.$(( 3 - 1 )); echo 1");
+}
+
+TEST_CASE("shell.builtin.parallel.exit_codes")
+{
+    TestShell shell;
+    shell("parallel --unordered sh -c \"exit {}\" ::: 0 1 2");
+    CHECK(shell.exitCode == 2); // number of failed jobs
+    CHECK(shell.env.get("PIPESTATUS").value_or("") == "0 1 2");
+}
+
+TEST_CASE("shell.spawn.benchmark", "[.benchmark]")
+{
+    TestShell shell;
+
+    shell.shell.setSpawnMethod(endo::SpawnMethod::Fork);
+    BENCHMARK("spawn via fork")
+    {
+        return shell("sleep 0").exitCode;
+    };
+
+    shell.shell.setSpawnMethod(endo::SpawnMethod::PosixSpawn);
+    BENCHMARK("spawn via posix_spawn")
+    {
+        return shell("sleep 0").exitCode;
+    };
+}
 
 // TEST_CASE("shell.builtin.set_and_export_variable")
 // {
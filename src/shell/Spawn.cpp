@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: Apache-2.0
+module;
+#include <fmt/format.h>
+
+#include <crispy/logstore.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+
+#if __has_include(<linux/close_range.h>)
+    #include <linux/close_range.h>
+#endif
+
+extern char** environ; // NOLINT(readability-redundant-declaration)
+
+#if defined(__GLIBC__)
+    #if __GLIBC_PREREQ(2, 34)
+        #define ENDO_POSIX_SPAWN_CLOSEFROM 1
+    #endif
+    #if __GLIBC_PREREQ(2, 35)
+        #define ENDO_POSIX_SPAWN_TCSETPGRP 1
+    #endif
+#endif
+
+import UnixPipe;
+
+export module Spawn;
+
+namespace endo
+{
+
+auto inline spawnLog = logstore::category("spawn ", "Process spawn log", logstore::category::state::Disabled);
+
+// Selects how child processes are being launched.
+export enum class SpawnMethod
+{
+    // posix_spawn(), which avoids copying the shell's page tables (vfork semantics on glibc and musl).
+    PosixSpawn,
+    // Classic fork() + exec(), used as a fallback.
+    Fork,
+};
+
+// A single file descriptor action, applied in the child after stdin and stdout have been set up.
+//
+// Actions are applied in order, so that a later action observes the effect of earlier ones (e.g. >FILE 2>&1).
+export struct FileAction
+{
+    int fd;          // file descriptor in the child
+    int source = -1; // file descriptor to duplicate onto @c fd, or -1 to close @c fd
+};
+
+// The environment handed to child processes, i.e. all exported variables.
+//
+// The variables are kept as ready-made "NAME=VALUE" strings, and the NULL terminated envp block
+// pointing to them is cached and only rebuilt after an exported variable changed,
+// so that spawning a process does not have to rebuild nor copy the environment.
+export class EnvironmentBlock
+{
+  public:
+    // Initializes the block from the given NULL terminated list of "NAME=VALUE" strings.
+    explicit EnvironmentBlock(char const* const* initial = environ)
+    {
+        for (; initial && *initial; ++initial)
+        {
+            auto const entry = std::string_view { *initial };
+            if (auto const eq = entry.find('='); eq != std::string_view::npos && eq != 0)
+                _entries.try_emplace(std::string(entry.substr(0, eq)), entry);
+        }
+    }
+
+    EnvironmentBlock(EnvironmentBlock const&) = delete;
+    EnvironmentBlock& operator=(EnvironmentBlock const&) = delete;
+    EnvironmentBlock(EnvironmentBlock&&) = delete;
+    EnvironmentBlock& operator=(EnvironmentBlock&&) = delete;
+
+    void set(std::string_view name, std::string_view value)
+    {
+        auto entry = std::string(name);
+        entry += '=';
+        entry += value;
+        if (auto i = _entries.find(name); i != _entries.end())
+        {
+            if (i->second == entry)
+                return;
+            i->second = std::move(entry);
+        }
+        else
+            _entries.emplace(std::string(name), std::move(entry));
+        _block.clear();
+    }
+
+    void unset(std::string_view name)
+    {
+        if (auto i = _entries.find(name); i != _entries.end())
+        {
+            _entries.erase(i);
+            _block.clear();
+        }
+    }
+
+    [[nodiscard]] bool contains(std::string_view name) const { return _entries.contains(name); }
+
+    [[nodiscard]] std::optional<std::string_view> get(std::string_view name) const
+    {
+        if (auto i = _entries.find(name); i != _entries.end())
+            return std::string_view(i->second).substr(name.size() + 1);
+        return std::nullopt;
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return _entries.size(); }
+
+    // Returns the NULL terminated envp block, rebuilding it if an exported variable changed.
+    [[nodiscard]] char* const* data()
+    {
+        if (_block.empty())
+        {
+            _block.reserve(_entries.size() + 1);
+            for (auto& [_, entry]: _entries)
+                _block.push_back(entry.data());
+            _block.push_back(nullptr);
+        }
+        return _block.data();
+    }
+
+    // Layers the given "NAME=VALUE" @p overrides on top of this block (e.g. for FOO=1 cmd).
+    //
+    // The returned envp block shares the variable strings of this block and of @p overrides,
+    // thus only the pointers are copied, and it is only valid as long as both are not modified.
+    [[nodiscard]] std::vector<char*> overlay(std::vector<std::string>& overrides)
+    {
+        auto result = std::vector<char*> {};
+        result.reserve(overrides.size() + _entries.size() + 1);
+        for (auto& entry: overrides)
+            result.push_back(entry.data());
+
+        auto const overridden = [&](std::string_view entry) {
+            auto const name = entry.substr(0, entry.find('=') + 1);
+            for (auto const& override: overrides)
+                if (override.starts_with(name))
+                    return true;
+            return false;
+        };
+        for (char* const entry: std::span(data(), _entries.size()))
+            if (!overridden(entry))
+                result.push_back(entry);
+        result.push_back(nullptr);
+        return result;
+    }
+
+  private:
+    std::map<std::string, std::string, std::less<>> _entries; // name -> "NAME=VALUE"
+    std::vector<char*> _block;                                // empty if to be rebuilt
+};
+
+export struct SpawnRequest
+{
+    std::filesystem::path program;       // resolved path to the executable
+    std::vector<char const*> argv;       // NULL terminated argument vector
+    int stdinFd = STDIN_FILENO;          // file descriptor to be used as the child's stdin
+    int stdoutFd = STDOUT_FILENO;        // file descriptor to be used as the child's stdout
+    pid_t processGroup = -1;             // -1: inherit, 0: become group leader, >0: join given group
+    int foregroundTerminal = -1;         // terminal the child's process group is made the foreground of
+    std::vector<FileAction> fileActions; // redirects, precomputed by the shell
+    char* const* envp = environ;         // NULL terminated environment block of the child
+
+    // All file descriptors from this one upward are closed in the child, so that no descriptor
+    // leaks into it, regardless of whether or not it was opened with O_CLOEXEC.
+    [[nodiscard]] int closeFrom() const noexcept
+    {
+        int from = STDERR_FILENO + 1;
+        for (auto const& action: fileActions)
+            from = std::max(from, action.fd + 1);
+        return from;
+    }
+
+    // Ranges [first, last] of the file descriptors below closeFrom() (and above stderr)
+    // that are not set up by any file action, and thus are closed in the child as well.
+    [[nodiscard]] std::vector<std::pair<int, int>> closeGaps() const
+    {
+        auto targets = std::vector<int> {};
+        for (auto const& action: fileActions)
+            if (action.fd > STDERR_FILENO)
+                targets.push_back(action.fd);
+        std::ranges::sort(targets);
+
+        auto gaps = std::vector<std::pair<int, int>> {};
+        int first = STDERR_FILENO + 1;
+        for (int const fd: targets)
+        {
+            if (fd > first)
+                gaps.emplace_back(first, fd - 1);
+            first = std::max(first, fd + 1);
+        }
+        return gaps;
+    }
+};
+
+// Result of a spawn attempt.
+//
+// If the program could not be executed, @c pid is -1 and @c error contains the errno value
+// as reported by the failing exec (or fork) call.
+export struct SpawnResult
+{
+    pid_t pid = -1;
+    int error = 0;
+
+    [[nodiscard]] bool good() const noexcept { return pid > 0; }
+};
+
+namespace
+{
+    // Signals an interactive shell ignores for job control, which must not be ignored by its children.
+    auto constexpr JobControlSignals = std::array { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD };
+
+    SpawnResult spawnWithPosixSpawn(SpawnRequest const& request)
+    {
+        posix_spawn_file_actions_t actions {};
+        posix_spawnattr_t attributes {};
+
+        posix_spawn_file_actions_init(&actions);
+        posix_spawnattr_init(&attributes);
+
+#if defined(ENDO_POSIX_SPAWN_TCSETPGRP)
+        // Done first, as the terminal may be the very descriptor that is replaced by stdin.
+        if (request.foregroundTerminal != -1)
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, request.foregroundTerminal);
+#endif
+        if (request.stdinFd != STDIN_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, request.stdinFd, STDIN_FILENO);
+        if (request.stdoutFd != STDOUT_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, request.stdoutFd, STDOUT_FILENO);
+        for (auto const& action: request.fileActions)
+        {
+            // Duplicating a descriptor onto itself clears its close-on-exec flag.
+            if (action.source == -1)
+                posix_spawn_file_actions_addclose(&actions, action.fd);
+            else
+                posix_spawn_file_actions_adddup2(&actions, action.source, action.fd);
+        }
+        // Closing a descriptor that is not open is no error, as far as posix_spawn is concerned.
+        for (auto const& [first, last]: request.closeGaps())
+            for (int fd = first; fd <= last; ++fd)
+                posix_spawn_file_actions_addclose(&actions, fd);
+#if defined(ENDO_POSIX_SPAWN_CLOSEFROM)
+        posix_spawn_file_actions_addclosefrom_np(&actions, request.closeFrom());
+#endif
+
+        short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#if defined(POSIX_SPAWN_USEVFORK)
+        flags |= POSIX_SPAWN_USEVFORK;
+#endif
+        if (request.processGroup != -1)
+        {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attributes, request.processGroup);
+        }
+
+        // The shell may block signals (e.g. SIGCHLD) for its own event handling,
+        // which must not be inherited by the child.
+        sigset_t emptyMask {};
+        sigemptyset(&emptyMask);
+        posix_spawnattr_setsigmask(&attributes, &emptyMask);
+        sigset_t defaultSignals {};
+        sigemptyset(&defaultSignals);
+        for (int const signo: JobControlSignals)
+            sigaddset(&defaultSignals, signo);
+        posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+        posix_spawnattr_setflags(&attributes, flags);
+
+        auto result = SpawnResult {};
+        int const error = posix_spawn(&result.pid,
+                                      request.program.c_str(),
+                                      &actions,
+                                      &attributes,
+                                      const_cast<char* const*>(request.argv.data()),
+                                      request.envp);
+
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&actions);
+
+        if (error != 0)
+            return SpawnResult { .pid = -1, .error = error };
+
+        return result;
+    }
+
+    // Closes all descriptors from @p first to @p last in the calling (child) process,
+    // except for @p keep, which is expected to be close-on-exec.
+    void closeDescriptors(unsigned first, unsigned last, int keep) noexcept
+    {
+        auto const kept = static_cast<unsigned>(keep);
+#if defined(SYS_close_range)
+        if (kept >= first && kept <= last)
+        {
+            if (kept > first)
+                syscall(SYS_close_range, first, kept - 1, 0);
+            if (kept < last)
+                syscall(SYS_close_range, kept + 1, last, 0);
+            return;
+        }
+        syscall(SYS_close_range, first, last, 0);
+#else
+        // Without close_range we rely on the shell owned descriptors being close-on-exec,
+        // unless the range is bounded.
+        if (last == ~0U)
+            return;
+        for (unsigned fd = first; fd <= last; ++fd)
+            if (fd != kept)
+                ::close(static_cast<int>(fd));
+#endif
+    }
+
+    SpawnResult spawnWithFork(SpawnRequest const& request)
+    {
+        // The child reports a failing exec through this close-on-exec pipe.
+        // A successful exec closes the write end and the parent reads EOF.
+        auto execStatus = UnixPipe { O_CLOEXEC };
+        auto const closeGaps = request.closeGaps();
+
+        pid_t const pid = fork();
+        switch (pid)
+        {
+            case -1: return SpawnResult { .pid = -1, .error = errno };
+            case 0: {
+                // child process
+                execStatus.closeReader();
+                if (request.processGroup != -1)
+                    setpgid(0, request.processGroup);
+                // SIGTTOU is still ignored here, as inherited from the shell.
+                if (request.foregroundTerminal != -1)
+                    tcsetpgrp(request.foregroundTerminal, getpgrp());
+                for (int const signo: JobControlSignals)
+                    signal(signo, SIG_DFL);
+                sigset_t emptyMask {};
+                sigemptyset(&emptyMask);
+                sigprocmask(SIG_SETMASK, &emptyMask, nullptr);
+                if (request.stdinFd != STDIN_FILENO)
+                    dup2(request.stdinFd, STDIN_FILENO);
+                if (request.stdoutFd != STDOUT_FILENO)
+                    dup2(request.stdoutFd, STDOUT_FILENO);
+                for (auto const& action: request.fileActions)
+                {
+                    if (action.source == -1)
+                        ::close(action.fd);
+                    else if (action.source == action.fd)
+                        fcntl(action.fd, F_SETFD, 0);
+                    else
+                        dup2(action.source, action.fd);
+                }
+                int const keep = execStatus.writer();
+                for (auto const& [first, last]: closeGaps)
+                    closeDescriptors(static_cast<unsigned>(first), static_cast<unsigned>(last), keep);
+                closeDescriptors(static_cast<unsigned>(request.closeFrom()), ~0U, keep);
+                execve(request.program.c_str(), const_cast<char* const*>(request.argv.data()), request.envp);
+                int const error = errno;
+                [[maybe_unused]] auto const _ = ::write(execStatus.writer(), &error, sizeof(error));
+                _exit(EXIT_FAILURE);
+            }
+            default: break;
+        }
+
+        // parent process
+        execStatus.closeWriter();
+        int error = 0;
+        ssize_t n = 0;
+        do
+            n = ::read(execStatus.reader(), &error, sizeof(error));
+        while (n == -1 && errno == EINTR);
+
+        if (n == sizeof(error))
+        {
+            // The child failed to exec and already exited, so reap it right away.
+            waitpid(pid, nullptr, 0);
+            return SpawnResult { .pid = -1, .error = error };
+        }
+
+        return SpawnResult { .pid = pid, .error = 0 };
+    }
+} // namespace
+
+// Sets close-on-exec on all descriptors above stderr that the calling process inherited.
+//
+// The shell opens all of its own descriptors with O_CLOEXEC, so afterwards none leaks into a child,
+// even where posix_spawn cannot close all descriptors above the redirect targets (before glibc 2.34).
+export void setInheritedDescriptorsCloseOnExec() noexcept
+{
+#if defined(SYS_close_range) && defined(CLOSE_RANGE_CLOEXEC)
+    if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, CLOSE_RANGE_CLOEXEC) == 0)
+        return;
+#endif
+    auto ec = std::error_code {};
+    auto descriptors = std::vector<int> {};
+    for (auto const& entry: std::filesystem::directory_iterator("/proc/self/fd", ec))
+        descriptors.push_back(std::atoi(entry.path().filename().c_str()));
+    if (ec)
+    {
+        descriptors.clear();
+        for (int fd = STDERR_FILENO + 1; fd < std::min(sysconf(_SC_OPEN_MAX), 65536L); ++fd)
+            descriptors.push_back(fd);
+    }
+    for (int const fd: descriptors)
+        if (fd > STDERR_FILENO)
+            if (int const flags = fcntl(fd, F_GETFD); flags != -1)
+                fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+// Launches the program as described by @p request using the given @p method.
+export SpawnResult spawnProcess(SpawnRequest const& request, SpawnMethod method)
+{
+    auto const result =
+        method == SpawnMethod::PosixSpawn ? spawnWithPosixSpawn(request) : spawnWithFork(request);
+
+    if (result.good())
+        spawnLog()("Spawned {} as PID {}", request.program.string(), result.pid);
+    else
+        spawnLog()("Failed to spawn {}: {}", request.program.string(), strerror(result.error));
+
+    return result;
+}
+
+} // namespace endo
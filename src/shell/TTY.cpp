@@ -118,6 +118,39 @@ export class RealTTY final: public TTY
     termios _originalTermios {};
 };
 
+// TTY of a shell that is not run interactively, e.g. when executing a script.
+//
+// Standard input and output are used as is, without touching any terminal settings,
+// as they may very well be pipes or regular files.
+export class NonInteractiveTTY final: public TTY
+{
+  public:
+    [[nodiscard]] static NonInteractiveTTY& instance()
+    {
+        static NonInteractiveTTY instance;
+        return instance;
+    }
+
+    [[nodiscard]] int inputFd() const noexcept override { return STDIN_FILENO; }
+    [[nodiscard]] int outputFd() const noexcept override { return STDOUT_FILENO; }
+
+    void setRawMode() override {}
+    void restoreMode() override {}
+
+    void writeToStdout(std::string_view str) const override
+    {
+        ssize_t const result = ::write(STDOUT_FILENO, str.data(), str.size());
+        if (result == -1)
+            throw std::runtime_error("write: " + std::string(strerror(errno)));
+    }
+    void writeToStdin(std::string_view str) const override
+    {
+        ssize_t const result = ::write(STDIN_FILENO, str.data(), str.size());
+        if (result == -1)
+            throw std::runtime_error("write: " + std::string(strerror(errno)));
+    }
+};
+
 // This is a TTY implementation that can be used for testing.
 // It uses a PTY to simulate a TTY.
 // The output of the TTY is stored in a buffer that can be inspected.
@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <catch2/catch.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+import CoreVM;
+
+namespace
+{
+
+using CoreVM::LiteralType;
+
+// A function returning a number, being built by an IRBuilder.
+struct TestFunction
+{
+    CoreVM::IRBuilder builder;
+    std::unique_ptr<CoreVM::IRProgram> program;
+    CoreVM::IRHandler* handler = nullptr;
+
+    TestFunction()
+    {
+        builder.setProgram(std::make_unique<CoreVM::IRProgram>());
+        program.reset(builder.program());
+        handler = builder.setHandler(builder.getHandler("test"));
+        handler->setReturnType(LiteralType::Number);
+        builder.setInsertPoint(builder.createBlock("entry"));
+    }
+
+    CoreVM::ConstantInt* number(CoreVM::CoreNumber value) { return builder.get(value); }
+
+    // Generates the function's target code and runs it, returning its result.
+    template <typename T = CoreVM::CoreNumber>
+    T run()
+    {
+        auto code = CoreVM::TargetCodeGenerator().generate(program.get());
+        auto globals = CoreVM::Runner::Globals {};
+        auto runner = CoreVM::Runner(code->findHandler("test"), nullptr, &globals, nullptr);
+        runner.run();
+        if constexpr (std::is_same_v<T, CoreVM::CoreString>)
+            return *reinterpret_cast<const CoreVM::CoreString*>(runner.stack()[-1]);
+        else
+            return static_cast<T>(runner.stack()[-1]);
+    }
+
+    template <typename T>
+    size_t count()
+    {
+        size_t result = 0;
+        for (CoreVM::BasicBlock* bb: handler->basicBlocks())
+            for (CoreVM::Instr* instr: bb->instructions())
+                result += dynamic_cast<T*>(instr) != nullptr ? 1 : 0;
+        return result;
+    }
+};
+
+// Sums up the numbers below @p n within variables:
+//   i = 0; s = 0; while i < n; do s = s + i; i = i + 1; done; return s
+void buildSum(TestFunction& f, CoreVM::CoreNumber n)
+{
+    auto& b = f.builder;
+    auto* i = b.createAlloca(LiteralType::Number, f.number(1), "i");
+    auto* s = b.createAlloca(LiteralType::Number, f.number(1), "s");
+    auto* cond = b.createBlock("while.cond");
+    auto* body = b.createBlock("while.body");
+    auto* end = b.createBlock("while.end");
+    b.createStore(i, f.number(0));
+    b.createStore(s, f.number(0));
+    b.createBr(cond);
+
+    b.setInsertPoint(cond);
+    b.createCondBr(b.createNCmpLT(b.createLoad(i), f.number(n)), body, end);
+
+    b.setInsertPoint(body);
+    b.createStore(s, b.createAdd(b.createLoad(s), b.createLoad(i)));
+    b.createStore(i, b.createAdd(b.createLoad(i), f.number(1)));
+    b.createBr(cond);
+
+    b.setInsertPoint(end);
+    b.createRet(b.createLoad(s));
+}
+
+// Assigns 1 or 2 to x, depending on @p condition, and returns x + y (with y never assigned).
+void buildBranches(TestFunction& f, bool condition)
+{
+    auto& b = f.builder;
+    auto* x = b.createAlloca(LiteralType::Number, f.number(1), "x");
+    auto* y = b.createAlloca(LiteralType::Number, f.number(1), "y");
+    auto* trueBlock = b.createBlock("if.trueBlock");
+    auto* falseBlock = b.createBlock("if.falseBlock");
+    auto* end = b.createBlock("if.end");
+    b.createCondBr(b.getBoolean(condition), trueBlock, falseBlock);
+
+    b.setInsertPoint(trueBlock);
+    b.createStore(x, f.number(1));
+    b.createBr(end);
+
+    b.setInsertPoint(falseBlock);
+    b.createStore(x, f.number(2));
+    b.createBr(end);
+
+    b.setInsertPoint(end);
+    b.createRet(b.createAdd(b.createLoad(x), b.createLoad(y)));
+}
+
+void optimize(CoreVM::IRHandler* handler)
+{
+    CoreVM::PassManager pm;
+    pm.registerPass("eliminate-empty-blocks", &CoreVM::transform::emptyBlockElimination);
+    pm.registerPass("eliminate-linear-br", &CoreVM::transform::eliminateLinearBr);
+    pm.registerPass("eliminate-unused-blocks", &CoreVM::transform::eliminateUnusedBlocks);
+    pm.registerPass("eliminate-unused-instr", &CoreVM::transform::eliminateUnusedInstr);
+    pm.registerPass("promote-memory-to-registers", &CoreVM::transform::promoteMemoryToRegisters);
+    pm.registerPass("propagate-constants", &CoreVM::transform::propagateConstants);
+    pm.registerPass("fuse-string-concatenations", &CoreVM::transform::fuseStringConcatenations);
+    pm.registerPass("fold-constant-condbr", &CoreVM::transform::foldConstantCondBr);
+    pm.registerPass("rewrite-br-to-exit", &CoreVM::transform::rewriteBrToExit);
+    pm.registerPass("rewrite-cond-br-to-same-branches", &CoreVM::transform::rewriteCondBrToSameBranches);
+    pm.run(handler);
+}
+
+} // namespace
+
+TEST_CASE("transform.DominatorTree")
+{
+    auto f = TestFunction {};
+    buildSum(f, 10);
+    auto* entry = f.handler->getEntryBlock();
+    auto* cond = entry->successors().front();
+    auto* body = cond->successors()[0];
+    auto* end = cond->successors()[1];
+
+    auto const tree = CoreVM::DominatorTree(f.handler);
+    CHECK(tree.immediateDominator(entry) == nullptr);
+    CHECK(tree.immediateDominator(cond) == entry);
+    CHECK(tree.immediateDominator(body) == cond);
+    CHECK(tree.immediateDominator(end) == cond);
+    CHECK(tree.dominates(cond, body));
+    CHECK_FALSE(tree.dominates(body, end));
+    CHECK(tree.dominanceFrontier(body) == std::vector { cond });
+    CHECK(tree.dominanceFrontier(cond) == std::vector { cond });
+    CHECK(tree.dominanceFrontier(end).empty());
+    CHECK(end->dominators() == std::vector { entry, cond, end });
+}
+
+TEST_CASE("transform.promoteMemoryToRegisters.loop")
+{
+    auto unoptimized = TestFunction {};
+    buildSum(unoptimized, 10);
+    CHECK(unoptimized.run() == 45);
+
+    auto f = TestFunction {};
+    buildSum(f, 10);
+    REQUIRE(CoreVM::transform::promoteMemoryToRegisters(f.handler));
+    f.handler->verify();
+    CHECK(f.count<CoreVM::AllocaInstr>() == 0);
+    CHECK(f.count<CoreVM::LoadInstr>() == 0);
+    CHECK(f.count<CoreVM::StoreInstr>() == 0);
+    CHECK(f.count<CoreVM::PhiNode>() == 2); // i and s, merged at the loop's header
+    CHECK(f.run() == 45);
+}
+
+TEST_CASE("transform.promoteMemoryToRegisters.branches")
+{
+    for (bool const condition: { true, false })
+    {
+        auto f = TestFunction {};
+        buildBranches(f, condition);
+        REQUIRE(CoreVM::transform::promoteMemoryToRegisters(f.handler));
+        CHECK(f.count<CoreVM::PhiNode>() == 1); // only x is ever assigned
+
+        // the other passes keep the PHI node in sync, up to resolving it to a constant
+        optimize(f.handler);
+        CHECK(f.count<CoreVM::PhiNode>() == 0);
+        CHECK(f.run() == (condition ? 1 : 2));
+    }
+}
+
+TEST_CASE("transform.eliminatePhiNodes.frontend")
+{
+    // IR without PHI nodes, whose values are used within their basic block only, needs no stack slots.
+    auto f = TestFunction {};
+    auto& b = f.builder;
+    auto* n = f.handler->addArgument(LiteralType::Number, "n");
+    auto* sum = b.createAdd(n, n);
+    b.createRet(b.createMul(sum, sum));
+
+    auto code = CoreVM::TargetCodeGenerator().generate(f.program.get());
+    for (CoreVM::Instruction const instr: code->findHandler("test")->code())
+        CHECK(CoreVM::opcode(instr) != CoreVM::Opcode::ALLOCA);
+}
+
+TEST_CASE("transform.propagateConstants.branches")
+{
+    // x = 1; if x == 1 then y = x + 1 else y = x * 100 fi; return y
+    auto f = TestFunction {};
+    auto& b = f.builder;
+    auto* x = b.createAlloca(LiteralType::Number, f.number(1), "x");
+    auto* y = b.createAlloca(LiteralType::Number, f.number(1), "y");
+    auto* trueBlock = b.createBlock("if.trueBlock");
+    auto* falseBlock = b.createBlock("if.falseBlock");
+    auto* end = b.createBlock("if.end");
+    b.createStore(x, f.number(1));
+    b.createCondBr(b.createNCmpEQ(b.createLoad(x), f.number(1)), trueBlock, falseBlock);
+
+    b.setInsertPoint(trueBlock);
+    b.createStore(y, b.createAdd(b.createLoad(x), f.number(1)));
+    b.createBr(end);
+
+    b.setInsertPoint(falseBlock);
+    b.createStore(y, b.createMul(b.createLoad(x), f.number(100)));
+    b.createBr(end);
+
+    b.setInsertPoint(end);
+    b.createRet(b.createLoad(y));
+
+    REQUIRE(CoreVM::transform::promoteMemoryToRegisters(f.handler));
+    REQUIRE(f.count<CoreVM::PhiNode>() == 1);
+
+    // the value flowing in from the branch not taken does not spoil the PHI node
+    REQUIRE(CoreVM::transform::propagateConstants(f.handler));
+    CHECK(f.count<CoreVM::PhiNode>() == 0);
+    CHECK(f.count<CoreVM::ICmpEQInstr>() == 0);
+    CHECK(f.count<CoreVM::IAddInstr>() == 0);
+    CHECK_FALSE(CoreVM::transform::propagateConstants(f.handler));
+
+    optimize(f.handler);
+    CHECK(f.count<CoreVM::CondBrInstr>() == 0);
+    CHECK(f.count<CoreVM::IMulInstr>() == 0);
+    CHECK(f.run() == 2);
+}
+
+TEST_CASE("transform.propagateConstants.regexp")
+{
+    for (bool const groupsUsed: { false, true })
+    {
+        auto f = TestFunction {};
+        auto& b = f.builder;
+        auto* trueBlock = b.createBlock("if.trueBlock");
+        auto* falseBlock = b.createBlock("if.falseBlock");
+        auto* subject = b.get(std::string_view { "hello" });
+        b.createCondBr(b.createSCmpRE(subject, b.get(CoreVM::util::RegExp("^h.*o$"))), trueBlock, falseBlock);
+
+        b.setInsertPoint(trueBlock);
+        if (groupsUsed)
+            b.createRegExpGroup(f.number(0));
+        b.createRet(f.number(1));
+
+        b.setInsertPoint(falseBlock);
+        b.createRet(f.number(2));
+
+        // the groups of a match must be kept around for those reading them
+        CHECK(CoreVM::transform::propagateConstants(f.handler) == !groupsUsed);
+        CHECK(f.count<CoreVM::SCmpREInstr>() == (groupsUsed ? 1 : 0));
+        if (!groupsUsed)
+            CHECK(f.run() == 1);
+    }
+}
+
+TEST_CASE("transform.fuseStringConcatenations")
+{
+    // return a + "-" + b + "-" + c + "." + "log", with the variables not being constant
+    auto f = TestFunction {};
+    f.handler->setReturnType(LiteralType::String);
+    auto& b = f.builder;
+    auto const text = [&](std::string_view value) { return b.get(value); };
+    auto* a = b.createAlloca(LiteralType::String, f.number(1), "a");
+    auto* bar = b.createAlloca(LiteralType::String, f.number(1), "b");
+    auto* c = b.createAlloca(LiteralType::String, f.number(1), "c");
+    b.createStore(a, text("foo"));
+    b.createStore(bar, text("bar"));
+    b.createStore(c, text("baz"));
+
+    auto* result = b.createSAdd(b.createLoad(a), text("-"));
+    result = b.createSAdd(result, b.createLoad(bar));
+    result = b.createSAdd(result, text("-"));
+    result = b.createSAdd(result, b.createLoad(c));
+    result = b.createSAdd(result, text("."));
+    result = b.createSAdd(result, text("log"));
+    b.createRet(result);
+    REQUIRE(f.count<CoreVM::SAddInstr>() == 6);
+    CHECK(f.run<CoreVM::CoreString>() == "foo-bar-baz.log");
+
+    REQUIRE(CoreVM::transform::fuseStringConcatenations(f.handler));
+    CHECK(f.count<CoreVM::SAddInstr>() == 0);
+    REQUIRE(f.count<CoreVM::SConcatInstr>() == 1);
+    CHECK_FALSE(CoreVM::transform::fuseStringConcatenations(f.handler));
+    CHECK(f.run<CoreVM::CoreString>() == "foo-bar-baz.log");
+
+    // a, "-", b, "-", c, ".log"
+    for (CoreVM::BasicBlock* bb: f.handler->basicBlocks())
+        for (CoreVM::Instr* instr: bb->instructions())
+            if (dynamic_cast<CoreVM::SConcatInstr*>(instr))
+                CHECK(instr->operands().size() == 6);
+}
+
+TEST_CASE("transform.PassManager")
+{
+    using CoreVM::PassManager;
+
+    auto f = TestFunction {};
+    buildSum(f, 10);
+
+    // "changer" changes instructions twice, which "inspector" depends on but "cleaner" does not.
+    size_t changerRuns = 0;
+    size_t cleanerRuns = 0;
+    size_t inspectorRuns = 0;
+    auto pm = PassManager {};
+    pm.registerPass(
+        "changer",
+        [&](CoreVM::IRHandler*) { return ++changerRuns <= 2; },
+        PassManager::Instructions,
+        PassManager::Instructions);
+    pm.registerPass(
+        "cleaner",
+        [&](CoreVM::IRHandler*) { return ++cleanerRuns == 0; },
+        PassManager::ControlFlow,
+        PassManager::ControlFlow);
+    pm.registerPass(
+        "inspector",
+        [&](CoreVM::IRHandler*) { return ++inspectorRuns == 0; },
+        PassManager::NoChanges,
+        PassManager::Instructions);
+    pm.run(f.handler);
+    CHECK(changerRuns == 3);
+    CHECK(cleanerRuns == 1);
+    CHECK(inspectorRuns == 1); // still pending from the start, when the changes were made
+    REQUIRE(pm.statistics("changer") != nullptr);
+    CHECK(pm.statistics("changer")->runs == 3);
+    CHECK(pm.statistics("changer")->changes == 2);
+    CHECK(pm.statistics("unknown") == nullptr);
+
+    auto const instructions = f.count<CoreVM::Instr>();
+    auto timed = PassManager {};
+    timed.setTimePasses(true);
+    timed.registerPass("promote-memory-to-registers", &CoreVM::transform::promoteMemoryToRegisters);
+    timed.run(f.handler);
+    auto const* statistics = timed.statistics("promote-memory-to-registers");
+    REQUIRE(statistics != nullptr);
+    CHECK(statistics->runs == 2);
+    CHECK(statistics->changes == 1);
+    CHECK(statistics->instructionsRemoved == static_cast<int64_t>(instructions - f.count<CoreVM::Instr>()));
+    CHECK(statistics->blocksRemoved == 0);
+    CHECK(timed.formatStatistics().find("promote-memory-to-registers") != std::string::npos);
+    CHECK(f.run() == 45);
+}
@@ -3,6 +3,8 @@ module;
 #include <fmt/format.h>
 #include <crispy/logstore.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <string>
@@ -79,6 +81,32 @@ export struct UnixPipe
     }
     [[nodiscard]] int writer() const noexcept { return pfd[1]; }
 
+    // Returns the pipe's buffer size in bytes, or -1 if unknown.
+    [[nodiscard]] int capacity() const noexcept
+    {
+#if defined(F_GETPIPE_SZ)
+        return fcntl(pfd[1] != -1 ? pfd[1] : pfd[0], F_GETPIPE_SZ);
+#else
+        return -1;
+#endif
+    }
+
+    // Resizes the pipe's buffer to (at least) @p size bytes, which reduces the number of
+    // context switches between producer and consumer for high throughput stages.
+    //
+    // Unprivileged processes are limited by /proc/sys/fs/pipe-max-size.
+    bool setCapacity(int size) noexcept
+    {
+#if defined(F_SETPIPE_SZ)
+        if (fcntl(pfd[1] != -1 ? pfd[1] : pfd[0], F_SETPIPE_SZ, size) != -1)
+            return true;
+        pipeLog()("Failed to resize pipe {} to {} bytes. {}\n", pfd[0], size, strerror(errno));
+#else
+        (void) size;
+#endif
+        return false;
+    }
+
     void closeReader() noexcept { saveClose(&pfd[0]); }
     void closeWriter() noexcept { saveClose(&pfd[1]); }
 
@@ -88,4 +116,88 @@ export struct UnixPipe
         closeWriter();
     }
 };
+namespace detail
+{
+    inline bool writeAll(int fd, char const* data, size_t size) noexcept
+    {
+        while (size > 0)
+        {
+            ssize_t const written = ::write(fd, data, size);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+} // namespace detail
+
+// Moves up to @p count bytes of what is readable from @p source to @p target.
+//
+// The data is moved inside the kernel without being copied through user space where possible,
+// i.e. via splice(2) if either side is a pipe. Otherwise a single read/write is used.
+//
+// @returns the number of bytes transferred, 0 on EOF, or -1 on error (errno is set).
+export inline ssize_t transfer(int source, int target, size_t count) noexcept
+{
+#if defined(__linux__)
+    while (true)
+    {
+        ssize_t const n = splice(source, nullptr, target, nullptr, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n >= 0)
+            return n;
+        if (errno == EINTR)
+            continue;
+        if (errno != EINVAL)
+            return -1;
+        break; // neither side is a pipe, or the target does not support splicing (e.g. a TTY)
+    }
+#endif
+
+    char buffer[64 * 1024];
+    while (true)
+    {
+        ssize_t const n = ::read(source, buffer, std::min(count, sizeof(buffer)));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n;
+        return detail::writeAll(target, buffer, static_cast<size_t>(n)) ? n : -1;
+    }
+}
+
+// Appends everything currently readable from @p fd to @p buffer.
+//
+// The data is read in large chunks straight into the buffer, whose capacity grows geometrically,
+// rather than through an intermediate buffer. Only the chunk about to be read is zero-initialized.
+//
+// @returns true if more data may follow (i.e. the non-blocking @p fd would block),
+//          false on EOF or error.
+export inline bool readInto(int fd, std::string& buffer)
+{
+    auto constexpr ChunkSize = size_t { 64 * 1024 };
+
+    while (true)
+    {
+        auto const size = buffer.size();
+        if (buffer.capacity() - size < ChunkSize)
+            buffer.reserve(std::max(buffer.capacity() * 2, size + ChunkSize));
+        buffer.resize(size + ChunkSize);
+
+        ssize_t const n = ::read(fd, buffer.data() + size, ChunkSize);
+        buffer.resize(size + static_cast<size_t>(std::max(n, ssize_t { 0 })));
+        if (n > 0)
+            continue;
+        if (n == 0)
+            return false;
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
 } // namespace endo
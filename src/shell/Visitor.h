@@ -9,18 +9,27 @@ struct BuiltinSetStmt;
 struct BuiltinExportStmt;
 struct BuiltinFalseStmt;
 struct BuiltinExitStmt;
+struct BuiltinHashStmt;
+struct BuiltinJobControlStmt;
 struct BuiltinReadStmt;
+struct BuiltinTimeStmt;
 struct BuiltinTrueStmt;
+struct BackgroundStmt;
 struct CallPipeline;
 struct CommandFileSubst;
 struct CompoundStmt;
 struct FileDescriptor;
+struct FunctionCall;
+struct FunctionDef;
 struct IfStmt;
 struct InputRedirect;
 struct LiteralExpr;
 struct OutputRedirect;
+struct ParameterExpr;
 struct ProgramCall;
+struct ReturnStmt;
 struct SubstitutionExpr;
+struct VariableExpr;
 struct WhileStmt;
 
 struct Visitor
@@ -34,24 +43,35 @@ struct Visitor
     virtual void visit(OutputRedirect const&) = 0;
     virtual void visit(ProgramCall const&) = 0;
     virtual void visit(CallPipeline const&) = 0;
+    virtual void visit(BackgroundStmt const&) = 0;
 
     // flow control
     virtual void visit(CompoundStmt const&) = 0;
     virtual void visit(IfStmt const&) = 0;
     virtual void visit(WhileStmt const&) = 0;
 
+    // functions
+    virtual void visit(FunctionDef const&) = 0;
+    virtual void visit(FunctionCall const&) = 0;
+    virtual void visit(ReturnStmt const&) = 0;
+
     // builtin statements
     virtual void visit(BuiltinExitStmt const&) = 0;
     virtual void visit(BuiltinExportStmt const&) = 0;
     virtual void visit(BuiltinTrueStmt const&) = 0;
     virtual void visit(BuiltinFalseStmt const&) = 0;
+    virtual void visit(BuiltinHashStmt const&) = 0;
+    virtual void visit(BuiltinJobControlStmt const&) = 0;
     virtual void visit(BuiltinReadStmt const&) = 0;
+    virtual void visit(BuiltinTimeStmt const&) = 0;
     virtual void visit(BuiltinChDirStmt const&) = 0;
     virtual void visit(BuiltinSetStmt const&) = 0;
 
     // epxressions
     virtual void visit(LiteralExpr const&) = 0;
     virtual void visit(SubstitutionExpr const&) = 0;
+    virtual void visit(VariableExpr const&) = 0;
+    virtual void visit(ParameterExpr const&) = 0;
     virtual void visit(CommandFileSubst const&) = 0;
 };
 
@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <shell/AST.h>
+
+#include <fmt/format.h>
+
+#define ANKERL_NANOBENCH_IMPLEMENT
+#include <nanobench.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+import CoreVM;
+import IncrementalParser;
+import IRGenerator;
+import Lexer;
+import Parser;
+import Shell;
+import Spawn;
+import TTY;
+
+// Benchmarks every phase of compiling and running a script, from tokenization to process spawning.
+//
+// Usage: bench-endo [--json FILE] [--filter TEXT]
+//
+// All inputs are generated deterministically, so that results of different builds can be compared.
+// With --json, the results are additionally written as JSON (nanobench's JSON template),
+// which is what release-to-release regression tracking is meant to consume.
+
+namespace
+{
+
+using ankerl::nanobench::Bench;
+using ankerl::nanobench::doNotOptimizeAway;
+
+// {{{ synthetic scripts
+// Generates a script of @p lines lines, cycling through the language's constructs.
+std::string makeScript(size_t lines)
+{
+    auto script = std::string {};
+    for (size_t i = 0; i < lines; ++i)
+    {
+        switch (i % 10)
+        {
+            case 0: script += fmt::format("# comment number {}\n", i); break;
+            case 1: script += fmt::format("echo hello world {} 'single quoted' \"double quoted\"\n", i); break;
+            case 2: script += fmt::format("ls -l /tmp/dir{} | grep -v foo | sort | uniq -c\n", i); break;
+            case 3: script += fmt::format("set VAR{} value{}\n", i, i); break;
+            case 4: script += fmt::format("cat <input{0}.txt >output{0}.txt 2>&1\n", i); break;
+            case 5: script += fmt::format("if test -f file{}; then echo yes; else echo no; fi\n", i); break;
+            case 6: script += fmt::format("echo $VAR{} $? $# $(basename /usr/bin/env)\n", i - 3); break;
+            case 7: script += fmt::format("FOO={} BAR=baz env | wc -l\n", i); break;
+            case 8: script += fmt::format("while false; do echo never {}; done\n", i); break;
+            case 9: script += fmt::format("diff <(echo a{0}) <(echo b{0}) >>log.txt\n", i); break;
+        }
+    }
+    return script;
+}
+
+// Generates a script of @p lines lines dominated by long runs (indentation, words and quoted strings),
+// which is where the lexer's run scanning pays off most.
+std::string makeLongRunScript(size_t lines)
+{
+    auto script = std::string {};
+    for (size_t i = 0; i < lines; ++i)
+        script += fmt::format("{:>{}}printf \"%s: {:=>60}\" /usr/local/share/endo/completions/generated_{:0>40}.txt\n",
+                              "",
+                              4 * (i % 4),
+                              i,
+                              i);
+    return script;
+}
+
+// Generates a script that only exercises the VM's instruction dispatch, without calling any builtin.
+std::string makeDispatchScript(size_t statements)
+{
+    auto script = std::string {};
+    for (size_t i = 0; i < statements; ++i)
+        script += "if true; then true; else false; fi\n";
+    return script;
+}
+
+// Generates a script that invokes a cheap native callback over and over.
+std::string makeNativeCallScript(size_t statements)
+{
+    auto script = std::string {};
+    for (size_t i = 0; i < statements; ++i)
+        script += fmt::format("set BENCH_VAR{} value\n", i % 16);
+    return script;
+}
+// }}}
+
+struct Options
+{
+    std::string jsonPath;
+    std::string filter;
+};
+
+// A parsed script, along with the parser owning its AST.
+struct ParsedScript
+{
+    std::unique_ptr<endo::Parser> parser;
+    endo::ast::Ptr<endo::ast::Statement> rootNode;
+};
+
+// Drives the individual compilation phases the same way the shell does.
+class Compiler
+{
+  public:
+    explicit Compiler(endo::Shell& shell): _shell { shell } {}
+
+    [[nodiscard]] ParsedScript parse(std::string const& script)
+    {
+        auto parser =
+            std::make_unique<endo::Parser>(_shell, _report, std::make_unique<endo::StringSource>(script));
+        auto rootNode = parser->parse();
+        return ParsedScript { .parser = std::move(parser), .rootNode = std::move(rootNode) };
+    }
+
+    [[nodiscard]] std::unique_ptr<CoreVM::IRProgram> generateIR(std::string const& script)
+    {
+        auto const parsed = parse(script);
+        return std::unique_ptr<CoreVM::IRProgram>(endo::IRGenerator::generate(*parsed.rootNode));
+    }
+
+    [[nodiscard]] std::unique_ptr<CoreVM::Program> link(std::unique_ptr<CoreVM::Program> program)
+    {
+        auto report = CoreVM::diagnostics::BufferedReport {};
+        if (!program->link(&_shell, &report))
+            throw std::runtime_error("Failed to link program");
+        return program;
+    }
+
+    [[nodiscard]] std::unique_ptr<CoreVM::Program> compile(std::string const& script)
+    {
+        auto const irProgram = generateIR(script);
+        return link(CoreVM::TargetCodeGenerator {}.generate(irProgram.get()));
+    }
+
+  private:
+    endo::Shell& _shell;
+    CoreVM::diagnostics::BufferedReport _report;
+};
+
+// Measures @p op, handing it a fresh object made by @p make on each call,
+// for operations that consume or modify their input (e.g. passes and linking).
+//
+// The objects are made upfront, so that making them is not part of the measurement.
+template <typename Make, typename Op>
+void runOnFresh(Bench& bench, std::string const& name, Make make, Op op)
+{
+    constexpr size_t Epochs = 25;
+    constexpr size_t Warmup = 1;
+
+    auto objects = std::vector<decltype(make())> {};
+    objects.reserve(Epochs + Warmup);
+    for (size_t i = 0; i < Epochs + Warmup; ++i)
+        objects.emplace_back(make());
+
+    size_t next = 0;
+    bench.epochs(Epochs).epochIterations(1).warmup(Warmup);
+    bench.run(name, [&] { op(objects.at(next++ % objects.size())); });
+    bench.epochs(11).epochIterations(0).warmup(0); // nanobench's defaults
+}
+
+Options parseOptions(int argc, char const* argv[])
+{
+    auto options = Options {};
+    for (int i = 1; i < argc; ++i)
+    {
+        auto const arg = std::string_view(argv[i]);
+        if (arg == "--json" && i + 1 < argc)
+            options.jsonPath = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc)
+            options.filter = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--json FILE] [--filter TEXT]\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char const* argv[])
+{
+    auto const options = parseOptions(argc, argv);
+
+    auto env = endo::TestEnvironment {};
+    auto shell = endo::Shell { endo::NonInteractiveTTY::instance(), env };
+    auto compiler = Compiler { shell };
+
+    auto bench = Bench {};
+    bench.title("endo").performanceCounters(true);
+
+    auto const selected = [&](std::string_view name) {
+        return options.filter.empty() || name.find(options.filter) != std::string_view::npos;
+    };
+
+    // {{{ lexer throughput on large inputs
+    for (auto const& [name, script]: { std::pair { "lexer/large", makeScript(200'000) },
+                                       std::pair { "lexer/long-runs", makeLongRunScript(100'000) } })
+    {
+        if (!selected(name))
+            continue;
+        bench.batch(script.size()).unit("byte").run(name, [&] {
+            auto lexer = endo::Lexer { std::make_unique<endo::StringSource>(script) };
+            size_t tokens = 0;
+            while (lexer.currentToken() != endo::Token::EndOfInput)
+            {
+                lexer.nextToken();
+                ++tokens;
+            }
+            doNotOptimizeAway(tokens);
+        });
+    }
+    // }}}
+
+    // {{{ parsing and releasing the AST of a large script
+    if (size_t const lines = 100'000; selected(fmt::format("parse+free/{}", lines)))
+    {
+        auto const script = makeScript(lines);
+        bench.batch(lines).unit("line").run(fmt::format("parse+free/{}", lines), [&] {
+            auto parsed = compiler.parse(script);
+            doNotOptimizeAway(parsed.rootNode.get());
+            parsed = {}; // releases the AST along with the parser's arena
+        });
+    }
+    // }}}
+
+    // {{{ re-parsing a large buffer as it is being edited
+    if (size_t const lines = 2000; selected(fmt::format("reparse/keystroke/{}", lines)))
+    {
+        auto parser = endo::IncrementalParser { shell };
+        parser.assign(makeScript(lines));
+        auto const offset = parser.text().size() / 2;
+        bench.batch(2).unit("keystroke").run(fmt::format("reparse/keystroke/{}", lines), [&] {
+            parser.edit(offset, 0, "x");
+            parser.edit(offset, 1, "");
+            doNotOptimizeAway(parser.statements().size());
+        });
+    }
+    // }}}
+
+    // {{{ compilation phases
+    for (size_t const lines: { 100, 10'000 })
+    {
+        auto const script = makeScript(lines);
+
+        if (auto const name = fmt::format("lexer/{}", lines); selected(name))
+        {
+            bench.batch(script.size()).unit("byte").run(name, [&] {
+                auto lexer = endo::Lexer { std::make_unique<endo::StringSource>(script) };
+                size_t tokens = 0;
+                while (lexer.currentToken() != endo::Token::EndOfInput)
+                {
+                    lexer.nextToken();
+                    ++tokens;
+                }
+                doNotOptimizeAway(tokens);
+            });
+        }
+
+        bench.batch(lines).unit("line");
+
+        if (auto const name = fmt::format("parser/{}", lines); selected(name))
+            bench.run(name, [&] { doNotOptimizeAway(compiler.parse(script)); });
+
+        if (auto const name = fmt::format("irgen/{}", lines); selected(name))
+        {
+            auto const parsed = compiler.parse(script);
+            bench.run(name, [&] {
+                auto irProgram =
+                    std::unique_ptr<CoreVM::IRProgram>(endo::IRGenerator::generate(*parsed.rootNode));
+                doNotOptimizeAway(irProgram);
+            });
+        }
+
+        using Pass = bool (*)(CoreVM::IRHandler*);
+        auto const passes = std::vector<std::pair<std::string_view, Pass>> {
+            { "eliminate-empty-blocks", &CoreVM::transform::emptyBlockElimination },
+            { "eliminate-linear-br", &CoreVM::transform::eliminateLinearBr },
+            { "eliminate-unused-blocks", &CoreVM::transform::eliminateUnusedBlocks },
+            { "eliminate-unused-instr", &CoreVM::transform::eliminateUnusedInstr },
+            { "propagate-constants", &CoreVM::transform::propagateConstants },
+            { "fuse-string-concatenations", &CoreVM::transform::fuseStringConcatenations },
+            { "fold-constant-condbr", &CoreVM::transform::foldConstantCondBr },
+            { "rewrite-br-to-exit", &CoreVM::transform::rewriteBrToExit },
+            { "rewrite-cond-br-to-same-branches", &CoreVM::transform::rewriteCondBrToSameBranches },
+        };
+        for (auto const& [passName, pass]: passes)
+        {
+            if (auto const name = fmt::format("pass/{}/{}", passName, lines); selected(name))
+            {
+                runOnFresh(
+                    bench,
+                    name,
+                    [&] { return compiler.generateIR(script); },
+                    [&](std::unique_ptr<CoreVM::IRProgram>& irProgram) {
+                        for (CoreVM::IRHandler* handler: irProgram->handlers())
+                            doNotOptimizeAway(pass(handler));
+                    });
+            }
+        }
+
+        if (auto const name = fmt::format("codegen/{}", lines); selected(name))
+        {
+            auto const irProgram = compiler.generateIR(script);
+            bench.run(name, [&] { doNotOptimizeAway(CoreVM::TargetCodeGenerator {}.generate(irProgram.get())); });
+        }
+
+        if (auto const name = fmt::format("link/{}", lines); selected(name))
+        {
+            auto const irProgram = compiler.generateIR(script);
+            runOnFresh(
+                bench,
+                name,
+                [&] { return CoreVM::TargetCodeGenerator {}.generate(irProgram.get()); },
+                [&](std::unique_ptr<CoreVM::Program>& program) { program = compiler.link(std::move(program)); });
+        }
+    }
+    // }}}
+
+    // {{{ execution
+    auto const runProgram = [&](std::string const& name, std::string const& script, size_t statements) {
+        if (!selected(name))
+            return;
+
+        auto const program = compiler.compile(script);
+        auto const* main = program->findHandler("@main");
+        auto globals = CoreVM::Runner::Globals {};
+        bench.batch(statements).unit("statement").run(name, [&] {
+            auto runner = CoreVM::Runner(main, nullptr, &globals, nullptr);
+            doNotOptimizeAway(runner.run());
+        });
+    };
+    runProgram("runner/dispatch", makeDispatchScript(1000), 1000);
+    runProgram("runner/native-call", makeNativeCallScript(1000), 1000);
+
+    bench.batch(1).unit("command");
+    for (auto const method: { endo::SpawnMethod::PosixSpawn, endo::SpawnMethod::Fork })
+    {
+        auto const methodName = method == endo::SpawnMethod::PosixSpawn ? "posix_spawn" : "fork";
+        shell.setSpawnMethod(method);
+
+        if (auto const name = fmt::format("execute/{}/program", methodName); selected(name))
+            bench.run(name, [&] { doNotOptimizeAway(shell.execute(std::string("test -n x"))); });
+
+        if (auto const name = fmt::format("execute/{}/pipeline", methodName); selected(name))
+            bench.run(name, [&] { doNotOptimizeAway(shell.execute(std::string("test -n x | test -z ''"))); });
+    }
+    // }}}
+
+    if (!options.jsonPath.empty())
+    {
+        auto output = std::ofstream(options.jsonPath);
+        bench.render(ankerl::nanobench::templates::json(), output);
+        if (!output)
+        {
+            std::cerr << "Failed to write " << options.jsonPath << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,10 +1,19 @@
 // SPDX-License-Identifier: Apache-2.0
 #include <crispy/utils.h>
 
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
 using namespace std::string_literals;
 
+import BytecodeCache;
 import Shell;
-
+import TTY;
 
 std::string_view getEnvironment(std::string_view name, std::string_view defaultValue)
 {
@@ -12,15 +21,51 @@ std::string_view getEnvironment(std::string_view name, std::string_view defaultV
     return value ? value : defaultValue;
 }
 
+void printUsage(char const* self)
+{
+    std::cerr << "Usage: " << self << " [-c COMMAND [NAME [ARGS...]] | SCRIPT [ARGS...]]\n";
+}
+
 int main(int argc, char const* argv[])
 {
-    auto shell = endo::Shell {};
+    auto const args = std::vector<std::string>(argv, argv + argc);
 
-    setsid();
+    if (argc == 1 && isatty(STDIN_FILENO))
+    {
+        auto shell = endo::Shell {};
+        shell.setPositionalParameters({ args[0] });
+
+        setsid();
 
-    if (argc == 2)
-        // This here only exists for early-development debugging purposes.
-        return shell.execute(argv[1]);
-    else
         return shell.run();
+    }
+
+    // Non-interactive shells leave the terminal settings untouched, as there may not even be a terminal.
+    auto shell = endo::Shell { endo::NonInteractiveTTY::instance(), endo::SystemEnvironment::instance() };
+
+    // endo -c COMMAND [NAME [ARGS...]]
+    if (argc >= 2 && args[1] == "-c")
+    {
+        if (argc == 2)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        shell.setPositionalParameters(argc > 3 ? std::vector<std::string>(args.begin() + 3, args.end())
+                                               : std::vector<std::string> { args[0] });
+        return shell.execute(args[2]);
+    }
+
+    // endo SCRIPT [ARGS...]
+    if (argc >= 2)
+    {
+        shell.setPositionalParameters({ args.begin() + 1, args.end() });
+        shell.setBytecodeCache(endo::BytecodeCache::defaultDirectory());
+        return shell.executeScript(args[1]);
+    }
+
+    // endo < SCRIPT
+    shell.setPositionalParameters({ args[0] });
+    auto const script = std::string(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    return shell.execute(script);
 }